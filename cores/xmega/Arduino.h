@@ -148,6 +148,12 @@ int atexit(void (*func)()) __attribute__((weak));
 void adc_setup(void); // implemented in wiring_analog.c - configures ADC for analogRead()
 // adc_setup must be called whenever exiting SLEEP MODE or ADC will malfunction
 // It is automatically called from 'init()' but sleep mode typically resets the controller
+void pwm_setup(void); // implemented in wiring.c - sets up the PWM timers (except the 'millis' timer)
+
+// FAST_BOOT (see wiring.c) - 'main()' calls these 2, before and after 'setup()'
+void boot_time_end(void);
+void init_late(void);
+unsigned long boot_time_us(void); // usecs from reset to 'setup()', 0 if not measured (needs FAST_BOOT)
 
 void pinMode(uint8_t, uint8_t);
 void digitalWrite(uint8_t, uint8_t);
@@ -202,6 +208,8 @@ enum _analogReference_ // pass to 'analogReference' function - see D manual sect
 
 unsigned long millis(void);
 unsigned long micros(void);
+unsigned long cycles(void); // CPU clocks, wraps every 2^32 - see wiring.c
+uint16_t ticks(void);       // the low 16 bits of 'cycles()', for short intervals
 void delay(unsigned long);
 void delayMicroseconds(unsigned int us);
 unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout);
@@ -212,6 +220,40 @@ uint8_t shiftIn(uint8_t dataPin, uint8_t clockPin, uint8_t bitOrder);
 // XMEGA specific
 void wait_for_interrupt(void); // uses 'IDLE' sleep mode to wait for an interrupt, then returns
 void low_power_delay(unsigned long ms); // similar to 'delay' but goes into low power 'IDLE sleep' state
+// these 3 need LOW_POWER_TICKLESS defined in 'pins_arduino.h' - see wiring.c
+unsigned long tickless_sleep(unsigned long ms); // 'POWER-SAVE' sleep for up to 'ms', woken by the RTC.  returns msecs slept
+void set_idle_deadline(unsigned long ms); // 'main()' sleeps for up to 'ms' after 'loop()' returns (0 to cancel)
+void idle_sleep(void); // sleeps until the deadline from 'set_idle_deadline()', if there is one
+
+// run-time clock switching - see wiring.c.  'clock_switch()' needs CLOCK_SWITCHING defined in 'pins_arduino.h'
+#define CLOCK_RC32M 0 /* 32Mhz internal RC, the default */
+#define CLOCK_RC2M  1 /* 2Mhz internal RC */
+#define CLOCK_PLL   2 /* PLL from the 2Mhz RC, at F_CPU */
+#define CLOCK_XOSC  3 /* external crystal (CLOCK_XOSC_HZ) through the PLL, at F_CPU */
+uint8_t clock_switch(uint8_t source); // returns 0 if it can't, and then nothing has changed
+unsigned long clock_hz(void); // the actual CPU (and peripheral) clock, F_CPU unless it was switched
+unsigned long clock_measure_hz(void); // the CPU clock measured against the RTC or USB frames (125 msec), 0 on timeout
+uint8_t clock_xtal32k_ready(void); // non-zero when CLOCK_DFLL_XTAL32K found the crystal, 0 if it timed out
+
+// software timers on the 'millis' tick - see wiring_timer.c.  Zero it (static or global) before first use
+struct soft_timer
+{
+  struct soft_timer *pNext, *pPrev; // in a timer wheel slot
+  struct soft_timer *pNextRun;      // in the 'deferred' queue for 'soft_timer_run()'
+  unsigned long expires;            // the tick it expires on
+  unsigned long period;             // in ticks, 0 for a one-shot
+  void (*pCallback)(void *pArg);
+  void *pArg;
+  uint8_t flags;
+};
+
+#define SOFT_TIMER_DEFERRED 0x01 /* 'flags' for 'soft_timer_start()' - run the callback from 'loop()' rather than the timer ISR */
+
+void soft_timer_start(struct soft_timer *pT, unsigned long ms, unsigned long periodMS,
+                      void (*pCallback)(void *pArg), void *pArg, uint8_t flags); // 'periodMS' is 0 for a one-shot
+void soft_timer_cancel(struct soft_timer *pT);
+uint8_t soft_timer_active(struct soft_timer *pT); // 1 if it's running (or expired and not called yet)
+void soft_timer_run(void) __attribute__((weak)); // 'main()' calls this after 'loop()' for SOFT_TIMER_DEFERRED callbacks
 
 
 // X M E G A   X M E G A   X M E G A   X M E G A   X M E G A   X M E G A   X M E G A   X M E G A
@@ -284,8 +326,7 @@ void loop(void);
 
 
 // hardware flow control 'helpers'
-void serial_0_cts_callback(void);
-void serial_1_cts_callback(void);
+void serial_cts_interrupt(PORT_t *pPort); // the PORTn_INT1 ISRs call this for a port with CTS pins on it
 void InitSerialFlowControlInterrupts(void);
 
 
@@ -405,7 +446,42 @@ long map(long, long, long, long, long);
 #endif // DEFAULT_TWI
 
 
+// FAST DIGITAL I/O - when the pin number is a constant, 'digitalWriteFast()' is a single store
+// to the port's OUTSET or OUTCLR register, 'digitalToggleFast()' one store to OUTTGL, and
+// 'digitalReadFast()' one load from IN.  No table lookups, no 'cli()', no function call.  It
+// needs 'digitalPinToPortStruct()' and 'digitalPinToBitIndex()' from 'pins_arduino.h'.  If the
+// pin number isn't a constant (or the variant doesn't have them) it's the regular function.
+//
+// UNLIKE 'digitalWrite()' and 'digitalRead()', these do NOT turn off PWM on the pin, and they
+// ignore the 'invert' bit from 'pinMode(pin, mode | INPUT_OUTPUT_INVERT)'.  The pin must also
+// be set up with 'pinMode()' first, as always.
+//
+//   pinMode(SCK, OUTPUT);
+//   digitalWriteFast(SCK, HIGH); // 'SCK' is a 'static const uint8_t', so this works
+
+#if defined(digitalPinToPortStruct) && defined(digitalPinToBitIndex)
+#define digitalPinIsFast(P) (__builtin_constant_p(P) && digitalPinToPortStruct(P) != 0)
+
+#define digitalWriteFast(P,V) do { if(digitalPinIsFast(P)) { \
+                                     if(V) { digitalPinToPortStruct(P)->OUTSET = _BV(digitalPinToBitIndex(P) & 7); } \
+                                     else { digitalPinToPortStruct(P)->OUTCLR = _BV(digitalPinToBitIndex(P) & 7); } } \
+                                   else { digitalWrite((P), (V)); } } while(0)
+#define digitalToggleFast(P) do { if(digitalPinIsFast(P)) { \
+                                    digitalPinToPortStruct(P)->OUTTGL = _BV(digitalPinToBitIndex(P) & 7); } \
+                                  else { uint8_t _pin = (P); digitalWrite(_pin, !digitalRead(_pin)); } } while(0)
+#define digitalReadFast(P) ( digitalPinIsFast(P) \
+                             ? ((digitalPinToPortStruct(P)->IN & _BV(digitalPinToBitIndex(P) & 7)) ? HIGH : LOW) \
+                             : digitalRead(P) )
+#else // no fast pin mapping
+#define digitalWriteFast(P,V) digitalWrite((P), (V))
+#define digitalToggleFast(P) do { uint8_t _pin = (P); digitalWrite(_pin, !digitalRead(_pin)); } while(0)
+#define digitalReadFast(P) digitalRead(P)
+#endif // digitalPinToPortStruct, digitalPinToBitIndex
+
+
 // added support for hardware serial flow control - spans multiple files
+// any serial port can have RTS and/or CTS, SERIAL_n_RTS_PORT_NAME etc. for n = 0 through 7
+// (see 'pins_arduino.h')
 
 #if defined(SERIAL_0_RTS_PORT_NAME) && defined(SERIAL_0_RTS_PIN_INDEX)
 #define SERIAL_0_RTS_ENABLED
@@ -419,6 +495,42 @@ long map(long, long, long, long, long);
 #define SERIAL_1_RTS_PIN _BV(SERIAL_1_RTS_PIN_INDEX)
 #endif // defined(SERIAL_1_RTS_PORT) && defined(SERIAL_1_RTS_PIN)
 
+#if defined(SERIAL_2_RTS_PORT_NAME) && defined(SERIAL_2_RTS_PIN_INDEX)
+#define SERIAL_2_RTS_ENABLED
+#define SERIAL_2_RTS_PORT (&SERIAL_2_RTS_PORT_NAME)
+#define SERIAL_2_RTS_PIN _BV(SERIAL_2_RTS_PIN_INDEX)
+#endif // defined(SERIAL_2_RTS_PORT) && defined(SERIAL_2_RTS_PIN)
+
+#if defined(SERIAL_3_RTS_PORT_NAME) && defined(SERIAL_3_RTS_PIN_INDEX)
+#define SERIAL_3_RTS_ENABLED
+#define SERIAL_3_RTS_PORT (&SERIAL_3_RTS_PORT_NAME)
+#define SERIAL_3_RTS_PIN _BV(SERIAL_3_RTS_PIN_INDEX)
+#endif // defined(SERIAL_3_RTS_PORT) && defined(SERIAL_3_RTS_PIN)
+
+#if defined(SERIAL_4_RTS_PORT_NAME) && defined(SERIAL_4_RTS_PIN_INDEX)
+#define SERIAL_4_RTS_ENABLED
+#define SERIAL_4_RTS_PORT (&SERIAL_4_RTS_PORT_NAME)
+#define SERIAL_4_RTS_PIN _BV(SERIAL_4_RTS_PIN_INDEX)
+#endif // defined(SERIAL_4_RTS_PORT) && defined(SERIAL_4_RTS_PIN)
+
+#if defined(SERIAL_5_RTS_PORT_NAME) && defined(SERIAL_5_RTS_PIN_INDEX)
+#define SERIAL_5_RTS_ENABLED
+#define SERIAL_5_RTS_PORT (&SERIAL_5_RTS_PORT_NAME)
+#define SERIAL_5_RTS_PIN _BV(SERIAL_5_RTS_PIN_INDEX)
+#endif // defined(SERIAL_5_RTS_PORT) && defined(SERIAL_5_RTS_PIN)
+
+#if defined(SERIAL_6_RTS_PORT_NAME) && defined(SERIAL_6_RTS_PIN_INDEX)
+#define SERIAL_6_RTS_ENABLED
+#define SERIAL_6_RTS_PORT (&SERIAL_6_RTS_PORT_NAME)
+#define SERIAL_6_RTS_PIN _BV(SERIAL_6_RTS_PIN_INDEX)
+#endif // defined(SERIAL_6_RTS_PORT) && defined(SERIAL_6_RTS_PIN)
+
+#if defined(SERIAL_7_RTS_PORT_NAME) && defined(SERIAL_7_RTS_PIN_INDEX)
+#define SERIAL_7_RTS_ENABLED
+#define SERIAL_7_RTS_PORT (&SERIAL_7_RTS_PORT_NAME)
+#define SERIAL_7_RTS_PIN _BV(SERIAL_7_RTS_PIN_INDEX)
+#endif // defined(SERIAL_7_RTS_PORT) && defined(SERIAL_7_RTS_PIN)
+
 #if defined(SERIAL_0_CTS_PORT_NAME) && defined(SERIAL_0_CTS_PIN_INDEX)
 #define SERIAL_0_CTS_ENABLED
 #define SERIAL_0_CTS_PORT (&SERIAL_0_CTS_PORT_NAME)
@@ -431,6 +543,99 @@ long map(long, long, long, long, long);
 #define SERIAL_1_CTS_PIN _BV(SERIAL_1_CTS_PIN_INDEX)
 #endif // defined(SERIAL_1_CTS_PORT) && defined(SERIAL_1_CTS_PIN)
 
+#if defined(SERIAL_2_CTS_PORT_NAME) && defined(SERIAL_2_CTS_PIN_INDEX)
+#define SERIAL_2_CTS_ENABLED
+#define SERIAL_2_CTS_PORT (&SERIAL_2_CTS_PORT_NAME)
+#define SERIAL_2_CTS_PIN _BV(SERIAL_2_CTS_PIN_INDEX)
+#endif // defined(SERIAL_2_CTS_PORT) && defined(SERIAL_2_CTS_PIN)
+
+#if defined(SERIAL_3_CTS_PORT_NAME) && defined(SERIAL_3_CTS_PIN_INDEX)
+#define SERIAL_3_CTS_ENABLED
+#define SERIAL_3_CTS_PORT (&SERIAL_3_CTS_PORT_NAME)
+#define SERIAL_3_CTS_PIN _BV(SERIAL_3_CTS_PIN_INDEX)
+#endif // defined(SERIAL_3_CTS_PORT) && defined(SERIAL_3_CTS_PIN)
+
+#if defined(SERIAL_4_CTS_PORT_NAME) && defined(SERIAL_4_CTS_PIN_INDEX)
+#define SERIAL_4_CTS_ENABLED
+#define SERIAL_4_CTS_PORT (&SERIAL_4_CTS_PORT_NAME)
+#define SERIAL_4_CTS_PIN _BV(SERIAL_4_CTS_PIN_INDEX)
+#endif // defined(SERIAL_4_CTS_PORT) && defined(SERIAL_4_CTS_PIN)
+
+#if defined(SERIAL_5_CTS_PORT_NAME) && defined(SERIAL_5_CTS_PIN_INDEX)
+#define SERIAL_5_CTS_ENABLED
+#define SERIAL_5_CTS_PORT (&SERIAL_5_CTS_PORT_NAME)
+#define SERIAL_5_CTS_PIN _BV(SERIAL_5_CTS_PIN_INDEX)
+#endif // defined(SERIAL_5_CTS_PORT) && defined(SERIAL_5_CTS_PIN)
+
+#if defined(SERIAL_6_CTS_PORT_NAME) && defined(SERIAL_6_CTS_PIN_INDEX)
+#define SERIAL_6_CTS_ENABLED
+#define SERIAL_6_CTS_PORT (&SERIAL_6_CTS_PORT_NAME)
+#define SERIAL_6_CTS_PIN _BV(SERIAL_6_CTS_PIN_INDEX)
+#endif // defined(SERIAL_6_CTS_PORT) && defined(SERIAL_6_CTS_PIN)
+
+#if defined(SERIAL_7_CTS_PORT_NAME) && defined(SERIAL_7_CTS_PIN_INDEX)
+#define SERIAL_7_CTS_ENABLED
+#define SERIAL_7_CTS_PORT (&SERIAL_7_CTS_PORT_NAME)
+#define SERIAL_7_CTS_PIN _BV(SERIAL_7_CTS_PIN_INDEX)
+#endif // defined(SERIAL_7_CTS_PORT) && defined(SERIAL_7_CTS_PIN)
+
+#if defined(SERIAL_0_RTS_ENABLED) || defined(SERIAL_1_RTS_ENABLED) || defined(SERIAL_2_RTS_ENABLED) || defined(SERIAL_3_RTS_ENABLED) \
+    || defined(SERIAL_4_RTS_ENABLED) || defined(SERIAL_5_RTS_ENABLED) || defined(SERIAL_6_RTS_ENABLED) || defined(SERIAL_7_RTS_ENABLED)
+#define SERIAL_RTS_ENABLED /* at least one port uses RTS */
+#endif // SERIAL_n_RTS_ENABLED
+
+#if defined(SERIAL_0_CTS_ENABLED) || defined(SERIAL_1_CTS_ENABLED) || defined(SERIAL_2_CTS_ENABLED) || defined(SERIAL_3_CTS_ENABLED) \
+    || defined(SERIAL_4_CTS_ENABLED) || defined(SERIAL_5_CTS_ENABLED) || defined(SERIAL_6_CTS_ENABLED) || defined(SERIAL_7_CTS_ENABLED)
+#define SERIAL_CTS_ENABLED /* at least one port uses CTS */
+#endif // SERIAL_n_CTS_ENABLED
+
+// the CTS pins (as a bit mask) that are on port 'P'.  When 'P' is a constant, like '&PORTD',
+// this is a constant expression, so the PORTn_INT1 ISRs only check the ports that need it.
+
+#ifdef SERIAL_0_CTS_ENABLED
+#define SERIAL_0_CTS_MASK(P) (SERIAL_0_CTS_PORT == (P) ? SERIAL_0_CTS_PIN : 0)
+#else // !SERIAL_0_CTS_ENABLED
+#define SERIAL_0_CTS_MASK(P) 0
+#endif // SERIAL_0_CTS_ENABLED
+#ifdef SERIAL_1_CTS_ENABLED
+#define SERIAL_1_CTS_MASK(P) (SERIAL_1_CTS_PORT == (P) ? SERIAL_1_CTS_PIN : 0)
+#else // !SERIAL_1_CTS_ENABLED
+#define SERIAL_1_CTS_MASK(P) 0
+#endif // SERIAL_1_CTS_ENABLED
+#ifdef SERIAL_2_CTS_ENABLED
+#define SERIAL_2_CTS_MASK(P) (SERIAL_2_CTS_PORT == (P) ? SERIAL_2_CTS_PIN : 0)
+#else // !SERIAL_2_CTS_ENABLED
+#define SERIAL_2_CTS_MASK(P) 0
+#endif // SERIAL_2_CTS_ENABLED
+#ifdef SERIAL_3_CTS_ENABLED
+#define SERIAL_3_CTS_MASK(P) (SERIAL_3_CTS_PORT == (P) ? SERIAL_3_CTS_PIN : 0)
+#else // !SERIAL_3_CTS_ENABLED
+#define SERIAL_3_CTS_MASK(P) 0
+#endif // SERIAL_3_CTS_ENABLED
+#ifdef SERIAL_4_CTS_ENABLED
+#define SERIAL_4_CTS_MASK(P) (SERIAL_4_CTS_PORT == (P) ? SERIAL_4_CTS_PIN : 0)
+#else // !SERIAL_4_CTS_ENABLED
+#define SERIAL_4_CTS_MASK(P) 0
+#endif // SERIAL_4_CTS_ENABLED
+#ifdef SERIAL_5_CTS_ENABLED
+#define SERIAL_5_CTS_MASK(P) (SERIAL_5_CTS_PORT == (P) ? SERIAL_5_CTS_PIN : 0)
+#else // !SERIAL_5_CTS_ENABLED
+#define SERIAL_5_CTS_MASK(P) 0
+#endif // SERIAL_5_CTS_ENABLED
+#ifdef SERIAL_6_CTS_ENABLED
+#define SERIAL_6_CTS_MASK(P) (SERIAL_6_CTS_PORT == (P) ? SERIAL_6_CTS_PIN : 0)
+#else // !SERIAL_6_CTS_ENABLED
+#define SERIAL_6_CTS_MASK(P) 0
+#endif // SERIAL_6_CTS_ENABLED
+#ifdef SERIAL_7_CTS_ENABLED
+#define SERIAL_7_CTS_MASK(P) (SERIAL_7_CTS_PORT == (P) ? SERIAL_7_CTS_PIN : 0)
+#else // !SERIAL_7_CTS_ENABLED
+#define SERIAL_7_CTS_MASK(P) 0
+#endif // SERIAL_7_CTS_ENABLED
+
+#define SERIAL_CTS_PINS(P) (SERIAL_0_CTS_MASK(P) | SERIAL_1_CTS_MASK(P) | SERIAL_2_CTS_MASK(P) | SERIAL_3_CTS_MASK(P) \
+                          | SERIAL_4_CTS_MASK(P) | SERIAL_5_CTS_MASK(P) | SERIAL_6_CTS_MASK(P) | SERIAL_7_CTS_MASK(P))
+
 
 #endif // Arduino_h
 
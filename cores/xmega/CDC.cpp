@@ -175,6 +175,40 @@ int Serial_::read(void)
   return USB_Recv(CDC_RX);
 }
 
+// block read - copies up to 'length' bytes that have ALREADY arrived into 'buffer' and returns
+// the number copied (0 if none).  It does not wait.  With the ping-pong 'out' endpoint this is
+// at most 2 'memcpy' calls (one per bank) instead of a 'USB_Recv' per byte.
+
+int Serial_::read(uint8_t *buffer, size_t length)
+{
+  int iRval = 0;
+
+  if (!length)
+  {
+    return 0;
+  }
+
+  if (peek_buffer >= 0)
+  {
+    *(buffer++) = (uint8_t)peek_buffer;
+    peek_buffer = -1;
+    length--;
+    iRval++;
+  }
+
+  if (length > 0)
+  {
+    int iLen = USB_Recv(CDC_RX, buffer, length > 0x7fff ? 0x7fff : (int)length);
+
+    if (iLen > 0)
+    {
+      iRval += iLen;
+    }
+  }
+
+  return iRval;
+}
+
 void Serial_::flush(void)
 {
   USB_Flush(CDC_TX);
@@ -213,6 +247,40 @@ size_t Serial_::write(const uint8_t *buffer, size_t size)
   return 0;
 }
 
+// zero-copy write - format output directly into the USB endpoint buffer.  'reserveWrite()'
+// returns a pointer to the free space and assigns '*pSpace' to its size (up to 64 bytes), or
+// returns NULL if there's no space right now (or the port isn't open).  It does not wait.
+// After writing (up to) that many bytes, call 'commitWrite()' with the number written.
+// A full packet is sent right away.  Otherwise it's sent on the next USB frame, or use
+// 'bSend' to send it now.
+uint8_t *Serial_::reserveWrite(uint8_t *pSpace)
+{
+  if (_usbLineInfo.lineState > 0)
+  {
+    return USB_SendReserve(CDC_TX, pSpace);
+  }
+
+  if (pSpace)
+  {
+    *pSpace = 0;
+  }
+
+  return NULL;
+}
+
+size_t Serial_::commitWrite(uint8_t len, bool bSend)
+{
+  int r = USB_SendCommit(bSend ? (CDC_TX | TRANSFER_RELEASE) : CDC_TX, len);
+
+  if (r < 0)
+  {
+    setWriteError();
+    return 0;
+  }
+
+  return r;
+}
+
 // This operator is a convenient way for a sketch to check whether the
 // port has actually been configured and opened by the host (as opposed
 // to just being connected to the host).  It can be used, for example, in 
@@ -105,6 +105,101 @@
 
 #endif // SERIAL_BUFFER_SIZE
 
+// Per-port buffer sizes.  Each serial port can have its own RX and TX buffer size, which you
+// can define in 'pins_arduino.h' or on the compiler command line (i.e. 'build.extra_flags' in
+// 'boards.txt', since the core is not compiled with the sketch's own '#define's), like this:
+//
+//   #define SERIAL_0_RX_BUFFER_SIZE 512 /* GPS receiver on 'Serial' */
+//   #define SERIAL_1_TX_BUFFER_SIZE 16  /* debug output on 'Serial2' */
+//
+// Anything you don't define will be SERIAL_BUFFER_SIZE.  The sizes MUST be a power of 2, since
+// the index wraparound uses a mask rather than '%' (which is a function call on the AVR for
+// anything that isn't a constant power of 2).  As before, one byte of each buffer is unused.
+// When every buffer is 256 bytes or less, 'head' and 'tail' are 8-bit (faster, smaller).
+
+#ifndef SERIAL_0_RX_BUFFER_SIZE
+#define SERIAL_0_RX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_0_RX_BUFFER_SIZE
+#ifndef SERIAL_0_TX_BUFFER_SIZE
+#define SERIAL_0_TX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_0_TX_BUFFER_SIZE
+#ifndef SERIAL_1_RX_BUFFER_SIZE
+#define SERIAL_1_RX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_1_RX_BUFFER_SIZE
+#ifndef SERIAL_1_TX_BUFFER_SIZE
+#define SERIAL_1_TX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_1_TX_BUFFER_SIZE
+#ifndef SERIAL_2_RX_BUFFER_SIZE
+#define SERIAL_2_RX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_2_RX_BUFFER_SIZE
+#ifndef SERIAL_2_TX_BUFFER_SIZE
+#define SERIAL_2_TX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_2_TX_BUFFER_SIZE
+#ifndef SERIAL_3_RX_BUFFER_SIZE
+#define SERIAL_3_RX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_3_RX_BUFFER_SIZE
+#ifndef SERIAL_3_TX_BUFFER_SIZE
+#define SERIAL_3_TX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_3_TX_BUFFER_SIZE
+#ifndef SERIAL_4_RX_BUFFER_SIZE
+#define SERIAL_4_RX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_4_RX_BUFFER_SIZE
+#ifndef SERIAL_4_TX_BUFFER_SIZE
+#define SERIAL_4_TX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_4_TX_BUFFER_SIZE
+#ifndef SERIAL_5_RX_BUFFER_SIZE
+#define SERIAL_5_RX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_5_RX_BUFFER_SIZE
+#ifndef SERIAL_5_TX_BUFFER_SIZE
+#define SERIAL_5_TX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_5_TX_BUFFER_SIZE
+#ifndef SERIAL_6_RX_BUFFER_SIZE
+#define SERIAL_6_RX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_6_RX_BUFFER_SIZE
+#ifndef SERIAL_6_TX_BUFFER_SIZE
+#define SERIAL_6_TX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_6_TX_BUFFER_SIZE
+#ifndef SERIAL_7_RX_BUFFER_SIZE
+#define SERIAL_7_RX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_7_RX_BUFFER_SIZE
+#ifndef SERIAL_7_TX_BUFFER_SIZE
+#define SERIAL_7_TX_BUFFER_SIZE SERIAL_BUFFER_SIZE
+#endif // SERIAL_7_TX_BUFFER_SIZE
+
+#define SERIAL_IS_POWER_OF_2(X) ((X) >= 2 && !((X) & ((X) - 1)))
+
+#if !SERIAL_IS_POWER_OF_2(SERIAL_0_RX_BUFFER_SIZE) || !SERIAL_IS_POWER_OF_2(SERIAL_0_TX_BUFFER_SIZE)
+#error SERIAL_0_RX_BUFFER_SIZE and SERIAL_0_TX_BUFFER_SIZE must be a power of 2
+#endif
+#if !SERIAL_IS_POWER_OF_2(SERIAL_1_RX_BUFFER_SIZE) || !SERIAL_IS_POWER_OF_2(SERIAL_1_TX_BUFFER_SIZE)
+#error SERIAL_1_RX_BUFFER_SIZE and SERIAL_1_TX_BUFFER_SIZE must be a power of 2
+#endif
+#if !SERIAL_IS_POWER_OF_2(SERIAL_2_RX_BUFFER_SIZE) || !SERIAL_IS_POWER_OF_2(SERIAL_2_TX_BUFFER_SIZE)
+#error SERIAL_2_RX_BUFFER_SIZE and SERIAL_2_TX_BUFFER_SIZE must be a power of 2
+#endif
+#if !SERIAL_IS_POWER_OF_2(SERIAL_3_RX_BUFFER_SIZE) || !SERIAL_IS_POWER_OF_2(SERIAL_3_TX_BUFFER_SIZE)
+#error SERIAL_3_RX_BUFFER_SIZE and SERIAL_3_TX_BUFFER_SIZE must be a power of 2
+#endif
+#if !SERIAL_IS_POWER_OF_2(SERIAL_4_RX_BUFFER_SIZE) || !SERIAL_IS_POWER_OF_2(SERIAL_4_TX_BUFFER_SIZE)
+#error SERIAL_4_RX_BUFFER_SIZE and SERIAL_4_TX_BUFFER_SIZE must be a power of 2
+#endif
+#if !SERIAL_IS_POWER_OF_2(SERIAL_5_RX_BUFFER_SIZE) || !SERIAL_IS_POWER_OF_2(SERIAL_5_TX_BUFFER_SIZE)
+#error SERIAL_5_RX_BUFFER_SIZE and SERIAL_5_TX_BUFFER_SIZE must be a power of 2
+#endif
+#if !SERIAL_IS_POWER_OF_2(SERIAL_6_RX_BUFFER_SIZE) || !SERIAL_IS_POWER_OF_2(SERIAL_6_TX_BUFFER_SIZE)
+#error SERIAL_6_RX_BUFFER_SIZE and SERIAL_6_TX_BUFFER_SIZE must be a power of 2
+#endif
+#if !SERIAL_IS_POWER_OF_2(SERIAL_7_RX_BUFFER_SIZE) || !SERIAL_IS_POWER_OF_2(SERIAL_7_TX_BUFFER_SIZE)
+#error SERIAL_7_RX_BUFFER_SIZE and SERIAL_7_TX_BUFFER_SIZE must be a power of 2
+#endif
+
+#if SERIAL_0_RX_BUFFER_SIZE > 256 || SERIAL_0_TX_BUFFER_SIZE > 256 || SERIAL_1_RX_BUFFER_SIZE > 256 || SERIAL_1_TX_BUFFER_SIZE > 256 \
+    || SERIAL_2_RX_BUFFER_SIZE > 256 || SERIAL_2_TX_BUFFER_SIZE > 256 || SERIAL_3_RX_BUFFER_SIZE > 256 || SERIAL_3_TX_BUFFER_SIZE > 256 \
+    || SERIAL_4_RX_BUFFER_SIZE > 256 || SERIAL_4_TX_BUFFER_SIZE > 256 || SERIAL_5_RX_BUFFER_SIZE > 256 || SERIAL_5_TX_BUFFER_SIZE > 256 \
+    || SERIAL_6_RX_BUFFER_SIZE > 256 || SERIAL_6_TX_BUFFER_SIZE > 256 || SERIAL_7_RX_BUFFER_SIZE > 256 || SERIAL_7_TX_BUFFER_SIZE > 256
+#define SERIAL_BUFFER_INDEX_16 /* at least one buffer needs a 16-bit index */
+#endif // any buffer larger than 256
+
 //////////////////////////////////////////////////////////////////////////////
 //                                                                          //
 //            _                 _              __   __                      //
@@ -116,56 +211,158 @@
 //                                                                          //
 //////////////////////////////////////////////////////////////////////////////
 
+#ifdef SERIAL_BUFFER_INDEX_16
+typedef unsigned int ring_index_t;
+#else // all buffers 256 bytes or less
+typedef uint8_t ring_index_t; // it's faster, smaller
+#endif // SERIAL_BUFFER_INDEX_16
+
 struct ring_buffer
 {
-  unsigned char buffer[SERIAL_BUFFER_SIZE];
-#if SERIAL_BUFFER_SIZE < 256
-  // when buffer size is less than 256 bytes, use an unsigned char (it's faster, smaller)
-  volatile uint8_t/*unsigned int*/ head;
-  volatile uint8_t/*unsigned int*/ tail;
-#else  // SERIAL_BUFFER_SIZE >= 256
-  volatile unsigned int head;
-  volatile unsigned int tail;
-#endif // SERIAL_BUFFER_SIZE
+  unsigned char *buffer;       // the actual storage, one of the 'xx_bufferN_data' arrays below
+  ring_index_t mask;           // buffer size - 1 (the size is always a power of 2)
+  volatile ring_index_t head;
+  volatile ring_index_t tail;
 };
 
-// ring buffers for serial ports 1 and 2 (must zero head/tail before use)
+#define RING_BUFFER_SIZE(X) ((unsigned int)((X)->mask) + 1)
+
+// Each ring buffer has exactly one producer and one consumer.  For RX the producer is the RXC
+// ISR and the consumer is the sketch ('available()', 'peek()', 'read()').  For TX the producer
+// is the sketch ('write()') and the consumer is the DRE ISR (or the DMA).  Only the producer
+// writes 'head', and only the consumer writes 'tail'.  So the sketch side doesn't need to turn
+// interrupts off, as long as:
+//
+//   a) the data is written BEFORE the producer publishes the new 'head', and it's read BEFORE
+//      the consumer publishes the new 'tail'.  The AVR doesn't re-order memory accesses, but
+//      the compiler can move a non-volatile buffer access past a volatile index access.  That's
+//      what SERIAL_RING_BARRIER is for.  It generates no code.
+//   b) the index that the OTHER side writes is read in one piece.  With 8-bit indices (the
+//      default) a load or store is a single instruction.  With SERIAL_BUFFER_INDEX_16 an ISR can
+//      change the index between the 2 byte loads, so 'ring_load()' reads it until 2 reads match.
+//      An ISR can't wait for the sketch to finish a 2-byte store, so 'ring_store()' turns off
+//      interrupts around that one store (~4 cycles).  That's the only place it happens.
+//
+// 'ring_load' and 'ring_store' are for the sketch side.  The ISRs can't be interrupted by the
+// sketch, so they just use the indices directly (plus the barrier).
+//
+// Before, 'available()', 'peek()', 'read()' and 'write()' each turned interrupts off for the
+// whole index update, and the block 'read()' and 'write()' kept them off for every byte they
+// copied.  Now none of them do, except 'ring_store()' with SERIAL_BUFFER_INDEX_16, and
+// 'tx_kick()' for the few instructions that turn on the DRE interrupt (or start the DMA).
+// Interrupt latency for everything else (the millis timer, USB) no longer depends on how much
+// serial I/O the sketch is doing.
+//
+// TODO:  the worst case interrupt latency, before and after, has NOT been measured yet.  To
+//        measure it, toggle a pin as the first thing in a high level ISR that's triggered at
+//        a fixed rate by a timer, and look at the jitter on a scope (or capture the timer
+//        count in that ISR and keep the largest 'count - compare value') while the sketch is
+//        doing serial I/O at a high baud rate.  Do it with this file and the one before it.
+
+#define SERIAL_RING_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+#ifdef SERIAL_BUFFER_INDEX_16
+static inline ring_index_t ring_load(volatile ring_index_t *pI)
+{
+register ring_index_t i1, i2;
+
+  do
+  {
+    i1 = *pI;
+    i2 = *pI;
+  } while(i1 != i2); // an ISR changed it in the middle of a read
+
+  SERIAL_RING_BARRIER(); // buffer reads stay AFTER this
+
+  return i1;
+}
+
+static inline void ring_store(volatile ring_index_t *pI, ring_index_t iVal)
+{
+uint8_t oldSREG = SREG;
+
+  SERIAL_RING_BARRIER(); // buffer reads and writes stay BEFORE this
+  cli(); // 2 byte store, the ISR must not see half of it
+  *pI = iVal;
+  SREG = oldSREG;
+}
+#else // !SERIAL_BUFFER_INDEX_16
+static inline ring_index_t ring_load(volatile ring_index_t *pI)
+{
+register ring_index_t iRval = *pI; // single byte, atomic
+
+  SERIAL_RING_BARRIER(); // buffer reads stay AFTER this
+
+  return iRval;
+}
+
+static inline void ring_store(volatile ring_index_t *pI, ring_index_t iVal)
+{
+  SERIAL_RING_BARRIER(); // buffer reads and writes stay BEFORE this
+  *pI = iVal; // single byte, atomic
+}
+#endif // SERIAL_BUFFER_INDEX_16
+
+// ring buffers for serial ports 1 and 2 (head/tail are zeroed again in the constructor)
 // NOTE:  there are ALWAYS at LEAST 2 serial ports:
 //        these are USARTD0 and USARTC0 (on pins 2,3) by default.
 
-ring_buffer rx_buffer; //  =  { { 0 }, 0, 0 };  // SERIAL_0
-ring_buffer tx_buffer; //  =  { { 0 }, 0, 0 };
-ring_buffer rx_buffer2; //  =  { { 0 }, 0, 0 }; // SERIAL_1
-ring_buffer tx_buffer2; //  =  { { 0 }, 0, 0 };
+static unsigned char rx_buffer_data[SERIAL_0_RX_BUFFER_SIZE];
+static unsigned char tx_buffer_data[SERIAL_0_TX_BUFFER_SIZE];
+static unsigned char rx_buffer2_data[SERIAL_1_RX_BUFFER_SIZE];
+static unsigned char tx_buffer2_data[SERIAL_1_TX_BUFFER_SIZE];
+
+ring_buffer rx_buffer  = { rx_buffer_data, SERIAL_0_RX_BUFFER_SIZE - 1, 0, 0 }; // SERIAL_0
+ring_buffer tx_buffer  = { tx_buffer_data, SERIAL_0_TX_BUFFER_SIZE - 1, 0, 0 };
+ring_buffer rx_buffer2 = { rx_buffer2_data, SERIAL_1_RX_BUFFER_SIZE - 1, 0, 0 }; // SERIAL_1
+ring_buffer tx_buffer2 = { tx_buffer2_data, SERIAL_1_TX_BUFFER_SIZE - 1, 0, 0 };
 
 #ifdef SERIAL_2_PORT_NAME
-ring_buffer rx_buffer3; //  =  { { 0 }, 0, 0 };
-ring_buffer tx_buffer3; //  =  { { 0 }, 0, 0 };
+static unsigned char rx_buffer3_data[SERIAL_2_RX_BUFFER_SIZE];
+static unsigned char tx_buffer3_data[SERIAL_2_TX_BUFFER_SIZE];
+
+ring_buffer rx_buffer3 = { rx_buffer3_data, SERIAL_2_RX_BUFFER_SIZE - 1, 0, 0 };
+ring_buffer tx_buffer3 = { tx_buffer3_data, SERIAL_2_TX_BUFFER_SIZE - 1, 0, 0 };
 #endif // SERIAL_2_PORT_NAME
 
 #ifdef SERIAL_3_PORT_NAME
-ring_buffer rx_buffer4; //  =  { { 0 }, 0, 0 };
-ring_buffer tx_buffer4; //  =  { { 0 }, 0, 0 };
+static unsigned char rx_buffer4_data[SERIAL_3_RX_BUFFER_SIZE];
+static unsigned char tx_buffer4_data[SERIAL_3_TX_BUFFER_SIZE];
+
+ring_buffer rx_buffer4 = { rx_buffer4_data, SERIAL_3_RX_BUFFER_SIZE - 1, 0, 0 };
+ring_buffer tx_buffer4 = { tx_buffer4_data, SERIAL_3_TX_BUFFER_SIZE - 1, 0, 0 };
 #endif // SERIAL_3_PORT_NAME
 
 #ifdef SERIAL_4_PORT_NAME
-ring_buffer rx_buffer5; //  =  { { 0 }, 0, 0 };
-ring_buffer tx_buffer5; //  =  { { 0 }, 0, 0 };
+static unsigned char rx_buffer5_data[SERIAL_4_RX_BUFFER_SIZE];
+static unsigned char tx_buffer5_data[SERIAL_4_TX_BUFFER_SIZE];
+
+ring_buffer rx_buffer5 = { rx_buffer5_data, SERIAL_4_RX_BUFFER_SIZE - 1, 0, 0 };
+ring_buffer tx_buffer5 = { tx_buffer5_data, SERIAL_4_TX_BUFFER_SIZE - 1, 0, 0 };
 #endif // SERIAL_4_PORT_NAME
 
 #ifdef SERIAL_5_PORT_NAME
-ring_buffer rx_buffer6; //  =  { { 0 }, 0, 0 };
-ring_buffer tx_buffer6; //  =  { { 0 }, 0, 0 };
+static unsigned char rx_buffer6_data[SERIAL_5_RX_BUFFER_SIZE];
+static unsigned char tx_buffer6_data[SERIAL_5_TX_BUFFER_SIZE];
+
+ring_buffer rx_buffer6 = { rx_buffer6_data, SERIAL_5_RX_BUFFER_SIZE - 1, 0, 0 };
+ring_buffer tx_buffer6 = { tx_buffer6_data, SERIAL_5_TX_BUFFER_SIZE - 1, 0, 0 };
 #endif // SERIAL_5_PORT_NAME
 
 #ifdef SERIAL_6_PORT_NAME
-ring_buffer rx_buffer7; //  =  { { 0 }, 0, 0 };
-ring_buffer tx_buffer7; //  =  { { 0 }, 0, 0 };
+static unsigned char rx_buffer7_data[SERIAL_6_RX_BUFFER_SIZE];
+static unsigned char tx_buffer7_data[SERIAL_6_TX_BUFFER_SIZE];
+
+ring_buffer rx_buffer7 = { rx_buffer7_data, SERIAL_6_RX_BUFFER_SIZE - 1, 0, 0 };
+ring_buffer tx_buffer7 = { tx_buffer7_data, SERIAL_6_TX_BUFFER_SIZE - 1, 0, 0 };
 #endif // SERIAL_6_PORT_NAME
 
 #ifdef SERIAL_7_PORT_NAME
-ring_buffer rx_buffer8; //  =  { { 0 }, 0, 0 };
-ring_buffer tx_buffer8; //  =  { { 0 }, 0, 0 };
+static unsigned char rx_buffer8_data[SERIAL_7_RX_BUFFER_SIZE];
+static unsigned char tx_buffer8_data[SERIAL_7_TX_BUFFER_SIZE];
+
+ring_buffer rx_buffer8 = { rx_buffer8_data, SERIAL_7_RX_BUFFER_SIZE - 1, 0, 0 };
+ring_buffer tx_buffer8 = { tx_buffer8_data, SERIAL_7_TX_BUFFER_SIZE - 1, 0, 0 };
 #endif // SERIAL_7_PORT_NAME
 
 
@@ -180,1407 +377,3896 @@ ring_buffer tx_buffer8; //  =  { { 0 }, 0, 0 };
 //                                                                          //
 //////////////////////////////////////////////////////////////////////////////
 
-//#ifdef SERIAL_0_CTS_ENABLED
-//static char bWasCTS0;
-//#endif // SERIAL_0_CTS_ENABLED
-//#ifdef SERIAL_1_CTS_ENABLED
-//static char bWasCTS1;
-//#endif // SERIAL_1_CTS_ENABLED
-
-
-// TODO:  _SOFT_ flow control enable/disable, arbitrary pin assignments for CTS/DTR
-
-#if defined(SERIAL_0_CTS_ENABLED)
-void InitSerialFlowControlInterrupt0(void)
+// ----------------------------------------------------------------------------------------
+//                         RTS/CTS HARDWARE FLOW CONTROL (ANY PORT)
+//
+// Any serial port can have an RTS output and/or a CTS input, on any pin.  In 'pins_arduino.h'
+// (or on the command line), for serial port 'n' (0 through 7):
+//
+//   #define SERIAL_n_RTS_PORT_NAME PORTD  /* RTS output, HIGH tells the other end to stop */
+//   #define SERIAL_n_RTS_PIN_INDEX 0
+//   #define SERIAL_n_CTS_PORT_NAME PORTD  /* CTS input, HIGH stops this end from sending */
+//   #define SERIAL_n_CTS_PIN_INDEX 1
+//
+// RTS uses 2 watermarks on the RX buffer.  It goes HIGH ('stop') when the number of bytes
+// waiting reaches the 'high' watermark, and back LOW when 'read()' brings it down to the 'low'
+// watermark.  The defaults are SERIAL_RTS_HEADROOM bytes short of full, and half full.  You can
+// change them with 'HardwareSerial::setFlowControl()'.  At high baud rates (1-2Mbit) give the
+// other end more headroom, since it may send a few more bytes before it sees RTS go high.
+//
+// The old check ran 3 modulo compares on every RX interrupt and every 'read()', and wrote the
+// RTS pin on every 'read()'.  Now the ISR does a subtract, mask and compare, and only writes the
+// pin when RTS actually changes.  'read()' only checks when RTS is HIGH.
+//
+// When RTS is already high the ISR only tests a flag, and so does 'read()' while it's low.
+//
+// TODO:  the RX ISR cycle count, before and after, has NOT been measured yet.  To measure it,
+//        toggle a spare pin with OUTSET/OUTCLR at the start and end of 'serial_rxc()' and look
+//        at it with a scope, or count the '__vector_N' instructions ('avr-objdump -d').
+//
+// The ISR only sets RTS (and 'stopped') when it's low, and 'read()' only clears it when it's
+// high.  'read()' does its check with interrupts off for a few cycles, so an RX interrupt can't
+// fill the buffer between the check and RTS going low.  That only happens while RTS is high.
+//
+// CTS works through the PORTn_INT1 interrupt for the CTS pin's port (see 'WInterrupts.c').
+// 'E' series parts only have one pin change interrupt per port (INTMASK, INTLVL) so it's that
+// one instead, shared with 'attachInterrupt()' the same way.
+// When CTS is HIGH the DRE handler stops sending and turns on the pin change interrupt, and
+// 'serial_cts_interrupt()' starts the DRE interrupt again when CTS goes LOW.
+// ----------------------------------------------------------------------------------------
+
+#ifndef SERIAL_RTS_HEADROOM
+#define SERIAL_RTS_HEADROOM 4 /* free bytes left in the RX buffer when RTS goes high */
+#endif // SERIAL_RTS_HEADROOM
+
+#define SERIAL_RTS_HIGH(X) ((X) - SERIAL_RTS_HEADROOM) /* default 'high' watermark, buffer size 'X' */
+#define SERIAL_RTS_LOW(X) ((X) / 2)                    /* default 'low' watermark */
+
+#ifdef PORTC_INT0MASK /* INT0MASK and INT1MASK, same test as 'WInterrupts.c' */
+#define SERIAL_CTS_INTMASK(P) ((P)->INT1MASK)
+#define SERIAL_CTS_INTLVL_gm PORT_INT1LVL_gm
+#else // only one int vector ('E' series)
+#define SERIAL_CTS_INTMASK(P) ((P)->INTMASK)
+#define SERIAL_CTS_INTLVL_gm PORT_INTLVL_gm
+#endif // PORTC_INT0MASK
+
+#ifdef SERIAL_RTS_ENABLED
+struct serial_flow
 {
-register8_t *pCTRL;
-uint8_t oldSREG;
-
-
-  pCTRL = &(SERIAL_0_CTS_PORT->PIN0CTRL) + SERIAL_0_CTS_PIN_INDEX;
+  PORT_t *pPort;            // the RTS pin's port
+  uint8_t bPin;             // the RTS pin's bit
+  ring_index_t high;        // RTS goes high when this many bytes are waiting in the RX buffer
+  ring_index_t low;         // RTS goes low again when it's down to this many
+  volatile uint8_t stopped; // RTS is high - only the ISR sets this, only 'read()' clears it
+};
 
-  SERIAL_0_CTS_PORT->DIR &= ~SERIAL_0_CTS_PIN; // it's an input
+#ifdef SERIAL_0_RTS_ENABLED
+static struct serial_flow serial_0_flow = { SERIAL_0_RTS_PORT, SERIAL_0_RTS_PIN,
+                                          SERIAL_RTS_HIGH(SERIAL_0_RX_BUFFER_SIZE), SERIAL_RTS_LOW(SERIAL_0_RX_BUFFER_SIZE), 0 };
+#endif // SERIAL_0_RTS_ENABLED
+#ifdef SERIAL_1_RTS_ENABLED
+static struct serial_flow serial_1_flow = { SERIAL_1_RTS_PORT, SERIAL_1_RTS_PIN,
+                                          SERIAL_RTS_HIGH(SERIAL_1_RX_BUFFER_SIZE), SERIAL_RTS_LOW(SERIAL_1_RX_BUFFER_SIZE), 0 };
+#endif // SERIAL_1_RTS_ENABLED
+#ifdef SERIAL_2_PORT_NAME
+#ifdef SERIAL_2_RTS_ENABLED
+static struct serial_flow serial_2_flow = { SERIAL_2_RTS_PORT, SERIAL_2_RTS_PIN,
+                                          SERIAL_RTS_HIGH(SERIAL_2_RX_BUFFER_SIZE), SERIAL_RTS_LOW(SERIAL_2_RX_BUFFER_SIZE), 0 };
+#endif // SERIAL_2_RTS_ENABLED
+#endif // SERIAL_2_PORT_NAME
+#ifdef SERIAL_3_PORT_NAME
+#ifdef SERIAL_3_RTS_ENABLED
+static struct serial_flow serial_3_flow = { SERIAL_3_RTS_PORT, SERIAL_3_RTS_PIN,
+                                          SERIAL_RTS_HIGH(SERIAL_3_RX_BUFFER_SIZE), SERIAL_RTS_LOW(SERIAL_3_RX_BUFFER_SIZE), 0 };
+#endif // SERIAL_3_RTS_ENABLED
+#endif // SERIAL_3_PORT_NAME
+#ifdef SERIAL_4_PORT_NAME
+#ifdef SERIAL_4_RTS_ENABLED
+static struct serial_flow serial_4_flow = { SERIAL_4_RTS_PORT, SERIAL_4_RTS_PIN,
+                                          SERIAL_RTS_HIGH(SERIAL_4_RX_BUFFER_SIZE), SERIAL_RTS_LOW(SERIAL_4_RX_BUFFER_SIZE), 0 };
+#endif // SERIAL_4_RTS_ENABLED
+#endif // SERIAL_4_PORT_NAME
+#ifdef SERIAL_5_PORT_NAME
+#ifdef SERIAL_5_RTS_ENABLED
+static struct serial_flow serial_5_flow = { SERIAL_5_RTS_PORT, SERIAL_5_RTS_PIN,
+                                          SERIAL_RTS_HIGH(SERIAL_5_RX_BUFFER_SIZE), SERIAL_RTS_LOW(SERIAL_5_RX_BUFFER_SIZE), 0 };
+#endif // SERIAL_5_RTS_ENABLED
+#endif // SERIAL_5_PORT_NAME
+#ifdef SERIAL_6_PORT_NAME
+#ifdef SERIAL_6_RTS_ENABLED
+static struct serial_flow serial_6_flow = { SERIAL_6_RTS_PORT, SERIAL_6_RTS_PIN,
+                                          SERIAL_RTS_HIGH(SERIAL_6_RX_BUFFER_SIZE), SERIAL_RTS_LOW(SERIAL_6_RX_BUFFER_SIZE), 0 };
+#endif // SERIAL_6_RTS_ENABLED
+#endif // SERIAL_6_PORT_NAME
+#ifdef SERIAL_7_PORT_NAME
+#ifdef SERIAL_7_RTS_ENABLED
+static struct serial_flow serial_7_flow = { SERIAL_7_RTS_PORT, SERIAL_7_RTS_PIN,
+                                          SERIAL_RTS_HIGH(SERIAL_7_RX_BUFFER_SIZE), SERIAL_RTS_LOW(SERIAL_7_RX_BUFFER_SIZE), 0 };
+#endif // SERIAL_7_RTS_ENABLED
+#endif // SERIAL_7_PORT_NAME
 
-  *pCTRL = PORT_OPC_PULLUP_gc | PORT_ISC_BOTHEDGES_gc; //PORT_ISC_FALLING_gc; // interrupt on falling, pulldown resistor
+// RXC handler helper, after a byte was stored.  RTS goes high at the 'high' watermark
+static inline void serial_rts_check(struct serial_flow *pF, ring_buffer *pB)
+{
+  if(!pF->stopped && // already high, nothing to do
+     (ring_index_t)((pB->head - pB->tail) & pB->mask) >= pF->high)
+  {
+    pF->pPort->OUTSET = pF->bPin; // set to '1' - stop sending
+    pF->stopped = 1;
+  }
+}
 
-  // this next section enables actual interrupts
+// the 'deplete' side, 'read()' calls this after the tail moves, but only when RTS is high
+static void serial_rts_release(struct serial_flow *pF, ring_buffer *pB)
+{
+uint8_t oldSREG = SREG;
 
-  oldSREG = SREG; // store the interrupt flag basically
 
-  cli(); // disable interrupts for a bit
+  cli(); // so the ISR can't add bytes between the check and RTS going low (~10 cycles)
 
-  SERIAL_0_CTS_PORT->INT1MASK &= ~SERIAL_0_CTS_PIN;
-      // TODO:  'E' series doesn't have 'INT1'
-//  SERIAL_0_CTS_PORT->INTCTRL &= ~PORT_INT1LVL_gm;  // interrupt initially off
+  if((ring_index_t)((pB->head - pB->tail) & pB->mask) <= pF->low)
+  {
+    pF->stopped = 0;
+    pF->pPort->OUTCLR = pF->bPin; // set to '0' - ok to send
+  }
 
-  SREG = oldSREG; // restore
+  SREG = oldSREG;
 }
-#endif // defined(SERIAL_0_CTS_ENABLED)
-
 
-#if defined(SERIAL_1_CTS_ENABLED)
-static void InitSerialFlowControlInterrupt1(void)
+// 'begin()' calls this - RTS is an output, LOW ('ok to send') with an empty buffer
+static void serial_rts_init(struct serial_flow *pF)
 {
-register8_t *pCTRL;
-uint8_t oldSREG;
-
-  pCTRL = &(SERIAL_1_CTS_PORT->PIN0CTRL) + SERIAL_1_CTS_PIN_INDEX;
+  pF->stopped = 0;
+  pF->pPort->OUTCLR = pF->bPin;
+  pF->pPort->DIRSET = pF->bPin;
+}
+#endif // SERIAL_RTS_ENABLED
 
-  SERIAL_1_CTS_PORT->DIR &= ~SERIAL_1_CTS_PIN; // it's an input
+#ifdef SERIAL_CTS_ENABLED
+// CTS is an input with a pullup and a pin change interrupt on both edges.  The interrupt
+// itself stays masked (SERIAL_CTS_INTMASK) until the DRE handler sees CTS go high.
+static void serial_cts_init(PORT_t *pPort, uint8_t bPin)
+{
+register8_t *pCTRL = &(pPort->PIN0CTRL);
+uint8_t b1, oldSREG;
 
-  *pCTRL = PORT_OPC_PULLUP_gc | PORT_ISC_BOTHEDGES_gc; //PORT_ISC_FALLING_gc; // interrupt on falling, pulldown resistor
 
-  // this next section enables actual interrupts
+  for(b1=1; b1 && b1 != bPin; b1 <<= 1) // treat PIN0CTRL through PIN7CTRL as an array
+  {
+    pCTRL++;
+  }
 
   oldSREG = SREG; // store the interrupt flag basically
-
   cli(); // disable interrupts for a bit
 
-  SERIAL_1_CTS_PORT->INT1MASK &= ~SERIAL_1_CTS_PIN; // interrupt off (for now)
-      // TODO:  'E' series doesn't have 'INT1'
-//  SERIAL_1_CTS_PORT->INTCTRL |= PORT_INT1LVL_gm; // max priority when I do this
+  pPort->DIRCLR = bPin; // it's an input
+
+  *pCTRL = PORT_OPC_PULLUP_gc | PORT_ISC_BOTHEDGES_gc; // interrupt on both edges, pullup resistor
+
+  SERIAL_CTS_INTMASK(pPort) &= ~bPin; // interrupt off (for now)
 
   SREG = oldSREG; // restore
 }
-#endif // defined(SERIAL_1_CTS_ENABLED)
-
+#endif // SERIAL_CTS_ENABLED
 
 void InitSerialFlowControlInterrupts(void)
 {
+#ifdef SERIAL_CTS_ENABLED
 uint8_t oldSREG=SREG;
 
   cli(); // disable interrupts for a bit
 
 #if defined(SERIAL_0_CTS_ENABLED)
-  InitSerialFlowControlInterrupt0();
+  serial_cts_init(SERIAL_0_CTS_PORT, SERIAL_0_CTS_PIN);
 #endif // defined(SERIAL_0_CTS_ENABLED)
-
 #if defined(SERIAL_1_CTS_ENABLED)
-  InitSerialFlowControlInterrupt1();
+  serial_cts_init(SERIAL_1_CTS_PORT, SERIAL_1_CTS_PIN);
 #endif // defined(SERIAL_1_CTS_ENABLED)
+#if defined(SERIAL_2_CTS_ENABLED)
+  serial_cts_init(SERIAL_2_CTS_PORT, SERIAL_2_CTS_PIN);
+#endif // defined(SERIAL_2_CTS_ENABLED)
+#if defined(SERIAL_3_CTS_ENABLED)
+  serial_cts_init(SERIAL_3_CTS_PORT, SERIAL_3_CTS_PIN);
+#endif // defined(SERIAL_3_CTS_ENABLED)
+#if defined(SERIAL_4_CTS_ENABLED)
+  serial_cts_init(SERIAL_4_CTS_PORT, SERIAL_4_CTS_PIN);
+#endif // defined(SERIAL_4_CTS_ENABLED)
+#if defined(SERIAL_5_CTS_ENABLED)
+  serial_cts_init(SERIAL_5_CTS_PORT, SERIAL_5_CTS_PIN);
+#endif // defined(SERIAL_5_CTS_ENABLED)
+#if defined(SERIAL_6_CTS_ENABLED)
+  serial_cts_init(SERIAL_6_CTS_PORT, SERIAL_6_CTS_PIN);
+#endif // defined(SERIAL_6_CTS_ENABLED)
+#if defined(SERIAL_7_CTS_ENABLED)
+  serial_cts_init(SERIAL_7_CTS_PORT, SERIAL_7_CTS_PIN);
+#endif // defined(SERIAL_7_CTS_ENABLED)
 
   SREG = oldSREG; // restore
+#endif // SERIAL_CTS_ENABLED
 }
 
 
-// helpers for hardware flow control
-// these will send the 'next character' _NOW_ if one is available by
-// restoring the 'DRE' interrupt.
 
-void serial_0_cts_callback(void)
+// ----------------------------------------------------------------------------------------
+//                          DMA (or EDMA) TRANSMIT - OPTIONAL
+//
+// To drain the TX ring buffer with the DMA controller rather than one DRE interrupt per
+// byte, assign a DMA channel to the serial port in 'pins_arduino.h' (or via the compiler
+// command line), similar to this:
+//
+//   #define SERIAL_0_TX_DMA_CHANNEL 0 /* use DMA channel 0 for 'Serial' output */
+//
+// The channel is triggered by the USART's DRE flag, one byte per trigger.  Each transfer
+// covers the contiguous span of the ring buffer from 'tail' to either 'head' or the end
+// of the buffer, so the only interrupt is the 'transfer complete' for that span.  If more
+// data was queued in the mean time, the completion handler starts the next span.
+//
+// The DRE path costs one interrupt per byte, and at 921600 baud a byte leaves every ~347 CPU
+// cycles (32Mhz), so a good part of the CPU goes to feeding the USART.  The DMA path costs one
+// interrupt per contiguous span (up to the TX buffer size), plus the bus cycles the DMA steals
+// to move each byte.
+//
+// CTS flow control is NOT supported on a DMA port since the DMA can't check the CTS pin.
+// 'D' series parts have no DMA controller.  'E' series parts use the EDMA in 'peripheral'
+// channel mode, with the USART data register implied by the trigger source.
+// ----------------------------------------------------------------------------------------
+
+#if defined(SERIAL_0_TX_DMA_CHANNEL) || defined(SERIAL_1_TX_DMA_CHANNEL) || defined(SERIAL_2_TX_DMA_CHANNEL) || defined(SERIAL_3_TX_DMA_CHANNEL) \
+    || defined(SERIAL_4_TX_DMA_CHANNEL) || defined(SERIAL_5_TX_DMA_CHANNEL) || defined(SERIAL_6_TX_DMA_CHANNEL) || defined(SERIAL_7_TX_DMA_CHANNEL)
+#define SERIAL_TX_DMA_ENABLED
+
+#if defined(DMA_CH0_CTRLA) /* A series and others with the 'classic' DMA controller */
+#define SERIAL_DMA_CH2(X) (&(DMA.CH##X))
+#define SERIAL_DMA_VECT2(X) DMA_CH##X##_vect
+typedef DMA_CH_t SERIAL_DMA_CH_t;
+#elif defined(EDMA_CH0_CTRLA) /* E series */
+#define SERIAL_DMA_CH2(X) (&(EDMA.CH##X))
+#define SERIAL_DMA_VECT2(X) EDMA_CH##X##_vect
+typedef EDMA_CH_t SERIAL_DMA_CH_t;
+#else
+#error this CPU does not have a DMA controller - do not define 'SERIAL_n_TX_DMA_CHANNEL'
+#endif // DMA_CH0_CTRLA, EDMA_CH0_CTRLA
+
+// these 2-level macros make sure that 'X' is expanded before token pasting
+#define SERIAL_DMA_CH(X) SERIAL_DMA_CH2(X)
+#define SERIAL_DMA_VECT(X) SERIAL_DMA_VECT2(X)
+
+#if (defined(SERIAL_0_TX_DMA_CHANNEL) && defined(SERIAL_0_CTS_ENABLED)) || (defined(SERIAL_1_TX_DMA_CHANNEL) && defined(SERIAL_1_CTS_ENABLED)) \
+    || (defined(SERIAL_2_TX_DMA_CHANNEL) && defined(SERIAL_2_CTS_ENABLED)) || (defined(SERIAL_3_TX_DMA_CHANNEL) && defined(SERIAL_3_CTS_ENABLED)) \
+    || (defined(SERIAL_4_TX_DMA_CHANNEL) && defined(SERIAL_4_CTS_ENABLED)) || (defined(SERIAL_5_TX_DMA_CHANNEL) && defined(SERIAL_5_CTS_ENABLED)) \
+    || (defined(SERIAL_6_TX_DMA_CHANNEL) && defined(SERIAL_6_CTS_ENABLED)) || (defined(SERIAL_7_TX_DMA_CHANNEL) && defined(SERIAL_7_CTS_ENABLED))
+#error CTS flow control cannot be used with a DMA transmit channel on the same serial port
+#endif // CTS + DMA
+
+// one of these for each serial port that uses DMA for transmit
+struct serial_tx_dma
 {
-uint8_t oldSREG = SREG; // get this FIRST
-#ifdef SERIAL_0_CTS_ENABLED
-char bCTS = SERIAL_0_CTS_PORT->IN & SERIAL_0_CTS_PIN;
-#endif // SERIAL_0_CTS_ENABLED
-
-
-  cli(); // in case I'm currently doing somethign ELSE that affects tx_buffer
+  SERIAL_DMA_CH_t *pCH;      // the DMA channel
+  volatile USART_t *pUSART;  // the USART it feeds
+  ring_buffer *pT;           // the TX ring buffer it drains
+  volatile unsigned int len; // length of the span being transferred, 0 if idle
+};
 
-#ifdef SERIAL_0_CTS_ENABLED
-  if(!bCTS) // it's cleared - turn off the interrupt
+// returns the DMA trigger source for the USART's DRE flag
+static uint8_t serial_tx_dma_trigger(volatile USART_t *pUSART)
+{
+#if defined(DMA_CH0_CTRLA)
+  if(pUSART == &USARTD0)
   {
-    SERIAL_0_CTS_PORT->INT1MASK &= ~SERIAL_0_CTS_PIN;
-      // TODO:  'E' series doesn't have 'INT1'
-//    SERIAL_0_CTS_PORT->INTCTRL |= PORT_INT1LVL_gm; // max priority when I do this
+    return DMA_CH_TRIGSRC_USARTD0_DRE_gc;
   }
-#endif // SERIAL_0_CTS_ENABLED
-
-  if(tx_buffer.head != tx_buffer.tail) // only when there's something to send
+#ifdef USARTD1
+  else if(pUSART == &USARTD1)
+  {
+    return DMA_CH_TRIGSRC_USARTD1_DRE_gc;
+  }
+#endif // USARTD1
+#ifdef USARTC1
+  else if(pUSART == &USARTC1)
+  {
+    return DMA_CH_TRIGSRC_USARTC1_DRE_gc;
+  }
+#endif // USARTC1
+#ifdef USARTE0
+  else if(pUSART == &USARTE0)
+  {
+    return DMA_CH_TRIGSRC_USARTE0_DRE_gc;
+  }
+#endif // USARTE0
+#ifdef USARTE1
+  else if(pUSART == &USARTE1)
+  {
+    return DMA_CH_TRIGSRC_USARTE1_DRE_gc;
+  }
+#endif // USARTE1
+#ifdef USARTF0
+  else if(pUSART == &USARTF0)
   {
-    // re-enable the DRE interrupt - this will cause transmission to
-    // occur again without code duplication.  see HardwareSerial::write()
+    return DMA_CH_TRIGSRC_USARTF0_DRE_gc;
+  }
+#endif // USARTF0
+#ifdef USARTF1
+  else if(pUSART == &USARTF1)
+  {
+    return DMA_CH_TRIGSRC_USARTF1_DRE_gc;
+  }
+#endif // USARTF1
 
-    (&(SERIAL_0_USART_NAME))->CTRLA /*USARTD0_CTRLA*/
-      = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp)
-      | _BV(USART_DREINTLVL1_bp) | _BV(USART_DREINTLVL0_bp); // set int bits for rx and dre (sect 19.14.3)
+  return DMA_CH_TRIGSRC_USARTC0_DRE_gc; // the only one that's left
+
+#else // EDMA
+
+  if(pUSART == &USARTD0)
+  {
+    return EDMA_CH_TRIGSRC_USARTD0_DRE_gc;
   }
 
-  SREG=oldSREG; // interrupts re-enabled
+  return EDMA_CH_TRIGSRC_USARTC0_DRE_gc;
+
+#endif // DMA_CH0_CTRLA
 }
 
-void serial_1_cts_callback(void)
+// one-time setup of the DMA channel, called from HardwareSerial::begin() with interrupts OFF
+static void serial_tx_dma_init(struct serial_tx_dma *pD)
 {
-uint8_t oldSREG = SREG; // get this FIRST
-#ifdef SERIAL_1_CTS_ENABLED
-char bCTS = SERIAL_1_CTS_PORT->IN & SERIAL_1_CTS_PIN;
-#endif // SERIAL_1_CTS_ENABLED
+SERIAL_DMA_CH_t *pCH = pD->pCH;
+#if defined(DMA_CH0_CTRLA)
+uint16_t wAddr = (uint16_t)&(pD->pUSART->DATA);
+#endif // DMA_CH0_CTRLA
 
+  pCH->CTRLA = 0; // disable channel (in case it was running)
+  pD->len = 0;
 
-  cli(); // in case I'm currently doing somethign ELSE that affects tx_buffer
+#if defined(DMA_CH0_CTRLA)
+  DMA_CTRL |= DMA_ENABLE_bm; // enable the DMA controller (other bits as they were)
 
-#ifdef SERIAL_1_CTS_ENABLED
-  if(!bCTS) // it's cleared - turn off the interrupt
+  // source increments through the ring buffer, destination is always the DATA register
+  pCH->ADDRCTRL = DMA_CH_SRCRELOAD_NONE_gc | DMA_CH_SRCDIR_INC_gc
+                | DMA_CH_DESTRELOAD_NONE_gc | DMA_CH_DESTDIR_FIXED_gc;
+
+  pCH->DESTADDR0 = (uint8_t)wAddr;
+  pCH->DESTADDR1 = (uint8_t)(wAddr >> 8);
+  pCH->DESTADDR2 = 0;
+
+  pCH->REPCNT = 0; // not repeating
+#else // EDMA
+  // peripheral channel mode on all 4 channels - the USART 'DATA' register is implied by the trigger
+  EDMA_CTRL = EDMA_ENABLE_bm | EDMA_CHMODE_PER0123_gc | (EDMA_CTRL & EDMA_PRIMODE_gm);
+
+  pCH->ADDRCTRL = EDMA_CH_RELOAD_NONE_gc | EDMA_CH_DIR_INC_gc; // memory address increments
+#endif // DMA_CH0_CTRLA
+
+  pCH->TRIGSRC = serial_tx_dma_trigger(pD->pUSART);
+}
+
+// start transmitting the next contiguous span of the ring buffer, if the channel is idle
+// and there's something to send.  Call this with interrupts disabled.
+static void serial_tx_dma_start(struct serial_tx_dma *pD)
+{
+register ring_buffer *pT = pD->pT;
+register SERIAL_DMA_CH_t *pCH = pD->pCH;
+unsigned int iHead, iTail, iLen;
+uint16_t wAddr;
+
+  if(pD->len) // a span is already in progress; completion will pick up anything new
   {
-    SERIAL_1_CTS_PORT->INT1MASK &= ~SERIAL_1_CTS_PIN;
-      // TODO:  'E' series doesn't have 'INT1'
-//    SERIAL_1_CTS_PORT->INTCTRL |= PORT_INT1LVL_gm; // max priority when I do this
+    return;
   }
-#endif // SERIAL_1_CTS_ENABLED
 
-  if (tx_buffer2.head != tx_buffer2.tail) // only when there's something to send
+  iHead = pT->head;
+  iTail = pT->tail;
+
+  if(iHead == iTail)
   {
-    // re-enable the DRE interrupt - this will cause transmission to
-    // occur again without code duplication.  see HardwareSerial::write()
+    return; // nothing to send
+  }
 
-    USARTC0_CTRLA = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp)
-                  | _BV(USART_DREINTLVL1_bp) | _BV(USART_DREINTLVL0_bp); // set int bits for rx and dre (sect 19.14.3)
+  if(iHead > iTail)
+  {
+    iLen = iHead - iTail;
+  }
+  else
+  {
+    iLen = RING_BUFFER_SIZE(pT) - iTail; // up to the end of the buffer, then wrap on the next one
   }
 
-  SREG=oldSREG; // interrupts re-enabled
-}
+  pD->len = iLen;
 
+  wAddr = (uint16_t)&(pT->buffer[iTail]);
 
+#if defined(DMA_CH0_CTRLA)
+  pCH->SRCADDR0 = (uint8_t)wAddr;
+  pCH->SRCADDR1 = (uint8_t)(wAddr >> 8);
+  pCH->SRCADDR2 = 0;
 
-//////////////////////////////////////////////////////////////////////////////////////////
-//                                                                                      //
-//   _         _  _                 __                      _    _                      //
-//  (_) _ __  | |(_) _ __    ___   / _| _   _  _ __    ___ | |_ (_)  ___   _ __   ___   //
-//  | || '_ \ | || || '_ \  / _ \ | |_ | | | || '_ \  / __|| __|| | / _ \ | '_ \ / __|  //
-//  | || | | || || || | | ||  __/ |  _|| |_| || | | || (__ | |_ | || (_) || | | |\__ \  //
-//  |_||_| |_||_||_||_| |_| \___| |_|   \__,_||_| |_| \___| \__||_| \___/ |_| |_||___/  //
-//                                                                                      //
-//                                                                                      //
-//////////////////////////////////////////////////////////////////////////////////////////
+  pCH->TRFCNT = iLen;
+
+  // clear both flags (write 1 to clear), interrupt on completion and error, same level as the DRE int
+  pCH->CTRLB = DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm | DMA_CH_ERRINTLVL_HI_gc | DMA_CH_TRNINTLVL_HI_gc;
+
+  // one byte per DRE trigger - the channel disables itself when the block is done
+  pCH->CTRLA = DMA_CH_ENABLE_bm | DMA_CH_SINGLE_bm | DMA_CH_BURSTLEN_1BYTE_gc;
+#else // EDMA
+  pCH->ADDR = wAddr;
+  pCH->TRFCNT = iLen;
+
+  pCH->CTRLB = EDMA_CH_TRNIF_bm | EDMA_CH_ERRIF_bm | EDMA_CH_ERRINTLVL_HI_gc | EDMA_CH_TRNINTLVL_HI_gc;
 
-inline void store_char(unsigned char c, ring_buffer *buffer)
+  pCH->CTRLA = EDMA_CH_ENABLE_bm | EDMA_CH_SINGLE_bm; // burst length 1 byte
+#endif // DMA_CH0_CTRLA
+}
+
+// DMA 'transaction complete' (or error) - advance the tail past the span that was sent, then
+// start the next one.  Called by the DMA ISR, or by 'serial_tx_dma_poll()' with ints disabled
+static void serial_tx_dma_complete(struct serial_tx_dma *pD)
 {
-  unsigned int i = (unsigned int)(buffer->head + 1) % SERIAL_BUFFER_SIZE;
+register ring_buffer *pT = pD->pT;
 
-  // if we should be storing the received character into the location
-  // just before the tail (meaning that the head would advance to the
-  // current location of the tail), we're about to overflow the buffer
-  // and so we don't write the character or advance the head.
-  if (i != buffer->tail)
+#if defined(DMA_CH0_CTRLA)
+  pD->pCH->CTRLB = DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm; // clear flags; these are NOT cleared by the ISR
+#else // EDMA
+  pD->pCH->CTRLB = EDMA_CH_TRNIF_bm | EDMA_CH_ERRIF_bm;
+#endif // DMA_CH0_CTRLA
+
+  // NOTE:  on a DMA error the span is simply dropped.  This should never happen with RAM to USART
+
+  pT->tail = (unsigned int)(pT->tail + pD->len) & pT->mask;
+  pD->len = 0;
+
+  serial_tx_dma_start(pD);
+}
+
+// for use when waiting with interrupts disabled - same idea as 'call_isr()'
+static void serial_tx_dma_poll(struct serial_tx_dma *pD)
+{
+#if defined(DMA_CH0_CTRLA)
+  if(pD->pCH->CTRLB & (DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm))
+#else // EDMA
+  if(pD->pCH->CTRLB & (EDMA_CH_TRNIF_bm | EDMA_CH_ERRIF_bm))
+#endif // DMA_CH0_CTRLA
   {
-    buffer->buffer[buffer->head] = c;
-    buffer->head = i;
+    serial_tx_dma_complete(pD);
   }
 }
 
-inline char set_not_rts(ring_buffer *buffer)
-{
-  unsigned int i1 = (unsigned int)(buffer->head + 3) % SERIAL_BUFFER_SIZE;
-  unsigned int i2 = (unsigned int)(buffer->head + 2) % SERIAL_BUFFER_SIZE;
-  unsigned int i3 = (unsigned int)(buffer->head + 1) % SERIAL_BUFFER_SIZE;
+#endif // SERIAL_TX_DMA_ENABLED
 
-  // if we should be storing the received character into the location
-  // just before the tail (meaning that the head would advance to the
-  // current location of the tail), we're about to overflow the buffer
-  // and so we don't write the character or advance the head.
-  return i1 == buffer->tail || i2 == buffer->tail || i3 == buffer->tail;
-}
 
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//                                                                                                          //
-//   ___         _                                   _     _   _                    _  _                    //
-//  |_ _| _ __  | |_  ___  _ __  _ __  _   _  _ __  | |_  | | | |  __ _  _ __    __| || |  ___  _ __  ___   //
-//   | | | '_ \ | __|/ _ \| '__|| '__|| | | || '_ \ | __| | |_| | / _` || '_ \  / _` || | / _ \| '__|/ __|  //
-//   | | | | | || |_|  __/| |   | |   | |_| || |_) || |_  |  _  || (_| || | | || (_| || ||  __/| |   \__ \  //
-//  |___||_| |_| \__|\___||_|   |_|    \__,_|| .__/  \__| |_| |_| \__,_||_| |_| \__,_||_| \___||_|   |___/  //
-//                                           |_|                                                            //
-//                                                                                                          //
-//////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-// TODO:  consider re-doing these to use a single ISR, via an ISR macro similar
-//        to the following:
-//
-//        ISR(USARTC0_RXC_vect)
-//        {
-//          ...
-//        }
+// ----------------------------------------------------------------------------------------
+//                     RECEIVE TIMESTAMPS AND GAP DETECTION - OPTIONAL
 //
-//        ISR(USARTD0_RXC_vect, ISR_ALIASOF(USARTC0_RXC_vect));
+// To tag every received byte with the 'micros()' time at which it arrived, enable it for the
+// serial port in 'pins_arduino.h' (or via the compiler command line), similar to this:
 //
-//        etc.
+//   #define SERIAL_0_RX_TIMESTAMP /* time-stamp bytes received on 'Serial' */
 //
-//        then the ISR would figure out 'whatever' for registers, etc. by checking flags
-//        to see who triggered the interrupt.  such common code could more easily allow
-//        for ISR call as currently done via 'call_isr()'.  downside, might run a bit
-//        slower, but probably smaller code.  Alternative to single utility function being
-//        passed the address of the serial port register block in each ISR.
+// The time is captured as the first thing in the RXC handler, so it's the end of the stop
+// bit plus the interrupt latency (a few microseconds unless a higher level interrupt holds
+// things up).  It's stored in a parallel ring that uses the same index as the RX buffer,
+// so it costs 4 bytes of RAM per RX buffer slot, plus 1 bit for the gap flag (below).  Use
+// 'readWithTimestamp()' to get a byte along with its time.
 //
-//        see http://www.nongnu.org/avr-libc/user-manual/group__avr__interrupts.html
+// The gap detector is enabled with 'setRxGap(microseconds)'.  A byte that arrives at least
+// that long after the previous one is flagged as the start of a new frame.  For Modbus RTU
+// the gap is 3.5 character times, i.e. 38500000 / baud for 11-bit characters (the spec says
+// to use a fixed 1750us above 19200 baud).  'availableFrame()' then returns the length of the
+// complete frame at the front of the RX buffer, or 0 if there isn't one yet.  A frame is
+// complete when the first byte of the NEXT frame has arrived, or the line has been quiet for
+// the gap time since the last byte.  No more polling 'available()' from 'loop()' and
+// guessing where the frame ends.
 //
+// Each RXC interrupt on a time-stamped port calls 'micros()' and does the gap bookkeeping.
+// The other ports only get the NULL check.  The 'micros()' resolution is 64 CPU clocks, i.e.
+// 2us at 32Mhz.
+// ----------------------------------------------------------------------------------------
 
-SERIAL_0_RXC_ISR // ISR(USARTD0_RXC_vect)
+#if defined(SERIAL_0_RX_TIMESTAMP) || defined(SERIAL_1_RX_TIMESTAMP) || defined(SERIAL_2_RX_TIMESTAMP) || defined(SERIAL_3_RX_TIMESTAMP) \
+    || defined(SERIAL_4_RX_TIMESTAMP) || defined(SERIAL_5_RX_TIMESTAMP) || defined(SERIAL_6_RX_TIMESTAMP) || defined(SERIAL_7_RX_TIMESTAMP)
+#define SERIAL_RX_TIMESTAMP_ENABLED
+
+// one of these for each serial port that time-stamps received data
+struct serial_rx_stamp
 {
-unsigned char c;
+  unsigned long *pTime;       // 'micros()' for each RX buffer slot, same index as the ring buffer
+  uint8_t *pGap;              // 1 bit per RX buffer slot, set for the first byte after a gap
+  unsigned long tLast;        // 'micros()' for the most recent byte (even if the buffer was full)
+  unsigned long tGap;         // inter-byte gap that starts a new frame, in microseconds (0 for none)
+};
 
-#ifdef SERIAL_0_RTS_ENABLED
-  if(set_not_rts(&rx_buffer)) // do I need to turn off RTS ?
-  {
-    SERIAL_0_RTS_PORT->OUT |= SERIAL_0_RTS_PIN; // set to '1'
-    SERIAL_0_RTS_PORT->DIR |= SERIAL_0_RTS_PIN; // make sure it's an output
-  }
-#endif // SERIAL_0_RTS_ENABLED
+#define SERIAL_RX_GAP_SIZE(X) (((X) + 7) / 8)
+
+#ifdef SERIAL_0_RX_TIMESTAMP
+static unsigned long rx_buffer_time[SERIAL_0_RX_BUFFER_SIZE];
+static uint8_t rx_buffer_gap[SERIAL_RX_GAP_SIZE(SERIAL_0_RX_BUFFER_SIZE)];
+static struct serial_rx_stamp serial_0_rx_stamp = { rx_buffer_time, rx_buffer_gap, 0, 0 };
+#endif // SERIAL_0_RX_TIMESTAMP
+
+#ifdef SERIAL_1_RX_TIMESTAMP
+static unsigned long rx_buffer2_time[SERIAL_1_RX_BUFFER_SIZE];
+static uint8_t rx_buffer2_gap[SERIAL_RX_GAP_SIZE(SERIAL_1_RX_BUFFER_SIZE)];
+static struct serial_rx_stamp serial_1_rx_stamp = { rx_buffer2_time, rx_buffer2_gap, 0, 0 };
+#endif // SERIAL_1_RX_TIMESTAMP
+
+#if defined(SERIAL_2_PORT_NAME) && defined(SERIAL_2_RX_TIMESTAMP)
+static unsigned long rx_buffer3_time[SERIAL_2_RX_BUFFER_SIZE];
+static uint8_t rx_buffer3_gap[SERIAL_RX_GAP_SIZE(SERIAL_2_RX_BUFFER_SIZE)];
+static struct serial_rx_stamp serial_2_rx_stamp = { rx_buffer3_time, rx_buffer3_gap, 0, 0 };
+#endif // SERIAL_2_PORT_NAME, SERIAL_2_RX_TIMESTAMP
+
+#if defined(SERIAL_3_PORT_NAME) && defined(SERIAL_3_RX_TIMESTAMP)
+static unsigned long rx_buffer4_time[SERIAL_3_RX_BUFFER_SIZE];
+static uint8_t rx_buffer4_gap[SERIAL_RX_GAP_SIZE(SERIAL_3_RX_BUFFER_SIZE)];
+static struct serial_rx_stamp serial_3_rx_stamp = { rx_buffer4_time, rx_buffer4_gap, 0, 0 };
+#endif // SERIAL_3_PORT_NAME, SERIAL_3_RX_TIMESTAMP
+
+#if defined(SERIAL_4_PORT_NAME) && defined(SERIAL_4_RX_TIMESTAMP)
+static unsigned long rx_buffer5_time[SERIAL_4_RX_BUFFER_SIZE];
+static uint8_t rx_buffer5_gap[SERIAL_RX_GAP_SIZE(SERIAL_4_RX_BUFFER_SIZE)];
+static struct serial_rx_stamp serial_4_rx_stamp = { rx_buffer5_time, rx_buffer5_gap, 0, 0 };
+#endif // SERIAL_4_PORT_NAME, SERIAL_4_RX_TIMESTAMP
+
+#if defined(SERIAL_5_PORT_NAME) && defined(SERIAL_5_RX_TIMESTAMP)
+static unsigned long rx_buffer6_time[SERIAL_5_RX_BUFFER_SIZE];
+static uint8_t rx_buffer6_gap[SERIAL_RX_GAP_SIZE(SERIAL_5_RX_BUFFER_SIZE)];
+static struct serial_rx_stamp serial_5_rx_stamp = { rx_buffer6_time, rx_buffer6_gap, 0, 0 };
+#endif // SERIAL_5_PORT_NAME, SERIAL_5_RX_TIMESTAMP
+
+#if defined(SERIAL_6_PORT_NAME) && defined(SERIAL_6_RX_TIMESTAMP)
+static unsigned long rx_buffer7_time[SERIAL_6_RX_BUFFER_SIZE];
+static uint8_t rx_buffer7_gap[SERIAL_RX_GAP_SIZE(SERIAL_6_RX_BUFFER_SIZE)];
+static struct serial_rx_stamp serial_6_rx_stamp = { rx_buffer7_time, rx_buffer7_gap, 0, 0 };
+#endif // SERIAL_6_PORT_NAME, SERIAL_6_RX_TIMESTAMP
+
+#if defined(SERIAL_7_PORT_NAME) && defined(SERIAL_7_RX_TIMESTAMP)
+static unsigned long rx_buffer8_time[SERIAL_7_RX_BUFFER_SIZE];
+static uint8_t rx_buffer8_gap[SERIAL_RX_GAP_SIZE(SERIAL_7_RX_BUFFER_SIZE)];
+static struct serial_rx_stamp serial_7_rx_stamp = { rx_buffer8_time, rx_buffer8_gap, 0, 0 };
+#endif // SERIAL_7_PORT_NAME, SERIAL_7_RX_TIMESTAMP
+
+// record the time (and the gap flag) for the RX buffer slot at 'iHead'.  called by the RXC
+// handler BEFORE 'store_char()'.  If the buffer is full, 'iHead' is the unused slot in front of
+// the tail, so writing it is harmless.  Only the ISR writes the gap bits, so the read-modify-write
+// on a byte that's shared with other slots can't collide with anything.
+static inline void stamp_char(struct serial_rx_stamp *pS, unsigned int iHead, unsigned long tNow)
+{
+register uint8_t *pG = pS->pGap + (iHead >> 3);
+register uint8_t bit = 1 << (iHead & 7);
+
+  pS->pTime[iHead] = tNow;
 
-  if((&(SERIAL_0_USART_NAME))->STATUS /*USARTD0_STATUS*/ & _BV(USART_RXCIF_bp)) // if there is data available
+  if(pS->tGap && (tNow - pS->tLast) >= pS->tGap) // unsigned math works across the 'micros()' wrap
   {
-    c = SERIAL_0_USART_DATA; //USARTD0_DATA;
-    store_char(c, &rx_buffer);
+    *pG |= bit;
   }
-  else // I got an interrupt for some reason, just eat data from data reg
+  else
   {
-    c = SERIAL_0_USART_DATA; //USARTD0_DATA;
+    *pG &= ~bit;
   }
+
+  pS->tLast = tNow;
 }
 
-SERIAL_1_RXC_ISR // ISR(USARTC0_RXC_vect)
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
+
+
+
+// ----------------------------------------------------------------------------------------
+//                        IDLE LINE (FRAME COMPLETE) DETECTION
+//
+// Each serial port can tell you when its RX line has been quiet for 'N' bit times after
+// receiving something, i.e. when a frame (Modbus RTU, DMX, etc.) is complete.  Use
+// 'setIdleTime(N)' to enable it, and then either poll 'rxIdle()' or assign a callback
+// with 'setIdleCallback()'.  Modbus RTU uses 3.5 characters (N = 39 for 11-bit characters).
+//
+// There's no extra timer.  The RXC handler re-loads a per-port tick count with each byte, and
+// the 'millis' timer ISR in wiring.c counts it down via 'timer0_tick_hook'.  When it reaches
+// zero, the flag is set and the callback is called.  The tick is 64 * 256 CPU clocks (512us at
+// 32Mhz) so the idle time is rounded UP to whole ticks, plus 1 since the first tick can
+// happen right after the last byte.  That also limits it to 255 ticks (~130ms at 32Mhz).
+//
+// NOTE:  the callback runs inside the timer ISR, at the same (high) priority as the serial
+//        interrupts.  Keep it short, i.e. set a flag or read out the frame and get out.
+//
+// The tick hook needs TIMER0_TICK_HOOK defined in 'pins_arduino.h', since any ISR that calls
+// a function has to save the call-used registers, and that would make the 'millis' ISR ~30
+// cycles longer for every sketch.  Without it, calling 'setIdleTime()' is a link error.  The
+// RXC handler gets a test and one store.
+// ----------------------------------------------------------------------------------------
+
+#define SERIAL_IDLE_TICK_CLOCKS (64UL * 256UL) /* one 'millis' timer underflow, see wiring.c */
+
+// one of these for each serial port
+struct serial_idle
 {
-unsigned char c;
+  volatile uint8_t count;     // ticks left until the line is idle, 0 if not counting
+  uint8_t reload;             // ticks for the idle time, 0 when the detector is off
+  volatile uint8_t flag;      // set when the line goes idle, cleared by 'rxIdle()'
+  unsigned int bits;          // the idle time in bit times (re-calculated by 'begin()')
+  void (*pCallback)(void);    // called from the timer ISR when the line goes idle (may be NULL)
+};
 
-#ifdef SERIAL_1_RTS_ENABLED
-  if(set_not_rts(&rx_buffer2)) // do I need to turn off RTS ?
-  {
-    SERIAL_1_RTS_PORT->OUT |= SERIAL_1_RTS_PIN; // set to '1'
-    SERIAL_1_RTS_PORT->DIR |= SERIAL_1_RTS_PIN; // make sure it's an output
-  }
-#endif // SERIAL_0_RTS_ENABLED
+static struct serial_idle serial_0_idle = { 0, 0, 0, 0, NULL };
+static struct serial_idle serial_1_idle = { 0, 0, 0, 0, NULL };
+#ifdef SERIAL_2_PORT_NAME
+static struct serial_idle serial_2_idle = { 0, 0, 0, 0, NULL };
+#endif // SERIAL_2_PORT_NAME
+#ifdef SERIAL_3_PORT_NAME
+static struct serial_idle serial_3_idle = { 0, 0, 0, 0, NULL };
+#endif // SERIAL_3_PORT_NAME
+#ifdef SERIAL_4_PORT_NAME
+static struct serial_idle serial_4_idle = { 0, 0, 0, 0, NULL };
+#endif // SERIAL_4_PORT_NAME
+#ifdef SERIAL_5_PORT_NAME
+static struct serial_idle serial_5_idle = { 0, 0, 0, 0, NULL };
+#endif // SERIAL_5_PORT_NAME
+#ifdef SERIAL_6_PORT_NAME
+static struct serial_idle serial_6_idle = { 0, 0, 0, 0, NULL };
+#endif // SERIAL_6_PORT_NAME
+#ifdef SERIAL_7_PORT_NAME
+static struct serial_idle serial_7_idle = { 0, 0, 0, 0, NULL };
+#endif // SERIAL_7_PORT_NAME
 
-  if((&(SERIAL_1_USART_NAME))->STATUS /*USARTC0_STATUS*/ & _BV(USART_RXCIF_bp)) // if there is data available
-  {
-    c = SERIAL_1_USART_DATA; //USARTC0_DATA;
-    store_char(c, &rx_buffer2);
-  }
-  else // I got an interrupt for some reason, just eat data from data reg
+// the number of timer ticks for 'bits' bit times at 'baud', rounded up, plus 1 for the phase
+// of the first tick.  (bit time in clocks / 16) * bits fits in 32 bits for any sane baud rate
+static uint8_t serial_idle_ticks(unsigned long baud, unsigned int bits)
+{
+unsigned long lTicks;
+
+  if(!bits || !baud)
   {
-    c = SERIAL_1_USART_DATA; //USARTC0_DATA;
+    return 0;
   }
+
+  lTicks = ((F_CPU / baud) >> 4) * bits;
+  lTicks = (lTicks + (SERIAL_IDLE_TICK_CLOCKS >> 4) - 1) / (SERIAL_IDLE_TICK_CLOCKS >> 4) + 1;
+
+  return lTicks > 255 ? 255 : (uint8_t)lTicks;
 }
 
-#ifdef SERIAL_2_PORT_NAME
-SERIAL_2_RXC_ISR // ISR(USARTE0_RXC_vect)
+static inline void serial_idle_check(struct serial_idle *pI)
 {
-unsigned char c;
-
-  if((&(SERIAL_2_USART_NAME))->STATUS /*USARTE0_STATUS*/ & _BV(USART_RXCIF_bp)) // if there is data available
+  if(pI->count && !--(pI->count)) // same priority as the RXC ISR, so it can't change under me
   {
-    c = SERIAL_2_USART_DATA; //USARTE0_DATA;
-    store_char(c, &rx_buffer3);
-  }
-  else // I got an interrupt for some reason, just eat data from data reg
-  {
-    c = SERIAL_2_USART_DATA; //USARTE0_DATA;
+    pI->flag = 1;
+
+    if(pI->pCallback)
+    {
+      pI->pCallback();
+    }
   }
 }
-#endif // SERIAL_2_PORT_NAME
 
-#ifdef SERIAL_3_PORT_NAME
-SERIAL_3_RXC_ISR // ISR(USARTF0_RXC_vect)
+static voidFuncPtr serial_idle_next = NULL; // the tick hook that was there before, if any
+static bool serial_idle_hooked = false; // only once, since other hooks may have chained onto mine
+
+// 'timer0_tick_hook' points here once any port has called 'setIdleTime()'
+static void serial_idle_tick(void)
 {
-unsigned char c;
+  serial_idle_check(&serial_0_idle);
+  serial_idle_check(&serial_1_idle);
+#ifdef SERIAL_2_PORT_NAME
+  serial_idle_check(&serial_2_idle);
+#endif // SERIAL_2_PORT_NAME
+#ifdef SERIAL_3_PORT_NAME
+  serial_idle_check(&serial_3_idle);
+#endif // SERIAL_3_PORT_NAME
+#ifdef SERIAL_4_PORT_NAME
+  serial_idle_check(&serial_4_idle);
+#endif // SERIAL_4_PORT_NAME
+#ifdef SERIAL_5_PORT_NAME
+  serial_idle_check(&serial_5_idle);
+#endif // SERIAL_5_PORT_NAME
+#ifdef SERIAL_6_PORT_NAME
+  serial_idle_check(&serial_6_idle);
+#endif // SERIAL_6_PORT_NAME
+#ifdef SERIAL_7_PORT_NAME
+  serial_idle_check(&serial_7_idle);
+#endif // SERIAL_7_PORT_NAME
 
-  if((&(SERIAL_3_USART_NAME))->STATUS /*USARTF0_STATUS*/ & _BV(USART_RXCIF_bp)) // if there is data available
-  {
-    c = SERIAL_3_USART_DATA; //USARTF0_DATA;
-    store_char(c, &rx_buffer4);
-  }
-  else // I got an interrupt for some reason, just eat data from data reg
+  if(serial_idle_next)
   {
-    c = SERIAL_3_USART_DATA; //USARTF0_DATA;
+    serial_idle_next(); // chained
   }
 }
-#endif // SERIAL_3_PORT_NAME
 
+
+// ----------------------------------------------------------------------------------------
+//                        RS-485 HALF-DUPLEX (DRIVER ENABLE PIN)
+//
+// 'begin(baud, config, dePin)' (or 'setDriverEnable(dePin)') assigns a pin that drives the
+// transceiver's DE input (and usually /RE, tied to it, so you don't receive your own data).
+// It goes HIGH when 'write()' queues data, before the first start bit, and the TXC interrupt
+// drops it as soon as the last stop bit has left the shift register.  Turnaround is then the
+// ISR latency (a few microseconds) rather than a trip through 'loop()' with 'flush()' and
+// 'digitalWrite()'.
+//
+// TXC is only enabled once the DRE handler finds the buffer empty.  The DRE handler clears
+// TXCIF each time it loads DATA, so a TXCIF left over from an earlier gap can't drop DE while
+// the last byte is still going out.  If more data was queued before TXC happens, DE stays up.
+// With DMA transmit, TXC stays enabled while DE is up, and 'head != tail' keeps it up until
+// the DMA has moved the last byte.
+//
+// The TXC ISRs cost ~30-70 bytes of flash per port (more with SERIAL_SHARED_ISR 1), plus the
+// per-port DE state, so they're only there if you define SERIAL_RS485 in 'pins_arduino.h'.
+// The variant must then define SERIAL_n_TXC_ISR for each port.
+//
+// NOTE:  if interrupts are disabled, 'flush()' and 'end()' drop DE themselves once TXCIF is
+//        set.  Otherwise DE stays up until interrupts are enabled again and the TXC ISR runs.
+// ----------------------------------------------------------------------------------------
+
+#ifdef SERIAL_RS485
+#define SERIAL_RS485_ENABLED /* TXC interrupt handlers for the driver enable pin */
+#endif // SERIAL_RS485
+
+// one of these for each serial port
+struct serial_de
+{
+  PORT_t *pPort;              // the DE pin's port, NULL if this port has no DE pin
+  uint8_t bPin;               // the DE pin's bit
+  volatile uint8_t busy;      // set when DE goes high, cleared when the TXC ISR drops it
+};
+
+#ifdef SERIAL_RS485_ENABLED
+static struct serial_de serial_0_de = { NULL, 0, 0 };
+static struct serial_de serial_1_de = { NULL, 0, 0 };
+#ifdef SERIAL_2_PORT_NAME
+static struct serial_de serial_2_de = { NULL, 0, 0 };
+#endif // SERIAL_2_PORT_NAME
+#ifdef SERIAL_3_PORT_NAME
+static struct serial_de serial_3_de = { NULL, 0, 0 };
+#endif // SERIAL_3_PORT_NAME
 #ifdef SERIAL_4_PORT_NAME
-SERIAL_4_RXC_ISR
+static struct serial_de serial_4_de = { NULL, 0, 0 };
+#endif // SERIAL_4_PORT_NAME
+#ifdef SERIAL_5_PORT_NAME
+static struct serial_de serial_5_de = { NULL, 0, 0 };
+#endif // SERIAL_5_PORT_NAME
+#ifdef SERIAL_6_PORT_NAME
+static struct serial_de serial_6_de = { NULL, 0, 0 };
+#endif // SERIAL_6_PORT_NAME
+#ifdef SERIAL_7_PORT_NAME
+static struct serial_de serial_7_de = { NULL, 0, 0 };
+#endif // SERIAL_7_PORT_NAME
+
+// the TXC vectors come from 'pins_arduino.h', same as SERIAL_n_RXC_ISR and SERIAL_n_DRE_ISR.
+// The USART names are macros in the avr-libc headers, so they can't be pasted into one here
+#ifndef SERIAL_0_TXC_ISR
+#error SERIAL_0_TXC_ISR must be defined in 'pins_arduino.h' for SERIAL_RS485
+#endif // SERIAL_0_TXC_ISR
+#ifndef SERIAL_1_TXC_ISR
+#error SERIAL_1_TXC_ISR must be defined in 'pins_arduino.h' for SERIAL_RS485
+#endif // SERIAL_1_TXC_ISR
+#if defined(SERIAL_2_PORT_NAME) && !defined(SERIAL_2_TXC_ISR)
+#error SERIAL_2_TXC_ISR must be defined in 'pins_arduino.h' for SERIAL_RS485
+#endif // SERIAL_2_PORT_NAME, SERIAL_2_TXC_ISR
+#if defined(SERIAL_3_PORT_NAME) && !defined(SERIAL_3_TXC_ISR)
+#error SERIAL_3_TXC_ISR must be defined in 'pins_arduino.h' for SERIAL_RS485
+#endif // SERIAL_3_PORT_NAME, SERIAL_3_TXC_ISR
+#if defined(SERIAL_4_PORT_NAME) && !defined(SERIAL_4_TXC_ISR)
+#error SERIAL_4_TXC_ISR must be defined in 'pins_arduino.h' for SERIAL_RS485
+#endif // SERIAL_4_PORT_NAME, SERIAL_4_TXC_ISR
+#if defined(SERIAL_5_PORT_NAME) && !defined(SERIAL_5_TXC_ISR)
+#error SERIAL_5_TXC_ISR must be defined in 'pins_arduino.h' for SERIAL_RS485
+#endif // SERIAL_5_PORT_NAME, SERIAL_5_TXC_ISR
+#if defined(SERIAL_6_PORT_NAME) && !defined(SERIAL_6_TXC_ISR)
+#error SERIAL_6_TXC_ISR must be defined in 'pins_arduino.h' for SERIAL_RS485
+#endif // SERIAL_6_PORT_NAME, SERIAL_6_TXC_ISR
+#if defined(SERIAL_7_PORT_NAME) && !defined(SERIAL_7_TXC_ISR)
+#error SERIAL_7_TXC_ISR must be defined in 'pins_arduino.h' for SERIAL_RS485
+#endif // SERIAL_7_PORT_NAME, SERIAL_7_TXC_ISR
+#endif // SERIAL_RS485_ENABLED
+
+#define SERIAL_TXC_INT_LEVEL (_BV(USART_TXCINTLVL1_bp) | _BV(USART_TXCINTLVL0_bp)) /* same level as RXC and DRE */
+
+
+// ----------------------------------------------------------------------------------------
+//                     MULTI-PROCESSOR (9-BIT ADDRESS) COMMUNICATION
+//
+// With 9-bit frames (SERIAL_9N1 etc.) the 9th bit marks an 'address' frame.  After
+// 'setNodeAddress(addr)' the USART runs with MPCM set, and the hardware throws away every
+// data frame without an interrupt.  Only address frames get through.  When one matches 'addr'
+// (or the broadcast address) the RXC handler clears MPCM, and the data frames that follow are
+// stored normally.  An address frame for some other node sets MPCM again.  On a busy bus that
+// means one interrupt per packet for other nodes, rather than one per byte.
+//
+// To keep the 9th bit of each received frame, define SERIAL_n_RX_9BIT in 'pins_arduino.h'.
+// That adds a bit per RX buffer entry (like the time stamp gap bits), and 'read9()' returns
+// it as bit 8.  The matching address frame is only stored when the port keeps the 9th bit,
+// since otherwise there's no way to tell it apart from the data.
+//
+// 'writeAddress()' sends an address frame (the master side).  Data frames go out with the 9th
+// bit clear, via 'write()' as usual.
+// ----------------------------------------------------------------------------------------
+
+#define SERIAL_MPCM_ON    0x01 /* address filtering is on */
+#define SERIAL_MPCM_BCAST 0x02 /* 'bcast' is also accepted */
+
+// one of these for each serial port
+struct serial_mpcm
 {
-unsigned char c;
+  uint8_t flags;              // SERIAL_MPCM_ON, SERIAL_MPCM_BCAST
+  uint8_t addr;               // this node's address
+  uint8_t bcast;              // the broadcast address (when SERIAL_MPCM_BCAST is set)
+  uint8_t *pBit9;             // the 9th bit of each RX buffer entry, NULL unless SERIAL_n_RX_9BIT
+};
+
+#ifdef SERIAL_0_RX_9BIT
+static uint8_t rx_buffer_bit9[(SERIAL_0_RX_BUFFER_SIZE + 7) / 8];
+static struct serial_mpcm serial_0_mpcm = { 0, 0, 0, rx_buffer_bit9 };
+#else // !SERIAL_0_RX_9BIT
+static struct serial_mpcm serial_0_mpcm = { 0, 0, 0, NULL };
+#endif // SERIAL_0_RX_9BIT
+#ifdef SERIAL_1_RX_9BIT
+static uint8_t rx_buffer2_bit9[(SERIAL_1_RX_BUFFER_SIZE + 7) / 8];
+static struct serial_mpcm serial_1_mpcm = { 0, 0, 0, rx_buffer2_bit9 };
+#else // !SERIAL_1_RX_9BIT
+static struct serial_mpcm serial_1_mpcm = { 0, 0, 0, NULL };
+#endif // SERIAL_1_RX_9BIT
+#ifdef SERIAL_2_PORT_NAME
+#ifdef SERIAL_2_RX_9BIT
+static uint8_t rx_buffer3_bit9[(SERIAL_2_RX_BUFFER_SIZE + 7) / 8];
+static struct serial_mpcm serial_2_mpcm = { 0, 0, 0, rx_buffer3_bit9 };
+#else // !SERIAL_2_RX_9BIT
+static struct serial_mpcm serial_2_mpcm = { 0, 0, 0, NULL };
+#endif // SERIAL_2_RX_9BIT
+#endif // SERIAL_2_PORT_NAME
+#ifdef SERIAL_3_PORT_NAME
+#ifdef SERIAL_3_RX_9BIT
+static uint8_t rx_buffer4_bit9[(SERIAL_3_RX_BUFFER_SIZE + 7) / 8];
+static struct serial_mpcm serial_3_mpcm = { 0, 0, 0, rx_buffer4_bit9 };
+#else // !SERIAL_3_RX_9BIT
+static struct serial_mpcm serial_3_mpcm = { 0, 0, 0, NULL };
+#endif // SERIAL_3_RX_9BIT
+#endif // SERIAL_3_PORT_NAME
+#ifdef SERIAL_4_PORT_NAME
+#ifdef SERIAL_4_RX_9BIT
+static uint8_t rx_buffer5_bit9[(SERIAL_4_RX_BUFFER_SIZE + 7) / 8];
+static struct serial_mpcm serial_4_mpcm = { 0, 0, 0, rx_buffer5_bit9 };
+#else // !SERIAL_4_RX_9BIT
+static struct serial_mpcm serial_4_mpcm = { 0, 0, 0, NULL };
+#endif // SERIAL_4_RX_9BIT
+#endif // SERIAL_4_PORT_NAME
+#ifdef SERIAL_5_PORT_NAME
+#ifdef SERIAL_5_RX_9BIT
+static uint8_t rx_buffer6_bit9[(SERIAL_5_RX_BUFFER_SIZE + 7) / 8];
+static struct serial_mpcm serial_5_mpcm = { 0, 0, 0, rx_buffer6_bit9 };
+#else // !SERIAL_5_RX_9BIT
+static struct serial_mpcm serial_5_mpcm = { 0, 0, 0, NULL };
+#endif // SERIAL_5_RX_9BIT
+#endif // SERIAL_5_PORT_NAME
+#ifdef SERIAL_6_PORT_NAME
+#ifdef SERIAL_6_RX_9BIT
+static uint8_t rx_buffer7_bit9[(SERIAL_6_RX_BUFFER_SIZE + 7) / 8];
+static struct serial_mpcm serial_6_mpcm = { 0, 0, 0, rx_buffer7_bit9 };
+#else // !SERIAL_6_RX_9BIT
+static struct serial_mpcm serial_6_mpcm = { 0, 0, 0, NULL };
+#endif // SERIAL_6_RX_9BIT
+#endif // SERIAL_6_PORT_NAME
+#ifdef SERIAL_7_PORT_NAME
+#ifdef SERIAL_7_RX_9BIT
+static uint8_t rx_buffer8_bit9[(SERIAL_7_RX_BUFFER_SIZE + 7) / 8];
+static struct serial_mpcm serial_7_mpcm = { 0, 0, 0, rx_buffer8_bit9 };
+#else // !SERIAL_7_RX_9BIT
+static struct serial_mpcm serial_7_mpcm = { 0, 0, 0, NULL };
+#endif // SERIAL_7_RX_9BIT
+#endif // SERIAL_7_PORT_NAME
 
-  if((&(SERIAL_4_USART_NAME))->STATUS & _BV(USART_RXCIF_bp)) // if there is data available
+// RXC handler helper - 'status' is the STATUS register, read BEFORE 'DATA' (that's when RXB8 is
+// valid).  Returns true if the frame should be stored in the RX buffer.
+static inline bool serial_mpcm_rx(struct serial_mpcm *pM, volatile USART_t *pU, uint8_t c, uint8_t status)
+{
+  if(!(pM->flags & SERIAL_MPCM_ON) || // not filtering
+     !(status & USART_RXB8_bm))       // a data frame, which only gets here after an address match
   {
-    c = SERIAL_4_USART_DATA;
-    store_char(c, &rx_buffer4);
+    return true;
   }
-  else // I got an interrupt for some reason, just eat data from data reg
+
+  if(c == pM->addr ||
+     ((pM->flags & SERIAL_MPCM_BCAST) && c == pM->bcast))
   {
-    c = SERIAL_4_USART_DATA;
+    pU->CTRLB &= ~USART_MPCM_bm; // receive the data frames that follow
+
+    return pM->pBit9 != NULL; // store the address only if the 9th bit is kept
   }
+
+  pU->CTRLB |= USART_MPCM_bm; // some other node's packet, ignore the data frames
+
+  return false;
 }
-#endif // SERIAL_4_PORT_NAME
 
-#ifdef SERIAL_5_PORT_NAME
-SERIAL_5_RXC_ISR
+// save the 9th bit for the entry at 'iHead', BEFORE the head moves
+static inline void serial_store_bit9(struct serial_mpcm *pM, unsigned int iHead, uint8_t status)
 {
-unsigned char c;
-
-  if((&(SERIAL_5_USART_NAME))->STATUS & _BV(USART_RXCIF_bp)) // if there is data available
+  if(status & USART_RXB8_bm)
   {
-    c = SERIAL_5_USART_DATA;
-    store_char(c, &rx_buffer4);
+    pM->pBit9[iHead >> 3] |= (uint8_t)(1 << (iHead & 7));
   }
-  else // I got an interrupt for some reason, just eat data from data reg
+  else
   {
-    c = SERIAL_5_USART_DATA;
+    pM->pBit9[iHead >> 3] &= (uint8_t)~(1 << (iHead & 7));
   }
 }
-#endif // SERIAL_5_PORT_NAME
 
+
+// ----------------------------------------------------------------------------------------
+//                              STATISTICS AND HEALTH COUNTERS
+//
+// Per-port counters, so you can tell a noisy line (framing, parity errors) from a sketch
+// that reads too slowly (RX buffer overflows) or an ISR that's held off too long (hardware
+// overruns).  'HardwareSerial::getStats()' copies them into a 'serial_stats'.
+//
+// To keep the RXC ISR cheap, it only does the things that the sketch side can't:
+//
+//   a) the error bits - STATUS is already in a register, so this is a test and a branch that's
+//      almost never taken (~2 cycles)
+//   b) overflow counting, which is in the 'buffer full' branch of 'store_char()'
+//   c) the RX high-water mark, a subtract, mask and compare (~6-8 cycles)
+//
+// The byte counts are kept by the sketch side.  'write()' counts what it queues, and 'read()'
+// (and 'end()') count what leaves the RX buffer.  'getStats()' adds what's still waiting in the
+// buffer plus the overflows to get the RX total.  Frames that 'setNodeAddress()' filters out
+// are not counted.  The TX high-water mark is also checked by 'write()'.
+//
+// That's a few cycles per received byte in the ISR, and nothing added to the DRE ISR.
+//
+// Define SERIAL_NO_STATS in 'pins_arduino.h' (or on the command line) to leave all of this out.
+// ----------------------------------------------------------------------------------------
+
+#ifndef SERIAL_NO_STATS
+#define SERIAL_STATS_ENABLED
+
+struct serial_counters
+{
+  unsigned long rx_read;     // bytes taken out of the RX buffer by 'read()' (or thrown away by 'end()')
+  unsigned long tx_bytes;    // bytes queued by 'write()'
+  unsigned int rx_overflow;  // received bytes dropped, RX buffer full
+  unsigned int rx_overrun;   // USART BUFOVF
+  unsigned int rx_framing;   // USART FERR
+  unsigned int rx_parity;    // USART PERR
+  ring_index_t rx_high;      // RX high-water mark (the ISR updates this)
+  ring_index_t tx_high;      // TX high-water mark ('write()' updates this)
+};
+
+static struct serial_counters serial_0_counters;
+static struct serial_counters serial_1_counters;
+#ifdef SERIAL_2_PORT_NAME
+static struct serial_counters serial_2_counters;
+#endif // SERIAL_2_PORT_NAME
+#ifdef SERIAL_3_PORT_NAME
+static struct serial_counters serial_3_counters;
+#endif // SERIAL_3_PORT_NAME
+#ifdef SERIAL_4_PORT_NAME
+static struct serial_counters serial_4_counters;
+#endif // SERIAL_4_PORT_NAME
+#ifdef SERIAL_5_PORT_NAME
+static struct serial_counters serial_5_counters;
+#endif // SERIAL_5_PORT_NAME
 #ifdef SERIAL_6_PORT_NAME
-SERIAL_6_RXC_ISR
+static struct serial_counters serial_6_counters;
+#endif // SERIAL_6_PORT_NAME
+#ifdef SERIAL_7_PORT_NAME
+static struct serial_counters serial_7_counters;
+#endif // SERIAL_7_PORT_NAME
+
+// RXC handler helper, the rare path.  'status' is the STATUS register that was read before 'DATA'
+static void serial_count_errors(struct serial_counters *pC, uint8_t status)
 {
-unsigned char c;
+  if(status & USART_FERR_bm)
+  {
+    pC->rx_framing++;
+  }
 
-  if((&(SERIAL_6_USART_NAME))->STATUS & _BV(USART_RXCIF_bp)) // if there is data available
+  if(status & USART_BUFOVF_bm)
   {
-    c = SERIAL_6_USART_DATA;
-    store_char(c, &rx_buffer4);
+    pC->rx_overrun++;
   }
-  else // I got an interrupt for some reason, just eat data from data reg
+
+  if(status & USART_PERR_bm)
   {
-    c = SERIAL_6_USART_DATA;
+    pC->rx_parity++;
   }
 }
-#endif // SERIAL_6_PORT_NAME
 
-#ifdef SERIAL_7_PORT_NAME
-SERIAL_7_RXC_ISR
+// high-water mark update, after the head moves.  The RXC ISR calls this for RX, and 'write()' for TX
+static inline void serial_high_water(ring_index_t *pHigh, ring_buffer *pB)
 {
-unsigned char c;
+register ring_index_t iUsed = (ring_index_t)((pB->head - pB->tail) & pB->mask);
 
-  if((&(SERIAL_7_USART_NAME))->STATUS & _BV(USART_RXCIF_bp)) // if there is data available
-  {
-    c = SERIAL_7_USART_DATA;
-    store_char(c, &rx_buffer4);
-  }
-  else // I got an interrupt for some reason, just eat data from data reg
+  if(iUsed > *pHigh)
   {
-    c = SERIAL_7_USART_DATA;
+    *pHigh = iUsed;
   }
 }
-#endif // SERIAL_7_PORT_NAME
+#endif // SERIAL_NO_STATS
 
 
-SERIAL_0_DRE_ISR // ISR(USARTD0_DRE_vect)
+// ----------------------------------------------------------------------------------------
+//                             AUTOMATIC BAUD RATE DETECTION
+//
+// 'HardwareSerial::beginAutoBaud()' times a sync character from the other end, 'U' (0x55),
+// and then calls 'begin()' with the baud rate it measured.  0x55 is alternating bits, so the
+// RX pin has a rising edge every 2 bit times.  The sender just keeps sending 'U' until it gets
+// an answer (same idea as the LIN 'sync field').  This works for 7 or 8 data bits, with or
+// without parity, since the first 3 'rising to rising' periods are always 2 bits each.
+//
+// The RX pin is routed through the event system to a free-running 16-bit timer in 'input
+// capture' mode.  Each rising edge captures the count, so the hardware does the timing and the
+// code only has to read CCA before the next edge (CCA is 2 deep).  The difference between 2
+// captures is one period.  The first edge only starts things off, then 3 periods in a row that
+// agree within 1/8 are 6 bit times.  The baud rate is 6 * F_CPU / total.
+//
+// The result is rounded to a standard rate if it's within 2.5% of one, otherwise it's used
+// as-is.  Either way it goes through 'begin()' and 'serial_baud_setting()' for BSEL and BSCALE.
+//
+// By default this uses CYCLES_TIMER, if there is one, or else TCC1, and event channel 3.  The
+// timer is never stopped or re-loaded if it's already running, so 'cycles()' keeps working.
+// If it wasn't running, it's turned off again when it's done.  To use something else, in
+// 'pins_arduino.h':
+//
+//   #define SERIAL_AUTOBAUD_TIMER TCD1        /* any 16-bit TCxn timer */
+//   #define SERIAL_AUTOBAUD_EVENT_CHANNEL 7   /* 0-7 ('D' series 0-3) */
+//
+// Range is from ~2 * F_CPU / 65536 (2 bit times have to fit in 16 bits, ~980 baud at 32Mhz) up
+// to ~2Mbit, where 2 bit times are 32 clocks and the polling loop takes ~15-20.  Above ~1Mbit
+// the capture error is over 1%, but rounding to the standard rate takes care of that.
+// ----------------------------------------------------------------------------------------
+
+#if !defined(SERIAL_AUTOBAUD_TIMER) && defined(CYCLES_TIMER)
+#define SERIAL_AUTOBAUD_TIMER CYCLES_TIMER /* shared, see above */
+#elif !defined(SERIAL_AUTOBAUD_TIMER) && defined(TCC1)
+#define SERIAL_AUTOBAUD_TIMER TCC1 /* 'E' series has TCC4/TCC5 instead, with different registers */
+#endif // SERIAL_AUTOBAUD_TIMER, CYCLES_TIMER, TCC1
+
+#ifndef SERIAL_AUTOBAUD_EVENT_CHANNEL
+#define SERIAL_AUTOBAUD_EVENT_CHANNEL 3
+#endif // SERIAL_AUTOBAUD_EVENT_CHANNEL
+
+#ifdef SERIAL_AUTOBAUD_TIMER
+#define SERIAL_AUTOBAUD_ENABLED
+
+#define SERIAL_AUTOBAUD_PERIODS 3 /* 2 bit times each */
+
+static const unsigned long serial_standard_baud[] PROGMEM =
 {
-#ifdef SERIAL_0_CTS_ENABLED
-uint8_t oldSREG;
-char bCTS = SERIAL_0_CTS_PORT->IN & SERIAL_0_CTS_PIN;
-#endif // SERIAL_0_CTS_ENABLED
+  1200, 2400, 4800, 9600, 14400, 19200, 28800, 38400, 57600, 76800, 115200,
+  230400, 250000, 460800, 500000, 921600, 1000000, 1500000, 2000000
+};
 
+// returns the timer count for (2 * SERIAL_AUTOBAUD_PERIODS) bit times, or 0 on timeout
+static unsigned long serial_autobaud_measure(PORT_t *pPort, uint8_t bitRX, unsigned long timeout)
+{
+TC1_t *pT = (TC1_t *)&(SERIAL_AUTOBAUD_TIMER); // TC0_t starts with the same registers
+register8_t *pMUX = &(EVSYS.CH0MUX) + SERIAL_AUTOBAUD_EVENT_CHANNEL;
+register8_t *pEVCTRL = &(EVSYS.CH0CTRL) + SERIAL_AUTOBAUD_EVENT_CHANNEL;
+uint8_t oldMUX = *pMUX, oldEVCTRL = *pEVCTRL;
+unsigned long tStart, lTotal = 0, lNow = 0, lEdge, lLastEdge = 0, lPeriod;
+uint16_t wCap = 0, wNow, wThen, wFirst = 0;
+uint8_t bFlags, nCap, oldSREG;
+bool bFirst = true, bOwn;
 
-  if (
-#ifdef SERIAL_0_CTS_ENABLED
-      bCTS ||
-#endif // SERIAL_0_CTS_ENABLED
-      tx_buffer.head == tx_buffer.tail)
-  {
-#ifdef SERIAL_0_CTS_ENABLED
-    if(bCTS)
-    {
-      oldSREG = SREG; // store the interrupt flag basically
 
-      cli(); // disable interrupts for a bit (in case they were enabled)
+  pPort->DIRCLR = _BV(bitRX);
+  (&(pPort->PIN0CTRL))[bitRX] = PORT_ISC_RISING_gc; // events on the rising edge ('begin()' puts it back)
 
-//      bWasCTS0 = 1; // to mark that I set the interrupt
+  // PORTA_PIN0 through PORTF_PIN7 are in order, 8 per port, and so are the PORT_t's
+  *pMUX = EVSYS_CHMUX_PORTA_PIN0_gc
+        + (uint8_t)((((uint16_t)pPort - (uint16_t)&PORTA) / sizeof(PORT_t)) << 3)
+        + bitRX;
+  *pEVCTRL = 0; // no digital filter
 
-      SERIAL_0_CTS_PORT->INT1MASK |= SERIAL_0_CTS_PIN;
-      // TODO:  'E' series doesn't have 'INT1'
-      SERIAL_0_CTS_PORT->INTCTRL |= PORT_INT1LVL_gm; // max priority when I do this
+  oldSREG = SREG;
+  cli(); // 16-bit registers go through TEMP, and 'cycles()' may read this timer from an ISR
 
-      SREG = oldSREG; // restore
-    }
-#endif // SERIAL_0_CTS_ENABLED
+  bOwn = !(pT->CTRLA & TC1_CLKSEL_gm); // when it's running, it's CYCLES_TIMER (DIV1, PER 0xffff)
 
-    // Buffer empty, so disable interrupts
-    // section 19.14.3 - the CTRLA register (interrupt stuff)
-    (&(SERIAL_0_USART_NAME))->CTRLA /*USARTD0_CTRLA*/
-      = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp); // only set these 2 (the DRE int is now OFF)
-  }
-  else
+  if(bOwn)
   {
-    // There is more data in the output buffer. Send the next byte
-    register unsigned char c = tx_buffer.buffer[tx_buffer.tail];
-    tx_buffer.tail = (tx_buffer.tail + 1) % SERIAL_BUFFER_SIZE;
+    pT->INTCTRLA = 0; // polled, no interrupts
+    pT->INTCTRLB = 0;
+    pT->CTRLB = TC_WGMODE_NORMAL_gc;
+    pT->PER = 0xffff;
+    pT->CNT = 0;
+    pT->CTRLA = TC_CLKSEL_DIV1_gc;
+  }
 
-    SERIAL_0_USART_DATA = c; //USARTD0_DATA = c;
+  // plain input capture, so the count keeps going (it's still good for 'cycles()')
+  pT->CTRLB |= TC1_CCAEN_bm;
+  pT->CTRLD = TC_EVACT_CAPT_gc | (TC_EVSEL_CH0_gc + SERIAL_AUTOBAUD_EVENT_CHANNEL);
+
+  while(pT->INTFLAGS & TC1_CCAIF_bm) // CCA is 2 deep
+  {
+    (void)pT->CCA;
   }
-}
 
-SERIAL_1_DRE_ISR // ISR(USARTC0_DRE_vect)
-{
-#ifdef SERIAL_1_CTS_ENABLED
-uint8_t oldSREG;
-char bCTS = SERIAL_1_CTS_PORT->IN & SERIAL_1_CTS_PIN;
-#endif // SERIAL_1_CTS_ENABLED
+  wThen = pT->CNT;
 
+  SREG = oldSREG;
 
-  if (
-#ifdef SERIAL_1_CTS_ENABLED
-      bCTS ||
-#endif // SERIAL_1_CTS_ENABLED
-      tx_buffer2.head == tx_buffer2.tail)
-  
+  nCap = 0;
+  tStart = millis();
+
+  for(;;)
   {
-#ifdef SERIAL_1_CTS_ENABLED
-    if(bCTS)
+    oldSREG = SREG;
+    cli();
+
+    bFlags = pT->INTFLAGS;
+    wNow = pT->CNT; // AFTER the flags, so a capture is never newer than this
+
+    if(bFlags & TC1_CCAIF_bm)
     {
-      oldSREG = SREG; // store the interrupt flag basically
+      wCap = pT->CCA; // this clears CCAIF (unless there's another one)
+    }
 
-      cli(); // disable interrupts for a bit
+    SREG = oldSREG;
 
-//      bWasCTS1 = 1; // to mark that I set the interrupt
+    // clocks since the start, extended to 32 bits.  Each pass is a lot shorter than 65536
+    // clocks, unless some ISR holds things up for more than 2 msec
 
-      SERIAL_1_CTS_PORT->INT1MASK |= SERIAL_1_CTS_PIN;
-      // TODO:  'E' series doesn't have 'INT1'
-      SERIAL_1_CTS_PORT->INTCTRL |= PORT_INT1LVL_gm; // max priority when I do this
+    lNow += (uint16_t)(wNow - wThen);
+    wThen = wNow;
 
-      SREG = oldSREG; // restore
+    if(!(bFlags & TC1_CCAIF_bm))
+    {
+      if(millis() - tStart >= timeout) // only when there's no capture waiting
+      {
+        lTotal = 0;
+        break;
+      }
+
+      continue;
     }
-#endif // SERIAL_1_CTS_ENABLED
 
-    // Buffer empty, so disable interrupts
-    // section 19.14.3 - the CTRLA register (interrupt stuff)
-    (&(SERIAL_1_USART_NAME))->CTRLA /*USARTC0_CTRLA*/
-      = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp); // only set these 2 (the DRE int is now OFF)
-  }
-  else
-  {
-    // There is more data in the output buffer. Send the next byte
-    register unsigned char c = tx_buffer2.buffer[tx_buffer2.tail];
-    tx_buffer2.tail = (tx_buffer2.tail + 1) % SERIAL_BUFFER_SIZE;
+    lEdge = lNow - (uint16_t)(wNow - wCap); // when the edge was
+    lPeriod = lEdge - lLastEdge;
+    lLastEdge = lEdge;
 
-    SERIAL_1_USART_DATA = c; //USARTC0_DATA = c;
-  }
-}
+    if(bFirst) // nothing to measure from yet
+    {
+      bFirst = false;
+      continue;
+    }
 
-#ifdef SERIAL_2_PORT_NAME
-SERIAL_2_DRE_ISR // ISR(USARTE0_DRE_vect)
-{
-  if (tx_buffer3.head == tx_buffer3.tail)
-  {
-    // Buffer empty, so disable interrupts
-    // section 19.14.3 - the CTRLA register (interrupt stuff)
-    (&(SERIAL_2_USART_NAME))->CTRLA /*USARTE0_CTRLA*/
-      = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp); // only set these 2 (the DRE int is now OFF)
-  }
-  else
-  {
-    // There is more data in the output buffer. Send the next byte
-    register unsigned char c = tx_buffer3.buffer[tx_buffer3.tail];
-    tx_buffer3.tail = (tx_buffer3.tail + 1) % SERIAL_BUFFER_SIZE;
+    if(lPeriod > 0xffffUL)
+    {
+      // an idle line or a slow baud rate.  Start over
+      nCap = 0;
 
-    SERIAL_2_USART_DATA = c; //USARTE0_DATA = c;
-  }
-}
-#endif // SERIAL_2_PORT_NAME
+      continue;
+    }
 
-#ifdef SERIAL_3_PORT_NAME
-SERIAL_3_DRE_ISR // ISR(USARTF0_DRE_vect)
-{
-  if (tx_buffer4.head == tx_buffer4.tail)
-  {
-    // Buffer empty, so disable interrupts
-    // section 19.14.3 - the CTRLA register (interrupt stuff)
-    (&(SERIAL_3_USART_NAME))->CTRLA /*USARTF0_CTRLA*/
-      = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp); // only set these 2 (the DRE int is now OFF)
-  }
-  else
-  {
-    // There is more data in the output buffer. Send the next byte
-    register unsigned char c = tx_buffer4.buffer[tx_buffer4.tail];
-    tx_buffer4.tail = (tx_buffer4.tail + 1) % SERIAL_BUFFER_SIZE;
+    wCap = (uint16_t)lPeriod;
+
+    if(!nCap || wCap < wFirst - (wFirst >> 3) || wCap > wFirst + (wFirst >> 3))
+    {
+      wFirst = wCap; // first one, or it doesn't match - start over with this one
+      lTotal = wCap;
+      nCap = 1;
+    }
+    else
+    {
+      lTotal += wCap;
 
-    SERIAL_3_USART_DATA = c; //USARTE0_DATA = c;
+      if(++nCap >= SERIAL_AUTOBAUD_PERIODS)
+      {
+        break;
+      }
+    }
   }
-}
-#endif // SERIAL_3_PORT_NAME
 
-#ifdef SERIAL_4_PORT_NAME
-SERIAL_4_DRE_ISR
-{
-  if (tx_buffer4.head == tx_buffer4.tail)
+  oldSREG = SREG;
+  cli();
+
+  pT->CTRLD = 0; // put everything back the way it was
+  pT->CTRLB &= ~TC1_CCAEN_bm;
+
+  if(bOwn)
   {
-    // Buffer empty, so disable interrupts
-    // section 19.14.3 - the CTRLA register (interrupt stuff)
-    (&(SERIAL_4_USART_NAME))->CTRLA
-      = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp); // only set these 2 (the DRE int is now OFF)
+    pT->CTRLA = TC_CLKSEL_OFF_gc;
+    pT->CTRLB = 0;
+    pT->INTFLAGS = 0xff;
   }
   else
   {
-    // There is more data in the output buffer. Send the next byte
-    register unsigned char c = tx_buffer4.buffer[tx_buffer4.tail];
-    tx_buffer4.tail = (tx_buffer4.tail + 1) % SERIAL_BUFFER_SIZE;
-
-    SERIAL_4_USART_DATA = c;
+    pT->INTFLAGS = TC1_CCAIF_bm; // NOT the overflow flag, that belongs to 'cycles()'
   }
+
+  SREG = oldSREG;
+
+  *pMUX = oldMUX;
+  *pEVCTRL = oldEVCTRL;
+
+  return lTotal;
 }
-#endif // SERIAL_4_PORT_NAME
 
-#ifdef SERIAL_5_PORT_NAME
-SERIAL_5_DRE_ISR
+// the closest standard rate if it's within 2.5%, otherwise 'lBaud'
+static unsigned long serial_autobaud_round(unsigned long lBaud)
 {
-  if (tx_buffer4.head == tx_buffer4.tail)
-  {
-    // Buffer empty, so disable interrupts
-    // section 19.14.3 - the CTRLA register (interrupt stuff)
-    (&(SERIAL_5_USART_NAME))->CTRLA
-      = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp); // only set these 2 (the DRE int is now OFF)
-  }
-  else
+uint8_t i1;
+unsigned long lStd;
+
+
+  for(i1=0; i1 < sizeof(serial_standard_baud) / sizeof(serial_standard_baud[0]); i1++)
   {
-    // There is more data in the output buffer. Send the next byte
-    register unsigned char c = tx_buffer4.buffer[tx_buffer4.tail];
-    tx_buffer4.tail = (tx_buffer4.tail + 1) % SERIAL_BUFFER_SIZE;
+    lStd = pgm_read_dword(&(serial_standard_baud[i1]));
 
-    SERIAL_5_USART_DATA = c;
+    if(lBaud + lStd / 40 >= lStd && lBaud <= lStd + lStd / 40)
+    {
+      return lStd;
+    }
   }
+
+  return lBaud;
 }
-#endif // SERIAL_5_PORT_NAME
+#endif // SERIAL_AUTOBAUD_TIMER
 
-#ifdef SERIAL_6_PORT_NAME
-SERIAL_6_DRE_ISR
+
+
+//////////////////////////////////////////////////////////////////////////////////////////
+//                                                                                      //
+//   _         _  _                 __                      _    _                      //
+//  (_) _ __  | |(_) _ __    ___   / _| _   _  _ __    ___ | |_ (_)  ___   _ __   ___   //
+//  | || '_ \ | || || '_ \  / _ \ | |_ | | | || '_ \  / __|| __|| | / _ \ | '_ \ / __|  //
+//  | || | | || || || | | ||  __/ |  _|| |_| || | | || (__ | |_ | || (_) || | | |\__ \  //
+//  |_||_| |_||_||_||_| |_| \___| |_|   \__,_||_| |_| \___| \__||_| \___/ |_| |_||___/  //
+//                                                                                      //
+//                                                                                      //
+//////////////////////////////////////////////////////////////////////////////////////////
+
+// returns false if the buffer is full and 'c' was dropped
+inline bool store_char(unsigned char c, ring_buffer *buffer)
 {
-  if (tx_buffer4.head == tx_buffer4.tail)
-  {
-    // Buffer empty, so disable interrupts
-    // section 19.14.3 - the CTRLA register (interrupt stuff)
-    (&(SERIAL_6_USART_NAME))->CTRLA
-      = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp); // only set these 2 (the DRE int is now OFF)
-  }
-  else
+  unsigned int i = (unsigned int)(buffer->head + 1) & buffer->mask;
+
+  // if we should be storing the received character into the location
+  // just before the tail (meaning that the head would advance to the
+  // current location of the tail), we're about to overflow the buffer
+  // and so we don't write the character or advance the head.
+  if (i != buffer->tail)
   {
-    // There is more data in the output buffer. Send the next byte
-    register unsigned char c = tx_buffer4.buffer[tx_buffer4.tail];
-    tx_buffer4.tail = (tx_buffer4.tail + 1) % SERIAL_BUFFER_SIZE;
+    buffer->buffer[buffer->head] = c;
+    SERIAL_RING_BARRIER(); // data first, then the head (see 'ring_load')
+    buffer->head = i;
 
-    SERIAL_6_USART_DATA = c;
+    return true;
   }
+
+  return false;
 }
-#endif // SERIAL_6_PORT_NAME
 
-#ifdef SERIAL_7_PORT_NAME
-SERIAL_7_DRE_ISR
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                                                                          //
+//   ___         _                                   _     _   _                    _  _                    //
+//  |_ _| _ __  | |_  ___  _ __  _ __  _   _  _ __  | |_  | | | |  __ _  _ __    __| || |  ___  _ __  ___   //
+//   | | | '_ \ | __|/ _ \| '__|| '__|| | | || '_ \ | __| | |_| | / _` || '_ \  / _` || | / _ \| '__|/ __|  //
+//   | | | | | || |_|  __/| |   | |   | |_| || |_) || |_  |  _  || (_| || | | || (_| || ||  __/| |   \__ \  //
+//  |___||_| |_| \__|\___||_|   |_|    \__,_|| .__/  \__| |_| |_| \__,_||_| |_| \__,_||_| \___||_|   |___/  //
+//                                           |_|                                                            //
+//                                                                                                          //
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// DMA transmit state and 'transfer complete' ISRs for ports that use DMA (see above)
+
+#ifdef SERIAL_0_TX_DMA_CHANNEL
+static struct serial_tx_dma serial_0_tx_dma = { SERIAL_DMA_CH(SERIAL_0_TX_DMA_CHANNEL), &(SERIAL_0_USART_NAME), &tx_buffer, 0 };
+
+ISR(SERIAL_DMA_VECT(SERIAL_0_TX_DMA_CHANNEL))
 {
-  if (tx_buffer4.head == tx_buffer4.tail)
-  {
-    // Buffer empty, so disable interrupts
-    // section 19.14.3 - the CTRLA register (interrupt stuff)
-    (&(SERIAL_7_USART_NAME))->CTRLA
-      = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp); // only set these 2 (the DRE int is now OFF)
-  }
-  else
-  {
-    // There is more data in the output buffer. Send the next byte
-    register unsigned char c = tx_buffer4.buffer[tx_buffer4.tail];
-    tx_buffer4.tail = (tx_buffer4.tail + 1) % SERIAL_BUFFER_SIZE;
+  serial_tx_dma_complete(&serial_0_tx_dma);
+}
+#endif // SERIAL_0_TX_DMA_CHANNEL
 
-    SERIAL_7_USART_DATA = c;
-  }
+#ifdef SERIAL_1_TX_DMA_CHANNEL
+static struct serial_tx_dma serial_1_tx_dma = { SERIAL_DMA_CH(SERIAL_1_TX_DMA_CHANNEL), &(SERIAL_1_USART_NAME), &tx_buffer2, 0 };
+
+ISR(SERIAL_DMA_VECT(SERIAL_1_TX_DMA_CHANNEL))
+{
+  serial_tx_dma_complete(&serial_1_tx_dma);
 }
-#endif // SERIAL_7_PORT_NAME
+#endif // SERIAL_1_TX_DMA_CHANNEL
 
+#ifdef SERIAL_2_PORT_NAME
+#ifdef SERIAL_2_TX_DMA_CHANNEL
+static struct serial_tx_dma serial_2_tx_dma = { SERIAL_DMA_CH(SERIAL_2_TX_DMA_CHANNEL), &(SERIAL_2_USART_NAME), &tx_buffer3, 0 };
 
-// this helper function calls the ISR directly whenever the status reg has the appropriate bit set, then clears the bit
-// call this function when you're waiting for I/O, whenever interrupts are disabled.
-void call_isr(volatile USART_t *pPort)
+ISR(SERIAL_DMA_VECT(SERIAL_2_TX_DMA_CHANNEL))
 {
-  if(pPort->STATUS & _BV(USART_RXCIF_bp))
-  {
-    if(0)
-    {
-      // so I can use 'else if' for everything else
-    }
-#ifdef USARTD0_VECTOR_EXISTS
-    else if(pPort == &(USARTD0))
-    {
-      USARTD0_RXC_vect();
-    }
-#endif // USARTD0_VECTOR_EXISTS
-#ifdef USARTD1_VECTOR_EXISTS
-    else if(pPort == &USARTD1)
-    {
-      USARTD1_RXC_vect();
-    }
-#endif // USARTD1_VECTOR_EXISTS
-#ifdef USARTC0_VECTOR_EXISTS
-    else if(pPort == &USARTC0)
-    {
-      USARTC0_RXC_vect();
-    }
-#endif // USARTC0_VECTOR_EXISTS
-#ifdef USARTC1_VECTOR_EXISTS
-    else if(pPort == &USARTC1)
-    {
-      USARTC1_RXC_vect();
-    }
-#endif // USARTC1_VECTOR_EXISTS
-#ifdef USARTE0_VECTOR_EXISTS
-    else if(pPort == &USARTE0)
-    {
-      USARTE0_RXC_vect();
-    }
-#endif // USARTE0_VECTOR_EXISTS
-#ifdef USARTE1_VECTOR_EXISTS
-    else if(pPort == &USARTE1)
-    {
-      USARTE1_RXC_vect();
-    }
-#endif // USARTE1_VECTOR_EXISTS
-#ifdef USARTF0_VECTOR_EXISTS
-    else if(pPort == &USARTF0)
-    {
-      USARTF0_RXC_vect();
-    }
-#endif // USARTF0_VECTOR_EXISTS
-#ifdef USARTF1_VECTOR_EXISTS
-    else if(pPort == &USARTF1)
-    {
-      USARTF1_RXC_vect();
-    }
-#endif // USARTF1_VECTOR_EXISTS
+  serial_tx_dma_complete(&serial_2_tx_dma);
+}
+#endif // SERIAL_2_TX_DMA_CHANNEL
+#endif // SERIAL_2_PORT_NAME
 
-    pPort->STATUS = _BV(USART_RXCIF_bp); // clear THIS one.  other bits must be written as zero
-  }
+#ifdef SERIAL_3_PORT_NAME
+#ifdef SERIAL_3_TX_DMA_CHANNEL
+static struct serial_tx_dma serial_3_tx_dma = { SERIAL_DMA_CH(SERIAL_3_TX_DMA_CHANNEL), &(SERIAL_3_USART_NAME), &tx_buffer4, 0 };
 
-  if(pPort->STATUS & _BV(USART_DREIF_bp))
-  {
-    if(0)
-    {
-      // so I can use 'else if' below
-    }
-#ifdef USARTD0_VECTOR_EXISTS
-    else if(pPort == &USARTD0)
-    {
-      USARTD0_DRE_vect();
-    }
-#endif // USARTD0_VECTOR_EXISTS
-#ifdef USARTD1_VECTOR_EXISTS
-    else if(pPort == &USARTD1)
-    {
-      USARTD1_DRE_vect();
-    }
-#endif // USARTD1_VECTOR_EXISTS
-#ifdef USARTC0_VECTOR_EXISTS
-    else if(pPort == &USARTC0)
-    {
-      USARTC0_DRE_vect();
-    }
-#endif // USARTC0_VECTOR_EXISTS
-#ifdef USARTC1_VECTOR_EXISTS
-    else if(pPort == &USARTC1)
-    {
-      USARTC1_DRE_vect();
-    }
-#endif // USARTC1_VECTOR_EXISTS
-#ifdef USARTE0_VECTOR_EXISTS
-    else if(pPort == &USARTE0)
-    {
-      USARTE0_DRE_vect();
-    }
-#endif // USARTE0_VECTOR_EXISTS
-#ifdef USARTE1_VECTOR_EXISTS
-    else if(pPort == &USARTE1)
-    {
-      USARTE1_DRE_vect();
-    }
-#endif // USARTE1_VECTOR_EXISTS
-#ifdef USARTF0_VECTOR_EXISTS
-    else if(pPort == &USARTF0)
-    {
-      USARTF0_DRE_vect();
-    }
-#endif // USARTF0_VECTOR_EXISTS
-#ifdef USARTF1_VECTOR_EXISTS
-    else if(pPort == &USARTF1)
-    {
-      USARTF1_DRE_vect();
-    }
-#endif // USARTF1_VECTOR_EXISTS
+ISR(SERIAL_DMA_VECT(SERIAL_3_TX_DMA_CHANNEL))
+{
+  serial_tx_dma_complete(&serial_3_tx_dma);
+}
+#endif // SERIAL_3_TX_DMA_CHANNEL
+#endif // SERIAL_3_PORT_NAME
 
-    pPort->STATUS = _BV(USART_DREIF_bp); // clear THIS one.  other bits must be written as zero
-  }
+#ifdef SERIAL_4_PORT_NAME
+#ifdef SERIAL_4_TX_DMA_CHANNEL
+static struct serial_tx_dma serial_4_tx_dma = { SERIAL_DMA_CH(SERIAL_4_TX_DMA_CHANNEL), &(SERIAL_4_USART_NAME), &tx_buffer5, 0 };
+
+ISR(SERIAL_DMA_VECT(SERIAL_4_TX_DMA_CHANNEL))
+{
+  serial_tx_dma_complete(&serial_4_tx_dma);
 }
+#endif // SERIAL_4_TX_DMA_CHANNEL
+#endif // SERIAL_4_PORT_NAME
 
+#ifdef SERIAL_5_PORT_NAME
+#ifdef SERIAL_5_TX_DMA_CHANNEL
+static struct serial_tx_dma serial_5_tx_dma = { SERIAL_DMA_CH(SERIAL_5_TX_DMA_CHANNEL), &(SERIAL_5_USART_NAME), &tx_buffer6, 0 };
 
-//////////////////////////////////////////////////////////////////////////////
-//                                                                          //
-//    ____               _         _   _____                     _          //
-//   / ___|   ___  _ __ (_)  __ _ | | | ____|__   __ ___  _ __  | |_  ___   //
-//   \___ \  / _ \| '__|| | / _` || | |  _|  \ \ / // _ \| '_ \ | __|/ __|  //
-//    ___) ||  __/| |   | || (_| || | | |___  \ V /|  __/| | | || |_ \__ \  //
-//   |____/  \___||_|   |_| \__,_||_| |_____|  \_/  \___||_| |_| \__||___/  //
-//                                                                          //
-//                                                                          //
-//////////////////////////////////////////////////////////////////////////////
+ISR(SERIAL_DMA_VECT(SERIAL_5_TX_DMA_CHANNEL))
+{
+  serial_tx_dma_complete(&serial_5_tx_dma);
+}
+#endif // SERIAL_5_TX_DMA_CHANNEL
+#endif // SERIAL_5_PORT_NAME
 
-void serialEvent() __attribute__((weak));
-void serialEvent() {}
-#define serialEvent_implemented
+#ifdef SERIAL_6_PORT_NAME
+#ifdef SERIAL_6_TX_DMA_CHANNEL
+static struct serial_tx_dma serial_6_tx_dma = { SERIAL_DMA_CH(SERIAL_6_TX_DMA_CHANNEL), &(SERIAL_6_USART_NAME), &tx_buffer7, 0 };
 
-void serialEvent2() __attribute__((weak));
-void serialEvent2() {}
-#define serialEvent2_implemented
+ISR(SERIAL_DMA_VECT(SERIAL_6_TX_DMA_CHANNEL))
+{
+  serial_tx_dma_complete(&serial_6_tx_dma);
+}
+#endif // SERIAL_6_TX_DMA_CHANNEL
+#endif // SERIAL_6_PORT_NAME
+
+#ifdef SERIAL_7_PORT_NAME
+#ifdef SERIAL_7_TX_DMA_CHANNEL
+static struct serial_tx_dma serial_7_tx_dma = { SERIAL_DMA_CH(SERIAL_7_TX_DMA_CHANNEL), &(SERIAL_7_USART_NAME), &tx_buffer8, 0 };
+
+ISR(SERIAL_DMA_VECT(SERIAL_7_TX_DMA_CHANNEL))
+{
+  serial_tx_dma_complete(&serial_7_tx_dma);
+}
+#endif // SERIAL_7_TX_DMA_CHANNEL
+#endif // SERIAL_7_PORT_NAME
+
+
+// ----------------------------------------------------------------------------------------
+//                     PER-PORT DESCRIPTORS AND SHARED ISR BODIES
+//
+// Each serial port has a small descriptor with everything the interrupt handlers need:  the
+// USART, the ring buffers, the RTS and CTS pins (when flow control is enabled), the DMA
+// state (when DMA transmit is enabled), and so on.  There's one RXC and one DRE handler body that works
+// from the descriptor.  Each port's ISR just calls it.  So does 'call_isr()', which no longer
+// needs to call the ISR vectors directly (that also did a 'RETI', which enables interrupts).
+//
+// SERIAL_SHARED_ISR selects how the handler bodies are built.  You can define it in
+// 'pins_arduino.h' or on the command line to override the default:
+//
+//   0 - the body is inlined into each ISR.  The descriptor is a constant, so the compiler
+//       folds it away and the code is essentially what the old per-port copies were.
+//       This is the default.
+//   1 - one copy of each body, called by every ISR.  Smaller with a lot of ports, but every
+//       byte costs more cycles (see below), so it's only worth it if you're short of flash.
+//
+// With 1, each ISR still has to save all of the call-used registers since it calls a function,
+// so it saves less flash than you'd think (a few hundred bytes with 8 ports) and every byte
+// takes longer.  To see what it does for your sketch, build it with each setting and compare
+// 'avr-size' and 'avr-nm --size-sort -C' output for the '__vector_N' symbols.
+// ----------------------------------------------------------------------------------------
+
+#ifndef SERIAL_SHARED_ISR
+#define SERIAL_SHARED_ISR 0 /* inline copies in each ISR (faster) */
+#endif // SERIAL_SHARED_ISR
+
+#if SERIAL_SHARED_ISR
+#define SERIAL_ISR_BODY static void __attribute__((noinline))
+#else // !SERIAL_SHARED_ISR
+#define SERIAL_ISR_BODY static inline void __attribute__((always_inline))
+#endif // SERIAL_SHARED_ISR
+
+// NOTE:  SERIAL_RTS_ENABLED and SERIAL_CTS_ENABLED are defined in 'Arduino.h' (any port uses RTS, CTS)
+
+struct serial_port
+{
+  volatile USART_t *pUSART;
+  ring_buffer *pRX;
+  ring_buffer *pTX;
+#ifdef SERIAL_RTS_ENABLED
+  struct serial_flow *pFlow;  // RTS pin and watermarks, NULL if this port has no RTS
+#endif // SERIAL_RTS_ENABLED
+#ifdef SERIAL_CTS_ENABLED
+  PORT_t *pCTS;               // NULL if this port has no CTS
+  uint8_t bCTS;               // the CTS pin's bit
+#endif // SERIAL_CTS_ENABLED
+#ifdef SERIAL_TX_DMA_ENABLED
+  struct serial_tx_dma *pDMA; // NULL if this port doesn't use DMA
+#endif // SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+  struct serial_rx_stamp *pStamp; // NULL if this port doesn't time-stamp received data
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
+  struct serial_idle *pIdle;   // idle line detector
+  struct serial_mpcm *pMPCM;   // multi-processor (9-bit address) mode
+#ifdef SERIAL_STATS_ENABLED
+  struct serial_counters *pStats; // statistics and error counters
+#endif // SERIAL_STATS_ENABLED
+#ifdef SERIAL_RS485_ENABLED
+  struct serial_de *pDE;       // RS-485 driver enable pin
+#endif // SERIAL_RS485_ENABLED
+};
+
+static const struct serial_port serial_0_port =
+{
+  &(SERIAL_0_USART_NAME), &rx_buffer, &tx_buffer,
+#ifdef SERIAL_RTS_ENABLED
+#ifdef SERIAL_0_RTS_ENABLED
+  &serial_0_flow,
+#else
+  NULL,
+#endif // SERIAL_0_RTS_ENABLED
+#endif // SERIAL_RTS_ENABLED
+#ifdef SERIAL_CTS_ENABLED
+#ifdef SERIAL_0_CTS_ENABLED
+  SERIAL_0_CTS_PORT, SERIAL_0_CTS_PIN,
+#else
+  NULL, 0,
+#endif // SERIAL_0_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
+#ifdef SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_0_TX_DMA_CHANNEL
+  &serial_0_tx_dma,
+#else
+  NULL,
+#endif // SERIAL_0_TX_DMA_CHANNEL
+#endif // SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+#ifdef SERIAL_0_RX_TIMESTAMP
+  &serial_0_rx_stamp,
+#else
+  NULL,
+#endif // SERIAL_0_RX_TIMESTAMP
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
+  &serial_0_idle,
+  &serial_0_mpcm,
+#ifdef SERIAL_STATS_ENABLED
+  &serial_0_counters,
+#endif // SERIAL_STATS_ENABLED
+#ifdef SERIAL_RS485_ENABLED
+  &serial_0_de,
+#endif // SERIAL_RS485_ENABLED
+};
+
+static const struct serial_port serial_1_port =
+{
+  &(SERIAL_1_USART_NAME), &rx_buffer2, &tx_buffer2,
+#ifdef SERIAL_RTS_ENABLED
+#ifdef SERIAL_1_RTS_ENABLED
+  &serial_1_flow,
+#else
+  NULL,
+#endif // SERIAL_1_RTS_ENABLED
+#endif // SERIAL_RTS_ENABLED
+#ifdef SERIAL_CTS_ENABLED
+#ifdef SERIAL_1_CTS_ENABLED
+  SERIAL_1_CTS_PORT, SERIAL_1_CTS_PIN,
+#else
+  NULL, 0,
+#endif // SERIAL_1_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
+#ifdef SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_1_TX_DMA_CHANNEL
+  &serial_1_tx_dma,
+#else
+  NULL,
+#endif // SERIAL_1_TX_DMA_CHANNEL
+#endif // SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+#ifdef SERIAL_1_RX_TIMESTAMP
+  &serial_1_rx_stamp,
+#else
+  NULL,
+#endif // SERIAL_1_RX_TIMESTAMP
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
+  &serial_1_idle,
+  &serial_1_mpcm,
+#ifdef SERIAL_STATS_ENABLED
+  &serial_1_counters,
+#endif // SERIAL_STATS_ENABLED
+#ifdef SERIAL_RS485_ENABLED
+  &serial_1_de,
+#endif // SERIAL_RS485_ENABLED
+};
 
 #ifdef SERIAL_2_PORT_NAME
-void serialEvent3() __attribute__((weak));
-void serialEvent3() {}
-#define serialEvent3_implemented
+static const struct serial_port serial_2_port =
+{
+  &(SERIAL_2_USART_NAME), &rx_buffer3, &tx_buffer3,
+#ifdef SERIAL_RTS_ENABLED
+#ifdef SERIAL_2_RTS_ENABLED
+  &serial_2_flow,
+#else
+  NULL,
+#endif // SERIAL_2_RTS_ENABLED
+#endif // SERIAL_RTS_ENABLED
+#ifdef SERIAL_CTS_ENABLED
+#ifdef SERIAL_2_CTS_ENABLED
+  SERIAL_2_CTS_PORT, SERIAL_2_CTS_PIN,
+#else
+  NULL, 0,
+#endif // SERIAL_2_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
+#ifdef SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_2_TX_DMA_CHANNEL
+  &serial_2_tx_dma,
+#else
+  NULL,
+#endif // SERIAL_2_TX_DMA_CHANNEL
+#endif // SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+#ifdef SERIAL_2_RX_TIMESTAMP
+  &serial_2_rx_stamp,
+#else
+  NULL,
+#endif // SERIAL_2_RX_TIMESTAMP
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
+  &serial_2_idle,
+  &serial_2_mpcm,
+#ifdef SERIAL_STATS_ENABLED
+  &serial_2_counters,
+#endif // SERIAL_STATS_ENABLED
+#ifdef SERIAL_RS485_ENABLED
+  &serial_2_de,
+#endif // SERIAL_RS485_ENABLED
+};
 #endif // SERIAL_2_PORT_NAME
 
 #ifdef SERIAL_3_PORT_NAME
-void serialEvent4() __attribute__((weak));
-void serialEvent4() {}
-#define serialEvent4_implemented
+static const struct serial_port serial_3_port =
+{
+  &(SERIAL_3_USART_NAME), &rx_buffer4, &tx_buffer4,
+#ifdef SERIAL_RTS_ENABLED
+#ifdef SERIAL_3_RTS_ENABLED
+  &serial_3_flow,
+#else
+  NULL,
+#endif // SERIAL_3_RTS_ENABLED
+#endif // SERIAL_RTS_ENABLED
+#ifdef SERIAL_CTS_ENABLED
+#ifdef SERIAL_3_CTS_ENABLED
+  SERIAL_3_CTS_PORT, SERIAL_3_CTS_PIN,
+#else
+  NULL, 0,
+#endif // SERIAL_3_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
+#ifdef SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_3_TX_DMA_CHANNEL
+  &serial_3_tx_dma,
+#else
+  NULL,
+#endif // SERIAL_3_TX_DMA_CHANNEL
+#endif // SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+#ifdef SERIAL_3_RX_TIMESTAMP
+  &serial_3_rx_stamp,
+#else
+  NULL,
+#endif // SERIAL_3_RX_TIMESTAMP
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
+  &serial_3_idle,
+  &serial_3_mpcm,
+#ifdef SERIAL_STATS_ENABLED
+  &serial_3_counters,
+#endif // SERIAL_STATS_ENABLED
+#ifdef SERIAL_RS485_ENABLED
+  &serial_3_de,
+#endif // SERIAL_RS485_ENABLED
+};
 #endif // SERIAL_3_PORT_NAME
 
 #ifdef SERIAL_4_PORT_NAME
-void serialEvent5() __attribute__((weak));
-void serialEvent5() {}
-#define serialEvent5_implemented
+static const struct serial_port serial_4_port =
+{
+  &(SERIAL_4_USART_NAME), &rx_buffer5, &tx_buffer5,
+#ifdef SERIAL_RTS_ENABLED
+#ifdef SERIAL_4_RTS_ENABLED
+  &serial_4_flow,
+#else
+  NULL,
+#endif // SERIAL_4_RTS_ENABLED
+#endif // SERIAL_RTS_ENABLED
+#ifdef SERIAL_CTS_ENABLED
+#ifdef SERIAL_4_CTS_ENABLED
+  SERIAL_4_CTS_PORT, SERIAL_4_CTS_PIN,
+#else
+  NULL, 0,
+#endif // SERIAL_4_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
+#ifdef SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_4_TX_DMA_CHANNEL
+  &serial_4_tx_dma,
+#else
+  NULL,
+#endif // SERIAL_4_TX_DMA_CHANNEL
+#endif // SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+#ifdef SERIAL_4_RX_TIMESTAMP
+  &serial_4_rx_stamp,
+#else
+  NULL,
+#endif // SERIAL_4_RX_TIMESTAMP
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
+  &serial_4_idle,
+  &serial_4_mpcm,
+#ifdef SERIAL_STATS_ENABLED
+  &serial_4_counters,
+#endif // SERIAL_STATS_ENABLED
+#ifdef SERIAL_RS485_ENABLED
+  &serial_4_de,
+#endif // SERIAL_RS485_ENABLED
+};
 #endif // SERIAL_4_PORT_NAME
 
 #ifdef SERIAL_5_PORT_NAME
-void serialEvent6() __attribute__((weak));
-void serialEvent6() {}
-#define serialEvent6_implemented
+static const struct serial_port serial_5_port =
+{
+  &(SERIAL_5_USART_NAME), &rx_buffer6, &tx_buffer6,
+#ifdef SERIAL_RTS_ENABLED
+#ifdef SERIAL_5_RTS_ENABLED
+  &serial_5_flow,
+#else
+  NULL,
+#endif // SERIAL_5_RTS_ENABLED
+#endif // SERIAL_RTS_ENABLED
+#ifdef SERIAL_CTS_ENABLED
+#ifdef SERIAL_5_CTS_ENABLED
+  SERIAL_5_CTS_PORT, SERIAL_5_CTS_PIN,
+#else
+  NULL, 0,
+#endif // SERIAL_5_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
+#ifdef SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_5_TX_DMA_CHANNEL
+  &serial_5_tx_dma,
+#else
+  NULL,
+#endif // SERIAL_5_TX_DMA_CHANNEL
+#endif // SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+#ifdef SERIAL_5_RX_TIMESTAMP
+  &serial_5_rx_stamp,
+#else
+  NULL,
+#endif // SERIAL_5_RX_TIMESTAMP
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
+  &serial_5_idle,
+  &serial_5_mpcm,
+#ifdef SERIAL_STATS_ENABLED
+  &serial_5_counters,
+#endif // SERIAL_STATS_ENABLED
+#ifdef SERIAL_RS485_ENABLED
+  &serial_5_de,
+#endif // SERIAL_RS485_ENABLED
+};
 #endif // SERIAL_5_PORT_NAME
 
 #ifdef SERIAL_6_PORT_NAME
-void serialEvent7() __attribute__((weak));
-void serialEvent7() {}
-#define serialEvent7_implemented
+static const struct serial_port serial_6_port =
+{
+  &(SERIAL_6_USART_NAME), &rx_buffer7, &tx_buffer7,
+#ifdef SERIAL_RTS_ENABLED
+#ifdef SERIAL_6_RTS_ENABLED
+  &serial_6_flow,
+#else
+  NULL,
+#endif // SERIAL_6_RTS_ENABLED
+#endif // SERIAL_RTS_ENABLED
+#ifdef SERIAL_CTS_ENABLED
+#ifdef SERIAL_6_CTS_ENABLED
+  SERIAL_6_CTS_PORT, SERIAL_6_CTS_PIN,
+#else
+  NULL, 0,
+#endif // SERIAL_6_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
+#ifdef SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_6_TX_DMA_CHANNEL
+  &serial_6_tx_dma,
+#else
+  NULL,
+#endif // SERIAL_6_TX_DMA_CHANNEL
+#endif // SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+#ifdef SERIAL_6_RX_TIMESTAMP
+  &serial_6_rx_stamp,
+#else
+  NULL,
+#endif // SERIAL_6_RX_TIMESTAMP
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
+  &serial_6_idle,
+  &serial_6_mpcm,
+#ifdef SERIAL_STATS_ENABLED
+  &serial_6_counters,
+#endif // SERIAL_STATS_ENABLED
+#ifdef SERIAL_RS485_ENABLED
+  &serial_6_de,
+#endif // SERIAL_RS485_ENABLED
+};
 #endif // SERIAL_6_PORT_NAME
 
 #ifdef SERIAL_7_PORT_NAME
-void serialEvent8() __attribute__((weak));
-void serialEvent8() {}
-#define serialEvent8_implemented
+static const struct serial_port serial_7_port =
+{
+  &(SERIAL_7_USART_NAME), &rx_buffer8, &tx_buffer8,
+#ifdef SERIAL_RTS_ENABLED
+#ifdef SERIAL_7_RTS_ENABLED
+  &serial_7_flow,
+#else
+  NULL,
+#endif // SERIAL_7_RTS_ENABLED
+#endif // SERIAL_RTS_ENABLED
+#ifdef SERIAL_CTS_ENABLED
+#ifdef SERIAL_7_CTS_ENABLED
+  SERIAL_7_CTS_PORT, SERIAL_7_CTS_PIN,
+#else
+  NULL, 0,
+#endif // SERIAL_7_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
+#ifdef SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_7_TX_DMA_CHANNEL
+  &serial_7_tx_dma,
+#else
+  NULL,
+#endif // SERIAL_7_TX_DMA_CHANNEL
+#endif // SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+#ifdef SERIAL_7_RX_TIMESTAMP
+  &serial_7_rx_stamp,
+#else
+  NULL,
+#endif // SERIAL_7_RX_TIMESTAMP
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
+  &serial_7_idle,
+  &serial_7_mpcm,
+#ifdef SERIAL_STATS_ENABLED
+  &serial_7_counters,
+#endif // SERIAL_STATS_ENABLED
+#ifdef SERIAL_RS485_ENABLED
+  &serial_7_de,
+#endif // SERIAL_RS485_ENABLED
+};
 #endif // SERIAL_7_PORT_NAME
 
-void serialEventRun(void)
+
+// the RXC interrupt handler body
+
+SERIAL_ISR_BODY serial_rxc(const struct serial_port *pP)
 {
-// TODO: support this
+register volatile USART_t *pU = pP->pUSART;
+unsigned char c;
+register uint8_t status;
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+unsigned long tNow = 0;
 
-#ifdef serialEvent_implemented
-#ifdef USBCON
-  if (Serial1.available())
-#else // normal
-  if (Serial.available())
-#endif // USBCON, normal
+  if(pP->pStamp)
   {
-    serialEvent();
+    tNow = micros(); // do this FIRST so the time is as close to the stop bit as possible
   }
-#endif // serialEvent_implemented
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
 
-#ifdef serialEvent2_implemented
-  if (Serial2.available())
+  status = pU->STATUS; // RXB8 (the 9th bit) has to be read BEFORE 'DATA'
+
+  if(status & _BV(USART_RXCIF_bp)) // if there is data available
   {
-    serialEvent2();
+    c = pU->DATA;
+
+#ifdef SERIAL_STATS_ENABLED
+    if(status & (USART_FERR_bm | USART_BUFOVF_bm | USART_PERR_bm)) // almost never
+    {
+      serial_count_errors(pP->pStats, status);
+    }
+#endif // SERIAL_STATS_ENABLED
+
+    if(serial_mpcm_rx(pP->pMPCM, pU, c, status)) // not filtered out by the node address
+    {
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+      if(pP->pStamp)
+      {
+        stamp_char(pP->pStamp, pP->pRX->head, tNow);
+      }
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
+      if(pP->pMPCM->pBit9)
+      {
+        serial_store_bit9(pP->pMPCM, pP->pRX->head, status);
+      }
+
+      if(store_char(c, pP->pRX))
+      {
+#ifdef SERIAL_RTS_ENABLED
+        if(pP->pFlow) // this port has RTS
+        {
+          serial_rts_check(pP->pFlow, pP->pRX); // RTS goes high at the 'high' watermark
+        }
+#endif // SERIAL_RTS_ENABLED
+#ifdef SERIAL_STATS_ENABLED
+        serial_high_water(&(pP->pStats->rx_high), pP->pRX);
+#endif // SERIAL_STATS_ENABLED
+      }
+#ifdef SERIAL_STATS_ENABLED
+      else
+      {
+        pP->pStats->rx_overflow++; // the sketch isn't reading fast enough
+      }
+#endif // SERIAL_STATS_ENABLED
+    }
+  }
+  else // I got an interrupt for some reason, just eat data from data reg
+  {
+    c = pU->DATA;
   }
-#endif // serialEvent2_implemented
 
-#ifdef serialEvent3_implemented
-  if (Serial3.available())
+  if(pP->pIdle->reload) // idle line detector is on, so re-start the count
   {
-    serialEvent3();
+    pP->pIdle->count = pP->pIdle->reload;
   }
-#endif // serialEvent3_implemented
+}
 
-#ifdef serialEvent4_implemented
-  if (Serial4.available())
+// the DRE interrupt handler body
+
+SERIAL_ISR_BODY serial_dre(const struct serial_port *pP)
+{
+register volatile USART_t *pU = pP->pUSART;
+register ring_buffer *pT = pP->pTX;
+#ifdef SERIAL_CTS_ENABLED
+uint8_t oldSREG;
+char bCTS;
+#endif // SERIAL_CTS_ENABLED
+
+
+#ifdef SERIAL_TX_DMA_ENABLED
+  if(pP->pDMA)
   {
-    serialEvent4();
+    // the DMA feeds this port, so just turn the DRE interrupt off (this can happen via 'call_isr()')
+    pU->CTRLA = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp)
+#ifdef SERIAL_RS485_ENABLED
+              | (pP->pDE->pPort ? SERIAL_TXC_INT_LEVEL : 0) // leave TXC on for the DE pin
+#endif // SERIAL_RS485_ENABLED
+              ;
+    return;
   }
-#endif // serialEvent4_implemented
+#endif // SERIAL_TX_DMA_ENABLED
 
-#ifdef serialEvent5_implemented
-  if (Serial5.available())
+#ifdef SERIAL_CTS_ENABLED
+  bCTS = pP->pCTS && (pP->pCTS->IN & pP->bCTS);
+#endif // SERIAL_CTS_ENABLED
+
+  if (
+#ifdef SERIAL_CTS_ENABLED
+      bCTS ||
+#endif // SERIAL_CTS_ENABLED
+      pT->head == pT->tail)
+  {
+#ifdef SERIAL_CTS_ENABLED
+    if(bCTS)
+    {
+      oldSREG = SREG; // store the interrupt flag basically
+
+      cli(); // disable interrupts for a bit (in case they were enabled)
+
+      SERIAL_CTS_INTMASK(pP->pCTS) |= pP->bCTS;
+      pP->pCTS->INTCTRL |= SERIAL_CTS_INTLVL_gm; // max priority when I do this
+
+      SREG = oldSREG; // restore
+    }
+#endif // SERIAL_CTS_ENABLED
+
+    // Buffer empty, so disable interrupts
+    // section 19.14.3 - the CTRLA register (interrupt stuff)
+    pU->CTRLA = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp) // only set these 2 (the DRE int is now OFF)
+#ifdef SERIAL_RS485_ENABLED
+              | (pP->pDE->pPort ? SERIAL_TXC_INT_LEVEL : 0) // and TXC, to drop the DE pin after the last byte
+#endif // SERIAL_RS485_ENABLED
+              ;
+  }
+  else
+  {
+    // There is more data in the output buffer. Send the next byte
+    register unsigned char c = pT->buffer[pT->tail];
+    SERIAL_RING_BARRIER(); // read the data before the tail moves
+    pT->tail = (pT->tail + 1) & pT->mask;
+
+    pU->DATA = c;
+
+    // DATA is full again, so any TXCIF that's set now is from an earlier gap.  Clear it, so that
+    // TXCIF (and the TXC interrupt) only happen after THIS byte, with nothing following it.
+    pU->STATUS = _BV(USART_TXCIF_bp); // other bits must be written as zero
+  }
+}
+
+#ifdef SERIAL_RS485_ENABLED
+// the TXC interrupt handler body - the last byte is completely sent, drop the DE pin
+
+SERIAL_ISR_BODY serial_txc(const struct serial_port *pP)
+{
+register struct serial_de *pD = pP->pDE;
+
+
+  // TXCIF is cleared by running this vector
+
+  if(pP->pTX->head != pP->pTX->tail) // more data was queued, or the DMA is still sending it
+  {
+    return; // DE stays up
+  }
+
+  if(pD->pPort)
+  {
+    pD->pPort->OUTCLR = pD->bPin; // driver off, back to receive
+  }
+
+  pD->busy = 0;
+
+  pP->pUSART->CTRLA &= ~USART_TXCINTLVL_gm; // 'tx_kick()' (or the DRE handler) turns it on again
+}
+#endif // SERIAL_RS485_ENABLED
+
+
+// the actual ISRs
+
+SERIAL_0_RXC_ISR // ISR(USARTD0_RXC_vect)
+{
+  serial_rxc(&serial_0_port);
+}
+
+SERIAL_0_DRE_ISR // ISR(USARTD0_DRE_vect)
+{
+  serial_dre(&serial_0_port);
+}
+
+#ifdef SERIAL_RS485_ENABLED
+SERIAL_0_TXC_ISR
+{
+  serial_txc(&serial_0_port);
+}
+#endif // SERIAL_RS485_ENABLED
+
+SERIAL_1_RXC_ISR // ISR(USARTC0_RXC_vect)
+{
+  serial_rxc(&serial_1_port);
+}
+
+SERIAL_1_DRE_ISR // ISR(USARTC0_DRE_vect)
+{
+  serial_dre(&serial_1_port);
+}
+
+#ifdef SERIAL_RS485_ENABLED
+SERIAL_1_TXC_ISR
+{
+  serial_txc(&serial_1_port);
+}
+#endif // SERIAL_RS485_ENABLED
+
+#ifdef SERIAL_2_PORT_NAME
+SERIAL_2_RXC_ISR // ISR(USARTE0_RXC_vect)
+{
+  serial_rxc(&serial_2_port);
+}
+
+SERIAL_2_DRE_ISR // ISR(USARTE0_DRE_vect)
+{
+  serial_dre(&serial_2_port);
+}
+
+#ifdef SERIAL_RS485_ENABLED
+SERIAL_2_TXC_ISR
+{
+  serial_txc(&serial_2_port);
+}
+#endif // SERIAL_RS485_ENABLED
+#endif // SERIAL_2_PORT_NAME
+
+#ifdef SERIAL_3_PORT_NAME
+SERIAL_3_RXC_ISR // ISR(USARTF0_RXC_vect)
+{
+  serial_rxc(&serial_3_port);
+}
+
+SERIAL_3_DRE_ISR // ISR(USARTF0_DRE_vect)
+{
+  serial_dre(&serial_3_port);
+}
+
+#ifdef SERIAL_RS485_ENABLED
+SERIAL_3_TXC_ISR
+{
+  serial_txc(&serial_3_port);
+}
+#endif // SERIAL_RS485_ENABLED
+#endif // SERIAL_3_PORT_NAME
+
+#ifdef SERIAL_4_PORT_NAME
+SERIAL_4_RXC_ISR
+{
+  serial_rxc(&serial_4_port);
+}
+
+SERIAL_4_DRE_ISR
+{
+  serial_dre(&serial_4_port);
+}
+
+#ifdef SERIAL_RS485_ENABLED
+SERIAL_4_TXC_ISR
+{
+  serial_txc(&serial_4_port);
+}
+#endif // SERIAL_RS485_ENABLED
+#endif // SERIAL_4_PORT_NAME
+
+#ifdef SERIAL_5_PORT_NAME
+SERIAL_5_RXC_ISR
+{
+  serial_rxc(&serial_5_port);
+}
+
+SERIAL_5_DRE_ISR
+{
+  serial_dre(&serial_5_port);
+}
+
+#ifdef SERIAL_RS485_ENABLED
+SERIAL_5_TXC_ISR
+{
+  serial_txc(&serial_5_port);
+}
+#endif // SERIAL_RS485_ENABLED
+#endif // SERIAL_5_PORT_NAME
+
+#ifdef SERIAL_6_PORT_NAME
+SERIAL_6_RXC_ISR
+{
+  serial_rxc(&serial_6_port);
+}
+
+SERIAL_6_DRE_ISR
+{
+  serial_dre(&serial_6_port);
+}
+
+#ifdef SERIAL_RS485_ENABLED
+SERIAL_6_TXC_ISR
+{
+  serial_txc(&serial_6_port);
+}
+#endif // SERIAL_RS485_ENABLED
+#endif // SERIAL_6_PORT_NAME
+
+#ifdef SERIAL_7_PORT_NAME
+SERIAL_7_RXC_ISR
+{
+  serial_rxc(&serial_7_port);
+}
+
+SERIAL_7_DRE_ISR
+{
+  serial_dre(&serial_7_port);
+}
+
+#ifdef SERIAL_RS485_ENABLED
+SERIAL_7_TXC_ISR
+{
+  serial_txc(&serial_7_port);
+}
+#endif // SERIAL_RS485_ENABLED
+#endif // SERIAL_7_PORT_NAME
+
+
+// find the descriptor for a USART, or NULL if it isn't one of the serial ports
+static const struct serial_port *serial_port_from_usart(volatile USART_t *pPort)
+{
+  if(pPort == &(SERIAL_0_USART_NAME))
+  {
+    return &serial_0_port;
+  }
+  else if(pPort == &(SERIAL_1_USART_NAME))
+  {
+    return &serial_1_port;
+  }
+#ifdef SERIAL_2_PORT_NAME
+  else if(pPort == &(SERIAL_2_USART_NAME))
+  {
+    return &serial_2_port;
+  }
+#endif // SERIAL_2_PORT_NAME
+#ifdef SERIAL_3_PORT_NAME
+  else if(pPort == &(SERIAL_3_USART_NAME))
+  {
+    return &serial_3_port;
+  }
+#endif // SERIAL_3_PORT_NAME
+#ifdef SERIAL_4_PORT_NAME
+  else if(pPort == &(SERIAL_4_USART_NAME))
+  {
+    return &serial_4_port;
+  }
+#endif // SERIAL_4_PORT_NAME
+#ifdef SERIAL_5_PORT_NAME
+  else if(pPort == &(SERIAL_5_USART_NAME))
+  {
+    return &serial_5_port;
+  }
+#endif // SERIAL_5_PORT_NAME
+#ifdef SERIAL_6_PORT_NAME
+  else if(pPort == &(SERIAL_6_USART_NAME))
+  {
+    return &serial_6_port;
+  }
+#endif // SERIAL_6_PORT_NAME
+#ifdef SERIAL_7_PORT_NAME
+  else if(pPort == &(SERIAL_7_USART_NAME))
+  {
+    return &serial_7_port;
+  }
+#endif // SERIAL_7_PORT_NAME
+
+  return NULL;
+}
+
+// this helper function calls the ISR body directly whenever the status reg has the appropriate bit set, then clears the bit
+// call this function when you're waiting for I/O, whenever interrupts are disabled.
+void call_isr(volatile USART_t *pPort)
+{
+const struct serial_port *pP = serial_port_from_usart(pPort);
+
+
+  if(!pP)
+  {
+    return; // not a serial port
+  }
+
+  if(pPort->STATUS & _BV(USART_RXCIF_bp))
+  {
+    serial_rxc(pP);
+
+    pPort->STATUS = _BV(USART_RXCIF_bp); // clear THIS one.  other bits must be written as zero
+  }
+
+  if(pPort->STATUS & _BV(USART_DREIF_bp))
+  {
+    serial_dre(pP);
+
+    pPort->STATUS = _BV(USART_DREIF_bp); // clear THIS one.  other bits must be written as zero
+  }
+}
+
+#ifdef SERIAL_CTS_ENABLED
+// CTS pin change for one serial port.  This sends the 'next character' _NOW_ if one is
+// available by restoring the 'DRE' interrupt.  If CTS is still high, the DRE handler turns the
+// pin change interrupt back on.
+
+static void serial_cts_callback(const struct serial_port *pP)
+{
+uint8_t oldSREG = SREG; // get this FIRST
+char bCTS = pP->pCTS->IN & pP->bCTS;
+
+
+  cli(); // in case I'm currently doing something ELSE that affects the TX buffer
+
+  if(!bCTS) // it's cleared - turn off the interrupt
+  {
+    SERIAL_CTS_INTMASK(pP->pCTS) &= ~pP->bCTS;
+  }
+
+  if(pP->pTX->head != pP->pTX->tail) // only when there's something to send
+  {
+    // re-enable the DRE interrupt - this will cause transmission to occur again without code
+    // duplication.  The other interrupt bits (RXC, TXC for RS-485) stay as they are.
+
+    pP->pUSART->CTRLA |= _BV(USART_DREINTLVL1_bp) | _BV(USART_DREINTLVL0_bp); // sect 19.14.3
+  }
+
+  SREG=oldSREG; // interrupts re-enabled
+}
+
+// the PORTn_INT1 (or PORTn_INT) ISRs in 'WInterrupts.c' call this when 'pPort' has CTS pins on it (see the
+// SERIAL_CTS_PINS macro in 'Arduino.h').  More than one serial port can use the same port.
+
+void serial_cts_interrupt(PORT_t *pPort)
+{
+#ifdef SERIAL_0_CTS_ENABLED
+  if(SERIAL_0_CTS_PORT == pPort)
+  {
+    serial_cts_callback(&serial_0_port);
+  }
+#endif // SERIAL_0_CTS_ENABLED
+#ifdef SERIAL_1_CTS_ENABLED
+  if(SERIAL_1_CTS_PORT == pPort)
+  {
+    serial_cts_callback(&serial_1_port);
+  }
+#endif // SERIAL_1_CTS_ENABLED
+#ifdef SERIAL_2_PORT_NAME
+#ifdef SERIAL_2_CTS_ENABLED
+  if(SERIAL_2_CTS_PORT == pPort)
+  {
+    serial_cts_callback(&serial_2_port);
+  }
+#endif // SERIAL_2_CTS_ENABLED
+#endif // SERIAL_2_PORT_NAME
+#ifdef SERIAL_3_PORT_NAME
+#ifdef SERIAL_3_CTS_ENABLED
+  if(SERIAL_3_CTS_PORT == pPort)
+  {
+    serial_cts_callback(&serial_3_port);
+  }
+#endif // SERIAL_3_CTS_ENABLED
+#endif // SERIAL_3_PORT_NAME
+#ifdef SERIAL_4_PORT_NAME
+#ifdef SERIAL_4_CTS_ENABLED
+  if(SERIAL_4_CTS_PORT == pPort)
+  {
+    serial_cts_callback(&serial_4_port);
+  }
+#endif // SERIAL_4_CTS_ENABLED
+#endif // SERIAL_4_PORT_NAME
+#ifdef SERIAL_5_PORT_NAME
+#ifdef SERIAL_5_CTS_ENABLED
+  if(SERIAL_5_CTS_PORT == pPort)
+  {
+    serial_cts_callback(&serial_5_port);
+  }
+#endif // SERIAL_5_CTS_ENABLED
+#endif // SERIAL_5_PORT_NAME
+#ifdef SERIAL_6_PORT_NAME
+#ifdef SERIAL_6_CTS_ENABLED
+  if(SERIAL_6_CTS_PORT == pPort)
+  {
+    serial_cts_callback(&serial_6_port);
+  }
+#endif // SERIAL_6_CTS_ENABLED
+#endif // SERIAL_6_PORT_NAME
+#ifdef SERIAL_7_PORT_NAME
+#ifdef SERIAL_7_CTS_ENABLED
+  if(SERIAL_7_CTS_PORT == pPort)
+  {
+    serial_cts_callback(&serial_7_port);
+  }
+#endif // SERIAL_7_CTS_ENABLED
+#endif // SERIAL_7_PORT_NAME
+}
+#endif // SERIAL_CTS_ENABLED
+
+
+//////////////////////////////////////////////////////////////////////////////
+//                                                                          //
+//    ____               _         _   _____                     _          //
+//   / ___|   ___  _ __ (_)  __ _ | | | ____|__   __ ___  _ __  | |_  ___   //
+//   \___ \  / _ \| '__|| | / _` || | |  _|  \ \ / // _ \| '_ \ | __|/ __|  //
+//    ___) ||  __/| |   | || (_| || | | |___  \ V /|  __/| | | || |_ \__ \  //
+//   |____/  \___||_|   |_| \__,_||_| |_____|  \_/  \___||_| |_| \__||___/  //
+//                                                                          //
+//                                                                          //
+//////////////////////////////////////////////////////////////////////////////
+
+void serialEvent() __attribute__((weak));
+void serialEvent() {}
+#define serialEvent_implemented
+
+void serialEvent2() __attribute__((weak));
+void serialEvent2() {}
+#define serialEvent2_implemented
+
+#ifdef SERIAL_2_PORT_NAME
+void serialEvent3() __attribute__((weak));
+void serialEvent3() {}
+#define serialEvent3_implemented
+#endif // SERIAL_2_PORT_NAME
+
+#ifdef SERIAL_3_PORT_NAME
+void serialEvent4() __attribute__((weak));
+void serialEvent4() {}
+#define serialEvent4_implemented
+#endif // SERIAL_3_PORT_NAME
+
+#ifdef SERIAL_4_PORT_NAME
+void serialEvent5() __attribute__((weak));
+void serialEvent5() {}
+#define serialEvent5_implemented
+#endif // SERIAL_4_PORT_NAME
+
+#ifdef SERIAL_5_PORT_NAME
+void serialEvent6() __attribute__((weak));
+void serialEvent6() {}
+#define serialEvent6_implemented
+#endif // SERIAL_5_PORT_NAME
+
+#ifdef SERIAL_6_PORT_NAME
+void serialEvent7() __attribute__((weak));
+void serialEvent7() {}
+#define serialEvent7_implemented
+#endif // SERIAL_6_PORT_NAME
+
+#ifdef SERIAL_7_PORT_NAME
+void serialEvent8() __attribute__((weak));
+void serialEvent8() {}
+#define serialEvent8_implemented
+#endif // SERIAL_7_PORT_NAME
+
+// called before power-save sleep (see wiring.c), which would stop the USARTs mid-character
+void serial_flush_all(void)
+{
+#ifdef USBCON
+  Serial1.flush();
+#else // normal
+  Serial.flush();
+#endif // USBCON, normal
+  Serial2.flush();
+#ifdef SERIAL_2_PORT_NAME
+  Serial3.flush();
+#endif // SERIAL_2_PORT_NAME
+#ifdef SERIAL_3_PORT_NAME
+  Serial4.flush();
+#endif // SERIAL_3_PORT_NAME
+#ifdef SERIAL_4_PORT_NAME
+  Serial5.flush();
+#endif // SERIAL_4_PORT_NAME
+#ifdef SERIAL_5_PORT_NAME
+  Serial6.flush();
+#endif // SERIAL_5_PORT_NAME
+#ifdef SERIAL_6_PORT_NAME
+  Serial7.flush();
+#endif // SERIAL_6_PORT_NAME
+#ifdef SERIAL_7_PORT_NAME
+  Serial8.flush();
+#endif // SERIAL_7_PORT_NAME
+}
+
+#ifdef CLOCK_SWITCHING
+static voidFuncPtr serial_clock_next = NULL; // the clock change hook that was there before, if any
+static bool serial_clock_hooked = false;
+
+// called with interrupts off right after 'clock_switch()' (see wiring.c).  The ports were
+// flushed first, so only the baud rate registers need to change
+static void serial_clock_change(void)
+{
+#ifdef USBCON
+  Serial1.updateBaud();
+#else // normal
+  Serial.updateBaud();
+#endif // USBCON, normal
+  Serial2.updateBaud();
+#ifdef SERIAL_2_PORT_NAME
+  Serial3.updateBaud();
+#endif // SERIAL_2_PORT_NAME
+#ifdef SERIAL_3_PORT_NAME
+  Serial4.updateBaud();
+#endif // SERIAL_3_PORT_NAME
+#ifdef SERIAL_4_PORT_NAME
+  Serial5.updateBaud();
+#endif // SERIAL_4_PORT_NAME
+#ifdef SERIAL_5_PORT_NAME
+  Serial6.updateBaud();
+#endif // SERIAL_5_PORT_NAME
+#ifdef SERIAL_6_PORT_NAME
+  Serial7.updateBaud();
+#endif // SERIAL_6_PORT_NAME
+#ifdef SERIAL_7_PORT_NAME
+  Serial8.updateBaud();
+#endif // SERIAL_7_PORT_NAME
+
+  if(serial_clock_next)
+  {
+    serial_clock_next(); // chained
+  }
+}
+#endif // CLOCK_SWITCHING
+
+void serialEventRun(void)
+{
+// TODO: support this
+
+#ifdef serialEvent_implemented
+#ifdef USBCON
+  if (Serial1.available())
+#else // normal
+  if (Serial.available())
+#endif // USBCON, normal
+  {
+    serialEvent();
+  }
+#endif // serialEvent_implemented
+
+#ifdef serialEvent2_implemented
+  if (Serial2.available())
+  {
+    serialEvent2();
+  }
+#endif // serialEvent2_implemented
+
+#ifdef serialEvent3_implemented
+  if (Serial3.available())
+  {
+    serialEvent3();
+  }
+#endif // serialEvent3_implemented
+
+#ifdef serialEvent4_implemented
+  if (Serial4.available())
+  {
+    serialEvent4();
+  }
+#endif // serialEvent4_implemented
+
+#ifdef serialEvent5_implemented
+  if (Serial5.available())
+  {
+    serialEvent5();
+  }
+#endif // serialEvent5_implemented
+
+#ifdef serialEvent6_implemented
+  if (Serial6.available())
+  {
+    serialEvent6();
+  }
+#endif // serialEvent6_implemented
+
+#ifdef serialEvent7_implemented
+  if (Serial7.available())
+  {
+    serialEvent7();
+  }
+#endif // serialEvent7_implemented
+
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////
+//                                                                               //
+//   ____                     _   ____         _           ____        _         //
+//  | __ )   __ _  _   _   __| | |  _ \  __ _ | |_  ___   / ___| __ _ | |  ___   //
+//  |  _ \  / _` || | | | / _` | | |_) |/ _` || __|/ _ \ | |    / _` || | / __|  //
+//  | |_) || (_| || |_| || (_| | |  _ <| (_| || |_|  __/ | |___| (_| || || (__   //
+//  |____/  \__,_| \__,_| \__,_| |_| \_\\__,_| \__|\___|  \____|\__,_||_| \___|  //
+//                                                                               //
+//                                                                               //
+///////////////////////////////////////////////////////////////////////////////////
+
+// These calculate the BSCALE and BSEL values for any baud rate and peripheral clock.  See the
+// 'BAUD RATE CALCULATION' notes and macros in HardwareSerial.h, which do the same thing when the
+// baud rate is a constant.  Section 19.3.1 and table 19-1 describe the formulae.
+//
+// NOTE:  baud <= f_per / 16 for 1x, f_per / 8 for 2x.  With 2Mhz (RC oscillator) that's 125k or
+//        250k baud, so 250000 baud DMX works at 2Mhz with CLK2X, BSCALE=0, BSEL=0 (0% error).
+
+static uint16_t serial_baud_scale(unsigned long f_per, unsigned long baud, uint8_t x)
+{
+uint8_t s;
+unsigned long bsel;
+
+  if(!SERIAL_BAUD_Q(f_per, baud, x))
+  {
+    return 0; // too fast, use the fastest
+  }
+
+  for(s=7; s > 0; s--) // most negative bscale first (finest resolution)
+  {
+    bsel = SERIAL_BAUD_BSEL_NEG(f_per, baud, x, s);
+
+    if(bsel <= 4095)
+    {
+      return bsel ? (uint16_t)(((16 - s) << 12) | bsel) : 0; // bsel 0 with negative bscale same as 0,0
+    }
+  }
+
+  for(s=0; s <= 7; s++)
+  {
+    bsel = SERIAL_BAUD_BSEL_POS(f_per, baud, x, s);
+
+    if(bsel <= 4095)
+    {
+      return (uint16_t)((s << 12) | bsel);
+    }
+  }
+
+  return 0x7fff; // too slow, use the slowest
+}
+
+uint32_t serial_baud_setting(unsigned long f_per, unsigned long baud)
+{
+uint32_t dw1, dw2;
+unsigned long e1, e2;
+
+  if(!baud)
+  {
+    return 0x7fff; // avoid divide by zero
+  }
+
+  dw2 = serial_baud_scale(f_per, baud, 8) | SERIAL_BAUD_CLK2X;
+
+  if(!SERIAL_BAUD_Q(f_per, baud, 16)) // too fast for 1x
+  {
+    return dw2;
+  }
+
+  dw1 = serial_baud_scale(f_per, baud, 16);
+
+  e1 = serial_baud_actual(f_per, dw1);
+  e1 = e1 > baud ? e1 - baud : baud - e1;
+  e2 = serial_baud_actual(f_per, dw2);
+  e2 = e2 > baud ? e2 - baud : baud - e2;
+
+  return e1 > 2 * e2 ? dw2 : dw1; // only use CLK2X if it more than halves the error
+}
+
+// the baud rate you ACTUALLY get from a 'baud setting'
+unsigned long serial_baud_actual(unsigned long f_per, uint32_t baud_setting)
+{
+  return SERIAL_BAUD_ACTUAL(f_per, baud_setting);
+}
+
+
+
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+//                                                                                         //
+//   _   _                  _                             ____               _         _   //
+//  | | | |  __ _  _ __  __| |__      __ __ _  _ __  ___ / ___|   ___  _ __ (_)  __ _ | |  //
+//  | |_| | / _` || '__|/ _` |\ \ /\ / // _` || '__|/ _ \\___ \  / _ \| '__|| | / _` || |  //
+//  |  _  || (_| || |  | (_| | \ V  V /| (_| || |  |  __/ ___) ||  __/| |   | || (_| || |  //
+//  |_| |_| \__,_||_|   \__,_|  \_/\_/  \__,_||_|   \___||____/  \___||_|   |_| \__,_||_|  //
+//                                                                                         //
+//                                                                                         //
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+// Constructors ////////////////////////////////////////////////////////////////
+
+void HardwareSerial::init(ring_buffer *rx_buffer0, ring_buffer *tx_buffer0,
+                          uint16_t usart0)
+{
+register ring_buffer *pR = rx_buffer0;
+register ring_buffer *pT = tx_buffer0;
+
+  _rx_buffer = pR;//rx_buffer0;
+  _tx_buffer = pT;//tx_buffer0;
+  _usart = (volatile USART_t *)usart0;
+#if defined(DMA_CH0_CTRLA) || defined(EDMA_CH0_CTRLA)
+  _tx_dma = NULL; // assigned in 'begin()'
+#endif // DMA_CH0_CTRLA, EDMA_CH0_CTRLA
+  _rx_stamp = NULL; // assigned in 'begin()'
+  _de = NULL; // assigned in 'begin()'
+  _mpcm = NULL; // assigned in 'begin()'
+  _stats = NULL; // assigned in 'begin()'
+  _flow = NULL; // assigned in 'begin()'
+  _baud = 0;
+
+  pR->head = 0;
+  pR->tail = 0;
+  pT->head = 0;
+  pT->tail = 0;
+//  memset(rx_buffer0, 0, sizeof(*rx_buffer0));
+//  memset(tx_buffer0, 0, sizeof(*tx_buffer0));
+}
+
+HardwareSerial::HardwareSerial(ring_buffer *rx_buffer0, ring_buffer *tx_buffer0,
+                               uint16_t usart0) /*__attribute__ ((noinline))*/
+{
+register ring_buffer *pR = rx_buffer0;
+register ring_buffer *pT = tx_buffer0;
+
+//  init(rx_buffer0, tx_buffer0, usart0); this is larger code, left for reference
+
+  _rx_buffer = pR;//rx_buffer0;
+  _tx_buffer = pT;//tx_buffer0;
+  _usart = (volatile USART_t *)usart0;
+#if defined(DMA_CH0_CTRLA) || defined(EDMA_CH0_CTRLA)
+  _tx_dma = NULL; // assigned in 'begin()'
+#endif // DMA_CH0_CTRLA, EDMA_CH0_CTRLA
+  _rx_stamp = NULL; // assigned in 'begin()'
+  _de = NULL; // assigned in 'begin()'
+  _mpcm = NULL; // assigned in 'begin()'
+  _stats = NULL; // assigned in 'begin()'
+  _flow = NULL; // assigned in 'begin()'
+  _baud = 0;
+
+  pR->head = 0;
+  pR->tail = 0;
+  pT->head = 0;
+  pT->tail = 0;
+//  memset(rx_buffer0, 0, sizeof(*rx_buffer0));
+//  memset(tx_buffer0, 0, sizeof(*tx_buffer0));
+}
+
+// pin re-mapping and port/pin assignments for one of the serial ports' USARTs.  This enables
+// the re-mapping (when the variant asks for it) and returns the port, and the TX and RX pin
+// index.  The XCK pin is always the one just below RX (pins 1,2,3 or 5,6,7 are XCK,RX,TX).
+// Returns false if the USART isn't one of the serial ports.  Call it with interrupts disabled.
+// 'HardwareSerial::begin()' and 'USARTSPI::begin()' both use this.
+
+bool serial_usart_pins(volatile USART_t *pU, PORT_t **ppPort, uint8_t *pbitTX, uint8_t *pbitRX)
+{
+  if(pU == &SERIAL_0_USART_NAME)
+  {
+    *pbitTX = (SERIAL_0_TX_PIN_INDEX);
+    *pbitRX = (SERIAL_0_RX_PIN_INDEX);
+#ifdef SERIAL_0_REMAP
+    SERIAL_0_REMAP |= SERIAL_0_REMAP_BIT; // enable re-mapping for this port
+#endif // SERIAL_0_REMAP
+  }
+  else if(pU == &SERIAL_1_USART_NAME)
+  {
+    *pbitTX = (SERIAL_1_TX_PIN_INDEX);
+    *pbitRX = (SERIAL_1_RX_PIN_INDEX);
+#ifdef SERIAL_1_REMAP
+    SERIAL_1_REMAP |= SERIAL_1_REMAP_BIT; // enable re-mapping for this port
+#endif // SERIAL_0_REMAP
+  }
+#ifdef SERIAL_2_PORT_NAME
+  else if(pU == &SERIAL_2_USART_NAME)
+  {
+    *pbitTX = (SERIAL_2_TX_PIN_INDEX);
+    *pbitRX = (SERIAL_2_RX_PIN_INDEX);
+#ifdef SERIAL_2_REMAP
+    SERIAL_2_REMAP |= SERIAL_2_REMAP_BIT; // enable re-mapping for this port
+#endif // SERIAL_2_REMAP
+  }
+#endif // SERIAL_2_PORT_NAME
+#ifdef SERIAL_3_PORT_NAME
+  else if(pU == &SERIAL_3_USART_NAME)
+  {
+    *pbitTX = (SERIAL_3_TX_PIN_INDEX);
+    *pbitRX = (SERIAL_3_RX_PIN_INDEX);
+#ifdef SERIAL_3_REMAP
+    SERIAL_3_REMAP |= SERIAL_3_REMAP_BIT; // enable re-mapping for this port
+#endif // SERIAL_3_REMAP
+  }
+#endif // SERIAL_3_PORT_NAME
+#ifdef SERIAL_4_PORT_NAME
+  else if(pU == &SERIAL_4_USART_NAME)
+  {
+    *pbitTX = (SERIAL_4_TX_PIN_INDEX);
+    *pbitRX = (SERIAL_4_RX_PIN_INDEX);
+
+#ifdef SERIAL_4_REMAP
+    // NOTE:  no remap for serial 4 through Serial 7
+#warning pin remap not supported for 'SERIAL_4'
+#endif // SERIAL_4_REMAP
+  }
+#endif // SERIAL_4_PORT_NAME
+#ifdef SERIAL_5_PORT_NAME
+  else if(pU == &SERIAL_5_USART_NAME)
+  {
+    *pbitTX = (SERIAL_5_TX_PIN_INDEX);
+    *pbitRX = (SERIAL_5_RX_PIN_INDEX);
+
+#ifdef SERIAL_5_REMAP
+    // NOTE:  no remap for serial 4 through Serial 7
+#warning pin remap not supported for 'SERIAL_5'
+#endif // SERIAL_5_REMAP
+  }
+#endif // SERIAL_5_PORT_NAME
+#ifdef SERIAL_6_PORT_NAME
+  else if(pU == &SERIAL_6_USART_NAME)
+  {
+    *pbitTX = (SERIAL_6_TX_PIN_INDEX);
+    *pbitRX = (SERIAL_6_RX_PIN_INDEX);
+
+#ifdef SERIAL_6_REMAP
+    // NOTE:  no remap for serial 4 through Serial 7
+#warning pin remap not supported for 'SERIAL_6'
+#endif // SERIAL_6_REMAP
+  }
+#endif // SERIAL_6_PORT_NAME
+#ifdef SERIAL_7_PORT_NAME
+  else if(pU == &SERIAL_7_USART_NAME)
+  {
+    *pbitTX = (SERIAL_7_TX_PIN_INDEX);
+    *pbitRX = (SERIAL_7_RX_PIN_INDEX);
+
+#ifdef SERIAL_7_REMAP
+    // NOTE:  no remap for serial 4 through Serial 7
+#warning pin remap not supported for 'SERIAL_7'
+#endif // SERIAL_7_REMAP
+  }
+#endif // SERIAL_7_PORT_NAME
+  else
+  {
+    return false; // not one of the serial ports
+  }
+
+
+  if(pU == &USARTD0
+#ifdef USARTD1
+     || pU == &USARTD1
+#endif // USARTD1
+    )
+  {
+    *ppPort = &PORTD;
+  }
+  else if(pU == &USARTC0
+#ifdef USARTC1
+          || pU == &USARTC1
+#endif // USARTC1
+         )
+  {
+    *ppPort = &PORTC;
+  }
+#ifdef USARTE0
+  else if(pU == &USARTE0
+#ifdef USARTE1
+          || pU == &USARTE1
+#endif // USARTE1
+         )
+  {
+    *ppPort = &PORTE;
+  }
+#endif // USARTE0
+#ifdef USARTF0
+  else if(pU == &USARTF0
+#ifdef USARTF1
+          || pU == &USARTF1
+#endif // USARTF1
+         )
+  {
+    *ppPort = &PORTF;
+  }
+#endif // USARTF0
+  else
+  {
+    return false;
+  }
+
+  return true;
+}
+
+// Public Methods //////////////////////////////////////////////////////////////
+
+// 'D' manual, section 19.5
+// USART Initialization
+// USART initialization should use the following sequence:
+// 1. Set the TxD pin value high, and optionally set the XCK pin low.
+// 2. Set the TxD and optionally the XCK pin as output.
+// 3. Set the baud rate and frame format.
+// 4. Set the mode of operation (enables XCK pin output in synchronous mode).
+// 5. Enable the transmitter or the receiver, depending on the usage.
+// For interrupt-driven USART operation, global interrupts should be disabled during the initialization.
+// Before doing a re-initialization with a changed baud rate or frame format, be sure that there are no ongoing transmissions
+// while the registers are changed.
+
+// NOTE:  'begin()' is inline (see HardwareSerial.h) so that the baud rate setting is calculated
+//        at compile time whenever the baud rate is a constant.  It calls THIS function.
+
+void HardwareSerial::beginWithSetting(unsigned long baud, uint32_t baud_setting, byte config)
+{
+  uint8_t use_u2x;
+  uint8_t bit, bitTX=3, bitRX=2; // defaults
+  PORT_t *pPort;
+  volatile uint8_t *reg;
+  volatile uint8_t *out;
+  volatile uint8_t *ctrlT;
+  volatile uint8_t *ctrlR;
+  uint8_t oldSREG;
+  const struct serial_port *pP;
+
+
+  // baud rate calc - table 19-1 (page 211) for calculation formulae, done by 'begin()'
+  // (also see theory discussion on page 219)
+#ifdef CLOCK_SWITCHING
+  if(clock_hz() != F_CPU) // 'begin()' calculated it for F_CPU, and the clock has been switched
+  {
+    baud_setting = serial_baud_setting(clock_hz(), baud);
+  }
+
+  if(!serial_clock_hooked) // only once, since other hooks may have chained onto mine
+  {
+    serial_clock_next = clock_set_change_hook(serial_clock_change);
+    serial_clock_hooked = true;
+  }
+#endif // CLOCK_SWITCHING
+
+  if(baud_setting & SERIAL_BAUD_CLK2X)
+  {
+    use_u2x = _BV(USART_CLK2X_bp);  // enable CLK2X - bit 2 in the CTRLB register (section 19.14.4)
+  }
+  else
+  {
+    use_u2x = 0;
+  }
+
+  transmitting = false; // pre-assign
+  _baud = baud;
+
+  pP = serial_port_from_usart(_usart);
+
+#ifdef SERIAL_RS485_ENABLED
+  _de = pP ? pP->pDE : NULL; // the pin itself is assigned by 'setDriverEnable()'
+#endif // SERIAL_RS485_ENABLED
+  _mpcm = pP ? pP->pMPCM : NULL;
+#ifdef SERIAL_STATS_ENABLED
+  _stats = pP ? pP->pStats : NULL;
+#endif // SERIAL_STATS_ENABLED
+#ifdef SERIAL_RTS_ENABLED
+  _flow = pP ? pP->pFlow : NULL;
+
+  if(_flow)
+  {
+    serial_rts_init(_flow); // output, 'ok to send'
+  }
+#endif // SERIAL_RTS_ENABLED
+#ifdef SERIAL_CTS_ENABLED
+  if(pP && pP->pCTS)
+  {
+    serial_cts_init(pP->pCTS, pP->bCTS); // input, pullup, pin change interrupt (masked)
+  }
+#endif // SERIAL_CTS_ENABLED
+
+  if(pP && pP->pIdle->bits) // idle line detector is on, the tick count depends on the baud rate
+  {
+    pP->pIdle->reload = serial_idle_ticks(baud, pP->pIdle->bits);
+  }
+
+
+  oldSREG = SREG; // save old to restore interrupts as they were
+  cli(); // clear interrupt flag until I'm done assigning pin stuff
+
+  // pin re-mapping register and port/pin assignments (see 'serial_usart_pins()')
+
+  if(!pP || !serial_usart_pins(_usart, &pPort, &bitTX, &bitRX))
+  {
+    goto exit_point; // not valid (bail)
+  }
+
+#ifdef SERIAL_TX_DMA_ENABLED
+  _tx_dma = pP->pDMA;
+#endif // SERIAL_TX_DMA_ENABLED
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+  _rx_stamp = pP->pStamp;
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
+
+  reg = &(pPort->DIR);
+  out = &(pPort->OUT);
+  ctrlT = &(pPort->PIN0CTRL) + bitTX;
+  ctrlR = &(pPort->PIN0CTRL) + bitRX;
+
+  // port config, transmit bit
+  bit = 1 << bitTX;
+  *ctrlT = 0; // trigger on BOTH, totem, no pullup
+  *out |= bit;  // set to 'HIGH'
+  *reg |= bit;  // set as output
+
+  // port config, receive bit
+  bit = 1 << bitRX;
+  *ctrlR = 0; // triger on BOTH, no pullup
+  *out &= ~bit; // off
+  *reg &= ~bit; // set as input
+
+
+  // section 19.4.4
+  _usart->CTRLB = use_u2x; // enable clock 2x when set (everything else disabled)
+
+
+  // section 19.14.5 - USART mode, parity, bits
+  // CMODE 7:6   00 [async]
+  // PMODE 5:4   00=none  10=even 11=odd
+  // SBMODE 3    0=1 stop  1=2 stop
+  // CHSIZE 2:0  000=5 bit 001=6 bit  010=7 bit  011=8 bit  111=9 bit
+  _usart->CTRLC = config & ~(_BV(USART_CMODE1_bp)|_BV(USART_CMODE0_bp)); // make sure bits 6 and 7 are cleared
+#ifdef USARTD0_CTRLD
+  _usart->CTRLD = 0;  // E5 has this register, must assign to zero
+#endif // USARTD0_CTRLD  
+
+  // assign the baud_setting, a.k.a. ubbr (USART Baud Rate Register)
+
+  _usart->BAUDCTRLA = (uint8_t)(baud_setting & 0xff);
+  _usart->BAUDCTRLB = (uint8_t)(baud_setting >> 8);
+
+  // section 19.4.4
+
+  // enable RX, enable TX.  Bit 2 will be 1 or 0 based on clock 2x/1x.  multi-processor disabled.  bit 9 = 0
+  _usart->CTRLB = use_u2x | _BV(USART_RXEN_bp) | _BV(USART_TXEN_bp);
+
+  if(_mpcm && (_mpcm->flags & SERIAL_MPCM_ON)) // 'setNodeAddress()' was called first
+  {
+    _usart->CTRLB |= _BV(USART_MPCM_bp); // wait for an address frame
+  }
+
+  // priority 3 for RX interrupts.  DRE and TX interrupts OFF (for now).
+  _usart->CTRLA = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp);
+
+#ifdef SERIAL_TX_DMA_ENABLED
+  if(_tx_dma)
+  {
+    serial_tx_dma_init(_tx_dma); // DMA will drain the TX buffer instead of the DRE interrupt
+  }
+#endif // SERIAL_TX_DMA_ENABLED
+
+exit_point:
+  SREG = oldSREG; // restore interrupt flag (now that I'm done assigning things)
+}
+
+void HardwareSerial::end()
+{
+  // wait for transmission of outgoing data
+  // TODO:  check for 'in an ISR' or stalled?
+
+  if(SREG & CPU_I_bm) // interrupts are enabled
+  {
+    // if ints not disabled it's safe to do this - wait for tx_buffer to empty
+
+    while (_tx_buffer->head != ring_load(&(_tx_buffer->tail))) { }
+  }
+
+#ifdef SERIAL_RS485_ENABLED
+  if(_de && _de->pPort)
+  {
+    flush(); // let the last stop bit out before the driver turns off
+
+    _de->pPort->OUTCLR = _de->bPin; // in case interrupts are off
+    _de->busy = 0;
+  }
+#endif // SERIAL_RS485_ENABLED
+
+#ifdef SERIAL_TX_DMA_ENABLED
+  if(_tx_dma)
+  {
+    _tx_dma->pCH->CTRLA = 0; // disable the DMA channel
+    _tx_dma->len = 0;
+  }
+#endif // SERIAL_TX_DMA_ENABLED
+
+  _usart->CTRLB = 0; // disable RX, TX
+  _usart->CTRLA = 0; // disable interrupts
+
+  // clear any received data (the tail belongs to the reader, so move that)
+#ifdef SERIAL_STATS_ENABLED
+  if(_stats) // they still count as received
+  {
+    _stats->rx_read += (ring_index_t)((_rx_buffer->head - _rx_buffer->tail) & _rx_buffer->mask);
+  }
+#endif // SERIAL_STATS_ENABLED
+
+  ring_store(&(_rx_buffer->tail), _rx_buffer->head);
+
+#ifdef SERIAL_RTS_ENABLED
+  if(_flow && _flow->stopped) // the buffer is empty now
+  {
+    serial_rts_release(_flow, _rx_buffer);
+  }
+#endif // SERIAL_RTS_ENABLED
+}
+
+int HardwareSerial::available(void)
+{
+  // no need to disable interrupts - see 'ring_load'
+  return (int)((unsigned int)((unsigned int)ring_load(&(_rx_buffer->head)) - (unsigned int)_rx_buffer->tail)
+               & _rx_buffer->mask); // power of 2 size, so this works even when head < tail
+}
+
+int HardwareSerial::peek(void)
+{
+register ring_index_t iTail = _rx_buffer->tail; // only I change this
+
+  if (ring_load(&(_rx_buffer->head)) == iTail)
+  {
+    return -1;
+  }
+
+  return _rx_buffer->buffer[iTail];
+}
+
+int HardwareSerial::read(void)
+{
+register int iRval;
+register ring_index_t iTail = _rx_buffer->tail; // only I change this
+
+  // if the head isn't ahead of the tail, we don't have any characters
+  if (ring_load(&(_rx_buffer->head)) == iTail)
   {
-    serialEvent5();
+    iRval = -1;
   }
-#endif // serialEvent5_implemented
-
-#ifdef serialEvent6_implemented
-  if (Serial6.available())
+  else
   {
-    serialEvent6();
+    iRval = (int)(_rx_buffer->buffer[iTail]);
+
+    ring_store(&(_rx_buffer->tail), (ring_index_t)((iTail + 1) & _rx_buffer->mask));
+
+#ifdef SERIAL_STATS_ENABLED
+    if(_stats)
+    {
+      _stats->rx_read++;
+    }
+#endif // SERIAL_STATS_ENABLED
   }
-#endif // serialEvent6_implemented
 
-#ifdef serialEvent7_implemented
-  if (Serial7.available())
+  // each time I read a byte, and RTS is HIGH ('stop'), check whether the buffer is down to
+  // the 'low' watermark so RTS can go back to LOW ('ok to send').  As I deplete the buffer, RTS
+  // will enable, and as the ISR fills it, RTS will disable.  When RTS is LOW, this is 1 test.
+
+#ifdef SERIAL_RTS_ENABLED
+  if(_flow && _flow->stopped)
   {
-    serialEvent7();
+    serial_rts_release(_flow, _rx_buffer);
   }
-#endif // serialEvent7_implemented
+#endif // SERIAL_RTS_ENABLED
 
+  return iRval;
 }
 
+// block read - copies up to 'length' bytes that are ALREADY in the receive buffer into 'buffer'
+// and returns the number copied (0 if none).  It does not wait.  The buffer is drained as (at
+// most) 2 contiguous spans, tail to end and then start to head.  Interrupts stay on, and the
+// ISR can keep adding data while I copy.  The RTS check happens once per call rather than once
+// per byte.  'Stream::readBytes()' calls this.
 
-///////////////////////////////////////////////////////////////////////////////////
-//                                                                               //
-//   ____                     _   ____         _           ____        _         //
-//  | __ )   __ _  _   _   __| | |  _ \  __ _ | |_  ___   / ___| __ _ | |  ___   //
-//  |  _ \  / _` || | | | / _` | | |_) |/ _` || __|/ _ \ | |    / _` || | / __|  //
-//  | |_) || (_| || |_| || (_| | |  _ <| (_| || |_|  __/ | |___| (_| || || (__   //
-//  |____/  \__,_| \__,_| \__,_| |_| \_\\__,_| \__|\___|  \____|\__,_||_| \___|  //
-//                                                                               //
-//                                                                               //
-///////////////////////////////////////////////////////////////////////////////////
+int HardwareSerial::read(uint8_t *buffer, size_t length)
+{
+register unsigned int iHead, iTail, iLen;
+size_t nRval = 0;
 
-// this function that uses 'canned' baud rate values is 'temporary'.  A proper one that
-// calculates the baud rate values will appear at some point in the future, once I have
-// a nice bullet-proof algorithm for it.
-//
-// Note that THESE values assume F_CPU==32000000
 
-uint16_t temp_get_baud(unsigned long baud, uint8_t use_u2x)
-{
-uint16_t i1;
-static const unsigned long aBaud[] PROGMEM = // standard baud rates
-{
-  2400, 4800, 9600, 14400, 19200, 28800, 31250,
-  38400, 57600, 76800, 115200, 230400, 460800, 921600
-};
+  iHead = ring_load(&(_rx_buffer->head));
+  iTail = _rx_buffer->tail; // only I change this
 
-static const uint16_t a2x[] PROGMEM = // 2x constants for standard baud rates
-{
-  (7 << 12) | 12,   // 2400
-  (6 << 12) | 12,   // 4800
-  (5 << 12) | 12,   // 9600
-  (1 << 12) | 138,  // 14400
-  (4 << 12) | 12,   // 19200
-  138,              // 28800
-  (2 << 12) | 31,   // 31250 - MIDI baud rate
-  (3 << 12) | 12,   // 38400
-  (uint16_t)(-1 << 12) | 137, // 57600
-  (2 << 12) | 12,   // 76800
-  (uint16_t)(-2 << 12) | 135, // 115200
-  (uint16_t)(-3 << 12) | 131, // 230400
-  (uint16_t)(-4 << 12) | 123, // 460800
-  (uint16_t)(-5 << 12) | 107  // 921600
-};
+  while(length > 0 && iHead != iTail)
+  {
+    if(iHead > iTail)
+    {
+      iLen = iHead - iTail;
+    }
+    else
+    {
+      iLen = RING_BUFFER_SIZE(_rx_buffer) - iTail; // up to the end, then wrap around on the next pass
+    }
 
-static const uint16_t a1x[] PROGMEM = // 1x constants for standard baud rates
-{
-  (6 << 12) | 12,   // 2400
-  (5 << 12) | 12,   // 4800
-  (4 << 12) | 12,   // 9600
-  138,              // 14400
-  (3 << 12) | 12,   // 19200
-  (uint16_t)(-1 << 12) | 137, // 28800
-  (1 << 12) | 31,   // 31250 - MIDI baud rate
-  (2 << 12) | 12,   // 38400
-  (uint16_t)(-2 << 12) | 135, // 57600
-  (1 << 12) | 12,   // 76800
-  (uint16_t)(-3 << 12) | 131, // 115200
-  (uint16_t)(-4 << 12) | 123, // 230400
-  (uint16_t)(-5 << 12) | 107, // 460800
-  (uint16_t)(-6 << 12) | 75   // 921600
-};
+    if(iLen > length)
+    {
+      iLen = length;
+    }
+
+    memcpy(buffer, (const void *)&(_rx_buffer->buffer[iTail]), iLen);
 
-  // TODO:  binary search is faster, but uses more code
+    iTail = (iTail + iLen) & _rx_buffer->mask;
 
-  for(i1=0; i1 < sizeof(aBaud)/sizeof(aBaud[0]); i1++)
+    buffer += iLen;
+    length -= iLen;
+    nRval += iLen;
+  }
+
+  if(nRval)
   {
-    unsigned long dw1 = pgm_read_dword(&aBaud[i1]);
-    if(baud == dw1)
+    ring_store(&(_rx_buffer->tail), (ring_index_t)iTail);
+
+#ifdef SERIAL_STATS_ENABLED
+    if(_stats)
     {
-      if(use_u2x)
-      {
-        return pgm_read_word(&a2x[i1]);
-      }
-      else
-      {
-        return pgm_read_word(&a1x[i1]);
-      }
+      _stats->rx_read += nRval;
     }
+#endif // SERIAL_STATS_ENABLED
   }
 
-  // NOTE:  baud <= F_CPU / 16 for 1x, F_CPU / 8 for 2x
-  //
-  // X = clk_2x ? 8 : 16    bscale >= 0:  bsel = F_CPU / ( (2 ^ bscale) * X * baud) - 1
-  //                                      baud = F_CPU / ( (2 ^ bscale) * X * (bsel + 1) )
-  //                        bscale < 0:   bsel = (1 / (2 ^ (bscale))) * (F_CPU / (X * baud) - 1)
-  //                                      baud = F_CPU / ( X * (((2 ^ bscale) * bsel) + 1) )
-  //
-  // NOTE:  if bsel is zero for a given bscale, then use bscale=0 and bsel=2^(bscale - 1)
-  //        see section 19.3.1
-  //
-  // find 'best fit baud' by calculating the best 'bscale' and 'bsel' for a given baud
-  // bscale is -7 through +7 so this can be done in a simple loop
-  // I determined that using floating point is almost MANDATORY to make this work.  scaled ints
-  // would work too.  But it's likely to take up WAY TOO MUCH SPACE in the NVRAM to be practical.
+  // now that the buffer has been depleted, see if RTS can go back to 'ok to send'
+  // (same as 'read()' but once for the whole block)
 
-  return 1; // for now [half the maximum baud rate]
+#ifdef SERIAL_RTS_ENABLED
+  if(_flow && _flow->stopped)
+  {
+    serial_rts_release(_flow, _rx_buffer);
+  }
+#endif // SERIAL_RTS_ENABLED
+
+  return (int)nRval;
 }
 
+// read one byte, along with the 'micros()' time it was received and whether it was the first
+// byte after an inter-byte gap (see 'setRxGap()').  Returns -1 if there's nothing to read.  If
+// the port doesn't time-stamp received data (SERIAL_n_RX_TIMESTAMP) the time is 0 and there
+// are no gaps.  Either pointer can be NULL.
 
+int HardwareSerial::readWithTimestamp(unsigned long *pTime, bool *pGap)
+{
+register int iRval;
+unsigned long tRval = 0;
+bool bGap = false;
 
+  // the ISR never writes the time stamp for the byte at the tail, and only 'read()' moves the
+  // tail, so this doesn't need interrupts off either
 
-/////////////////////////////////////////////////////////////////////////////////////////////
-//                                                                                         //
-//   _   _                  _                             ____               _         _   //
-//  | | | |  __ _  _ __  __| |__      __ __ _  _ __  ___ / ___|   ___  _ __ (_)  __ _ | |  //
-//  | |_| | / _` || '__|/ _` |\ \ /\ / // _` || '__|/ _ \\___ \  / _ \| '__|| | / _` || |  //
-//  |  _  || (_| || |  | (_| | \ V  V /| (_| || |  |  __/ ___) ||  __/| |   | || (_| || |  //
-//  |_| |_| \__,_||_|   \__,_|  \_/\_/  \__,_||_|   \___||____/  \___||_|   |_| \__,_||_|  //
-//                                                                                         //
-//                                                                                         //
-/////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+  if(_rx_stamp && ring_load(&(_rx_buffer->head)) != _rx_buffer->tail)
+  {
+    register unsigned int iTail = _rx_buffer->tail;
 
-// Constructors ////////////////////////////////////////////////////////////////
+    tRval = _rx_stamp->pTime[iTail];
+    bGap = (_rx_stamp->pGap[iTail >> 3] & (1 << (iTail & 7))) != 0;
+  }
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
 
-void HardwareSerial::init(ring_buffer *rx_buffer0, ring_buffer *tx_buffer0,
-                          uint16_t usart0)
-{
-register ring_buffer *pR = rx_buffer0;
-register ring_buffer *pT = tx_buffer0;
+  iRval = HardwareSerial::read(); // same byte, since nobody else moves the tail (and this does the RTS)
 
-  _rx_buffer = pR;//rx_buffer0;
-  _tx_buffer = pT;//tx_buffer0;
-  _usart = (volatile USART_t *)usart0;
+  if(pTime)
+  {
+    *pTime = tRval;
+  }
 
-  pR->head = 0;
-  pR->tail = 0;
-  pT->head = 0;
-  pT->tail = 0;
-//  memset(rx_buffer0, 0, sizeof(*rx_buffer0));
-//  memset(tx_buffer0, 0, sizeof(*tx_buffer0));
+  if(pGap)
+  {
+    *pGap = bGap;
+  }
+
+  return iRval;
 }
 
-HardwareSerial::HardwareSerial(ring_buffer *rx_buffer0, ring_buffer *tx_buffer0,
-                               uint16_t usart0) /*__attribute__ ((noinline))*/
+// set the inter-byte gap, in microseconds, that marks the start of a new frame.  0 disables
+// the gap detector.  For Modbus RTU use 3.5 character times (38500000 / baud for 11 bit
+// characters, or 1750 above 19200 baud).  Does nothing without SERIAL_n_RX_TIMESTAMP.
+
+void HardwareSerial::setRxGap(unsigned long uSec)
 {
-register ring_buffer *pR = rx_buffer0;
-register ring_buffer *pT = tx_buffer0;
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+  if(_rx_stamp)
+  {
+    uint8_t oldSREG = SREG;
 
-//  init(rx_buffer0, tx_buffer0, usart0); this is larger code, left for reference
+    cli(); // it's a 32-bit value that the ISR reads
 
-  _rx_buffer = pR;//rx_buffer0;
-  _tx_buffer = pT;//tx_buffer0;
-  _usart = (volatile USART_t *)usart0;
+    _rx_stamp->tGap = uSec;
 
-  pR->head = 0;
-  pR->tail = 0;
-  pT->head = 0;
-  pT->tail = 0;
-//  memset(rx_buffer0, 0, sizeof(*rx_buffer0));
-//  memset(tx_buffer0, 0, sizeof(*tx_buffer0));
+    SREG = oldSREG;
+  }
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
 }
 
-// Public Methods //////////////////////////////////////////////////////////////
-
-// 'D' manual, section 19.5
-// USART Initialization
-// USART initialization should use the following sequence:
-// 1. Set the TxD pin value high, and optionally set the XCK pin low.
-// 2. Set the TxD and optionally the XCK pin as output.
-// 3. Set the baud rate and frame format.
-// 4. Set the mode of operation (enables XCK pin output in synchronous mode).
-// 5. Enable the transmitter or the receiver, depending on the usage.
-// For interrupt-driven USART operation, global interrupts should be disabled during the initialization.
-// Before doing a re-initialization with a changed baud rate or frame format, be sure that there are no ongoing transmissions
-// while the registers are changed.
-
-void HardwareSerial::begin(unsigned long baud)
-{
-  begin(baud, SERIAL_8N1); // eliminated replicated code (12/9/2014)
-}
+// the length of the complete frame at the front of the RX buffer, or 0 if there isn't one.
+// The frame ends just before the next byte that was flagged as following a gap.  If there
+// is no such byte, everything in the buffer is one frame once the line has been quiet for the
+// gap time.  Read exactly this many bytes to consume the frame.  If the RX buffer overflows,
+// bytes are lost, so size the buffer for the largest frame (256 bytes for Modbus RTU).
 
-void HardwareSerial::begin(unsigned long baud, byte config)
+int HardwareSerial::availableFrame(void)
 {
-  uint16_t baud_setting;
-  uint8_t use_u2x;
-  uint8_t bit, bitTX=3, bitRX=2; // defaults
-  volatile uint8_t *reg;
-  volatile uint8_t *out;
-  volatile uint8_t *ctrlT;
-  volatile uint8_t *ctrlR;
-  uint8_t oldSREG;
+#ifdef SERIAL_RX_TIMESTAMP_ENABLED
+register unsigned int iHead, iTail, iLen, i1, i2;
+register struct serial_rx_stamp *pS = _rx_stamp;
+unsigned long tQuiet, tGap;
+uint8_t oldSREG;
 
 
-  if (baud <= 57600)
-  {
-    use_u2x = 0;
-  }
-  else
+  if(!pS)
   {
-    use_u2x = _BV(USART_CLK2X_bp);  // enable CLK2X - bit 2 in the CTRLB register (section 19.14.4)
+    return 0;
   }
 
-  transmitting = false; // pre-assign
-
-  // baud rate calc - page 220 table 19-5 [for standard values]
-  //                  table 19-1 (page 211) for calculation formulae
-  // (also see theory discussion on page 219)
-  baud_setting = temp_get_baud(baud, use_u2x);
-
+  oldSREG = SREG;
+  cli(); // consistent snapshot of head, tail, and the 32-bit times
 
-  oldSREG = SREG; // save old to restore interrupts as they were
-  cli(); // clear interrupt flag until I'm done assigning pin stuff
+  iHead = _rx_buffer->head;
+  iTail = _rx_buffer->tail;
+  tQuiet = micros() - pS->tLast; // how long the line has been quiet as of THIS snapshot
+  tGap = pS->tGap;
 
-  // pin re-mapping register and port/pin assignments
+  SREG = oldSREG;
 
-  if(_usart == &SERIAL_0_USART_NAME)
-  {
-    bitTX = (SERIAL_0_TX_PIN_INDEX);
-    bitRX = (SERIAL_0_RX_PIN_INDEX);
-#ifdef SERIAL_0_REMAP
-    SERIAL_0_REMAP |= SERIAL_0_REMAP_BIT; // enable re-mapping for this port
-#endif // SERIAL_0_REMAP
-  }
-  else if(_usart == &SERIAL_1_USART_NAME)
-  {
-    bitTX = (SERIAL_1_TX_PIN_INDEX);
-    bitRX = (SERIAL_1_RX_PIN_INDEX);
-#ifdef SERIAL_1_REMAP
-    SERIAL_1_REMAP |= SERIAL_1_REMAP_BIT; // enable re-mapping for this port
-#endif // SERIAL_0_REMAP
-  }
-#ifdef SERIAL_2_PORT_NAME
-  else if(_usart == &SERIAL_2_USART_NAME)
+  if(!tGap || iHead == iTail) // gap detector off, or nothing to read
   {
-    bitTX = (SERIAL_2_TX_PIN_INDEX);
-    bitRX = (SERIAL_2_RX_PIN_INDEX);
-#ifdef SERIAL_2_REMAP
-    SERIAL_2_REMAP |= SERIAL_2_REMAP_BIT; // enable re-mapping for this port
-#endif // SERIAL_2_REMAP
-  }
-#endif // SERIAL_2_PORT_NAME
-#ifdef SERIAL_3_PORT_NAME
-  else if(_usart == &SERIAL_3_USART_NAME)
-  {
-    bitTX = (SERIAL_3_TX_PIN_INDEX);
-    bitRX = (SERIAL_3_RX_PIN_INDEX);
-#ifdef SERIAL_3_REMAP
-    SERIAL_3_REMAP |= SERIAL_3_REMAP_BIT; // enable re-mapping for this port
-#endif // SERIAL_3_REMAP
+    return 0;
   }
-#endif // SERIAL_3_PORT_NAME
-#ifdef SERIAL_4_PORT_NAME
-  else if(_usart == &SERIAL_4_USART_NAME)
-  {
-    bitTX = (SERIAL_4_TX_PIN_INDEX);
-    bitRX = (SERIAL_4_RX_PIN_INDEX);
 
-#ifdef SERIAL_4_REMAP
-    // NOTE:  no remap for serial 4 through Serial 7
-#warning pin remap not supported for 'SERIAL_4'
-#endif // SERIAL_4_REMAP
-  }
-#endif // SERIAL_4_PORT_NAME
-#ifdef SERIAL_5_PORT_NAME
-  else if(_usart == &SERIAL_5_USART_NAME)
-  {
-    bitTX = (SERIAL_5_TX_PIN_INDEX);
-    bitRX = (SERIAL_5_RX_PIN_INDEX);
+  iLen = (iHead - iTail) & _rx_buffer->mask;
 
-#ifdef SERIAL_5_REMAP
-    // NOTE:  no remap for serial 4 through Serial 7
-#warning pin remap not supported for 'SERIAL_5'
-#endif // SERIAL_5_REMAP
-  }
-#endif // SERIAL_5_PORT_NAME
-#ifdef SERIAL_6_PORT_NAME
-  else if(_usart == &SERIAL_6_USART_NAME)
-  {
-    bitTX = (SERIAL_6_TX_PIN_INDEX);
-    bitRX = (SERIAL_6_RX_PIN_INDEX);
+  // the ISR only writes the gap bit for the slot at 'head' so the ones between
+  // tail and head are stable, and I can scan them with interrupts enabled.
+  // the byte at the tail starts the frame whether it's flagged or not.
 
-#ifdef SERIAL_6_REMAP
-    // NOTE:  no remap for serial 4 through Serial 7
-#warning pin remap not supported for 'SERIAL_6'
-#endif // SERIAL_6_REMAP
-  }
-#endif // SERIAL_6_PORT_NAME
-#ifdef SERIAL_7_PORT_NAME
-  else if(_usart == &SERIAL_7_USART_NAME)
+  for(i1=1; i1 < iLen; i1++)
   {
-    bitTX = (SERIAL_7_TX_PIN_INDEX);
-    bitRX = (SERIAL_7_RX_PIN_INDEX);
+    i2 = (iTail + i1) & _rx_buffer->mask;
 
-#ifdef SERIAL_7_REMAP
-    // NOTE:  no remap for serial 4 through Serial 7
-#warning pin remap not supported for 'SERIAL_7'
-#endif // SERIAL_7_REMAP
+    if(pS->pGap[i2 >> 3] & (1 << (i2 & 7)))
+    {
+      return (int)i1; // the next frame starts here
+    }
   }
-#endif // SERIAL_7_PORT_NAME
-  else
+
+  if(tQuiet >= tGap) // the line has been quiet long enough (any byte after this gets a gap flag)
   {
-    goto exit_point; // not valid (bail)
+    return (int)iLen;
   }
+#endif // SERIAL_RX_TIMESTAMP_ENABLED
 
-  // USART setup - for existing ports only (otherwise we just return)
+  return 0;
+}
 
-  if(_usart == &USARTD0
-#ifdef USARTD1
-     || _usart == &USARTD1
-#endif // USARTD1
-    )
+// enable the idle line detector.  'bits' is the number of bit times that the RX line must be
+// quiet after receiving something before 'rxIdle()' returns true and the callback is called.
+// 0 turns it off.  The actual time is rounded up to the 'millis' timer tick (see above).
+
+void HardwareSerial::setIdleTime(unsigned int bits)
+{
+const struct serial_port *pP = serial_port_from_usart(_usart);
+uint8_t oldSREG;
+
+  if(!pP)
   {
-    reg = &PORTD_DIR;
-    out = &PORTD_OUT;
-    ctrlT = &PORTD_PIN0CTRL + bitTX;
-    ctrlR = &PORTD_PIN0CTRL + bitRX;
+    return;
   }
-  else if(_usart == &USARTC0
-#ifdef USARTC1
-          || _usart == &USARTC1
-#endif // USARTC1
-         )
+
+  oldSREG = SREG;
+  cli(); // the ISRs use these
+
+  pP->pIdle->bits = bits;
+  pP->pIdle->reload = serial_idle_ticks(_baud, bits);
+  pP->pIdle->count = 0;
+  pP->pIdle->flag = 0;
+
+  if(bits && !serial_idle_hooked)
   {
-    reg = &PORTC_DIR;
-    out = &PORTC_OUT;
-    ctrlT = &PORTC_PIN0CTRL + bitTX;
-    ctrlR = &PORTC_PIN0CTRL + bitRX; // note bitTX and bitRX must be correct
+    serial_idle_next = timer0_set_tick_hook(serial_idle_tick); // start getting ticks (it's fine to leave this assigned)
+    serial_idle_hooked = true;
   }
-#ifdef USARTE0
-  else if(_usart == &USARTE0
-#ifdef USARTE1
-          || _usart == &USARTE1
-#endif // USARTE1
-         )
+
+  SREG = oldSREG;
+}
+
+// assign a function that's called when the RX line goes idle (NULL for none).  It's called
+// from the timer ISR, so keep it short.  'setIdleTime()' must also be called to enable it.
+
+void HardwareSerial::setIdleCallback(void (*pCallback)(void))
+{
+const struct serial_port *pP = serial_port_from_usart(_usart);
+uint8_t oldSREG;
+
+  if(pP)
   {
-    reg = &PORTE_DIR;
-    out = &PORTE_OUT;
-    ctrlT = &PORTE_PIN0CTRL + bitTX;
-    ctrlR = &PORTE_PIN0CTRL + bitRX;
+    oldSREG = SREG;
+    cli(); // a function pointer is 2 (or 3) bytes, and the ISR uses it
+
+    pP->pIdle->pCallback = pCallback;
+
+    SREG = oldSREG;
   }
-#endif // USARTE0
-#ifdef USARTF0
-  else if(_usart == &USARTF0
-#ifdef USARTE1
-          || _usart == &USARTF1
-#endif // USARTE1
-         )
+}
+
+// returns true (once) after the RX line has gone idle following received data
+
+bool HardwareSerial::rxIdle(void)
+{
+const struct serial_port *pP = serial_port_from_usart(_usart);
+
+  if(pP && pP->pIdle->flag)
   {
-    reg = &PORTF_DIR;
-    out = &PORTF_OUT;
-    ctrlT = &PORTF_PIN0CTRL + bitTX;
-    ctrlR = &PORTF_PIN0CTRL + bitRX;
+    pP->pIdle->flag = 0; // single byte, no need for 'cli()'
+    return true;
   }
-#endif // USARTF0
-  else
+
+  return false;
+}
+
+// assign the RS-485 driver enable pin (see 'RS-485 HALF-DUPLEX' above), or -1 for none.  The
+// pin is made an output and set LOW (receive).  Returns false if the pin isn't valid, or the
+// TXC handlers were left out (SERIAL_RS485 isn't defined).  'begin(baud, config, dePin)' calls this.
+
+bool HardwareSerial::setDriverEnable(int dePin)
+{
+#ifdef SERIAL_RS485_ENABLED
+const struct serial_port *pP = serial_port_from_usart(_usart);
+PORT_t *pPort = NULL;
+uint8_t bPin = 0, oldSREG;
+
+
+  if(!pP)
   {
-    goto exit_point; // not valid (bail)
+    return false;
   }
 
-  // port config, transmit bit
-  bit = 1 << bitTX;
-  *ctrlT = 0; // trigger on BOTH, totem, no pullup
-  *out |= bit;  // set to 'HIGH'
-  *reg |= bit;  // set as output
+  if(dePin >= 0)
+  {
+    uint8_t port;
 
-  // port config, receive bit
-  bit = 1 << bitRX;
-  *ctrlR = 0; // triger on BOTH, no pullup
-  *out &= ~bit; // off
-  *reg &= ~bit; // set as input
+    if(dePin >= NUM_DIGITAL_PINS)
+    {
+      return false;
+    }
 
+    port = digitalPinToPort(dePin);
 
-  // section 19.4.4
-  _usart->CTRLB = use_u2x; // enable clock 2x when set (everything else disabled)
+    if(port == NOT_A_PORT)
+    {
+      return false;
+    }
 
+    pPort = (PORT_t *)portModeRegister(port); // 'DIR' is the first register in PORT_t
+    bPin = digitalPinToBitMask(dePin);
 
-  // section 19.14.5 - USART mode, parity, bits
-  // CMODE 7:6   00 [async]
-  // PMODE 5:4   00=none  10=even 11=odd
-  // SBMODE 3    0=1 stop  1=2 stop
-  // CHSIZE 2:0  000=5 bit 001=6 bit  010=7 bit  011=8 bit  111=9 bit
-  _usart->CTRLC = config & ~(_BV(USART_CMODE1_bp)|_BV(USART_CMODE0_bp)); // make sure bits 6 and 7 are cleared
-#ifdef USARTD0_CTRLD
-  _usart->CTRLD = 0;  // E5 has this register, must assign to zero
-#endif // USARTD0_CTRLD  
+    pPort->OUTCLR = bPin; // receive
+    pPort->DIRSET = bPin; // it's an output
+  }
 
-  // assign the baud_setting, a.k.a. ubbr (USART Baud Rate Register)
+  flush(); // don't change pins in the middle of sending something
 
-  _usart->BAUDCTRLA = (uint8_t)(baud_setting & 0xff);
-  _usart->BAUDCTRLB = (uint8_t)(baud_setting >> 8);
+  oldSREG = SREG;
+  cli(); // the TXC ISR uses these
 
-  // section 19.4.4
+  if(pP->pDE->pPort && (pP->pDE->pPort != pPort || pP->pDE->bPin != bPin))
+  {
+    pP->pDE->pPort->OUTCLR = pP->pDE->bPin; // old pin back to 'receive'
+  }
 
-  // enable RX, enable TX.  Bit 2 will be 1 or 0 based on clock 2x/1x.  multi-processor disabled.  bit 9 = 0
-  _usart->CTRLB = use_u2x | _BV(USART_RXEN_bp) | _BV(USART_TXEN_bp);
+  pP->pDE->pPort = pPort;
+  pP->pDE->bPin = bPin;
+  pP->pDE->busy = 0;
 
-  // priority 3 for RX interrupts.  DRE and TX interrupts OFF (for now).
-  _usart->CTRLA = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp);
+  _de = pP->pDE;
 
-exit_point:
-  SREG = oldSREG; // restore interrupt flag (now that I'm done assigning things)
+  SREG = oldSREG;
+
+  return true;
+#else // SERIAL_RS485_ENABLED
+  return false;
+#endif // SERIAL_RS485_ENABLED
 }
 
-void HardwareSerial::end()
+// multi-processor mode (see 'MULTI-PROCESSOR' above).  Only frames after an address frame that
+// matches 'addr' (or 'broadcast', when it's not -1) are received.  An 'addr' of -1 turns it off,
+// and everything is received again.  Use a 9-bit 'config' in 'begin()', i.e. SERIAL_9N1.
+
+void HardwareSerial::setNodeAddress(int addr, int broadcast)
 {
-  // wait for transmission of outgoing data
-  // TODO:  check for 'in an ISR' or stalled?
+uint8_t oldSREG;
 
-  if(SREG & CPU_I_bm) // interrupts are enabled
+
+  if(!_mpcm) // 'begin()' hasn't been called yet
   {
-    // if ints not disabled it's safe to do this - wait for tx_buffer to empty
+    const struct serial_port *pP = serial_port_from_usart(_usart);
+
+    if(!pP)
+    {
+      return;
+    }
 
-    while (_tx_buffer->head != _tx_buffer->tail) { }
+    _mpcm = pP->pMPCM;
   }
 
-  _usart->CTRLB = 0; // disable RX, TX
-  _usart->CTRLA = 0; // disable interrupts
+  oldSREG = SREG;
+  cli(); // the RXC ISR uses these, and changes CTRLB
+
+  if(addr < 0)
+  {
+    _mpcm->flags = 0;
+    _usart->CTRLB &= ~_BV(USART_MPCM_bp); // receive everything
+  }
+  else
+  {
+    _mpcm->addr = (uint8_t)addr;
+    _mpcm->bcast = (uint8_t)broadcast;
+    _mpcm->flags = SERIAL_MPCM_ON | (broadcast >= 0 ? SERIAL_MPCM_BCAST : 0);
 
-  // clear any received data
-  _rx_buffer->head = _rx_buffer->tail;
+    _usart->CTRLB |= _BV(USART_MPCM_bp); // ignore data frames until my address shows up
+  }
+
+  SREG = oldSREG;
 }
 
-int HardwareSerial::available(void)
+// 'read()' with the 9th bit of the frame in bit 8 (0 for an 8-bit frame).  Returns -1 if
+// there's nothing to read.  Without SERIAL_n_RX_9BIT the 9th bit is always 0.
+
+int HardwareSerial::read9(void)
 {
-  register int iRval;
-  register uint8_t oldSREG = SREG; // save old to restore interrupts as they were
+register int iRval;
+register int iBit9 = 0;
+register ring_index_t iTail = _rx_buffer->tail; // only I change this
 
-  cli(); // clear interrupt flag to prevent inconsistency
 
-  iRval = (int)((unsigned int)(SERIAL_BUFFER_SIZE + (unsigned int)_rx_buffer->head - (unsigned int)_rx_buffer->tail)
-                % SERIAL_BUFFER_SIZE);
+  if(_mpcm && _mpcm->pBit9 && ring_load(&(_rx_buffer->head)) != iTail)
+  {
+    // the ISR only writes the bit for the entry at the head, so this one is stable
+    if(_mpcm->pBit9[iTail >> 3] & (1 << (iTail & 7)))
+    {
+      iBit9 = 0x100;
+    }
+  }
+
+  iRval = HardwareSerial::read(); // same entry, nobody else moves the tail
 
-  SREG = oldSREG; // restore interrupt flag
+  if(iRval < 0)
+  {
+    return iRval;
+  }
 
-  return iRval;
+  return iRval | iBit9;
 }
 
-int HardwareSerial::peek(void)
+// send an address frame (9th bit set) for multi-processor mode.  Anything already in the TX
+// buffer goes out first, since the 9th bit (TXB8) applies to whatever is written to DATA.  Data
+// frames that follow via 'write()' have the 9th bit clear.
+
+size_t HardwareSerial::writeAddress(uint8_t addr)
 {
-  register int iRval;
-  register uint8_t oldSREG = SREG; // save old to restore interrupts as they were
+uint8_t oldSREG;
+
 
-  cli(); // clear interrupt flag to prevent inconsistency
+  flush(); // TX buffer and shift register empty (this drops DE, I raise it again below)
 
-  if (_rx_buffer->head == _rx_buffer->tail)
+#ifdef SERIAL_RS485_ENABLED
+  if(_de && _de->pPort)
   {
-    iRval = -1;
+    _de->busy = 1;
+    _de->pPort->OUTSET = _de->bPin; // driver on
   }
-  else
+#endif // SERIAL_RS485_ENABLED
+
+  oldSREG = SREG;
+  cli(); // the RXC ISR changes CTRLB (MPCM)
+
+  _usart->CTRLB |= _BV(USART_TXB8_bp); // 9th bit = 1, 'address'
+  _usart->STATUS = _BV(USART_TXCIF_bp); // other bits must be written as zero
+  _usart->DATA = addr;
+
+  SREG = oldSREG;
+
+  transmitting = true;
+
+#ifdef SERIAL_STATS_ENABLED
+  if(_stats)
   {
-    iRval = _rx_buffer->buffer[_rx_buffer->tail];
+    _stats->tx_bytes++;
   }
+#endif // SERIAL_STATS_ENABLED
 
-  SREG = oldSREG; // restore interrupt flag
+  while(!(_usart->STATUS & _BV(USART_DREIF_bp))) { } // wait for it to move into the shift register
 
-  return iRval;
+  oldSREG = SREG;
+  cli();
+
+  _usart->CTRLB &= ~_BV(USART_TXB8_bp); // data frames from here on
+
+#ifdef SERIAL_RS485_ENABLED
+  if(_de && _de->pPort)
+  {
+    _usart->CTRLA |= SERIAL_TXC_INT_LEVEL; // drop DE after it, unless 'write()' sends more
+  }
+#endif // SERIAL_RS485_ENABLED
+
+  SREG = oldSREG;
+
+  return 1;
 }
 
-int HardwareSerial::read(void)
-{
-  register int iRval;
-  uint8_t oldSREG = SREG;
+// copy this port's statistics into 'pStats', and optionally zero them.  The counters are
+// copied with interrupts off (~50 cycles) so they're consistent with each other.
+// Returns false (with 'pStats' all zeros) if statistics are disabled (SERIAL_NO_STATS).  The
+// 16-bit error counters wrap around, so compare snapshots rather than absolute values if a port
+// runs for a long time.
 
-  cli(); // clear interrupt flag for consistency
+bool HardwareSerial::getStats(struct serial_stats *pStats, bool bReset)
+{
+#ifdef SERIAL_STATS_ENABLED
+const struct serial_port *pP = serial_port_from_usart(_usart); // works before 'begin()', too
+register struct serial_counters *pC;
+register ring_index_t iWaiting;
+uint8_t oldSREG;
+#endif // SERIAL_STATS_ENABLED
 
-  // each time I'm ready to read a byte, double-check that the RTS (when enabled)
-  // needs to be set to a 0 value [which enables things to be sent to me].  As
-  // I deplete the buffer, RTS will enable, and as I fill it, RTS will disable.
 
-  // This section is the 'deplete' part.  So I'll set RTS to 'LOW' which is 'ok to send'
-  // if the buffer is _NOT_ too full (the set_not_rts() function determines that)
+  memset(pStats, 0, sizeof(*pStats));
 
-#ifdef SERIAL_0_RTS_ENABLED
-  if(_rx_buffer == &rx_buffer && // it's serial #0
-     !set_not_rts(&rx_buffer))   // do I need to turn off RTS ?
+#ifdef SERIAL_STATS_ENABLED
+  if(!pP)
   {
-    SERIAL_0_RTS_PORT->OUT &= ~SERIAL_0_RTS_PIN; // set to '0'
-    SERIAL_0_RTS_PORT->DIR |= SERIAL_0_RTS_PIN; // make sure it's an output
+    return false;
   }
-#endif // SERIAL_0_RTS_ENABLED
 
-#ifdef SERIAL_1_RTS_ENABLED
-  if(_rx_buffer == &rx_buffer2 && // it's serial #1
-     !set_not_rts(&rx_buffer2))   // do I need to turn off RTS ?
+  pC = pP->pStats;
+
+  oldSREG = SREG;
+  cli(); // the RXC ISR changes some of these
+
+  iWaiting = (ring_index_t)((_rx_buffer->head - _rx_buffer->tail) & _rx_buffer->mask);
+
+  // 'received' is everything that was read, everything that's still waiting, and everything
+  // that was dropped.  the ISR doesn't count bytes, which keeps it fast (see above).
+  pStats->rx_bytes = pC->rx_read + iWaiting + pC->rx_overflow;
+  pStats->tx_bytes = pC->tx_bytes;
+  pStats->rx_overflow = pC->rx_overflow;
+  pStats->rx_overrun = pC->rx_overrun;
+  pStats->rx_framing = pC->rx_framing;
+  pStats->rx_parity = pC->rx_parity;
+  pStats->rx_high_water = pC->rx_high;
+  pStats->tx_high_water = pC->tx_high;
+
+  if(bReset)
   {
-    SERIAL_1_RTS_PORT->OUT &= ~SERIAL_1_RTS_PIN; // set to '0'
-    SERIAL_1_RTS_PORT->DIR |= SERIAL_1_RTS_PIN; // make sure it's an output
+    memset(pC, 0, sizeof(*pC));
+
+    pC->rx_read = 0 - (unsigned long)iWaiting; // so what's waiting now isn't counted twice
   }
-#endif // SERIAL_1_RTS_ENABLED
 
-  // back to regular serial I/O handling
+  SREG = oldSREG;
 
-  // if the head isn't ahead of the tail, we don't have any characters
-  if (_rx_buffer->head == _rx_buffer->tail)
+  return true;
+#else // !SERIAL_STATS_ENABLED
+  return false;
+#endif // SERIAL_STATS_ENABLED
+}
+
+// RTS watermarks, as the number of bytes waiting in the RX buffer.  RTS goes high ('stop') when
+// it reaches 'highWater', and low again when 'read()' brings it down to 'lowWater'.  'highWater'
+// must be less than the buffer size, and more than 'lowWater'.  Returns false if the values
+// aren't valid, or this port has no RTS (SERIAL_n_RTS_PORT_NAME).  'begin()' doesn't change them.
+
+bool HardwareSerial::setFlowControl(unsigned int highWater, unsigned int lowWater)
+{
+#ifdef SERIAL_RTS_ENABLED
+const struct serial_port *pP = serial_port_from_usart(_usart); // works before 'begin()', too
+uint8_t oldSREG;
+
+
+  if(!pP || !pP->pFlow ||
+     highWater >= RING_BUFFER_SIZE(_rx_buffer) || lowWater >= highWater)
   {
-    iRval = -1;
+    return false;
   }
-  else
-  {
-    iRval = (int)(_rx_buffer->buffer[_rx_buffer->tail]);
 
-    _rx_buffer->tail = (unsigned int)(_rx_buffer->tail + 1) % SERIAL_BUFFER_SIZE;
-  }
+  oldSREG = SREG;
+  cli(); // the ISR uses these
 
-  SREG = oldSREG; // restore interrupt flag
+  pP->pFlow->high = (ring_index_t)highWater;
+  pP->pFlow->low = (ring_index_t)lowWater;
 
-  return iRval;
+  SREG = oldSREG;
+
+  if(pP->pFlow->stopped) // a higher 'low' might let RTS go low right now
+  {
+    serial_rts_release(pP->pFlow, _rx_buffer);
+  }
+
+  return true;
+#else // !SERIAL_RTS_ENABLED
+  return false;
+#endif // SERIAL_RTS_ENABLED
 }
 
 void HardwareSerial::flush()
 {
   // TODO:  force an 'sei' here?
 
+#ifdef SERIAL_TX_DMA_ENABLED
+  // the DMA might be between spans, so wait for the buffer to drain first
+  if(_tx_dma)
+  {
+    if(SREG & CPU_I_bm)
+    {
+      while(_tx_buffer->head != ring_load(&(_tx_buffer->tail))) { }
+    }
+    else
+    {
+      // interrupts are off, so the DMA 'complete' ISR can't start the next span.  Do it here,
+      // same as 'write()' does.  While there's still data in the buffer, any TXCIF is from a
+      // gap between spans, not the end, so clear it.
+
+      while(_tx_buffer->head != _tx_buffer->tail)
+      {
+        serial_tx_dma_poll(_tx_dma); // advances the tail, and starts the next span
+
+        if(_tx_buffer->head != _tx_buffer->tail)
+        {
+          tx_kick(); // does nothing if a span is already running
+
+          _usart->STATUS = _BV(USART_TXCIF_bp); // other bits must be written as zero
+        }
+      }
+    }
+  }
+#endif // SERIAL_TX_DMA_ENABLED
+
+#ifdef SERIAL_RS485_ENABLED
+  // the TXC ISR clears TXCIF when it drops the DE pin, so wait for THAT instead
+  if(_de && _de->pPort && (SREG & CPU_I_bm))
+  {
+    while(_de->busy) { }
+
+    transmitting = false;
+    return;
+  }
+#endif // SERIAL_RS485_ENABLED
+
   // DATA is kept full while the buffer is not empty, so TXCIF triggers when EMPTY && SENT
   while (transmitting && !(_usart->STATUS & _BV(USART_TXCIF_bp))) // TXCIF bit 6 indicates transmit complete
     ;
 
   transmitting = false;
+
+#ifdef SERIAL_RS485_ENABLED
+  if(_de && _de->pPort) // interrupts are off, so the TXC ISR can't drop DE.  do it here.
+  {
+    _de->pPort->OUTCLR = _de->bPin;
+    _de->busy = 0;
+  }
+#endif // SERIAL_RS485_ENABLED
 }
 
-size_t HardwareSerial::write(uint8_t c)
+// start (or re-start) transmitting after the head moves.  Both paths turn interrupts off, since
+// the DRE and TXC ISRs also change CTRLA, and the DMA 'complete' ISR also starts spans.  If the
+// DRE ISR runs afterwards and finds the buffer empty, it just turns itself off again.
+
+void HardwareSerial::tx_kick(void)
 {
-register unsigned int i1;
-uint8_t oldSREG;
+#ifdef SERIAL_RS485_ENABLED
+  if(_de && _de->pPort)
+  {
+    // the head has already moved, so if the TXC ISR runs after this it sees 'head != tail'
+    // and leaves DE alone.  If it ran before, it can't undo this.
+    _de->busy = 1;
+    _de->pPort->OUTSET = _de->bPin; // driver on, BEFORE the DRE interrupt (or DMA) starts
+  }
+#endif // SERIAL_RS485_ENABLED
+
+#ifdef SERIAL_TX_DMA_ENABLED
+  if(_tx_dma)
+  {
+    uint8_t oldSREG = SREG;
+
+    cli();
+
+    if(!_tx_dma->len) // DMA idle, so there's no DRE handler to clear TXCIF for me
+    {
+      _usart->STATUS = _BV(USART_TXCIF_bp); // other bits must be written as zero
+    }
+
+    serial_tx_dma_start(_tx_dma); // does nothing if a span is already in progress
 
+#ifdef SERIAL_RS485_ENABLED
+    if(_de && _de->pPort)
+    {
+      _usart->CTRLA |= SERIAL_TXC_INT_LEVEL; // TXC drops DE once the DMA is done (see 'serial_txc')
+    }
+#endif // SERIAL_RS485_ENABLED
+
+    SREG = oldSREG;
+  }
+  else
+#endif // SERIAL_TX_DMA_ENABLED
+  {
+    uint8_t oldSREG = SREG;
+
+    cli(); // read-modify-write on CTRLA, and the TXC ISR clears its own level bits
+
+    // (re)enable the DRE interrupt (sect 19.14.3).  The RXC and TXC levels are left alone, so
+    // RS-485 still gets its TXC interrupt.  If CTS is holding off the transmitter, the DRE ISR
+    // sees that, turns DRE off again, and arms the CTS pin change interrupt to restart it.
+    _usart->CTRLA |= _BV(USART_DREINTLVL1_bp) | _BV(USART_DREINTLVL0_bp);
 
-  oldSREG = SREG; // get this FIRST
-  cli(); // in case I'm currently doing somethign ELSE that affects the _tx_buffer
+    SREG = oldSREG;
+  }
+}
+
+// NOTE:  'write()' is the only producer for the TX ring buffer, so it doesn't turn interrupts
+//        off (see 'ring_load').  That also means you can't write to the same port from the
+//        sketch AND from an ISR without protecting it yourself.
+
+size_t HardwareSerial::write(uint8_t c)
+{
+register ring_index_t iHead, i1;
 
-  i1 = (unsigned int)((_tx_buffer->head + 1) % SERIAL_BUFFER_SIZE); // next head after this char
+
+  iHead = _tx_buffer->head; // only I change this
+  i1 = (ring_index_t)((iHead + 1) & _tx_buffer->mask); // next head after this char
 
   // If the output buffer is full, there's nothing for it other than to
   // wait for the interrupt handler to empty it a bit
 
-  if (i1 == _tx_buffer->tail) // the buffer is still 'full'?
+  if (i1 == ring_load(&(_tx_buffer->tail))) // the buffer is 'full'?
   {
-    // if the interrupt flag is cleared in 'oldSREG' we must call the ISR directly
-    // otherwise we can set the int flag and wait for it
+    // if the interrupt flag is cleared we must call the ISR directly
+    // otherwise we can just wait for it
 
-    if(oldSREG & CPU_I_bm) // interrupts were enabled
+    if(SREG & CPU_I_bm) // interrupts are enabled
     {
-      // make sure that the USART's RXC and DRE interupts are enabled
-      _usart->CTRLA = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp)
-                    | _BV(USART_DREINTLVL1_bp) | _BV(USART_DREINTLVL0_bp); // set int bits for rx and dre (sect 19.14.3)
-    }
+      tx_kick(); // make sure the DRE interrupt (or the DMA) is running
 
-    do
+      while(i1 == ring_load(&(_tx_buffer->tail))) { } // the ISR will make room
+    }
+    else
     {
-      if(oldSREG & CPU_I_bm) // interrupts were enabled
-      {
-        sei(); // re-enable interrupts
-        __builtin_avr_delay_cycles((F_CPU / 2000000) + 1); // delay ~17 cycles, enough time to allow for an interrupt to happen
-      }
-      else
+      do
       {
         call_isr(_usart); // this will block until there is a serial interrupt condition, but in an ISR-safe manner
+
+#ifdef SERIAL_TX_DMA_ENABLED
+        if(_tx_dma)
+        {
+          serial_tx_dma_poll(_tx_dma); // DMA completion flag, same idea
+        }
+#endif // SERIAL_TX_DMA_ENABLED
+      } while (i1 == ring_load(&(_tx_buffer->tail))); // while the buffer is still 'full'
+    }
+  }
+
+  _tx_buffer->buffer[iHead] = c;
+  ring_store(&(_tx_buffer->head), i1); // publish it AFTER the data is in the buffer
+
+#ifdef SERIAL_STATS_ENABLED
+  if(_stats)
+  {
+    _stats->tx_bytes++;
+    serial_high_water(&(_stats->tx_high), _tx_buffer);
+  }
+#endif // SERIAL_STATS_ENABLED
+
+  transmitting = true;
+
+  // NOTE:  the DRE handler clears TXCIF each time it loads DATA, so I don't do it here.  Without
+  //        interrupts off, clearing it here could eat the one for the last byte.
+  tx_kick();
+
+  return 1;
+}
+
+// block write - this overrides 'Print::write(const uint8_t *, size_t)', which would otherwise call
+// 'write(uint8_t)' once per byte.  Each chunk is copied into the ring buffer with interrupts
+// still on, wrapping at the end of the buffer, and the DRE interrupt (or DMA) is armed once per
+// chunk rather than once per byte.  When the buffer is full, 'write(uint8_t)' does the waiting
+// for me, since it already handles the 'interrupts disabled' case.
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+size_t nRval = size;
+register unsigned int iHead, iTail, iLen;
+
+
+  while(size > 0)
+  {
+    iHead = _tx_buffer->head; // only I change this
+    iTail = ring_load(&(_tx_buffer->tail));
+
+    // the free space I can fill without wrapping.  the buffer is 'full' when head is one
+    // behind the tail, so there's always one unused byte
+    if(iHead >= iTail)
+    {
+      iLen = RING_BUFFER_SIZE(_tx_buffer) - iHead;
+
+      if(!iTail) // can't fill the last byte, head would wrap to the tail
+      {
+        iLen--;
       }
+    }
+    else
+    {
+      iLen = iTail - iHead - 1;
+    }
+
+    if(!iLen) // buffer is full
+    {
+      write(*(buffer++)); // this one waits for space, with or without interrupts
+      size--;
 
-      i1 = (unsigned int)((_tx_buffer->head + 1) % SERIAL_BUFFER_SIZE); // next head after this char
+      continue;
+    }
+
+    if(iLen > size)
+    {
+      iLen = size;
+    }
+
+    memcpy((void *)&(_tx_buffer->buffer[iHead]), buffer, iLen);
+
+    ring_store(&(_tx_buffer->head), (ring_index_t)((iHead + iLen) & _tx_buffer->mask));
+
+#ifdef SERIAL_STATS_ENABLED
+    if(_stats)
+    {
+      _stats->tx_bytes += iLen;
+      serial_high_water(&(_stats->tx_high), _tx_buffer);
+    }
+#endif // SERIAL_STATS_ENABLED
+
+    transmitting = true;
 
-      cli(); // do this regardless (smaller than another 'if' block, no harm if already clear)
+    tx_kick(); // the DRE handler clears TXCIF (see 'write(uint8_t)')
 
-    } while (i1 == _tx_buffer->tail); // while the buffer is still 'full'
+    buffer += iLen;
+    size -= iLen;
   }
 
-  // if I didn't have to wait for buffer space, I'm already covered
+  return nRval;
+}
 
-  _tx_buffer->buffer[_tx_buffer->head] = c;
-  _tx_buffer->head = i1; // I already incremented it earlier, assume nobody ELSE modifies this
+unsigned long HardwareSerial::actualBaud(void)
+{
+uint32_t baud_setting = _usart->BAUDCTRLA | ((uint16_t)_usart->BAUDCTRLB << 8);
 
-  // NOTE:  this messes with flow control.  it will still work, however
-//  _usart->CTRLA |= _BV(1) | _BV(0); // make sure I (re)enable the DRE interrupt (sect 19.14.3)
-  _usart->CTRLA = _BV(USART_RXCINTLVL1_bp) | _BV(USART_RXCINTLVL0_bp)
-                | _BV(USART_DREINTLVL1_bp) | _BV(USART_DREINTLVL0_bp); // set int bits for rx and dre (sect 19.14.3)
+  if(_usart->CTRLB & _BV(USART_CLK2X_bp))
+  {
+    baud_setting |= SERIAL_BAUD_CLK2X;
+  }
 
-  transmitting = true;
-//  sbi(_usart->STATUS,6);  // clear the TXCIF bit by writing a 1 to its location (sect 19.14.2)
-  _usart->STATUS = _BV(USART_TXCIF_bp); // other bits must be written as zero
+  return serial_baud_actual(clock_hz(), baud_setting);
+}
 
-  SREG=oldSREG; // interrupts re-enabled
+void HardwareSerial::updateBaud(void)
+{
+uint32_t baud_setting;
 
-  return 1;
+
+  if(!_baud || !(_usart->CTRLB & (_BV(USART_RXEN_bp) | _BV(USART_TXEN_bp))))
+  {
+    return; // not running
+  }
+
+  baud_setting = serial_baud_setting(clock_hz(), _baud);
+
+  _usart->BAUDCTRLA = (uint8_t)(baud_setting & 0xff);
+  _usart->BAUDCTRLB = (uint8_t)(baud_setting >> 8);
+
+  if(baud_setting & SERIAL_BAUD_CLK2X)
+  {
+    _usart->CTRLB |= _BV(USART_CLK2X_bp);
+  }
+  else
+  {
+    _usart->CTRLB &= ~_BV(USART_CLK2X_bp);
+  }
+}
+
+int HardwareSerial::baudError(void)
+{
+long lDiff;
+
+  if(!_baud)
+  {
+    return 0; // not started
+  }
+
+  lDiff = (long)actualBaud() - (long)_baud;
+
+  if(_baud < 200000L) // the '* 10000' won't overflow
+  {
+    return (int)(lDiff * 10000L / (long)_baud);
+  }
+
+  return (int)(lDiff * 100L / (long)(_baud / 100));
+}
+
+unsigned long HardwareSerial::beginAutoBaud(uint8_t config, unsigned long timeout)
+{
+#ifdef SERIAL_AUTOBAUD_ENABLED
+PORT_t *pPort;
+uint8_t bitTX, bitRX;
+unsigned long lTotal, lBaud;
+
+
+  if(_usart->CTRLB & (_BV(USART_RXEN_bp) | _BV(USART_TXEN_bp)))
+  {
+    end(); // already running, so stop it (and flush) first
+  }
+
+  if(!serial_usart_pins(_usart, &pPort, &bitTX, &bitRX))
+  {
+    return 0;
+  }
+
+  lTotal = serial_autobaud_measure(pPort, bitRX, timeout);
+
+  if(!lTotal)
+  {
+    (&(pPort->PIN0CTRL))[bitRX] = 0; // timed out, put the RX pin back
+
+    return 0;
+  }
+
+  // 'lTotal' is (2 * SERIAL_AUTOBAUD_PERIODS) bit times.  8 * 32Mhz still fits in 32 bits
+  lBaud = ((2UL * SERIAL_AUTOBAUD_PERIODS) * clock_hz() + lTotal / 2) / lTotal;
+
+  lBaud = serial_autobaud_round(lBaud);
+
+  begin(lBaud, config); // 'serial_baud_setting()' for BSEL and BSCALE, same as any other rate
+
+  return lBaud;
+#else // SERIAL_AUTOBAUD_ENABLED
+  (void)config;
+  (void)timeout;
+
+  return 0; // no timer for it on this CPU
+#endif // SERIAL_AUTOBAUD_ENABLED
 }
 
 HardwareSerial::operator bool()
@@ -1623,19 +4309,19 @@ HardwareSerial Serial4(&rx_buffer4, &tx_buffer4, (uint16_t)&(SERIAL_3_USART_NAME
 #endif // SERIAL_3_PORT_NAME
 
 #ifdef SERIAL_4_PORT_NAME
-HardwareSerial Serial5(&rx_buffer5, &tx_buffer5, (uint16_t)&(SERIAL_3_USART_NAME));
+HardwareSerial Serial5(&rx_buffer5, &tx_buffer5, (uint16_t)&(SERIAL_4_USART_NAME));
 #endif // SERIAL_4_PORT_NAME
 
 #ifdef SERIAL_5_PORT_NAME
-HardwareSerial Serial6(&rx_buffer6, &tx_buffer6, (uint16_t)&(SERIAL_3_USART_NAME));
+HardwareSerial Serial6(&rx_buffer6, &tx_buffer6, (uint16_t)&(SERIAL_5_USART_NAME));
 #endif // SERIAL_5_PORT_NAME
 
 #ifdef SERIAL_6_PORT_NAME
-HardwareSerial Serial7(&rx_buffer7, &tx_buffer7, (uint16_t)&(SERIAL_3_USART_NAME));
+HardwareSerial Serial7(&rx_buffer7, &tx_buffer7, (uint16_t)&(SERIAL_6_USART_NAME));
 #endif // SERIAL_6_PORT_NAME
 
 #ifdef SERIAL_7_PORT_NAME
-HardwareSerial Serial8(&rx_buffer8, &tx_buffer8, (uint16_t)&(SERIAL_3_USART_NAME));
+HardwareSerial Serial8(&rx_buffer8, &tx_buffer8, (uint16_t)&(SERIAL_7_USART_NAME));
 #endif // SERIAL_7_PORT_NAME
 
 
@@ -34,6 +34,34 @@
 #include "Stream.h"
 
 struct ring_buffer;
+struct serial_tx_dma; // see HardwareSerial.cpp
+struct serial_rx_stamp; // see HardwareSerial.cpp
+struct serial_de; // see HardwareSerial.cpp
+struct serial_mpcm; // see HardwareSerial.cpp
+struct serial_counters; // see HardwareSerial.cpp
+struct serial_flow; // see HardwareSerial.cpp
+
+// a snapshot of a serial port's statistics, see 'HardwareSerial::getStats()'
+struct serial_stats
+{
+  unsigned long rx_bytes;     // bytes received, including the ones that were dropped
+  unsigned long tx_bytes;     // bytes queued for transmit
+  unsigned int rx_overflow;   // received bytes dropped because the RX buffer was full (the sketch is too slow)
+  unsigned int rx_overrun;    // hardware overruns (the RXC interrupt was held off too long)
+  unsigned int rx_framing;    // framing errors (noise, or the wrong baud rate)
+  unsigned int rx_parity;     // parity errors
+  unsigned int rx_high_water; // the most bytes that were ever waiting in the RX buffer
+  unsigned int tx_high_water; // the most bytes that were ever waiting in the TX buffer
+};
+
+// baud rate calculation (see below).  The 'baud setting' is BAUDCTRLB:BAUDCTRLA in the lower
+// 16 bits, plus SERIAL_BAUD_CLK2X when the USART's CLK2X bit must be set.
+uint32_t serial_baud_setting(unsigned long f_per, unsigned long baud);
+unsigned long serial_baud_actual(unsigned long f_per, uint32_t baud_setting);
+
+// pin re-mapping and port/pin assignment for a serial port's USART (see HardwareSerial.cpp).
+// returns false if it's not one of the serial ports.  'USARTSPI' uses this, too.
+bool serial_usart_pins(volatile USART_t *pU, PORT_t **ppPort, uint8_t *pbitTX, uint8_t *pbitRX);
 
 class HardwareSerial : public Stream
 {
@@ -43,23 +71,54 @@ class HardwareSerial : public Stream
     ring_buffer *_rx_buffer;
     ring_buffer *_tx_buffer;
     volatile USART_t *_usart;
+#if defined(DMA_CH0_CTRLA) || defined(EDMA_CH0_CTRLA)
+    struct serial_tx_dma *_tx_dma; // non-NULL when a DMA channel drains the TX buffer
+#endif // DMA_CH0_CTRLA, EDMA_CH0_CTRLA
+    struct serial_rx_stamp *_rx_stamp; // non-NULL when received bytes are time-stamped
+    struct serial_de *_de; // RS-485 driver enable pin state (NULL without SERIAL_RS485_ENABLED)
+    struct serial_mpcm *_mpcm; // multi-processor (9-bit address) mode state
+    struct serial_counters *_stats; // statistics (NULL with SERIAL_NO_STATS)
+    struct serial_flow *_flow; // RTS pin and watermarks (NULL if this port has no RTS)
     bool transmitting;
+    unsigned long _baud; // the requested baud rate, from 'begin()'
+    void tx_kick(void); // start the DRE interrupt (or the DMA) after the TX head moves
   public:
     HardwareSerial(ring_buffer *rx_buffer, ring_buffer *tx_buffer, uint16_t usart)  __attribute__ ((noinline));
     void init(ring_buffer *rx_buffer, ring_buffer *tx_buffer, uint16_t usart) __attribute__ ((noinline));
-    void begin(unsigned long);
-    void begin(unsigned long, uint8_t);
+    inline void begin(unsigned long);
+    inline void begin(unsigned long, uint8_t);
+    inline void begin(unsigned long baud, uint8_t config, int dePin); // RS-485, see 'setDriverEnable()'
+    void beginWithSetting(unsigned long baud, uint32_t baud_setting, uint8_t config); // 'begin()' uses this
     void end();
     virtual int available(void);
     virtual int peek(void);
     virtual int read(void);
+    virtual int read(uint8_t *buffer, size_t length); // block read, does not wait.  returns # of bytes read
+    int readWithTimestamp(unsigned long *pTime, bool *pGap = NULL); // 'read()' plus 'micros()' when it arrived
+    void setRxGap(unsigned long uSec); // inter-byte gap that starts a new frame, 0 to disable
+    int availableFrame(void); // length of the complete frame at the front of the RX buffer, or 0
+    void setIdleTime(unsigned int bits); // idle line detector, 'bits' bit times of quiet after RX (0 is off)
+    void setIdleCallback(void (*pCallback)(void)); // called from the timer ISR when the RX line goes idle
+    bool rxIdle(void); // true (once) after the RX line goes idle
+    bool setDriverEnable(int dePin); // RS-485 DE pin, HIGH while transmitting (-1 for none).  needs SERIAL_RS485
+    void setNodeAddress(int addr, int broadcast = -1); // multi-drop, receive only after a matching address (-1 for off)
+    int read9(void); // 'read()' with the 9th bit in bit 8 (needs SERIAL_n_RX_9BIT)
+    size_t writeAddress(uint8_t addr); // send an address frame (9th bit set)
+    bool getStats(struct serial_stats *pStats, bool bReset = false); // false (and all zeros) with SERIAL_NO_STATS
+    bool setFlowControl(unsigned int highWater, unsigned int lowWater); // RTS watermarks, bytes waiting in the RX buffer
     virtual void flush(void);
     virtual size_t write(uint8_t);
     inline size_t write(unsigned long n) { return write((uint8_t)n); }
     inline size_t write(long n) { return write((uint8_t)n); }
     inline size_t write(unsigned int n) { return write((uint8_t)n); }
     inline size_t write(int n) { return write((uint8_t)n); }
-    using Print::write; // pull in write(str) and write(buf, size) from Print
+    virtual size_t write(const uint8_t *buffer, size_t size); // block write, copies a chunk at a time (interrupts stay on)
+    unsigned long actualBaud(void); // the baud rate the USART is ACTUALLY running at
+    int baudError(void); // (actual - requested) / requested, in units of 0.01%
+    void updateBaud(void); // re-calculate BSEL/BSCALE for the current CPU clock (see 'clock_switch()' in wiring.c)
+    unsigned long beginAutoBaud(uint8_t config, unsigned long timeout = 10000); // wait for 'U' (0x55), 'begin()' at its baud rate.  0 on timeout
+    inline unsigned long beginAutoBaud(void);
+    using Print::write; // pull in write(str) and write(const char *, size) from Print
     operator bool();
 };
 
@@ -97,6 +156,122 @@ class HardwareSerial : public Stream
 #define SERIAL_7O2 (SERIAL_7N2 | SERIAL_ODD_PARITY)
 #define SERIAL_8O2 (SERIAL_8N2 | SERIAL_ODD_PARITY)
 
+// 9-bit frames.  In multi-processor mode the 9th bit marks an address (see 'setNodeAddress()')
+#define SERIAL_9N1 0x07
+#define SERIAL_9N2 (SERIAL_9N1 | SERIAL_TWO_STOP)
+#define SERIAL_9E1 (SERIAL_9N1 | SERIAL_EVEN_PARITY)
+#define SERIAL_9E2 (SERIAL_9N2 | SERIAL_EVEN_PARITY)
+#define SERIAL_9O1 (SERIAL_9N1 | SERIAL_ODD_PARITY)
+#define SERIAL_9O2 (SERIAL_9N2 | SERIAL_ODD_PARITY)
+
+
+// BAUD RATE CALCULATION
+// ---------------------
+// X = 16 (or 8 with CLK2X) and 'D' is the ideal divisor, f_per / (X * baud).  From table 19-1,
+//
+//   bscale >= 0:  baud = f_per / (X * (2 ^ bscale) * (bsel + 1))  i.e. D = (2 ^ bscale) * (bsel + 1)
+//   bscale < 0:   baud = f_per / (X * ((2 ^ bscale) * bsel + 1))  i.e. D = (2 ^ bscale) * bsel + 1
+//
+// Every divisor that a coarser 'bscale' can represent can also be represented by a finer one,
+// so the best fit is simply the most negative 'bscale' whose rounded 'bsel' still fits in 12
+// bits.  No trial and error, no floating point.  CLK2X halves the number of samples per bit,
+// so it's only used when 1x can't reach the baud rate, or when it more than halves the error.
+//
+// When the baud rate is a constant, 'begin()' lets the compiler do all of this via the macros
+// below.  Otherwise 'serial_baud_setting()' does exactly the same thing at run time.  Either
+// way, if the baud rate is too fast you get the fastest one, and too slow gets the slowest.
+
+#define SERIAL_BAUD_CLK2X 0x10000UL /* 'baud setting' bit for CLK2X */
+
+// integer part and remainder of 'D'
+#define SERIAL_BAUD_XB(B,X) ((unsigned long)(X) * (unsigned long)(B))
+#define SERIAL_BAUD_Q(F,B,X) ((unsigned long)(F) / SERIAL_BAUD_XB(B,X))
+#define SERIAL_BAUD_R(F,B,X) ((unsigned long)(F) % SERIAL_BAUD_XB(B,X))
+
+// the fraction part of 'D' times 2^S, rounded (the 'else' avoids overflow for VERY high baud rates)
+#define SERIAL_BAUD_FRAC(F,B,X,S) \
+  (SERIAL_BAUD_XB(B,X) < 0x2000000UL \
+   ? ((SERIAL_BAUD_R(F,B,X) << (S)) + (SERIAL_BAUD_XB(B,X) >> 1)) / SERIAL_BAUD_XB(B,X) \
+   : SERIAL_BAUD_R(F,B,X) / (SERIAL_BAUD_XB(B,X) >> (S)))
+
+// rounded 'bsel' for bscale = -S (S is 1 to 7), and for bscale = S (S is 0 to 7)
+#define SERIAL_BAUD_BSEL_NEG(F,B,X,S) (((SERIAL_BAUD_Q(F,B,X) - 1) << (S)) + SERIAL_BAUD_FRAC(F,B,X,S))
+#define SERIAL_BAUD_BSEL_POS(F,B,X,S) \
+  (((unsigned long)(F) + (SERIAL_BAUD_XB(B,X) << (S) >> 1)) / (SERIAL_BAUD_XB(B,X) << (S)) - 1)
+
+// 'baud setting' for these.  a 'bsel' of zero with a negative bscale is the same as bscale=0, bsel=0
+#define SERIAL_BAUD_NEG(F,B,X,S) \
+  (SERIAL_BAUD_BSEL_NEG(F,B,X,S) ? (((16UL - (S)) << 12) | SERIAL_BAUD_BSEL_NEG(F,B,X,S)) : 0UL)
+#define SERIAL_BAUD_POS(F,B,X,S) (((unsigned long)(S) << 12) | SERIAL_BAUD_BSEL_POS(F,B,X,S))
+
+#define SERIAL_BAUD_SCALE(F,B,X) \
+  (!SERIAL_BAUD_Q(F,B,X) ? 0UL /* too fast, use the fastest */ \
+   : SERIAL_BAUD_BSEL_NEG(F,B,X,7) <= 4095 ? SERIAL_BAUD_NEG(F,B,X,7) \
+   : SERIAL_BAUD_BSEL_NEG(F,B,X,6) <= 4095 ? SERIAL_BAUD_NEG(F,B,X,6) \
+   : SERIAL_BAUD_BSEL_NEG(F,B,X,5) <= 4095 ? SERIAL_BAUD_NEG(F,B,X,5) \
+   : SERIAL_BAUD_BSEL_NEG(F,B,X,4) <= 4095 ? SERIAL_BAUD_NEG(F,B,X,4) \
+   : SERIAL_BAUD_BSEL_NEG(F,B,X,3) <= 4095 ? SERIAL_BAUD_NEG(F,B,X,3) \
+   : SERIAL_BAUD_BSEL_NEG(F,B,X,2) <= 4095 ? SERIAL_BAUD_NEG(F,B,X,2) \
+   : SERIAL_BAUD_BSEL_NEG(F,B,X,1) <= 4095 ? SERIAL_BAUD_NEG(F,B,X,1) \
+   : SERIAL_BAUD_BSEL_POS(F,B,X,0) <= 4095 ? SERIAL_BAUD_POS(F,B,X,0) \
+   : SERIAL_BAUD_BSEL_POS(F,B,X,1) <= 4095 ? SERIAL_BAUD_POS(F,B,X,1) \
+   : SERIAL_BAUD_BSEL_POS(F,B,X,2) <= 4095 ? SERIAL_BAUD_POS(F,B,X,2) \
+   : SERIAL_BAUD_BSEL_POS(F,B,X,3) <= 4095 ? SERIAL_BAUD_POS(F,B,X,3) \
+   : SERIAL_BAUD_BSEL_POS(F,B,X,4) <= 4095 ? SERIAL_BAUD_POS(F,B,X,4) \
+   : SERIAL_BAUD_BSEL_POS(F,B,X,5) <= 4095 ? SERIAL_BAUD_POS(F,B,X,5) \
+   : SERIAL_BAUD_BSEL_POS(F,B,X,6) <= 4095 ? SERIAL_BAUD_POS(F,B,X,6) \
+   : SERIAL_BAUD_BSEL_POS(F,B,X,7) <= 4095 ? SERIAL_BAUD_POS(F,B,X,7) \
+   : 0x7fffUL /* too slow, use the slowest */)
+
+// the divisor that a 'baud setting' ACTUALLY gives you, times 128 (7 fraction bits)
+#define SERIAL_BAUD_DEFF128(V) \
+  (((V) & 0x8000UL) ? (128UL + (((unsigned long)(V) & 0xfffUL) << ((((V) >> 12) & 15) - 9))) \
+                    : ((((unsigned long)(V) & 0xfffUL) + 1) << (7 + (((V) >> 12) & 7))))
+
+// the baud rate that a 'baud setting' ACTUALLY gives you
+#define SERIAL_BAUD_ACTUAL(F,V) \
+  (((((unsigned long)(F) / (((V) & SERIAL_BAUD_CLK2X) ? 8 : 16)) << 7) + (SERIAL_BAUD_DEFF128(V) >> 1)) \
+   / SERIAL_BAUD_DEFF128(V))
+
+#define SERIAL_BAUD_ERR(F,B,V) \
+  (SERIAL_BAUD_ACTUAL(F,V) > (B) ? SERIAL_BAUD_ACTUAL(F,V) - (B) : (B) - SERIAL_BAUD_ACTUAL(F,V))
+
+#define SERIAL_BAUD_SETTING_1X(F,B) SERIAL_BAUD_SCALE(F,B,16)
+#define SERIAL_BAUD_SETTING_2X(F,B) (SERIAL_BAUD_SCALE(F,B,8) | SERIAL_BAUD_CLK2X)
+
+// the 'baud setting' for peripheral clock 'F' and baud rate 'B'
+#define SERIAL_BAUD_SETTING(F,B) \
+  (!(B) ? 0x7fffUL \
+   : (!SERIAL_BAUD_Q(F,B,16) \
+      || SERIAL_BAUD_ERR(F,B,SERIAL_BAUD_SETTING_1X(F,B)) > 2 * SERIAL_BAUD_ERR(F,B,SERIAL_BAUD_SETTING_2X(F,B))) \
+     ? SERIAL_BAUD_SETTING_2X(F,B) : SERIAL_BAUD_SETTING_1X(F,B))
+
+// 'begin()' is inlined so that a constant baud rate is calculated at compile time
+
+inline __attribute__((always_inline)) void HardwareSerial::begin(unsigned long baud, uint8_t config)
+{
+  beginWithSetting(baud,
+                   __builtin_constant_p(baud) ? SERIAL_BAUD_SETTING(F_CPU, baud)
+                                              : serial_baud_setting(F_CPU, baud),
+                   config);
+}
+
+inline __attribute__((always_inline)) void HardwareSerial::begin(unsigned long baud, uint8_t config, int dePin)
+{
+  begin(baud, config);
+  setDriverEnable(dePin);
+}
+
+inline __attribute__((always_inline)) void HardwareSerial::begin(unsigned long baud)
+{
+  begin(baud, SERIAL_8N1); // eliminated replicated code (12/9/2014)
+}
+
+inline unsigned long HardwareSerial::beginAutoBaud(void)
+{
+  return beginAutoBaud(SERIAL_8N1);
+}
+
 
 // this is where I must include 'pins_arduino.h' to get the 'USBCON' definition
 #include "pins_arduino.h"
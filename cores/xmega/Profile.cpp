@@ -0,0 +1,174 @@
+/*
+  Profile.cpp - cycle-counting profiler scopes, using 'cycles()'
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  See Profile.h for how to use it
+*/
+
+#include "Arduino.h"
+#include "Profile.h"
+
+const uint8_t profile_scopes = PROFILE_SCOPES;
+
+static struct profile_entry profile_table[PROFILE_SCOPES];
+static unsigned long profile_overhead = 0; // the cost of one 'cycles()', subtracted from each one
+static bool profile_calibrated = false;
+
+// interrupts must be OFF, so nothing gets in between the 2 calls
+static void profile_calibrate(void)
+{
+unsigned long l1, l2;
+uint8_t i1;
+
+
+  profile_overhead = 0xffffffffUL;
+
+  for(i1=0; i1 < 4; i1++) // the least of 4, in case a pending overflow made one of them longer
+  {
+    l1 = cycles();
+    l2 = cycles();
+
+    if(l2 - l1 < profile_overhead)
+    {
+      profile_overhead = l2 - l1;
+    }
+  }
+
+  profile_calibrated = true;
+}
+
+void profile_add(uint8_t scope, unsigned long clocks)
+{
+struct profile_entry *pE;
+uint8_t oldSREG;
+
+
+  if(scope >= PROFILE_SCOPES)
+  {
+    return;
+  }
+
+  pE = &(profile_table[scope]);
+
+  oldSREG = SREG;
+  cli(); // ISRs can use this too
+
+  if(!profile_calibrated)
+  {
+    profile_calibrate();
+  }
+
+  clocks = clocks > profile_overhead ? clocks - profile_overhead : 0;
+
+  if(!pE->count || clocks < pE->min)
+  {
+    pE->min = clocks;
+  }
+
+  if(clocks > pE->max)
+  {
+    pE->max = clocks;
+  }
+
+  pE->total += clocks;
+  pE->count++;
+
+  SREG = oldSREG;
+}
+
+void profile_name(uint8_t scope, const char *pName)
+{
+  if(scope < PROFILE_SCOPES)
+  {
+    profile_table[scope].pName = pName; // a single pointer store, ISRs don't touch it
+  }
+}
+
+void profile_reset(void)
+{
+uint8_t i1, oldSREG = SREG;
+
+
+  cli();
+
+  for(i1=0; i1 < PROFILE_SCOPES; i1++)
+  {
+    profile_table[i1].count = 0;
+    profile_table[i1].total = 0;
+    profile_table[i1].min = 0;
+    profile_table[i1].max = 0;
+  }
+
+  SREG = oldSREG;
+}
+
+bool profile_get(uint8_t scope, struct profile_entry *pEntry)
+{
+uint8_t oldSREG;
+
+
+  if(scope >= PROFILE_SCOPES)
+  {
+    return false;
+  }
+
+  oldSREG = SREG;
+  cli(); // a consistent copy
+
+  *pEntry = profile_table[scope];
+
+  SREG = oldSREG;
+
+  return true;
+}
+
+void profile_dump(Print &out)
+{
+struct profile_entry entry;
+uint8_t i1;
+
+
+  out.println(F("scope\tcount\tmin\tmax\tavg\ttotal (CPU clocks)"));
+
+  for(i1=0; i1 < PROFILE_SCOPES; i1++)
+  {
+    profile_get(i1, &entry); // a copy, since this can take a while
+
+    if(!entry.count)
+    {
+      continue;
+    }
+
+    out.print(i1);
+
+    if(entry.pName)
+    {
+      out.print(' ');
+      out.print(entry.pName);
+    }
+
+    out.print('\t');
+    out.print(entry.count);
+    out.print('\t');
+    out.print(entry.min);
+    out.print('\t');
+    out.print(entry.max);
+    out.print('\t');
+    out.print(entry.total / entry.count);
+    out.print('\t');
+    out.println(entry.total);
+  }
+}
@@ -0,0 +1,85 @@
+/*
+  Profile.h - cycle-counting profiler scopes, using 'cycles()'
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  Each 'scope' is a small number (0 through PROFILE_SCOPES - 1) with an entry in a fixed table
+  that keeps the count, min, max and total CPU clocks between PROFILE_BEGIN and PROFILE_END.
+  They work in ISRs too.  The overhead of reading 'cycles()' is measured once and subtracted.
+
+    #include <Profile.h>
+
+    ISR(...)
+    {
+      PROFILE_BEGIN(0);
+      ...
+      PROFILE_END(0);
+    }
+
+    void setup() { Serial.begin(115200); profile_name(0, "my ISR"); }
+    void loop() { delay(5000); profile_dump(Serial); }
+
+  BEGIN and END must be in the same block (BEGIN declares a local variable).  Define
+  PROFILE_DISABLE before including this to make them all go away without editing the code.
+
+  The table is part of the core, so its size is set when the CORE compiles.  To change it, define
+  PROFILE_SCOPES in 'pins_arduino.h' (defining it in a sketch does nothing to the table).  Use
+  'profile_scopes' to see how many there really are.  Out of range scopes are ignored.
+
+  Each BEGIN/END pair costs 2 'cycles()' calls and a table update with interrupts off, ~100-150
+  cycles with the cascaded 'millis' timers.
+*/
+
+#ifndef Profile_h
+#define Profile_h
+
+#include <inttypes.h>
+
+#include "Arduino.h"
+
+#ifndef PROFILE_SCOPES
+#define PROFILE_SCOPES 8 /* define it in 'pins_arduino.h' to change it */
+#endif // PROFILE_SCOPES
+
+#ifndef PROFILE_DISABLE
+
+#define PROFILE_BEGIN(N) unsigned long _profile_start_##N = cycles()
+#define PROFILE_END(N) profile_add((N), cycles() - _profile_start_##N)
+
+#else // PROFILE_DISABLE
+
+#define PROFILE_BEGIN(N)
+#define PROFILE_END(N)
+
+#endif // PROFILE_DISABLE
+
+struct profile_entry
+{
+  const char *pName;   // from 'profile_name()', NULL if none
+  unsigned long count; // number of times through
+  unsigned long total; // CPU clocks, all of them (wraps after ~134 seconds' worth at 32Mhz)
+  unsigned long min;
+  unsigned long max;
+};
+
+extern const uint8_t profile_scopes; // the size of the table, which is PROFILE_SCOPES when the core was built
+
+void profile_add(uint8_t scope, unsigned long clocks); // what PROFILE_END calls, safe from an ISR
+void profile_name(uint8_t scope, const char *pName);  // a name for 'profile_dump()', must stay valid
+void profile_reset(void); // zeros the counts (not the names)
+bool profile_get(uint8_t scope, struct profile_entry *pEntry); // a snapshot, false if 'scope' is out of range
+void profile_dump(Print &out); // a table of all of the scopes that have been used, in CPU clocks
+
+#endif // Profile_h
@@ -217,13 +217,31 @@ float Stream::parseFloat(char skipChar){
 size_t Stream::readBytes(char *buffer, size_t length)
 {
   size_t count = 0;
+  _startMillis = millis();
   while (count < length) {
-    int c = timedRead();
+    int n = read((uint8_t *)buffer + count, length - count);
+    if (n > 0) {
+      count += n;
+      _startMillis = millis(); // the timeout applies to each wait, same as 'timedRead()'
+    }
+    else if (millis() - _startMillis >= _timeout) {
+      break;
+    }
+  }
+  return count;
+}
+
+// default block read - one byte at a time via 'read()', stops when nothing is available
+int Stream::read(uint8_t *buffer, size_t length)
+{
+  size_t count = 0;
+  while (count < length) {
+    int c = read();
     if (c < 0) break;
-    *buffer++ = (char)c;
+    *buffer++ = (uint8_t)c;
     count++;
   }
-  return count;
+  return (int)count;
 }
 
 
@@ -50,6 +50,11 @@ class Stream : public Print
     virtual int peek() = 0;
     virtual void flush() = 0;
 
+    // read up to 'length' bytes that are already available, without waiting.  returns the
+    // number of bytes read (0 if none).  The default calls 'read()' for each byte; a derived
+    // class can override this with something faster.  'readBytes()' uses this.
+    virtual int read(uint8_t *buffer, size_t length);
+
     Stream() {_timeout=1000;}
 
 // parsing methods
@@ -45,6 +45,7 @@ Version Modified By Date     Comments
 #include <avr/pgmspace.h>
 #include "Arduino.h"
 #include "pins_arduino.h"
+#include "wiring_private.h" // voidFuncPtr, clock_set_change_hook, clock_pwm_clksel
 
 #if defined(TCC4) || !defined(TCC2)
 
@@ -68,6 +69,53 @@ Version Modified By Date     Comments
 static PORT_t *pTonePort = NULL; // must assign at startup due to ISR
 static uint8_t bToneMask = 0; // bitmask for tone pin
 static unsigned long toggle_count = 0; // number of cycles to output
+#ifdef CLOCK_SWITCHING
+static unsigned int tone_frequency = 0; // so it can be re-calculated when the clock changes
+static voidFuncPtr tone_clock_next = NULL; // the clock change hook that was there before, if any
+static bool tone_clock_hooked = false;
+#endif // CLOCK_SWITCHING
+
+// the pre-scaler (CTRLA) and period for a tone's frequency, using the current CPU clock
+static uint8_t tone_divisor(unsigned int frequency, uint16_t *pPer)
+{
+register int8_t b1;
+unsigned short per, w2;
+unsigned long ulTemp, ulClock = clock_hz();
+static const uint16_t aPreScaler[] PROGMEM = {1,2,4,8,64,256,1024}; // pre-scaler
+
+  // based on the frequency, set up the divider and period
+  // period is 16-bits
+
+  // NOTE:  use the smallest possible divisor
+
+  ulTemp = frequency * 16384L; // ideal counter 16384
+
+  for(b1=sizeof(aPreScaler)/sizeof(aPreScaler[0]) - 1; b1 > 0; b1--)
+  {
+    w2 = pgm_read_word(&(aPreScaler[0]) + b1);
+    if((ulClock / 2 / w2) >= ulTemp) // note that I flip the bit every OTHER cycle
+    {
+      break;
+    }
+  }
+
+  if(!b1)
+  {
+    w2 = 1; // make sure
+  }
+
+  // b1 is the divisor bit value for CTRLA, per caches the actual divisor
+
+  per = (ulClock / 2 / w2) / frequency;
+  if(!per)
+  {
+    per++;
+  }
+
+  *pPer = per;
+
+  return b1;
+}
 
 static void toneBegin(uint8_t _pin, uint8_t _div, uint16_t _per)
 {
@@ -116,51 +164,56 @@ static void toneBegin(uint8_t _pin, uint8_t _div, uint16_t _per)
   // tone starts now, shuts off when the 'toggle_count' hits zero
 }
 
-// frequency (in hertz) and duration (in milliseconds).
-
-void tone(uint8_t _pin, unsigned int frequency, unsigned long duration)
+#ifdef CLOCK_SWITCHING
+// called with interrupts off right after 'clock_switch()' (see wiring.c).  A tone that's playing
+// gets a new divisor and period, so the pitch stays the same.  'toggle_count' doesn't change.
+static void tone_clock_change(void)
 {
-register int8_t b1;
-unsigned short per, w2;
-unsigned long ulTemp;
-static const uint16_t aPreScaler[] PROGMEM = {1,2,4,8,64,256,1024}; // pre-scaler
+uint8_t b1;
+uint16_t per;
 
-  // frequency 
-
-  // based on the frequency, set up the divider and period
-  // period is 16-bits
-
-  // NOTE:  use the smallest possible divisor
-
-  if(!frequency)
+  if(toggle_count && pTonePort && tone_frequency)
   {
-    return;
-  }
-
-  ulTemp = frequency * 16384L; // ideal counter 16384
+    b1 = tone_divisor(tone_frequency, &per);
 
-  for(b1=sizeof(aPreScaler)/sizeof(aPreScaler[0]) - 1; b1 > 0; b1--)
-  {
-    w2 = pgm_read_word(&(aPreScaler[0]) + b1);
-    if(((unsigned long)F_CPU / 2 / w2) >= ulTemp) // note that I flip the bit every OTHER cycle
-    {
-      break;
-    }
+#if NUM_DIGITAL_PINS > 18 /* meaning there is a PORT E available */
+    TCE0_CTRLA = b1;
+    TCE0_PER = per;
+    TCE0_CNT = 0; // in case it's past the new period
+#elif defined(TCC4) // E series and anything else with 'TCC4'
+    TCC4_CTRLA = b1;
+    TCC4_PER = per;
+    TCC4_CNT = 0;
+#else // other stuff not yet explored by me
+    TCC0_CTRLA = b1;
+    TCC0_PER = per;
+    TCC0_CNT = 0;
+#endif // NUM_DIGITAL_PINS > 18
   }
 
-  if(!b1)
+  if(tone_clock_next)
   {
-    w2 = 1; // make sure
+    tone_clock_next(); // chained
   }
+}
+#endif // CLOCK_SWITCHING
 
-  // b1 is the divisor bit value for CTRLA, per caches the actual divisor
+// frequency (in hertz) and duration (in milliseconds).
 
-  per = (F_CPU / 2 / w2) / frequency;
-  if(!per)
+void tone(uint8_t _pin, unsigned int frequency, unsigned long duration)
+{
+uint8_t b1;
+uint16_t per;
+
+  // frequency 
+
+  if(!frequency)
   {
-    per++;
+    return;
   }
 
+  b1 = tone_divisor(frequency, &per);
+
   // Calculate the toggle count
   if (duration > 0)
   {
@@ -171,6 +224,16 @@ static const uint16_t aPreScaler[] PROGMEM = {1,2,4,8,64,256,1024}; // pre-scale
     toggle_count = -1;
   }
 
+#ifdef CLOCK_SWITCHING
+  tone_frequency = frequency;
+
+  if(!tone_clock_hooked) // only once, since other hooks may have chained onto mine
+  {
+    tone_clock_next = clock_set_change_hook(tone_clock_change);
+    tone_clock_hooked = true;
+  }
+#endif // CLOCK_SWITCHING
+
   toneBegin(_pin, b1, per);
 }
 
@@ -194,7 +257,7 @@ void disableTimer(uint8_t _timer)
 
 #if NUM_DIGITAL_PINS > 22 /* meaning PORTE has 8 pins */
 
-  TCE2_CTRLA = 5; // b0101 - divide by 64 - D manual 13.9.1
+  TCE2_CTRLA = clock_pwm_clksel(); // b0101 - divide by 64 - D manual 13.9.1
   TCE2_CTRLB = 0; // compare outputs disabled on all 8 bits (13.9.2)
 //  TCE2_CTRLC = 0; // when timer not running, sets compare (13.9.3)
   TCE2_CTRLE = 0x2; // b10 - 'split' mode - D manual 13.9.4
@@ -221,7 +284,7 @@ void disableTimer(uint8_t _timer)
 
 #else // 16-bit timer on TCE0
 
-  TCE0_CTRLA = 5; // b0101 - divide by 64 - D manual 12.11.1
+  TCE0_CTRLA = clock_pwm_clksel(); // b0101 - divide by 64 - D manual 12.11.1
   TCE0_CTRLB = TC_WGMODE_SS_gc; // single-slope PWM.  NOTE:  this counts UP, whereas the other timers count DOWN
                // other bits (high nybble) are OFF - they enable output on the 4 port E pins
 //  TCE0_CTRLC = 0; // when timer not running, sets compare (12.11.3)
@@ -252,7 +315,7 @@ void disableTimer(uint8_t _timer)
 
   // re-assign TCC0 defaults.  see 'wiring.c'
 
-  TCC4_CTRLA = 5; // b0101 - divide by 64 - E manual 13.13.1
+  TCC4_CTRLA = clock_pwm_clksel(); // b0101 - divide by 64 - E manual 13.13.1
   TCC4_CTRLB = TC45_BYTEM_BYTEMODE_gc | TC45_WGMODE_SINGLESLOPE_gc; // byte mode, single slope
 //  TCC5_CTRLC = 0; // when timer not running, sets compare (13.9.3)
   TCC4_CTRLD = 0; // events off
@@ -279,7 +342,7 @@ void disableTimer(uint8_t _timer)
 
   // re-assign TCC0 defaults.  see 'wiring.c'
 
-  TCC2_CTRLA = 5; // b0101 - divide by 64 - D manual 13.9.1
+  TCC2_CTRLA = clock_pwm_clksel(); // b0101 - divide by 64 - D manual 13.9.1
   TCC2_CTRLB = 0; // compare outputs disabled on all 8 bits (13.9.2)
 //  TCC2_CTRLC = 0; // when timer not running, sets compare (13.9.3)
   TCC2_CTRLE = 0x2; // b10 - 'split' mode - D manual 13.9.4
@@ -0,0 +1,412 @@
+/*
+  USARTSPI.cpp - master SPI (MSPI) mode on the xmega USARTs
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  See 'USARTSPI.h' for an example.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "Arduino.h"
+#include "pins_arduino.h"
+#include "wiring_private.h"
+#include "HardwareSerial.h"
+#include "USARTSPI.h"
+
+
+// ----------------------------------------------------------------------------------------
+//                               USART MASTER SPI (MSPI)
+//
+// 'A' manual section 19.11 (and 'D' manual 19.11).  In MSPI mode CMODE is 11, the CHSIZE bits
+// become UDORD (bit 2, 1 for LSB first) and UCPHA (bit 1), and the clock is
+//
+//   f_sck = f_per / (2 * (BSEL + 1))   with BSCALE 0 and CLK2X 0
+//
+// so the fastest is f_per / 2 (16Mhz at 32Mhz).  CPOL is done by inverting the XCK pin.  The
+// transmitter is double buffered, and so is the receiver, so the polled block transfer keeps
+// up to 2 bytes in flight.  That way the next byte is already in DATA when the previous one
+// finishes, and SCK doesn't stop between bytes until f_sck gets close to the loop speed.
+//
+// Polled loop cost, 32Mhz, -Os:  ~20-25 cycles per byte, so it keeps up with SCK up to ~8Mhz
+// (16 cycles per byte at 16Mhz is faster than the loop).  With DMA the bus runs at the full
+// rate and the CPU is free while it runs, plus ~2 cycles of bus time per byte per channel.
+//
+// DMA needs 2 channels per bus, one triggered by DRE (feeds DATA) and one by RXC (empties it).
+// Only the 'classic' DMA controller ('A' series and others with DMA_CH0_CTRLA) is supported.
+// Don't assign a channel that a serial port already uses (SERIAL_n_TX_DMA_CHANNEL).
+// ----------------------------------------------------------------------------------------
+
+#define USARTSPI_UDORD_bm 0x04 /* CHSIZE2 in MSPI mode, 1 = LSB first */
+#define USARTSPI_UCPHA_bm 0x02 /* CHSIZE1 in MSPI mode, 1 = sample on the trailing edge */
+
+#define USARTSPI_DMA_MIN 8 /* below this, the polled loop is faster than setting up the DMA */
+
+#if defined(DMA_CH0_CTRLA)
+// the DMA trigger source for the USART's RXC flag.  DRE is always the next one (RXC + 1)
+static uint8_t usartspi_dma_trigger(volatile USART_t *pU)
+{
+  if(pU == &USARTC0)
+  {
+    return DMA_CH_TRIGSRC_USARTC0_RXC_gc;
+  }
+#ifdef USARTC1
+  else if(pU == &USARTC1)
+  {
+    return DMA_CH_TRIGSRC_USARTC1_RXC_gc;
+  }
+#endif // USARTC1
+#ifdef USARTE0
+  else if(pU == &USARTE0)
+  {
+    return DMA_CH_TRIGSRC_USARTE0_RXC_gc;
+  }
+#endif // USARTE0
+#ifdef USARTE1
+  else if(pU == &USARTE1)
+  {
+    return DMA_CH_TRIGSRC_USARTE1_RXC_gc;
+  }
+#endif // USARTE1
+#ifdef USARTF0
+  else if(pU == &USARTF0)
+  {
+    return DMA_CH_TRIGSRC_USARTF0_RXC_gc;
+  }
+#endif // USARTF0
+#ifdef USARTF1
+  else if(pU == &USARTF1)
+  {
+    return DMA_CH_TRIGSRC_USARTF1_RXC_gc;
+  }
+#endif // USARTF1
+#ifdef USARTD1
+  else if(pU == &USARTD1)
+  {
+    return DMA_CH_TRIGSRC_USARTD1_RXC_gc;
+  }
+#endif // USARTD1
+
+  return DMA_CH_TRIGSRC_USARTD0_RXC_gc; // the only one that's left
+}
+
+static inline DMA_CH_t *usartspi_dma_ch(int8_t iChannel)
+{
+  return &(DMA.CH0) + iChannel; // CH0 through CH3 are contiguous
+}
+
+static void usartspi_dma_addr(DMA_CH_t *pCH, const volatile void *pSrc, const volatile void *pDest)
+{
+uint16_t wAddr = (uint16_t)pSrc;
+
+  pCH->SRCADDR0 = (uint8_t)wAddr;
+  pCH->SRCADDR1 = (uint8_t)(wAddr >> 8);
+  pCH->SRCADDR2 = 0;
+
+  wAddr = (uint16_t)pDest;
+
+  pCH->DESTADDR0 = (uint8_t)wAddr;
+  pCH->DESTADDR1 = (uint8_t)(wAddr >> 8);
+  pCH->DESTADDR2 = 0;
+}
+#endif // DMA_CH0_CTRLA
+
+
+USARTSPI::USARTSPI(uint16_t usart)
+{
+  _usart = (volatile USART_t *)usart;
+  _port = NULL;
+  _bitXCK = 1;
+  _dmaTX = _dmaRX = -1;
+  _dummyTX = 0xff;
+  _dummyRX = 0;
+}
+
+// 'clock' is the highest SCK frequency you want.  The actual one is the closest one that's
+// not faster (see 'actualClock()').  Returns false if the USART isn't one of the serial ports.
+
+bool USARTSPI::begin(unsigned long clock, uint8_t mode, uint8_t bitOrder)
+{
+uint8_t bitTX, bitRX, oldSREG;
+unsigned long lDiv;
+register8_t *pCTRL;
+
+
+  if(!clock)
+  {
+    clock = 1;
+  }
+
+  // BSEL = ceil(f_per / (2 * clock)) - 1, limited to 12 bits
+  lDiv = (clock_hz() / 2 + clock - 1) / clock; // the current clock, in case it was switched
+
+  if(lDiv > 0)
+  {
+    lDiv--;
+  }
+
+  if(lDiv > 0xfff)
+  {
+    lDiv = 0xfff;
+  }
+
+  oldSREG = SREG;
+  cli(); // same as 'HardwareSerial::begin()', interrupts off while I assign pins
+
+  if(!serial_usart_pins(_usart, &_port, &bitTX, &bitRX))
+  {
+    _port = NULL;
+    SREG = oldSREG;
+
+    return false;
+  }
+
+  _bitXCK = bitRX - 1; // XCK, RX, TX are always pins 1,2,3 or 5,6,7
+
+  _usart->CTRLA = 0; // no interrupts, this is polled (or DMA)
+  _usart->CTRLB = 0; // RX and TX off while I change things
+
+  // section 19.5 - TX high, XCK idle, both outputs.  'INVEN' on XCK gives me CPOL = 1
+  pCTRL = &(_port->PIN0CTRL);
+
+  pCTRL[_bitXCK] = (mode & 0x02) ? PORT_INVEN_bm : 0;
+  _port->OUTCLR = _BV(_bitXCK);
+  _port->DIRSET = _BV(_bitXCK);
+
+  pCTRL[bitTX] = 0; // totem, no pullup
+  _port->OUTSET = _BV(bitTX);
+  _port->DIRSET = _BV(bitTX);
+
+  pCTRL[bitRX] = 0;
+  _port->DIRCLR = _BV(bitRX); // MISO is an input
+
+  _usart->CTRLC = USART_CMODE_MSPI_gc
+                | (bitOrder == LSBFIRST ? USARTSPI_UDORD_bm : 0)
+                | ((mode & 0x01) ? USARTSPI_UCPHA_bm : 0);
+#ifdef USARTD0_CTRLD
+  _usart->CTRLD = 0;  // E5 has this register, must assign to zero
+#endif // USARTD0_CTRLD
+
+  _usart->BAUDCTRLA = (uint8_t)lDiv;
+  _usart->BAUDCTRLB = (uint8_t)(lDiv >> 8); // BSCALE must be 0 in MSPI mode
+
+  _usart->CTRLB = _BV(USART_RXEN_bp) | _BV(USART_TXEN_bp); // CLK2X must be 0 in MSPI mode
+
+  SREG = oldSREG;
+
+  return true;
+}
+
+void USARTSPI::end(void)
+{
+  if(!_port)
+  {
+    return;
+  }
+
+  while(!transferDone()) { } // let a DMA transfer finish
+
+  _usart->CTRLB = 0; // RX and TX off
+  _usart->CTRLC = 0; // back to async mode, for 'HardwareSerial::begin()'
+
+  (&(_port->PIN0CTRL))[_bitXCK] = 0; // no more 'INVEN' on XCK
+
+  _port = NULL;
+}
+
+unsigned long USARTSPI::actualClock(void)
+{
+uint16_t wBSEL = (_usart->BAUDCTRLA | ((uint16_t)_usart->BAUDCTRLB << 8)) & 0xfff;
+
+  return clock_hz() / (2UL * (wBSEL + 1));
+}
+
+uint8_t USARTSPI::transfer(uint8_t data)
+{
+  while(!(_usart->STATUS & _BV(USART_DREIF_bp))) { }
+
+  _usart->DATA = data;
+
+  while(!(_usart->STATUS & _BV(USART_RXCIF_bp))) { }
+
+  return _usart->DATA;
+}
+
+void USARTSPI::transfer(void *buf, size_t count)
+{
+  transfer(buf, buf, count); // each byte is read before the byte 2 ahead of it is received
+}
+
+// block transfer - 'txBuf' NULL sends 0xFF, 'rxBuf' NULL throws away what's received.  Uses
+// the DMA when 'useDMA()' assigned channels (and it's worth it), otherwise the polled loop.
+
+void USARTSPI::transfer(const void *txBuf, void *rxBuf, size_t count)
+{
+register volatile USART_t *pU = _usart;
+const uint8_t *pTX = (const uint8_t *)txBuf;
+uint8_t *pRX = (uint8_t *)rxBuf;
+size_t nTX = 0, nRX = 0;
+register uint8_t c;
+
+
+  if(!_port || !count)
+  {
+    return;
+  }
+
+#if defined(DMA_CH0_CTRLA)
+  if(_dmaTX >= 0 && count >= USARTSPI_DMA_MIN && startTransfer(txBuf, rxBuf, count))
+  {
+    while(!transferDone()) { }
+
+    return;
+  }
+#endif // DMA_CH0_CTRLA
+
+  while(pU->STATUS & _BV(USART_RXCIF_bp)) // anything left over from before
+  {
+    (void)pU->DATA;
+  }
+
+  while(nRX < count)
+  {
+    // keep DATA full, but never more than 2 bytes ahead of what I've read (the RX buffer is
+    // 2 bytes deep, so a 3rd could overrun it)
+
+    if(nTX < count && (uint8_t)(nTX - nRX) < 2 && (pU->STATUS & _BV(USART_DREIF_bp)))
+    {
+      pU->DATA = pTX ? pTX[nTX] : 0xff;
+      nTX++;
+    }
+
+    if(pU->STATUS & _BV(USART_RXCIF_bp))
+    {
+      c = pU->DATA;
+
+      if(pRX)
+      {
+        pRX[nRX] = c;
+      }
+
+      nRX++;
+    }
+  }
+}
+
+// assign 2 DMA channels (0-3) for block transfers.  -1, -1 goes back to the polled loop.
+// Returns false if the channels aren't valid, or there's no 'classic' DMA controller.
+
+bool USARTSPI::useDMA(int txChannel, int rxChannel)
+{
+#if defined(DMA_CH0_CTRLA)
+  while(!transferDone()) { } // don't pull the rug out from under a transfer
+
+  if(txChannel < 0 || rxChannel < 0)
+  {
+    _dmaTX = _dmaRX = -1;
+
+    return true;
+  }
+
+  if(txChannel > 3 || rxChannel > 3 || txChannel == rxChannel)
+  {
+    return false;
+  }
+
+  _dmaTX = (int8_t)txChannel;
+  _dmaRX = (int8_t)rxChannel;
+
+  return true;
+#else // DMA_CH0_CTRLA
+  return false;
+#endif // DMA_CH0_CTRLA
+}
+
+// start a DMA block transfer and return right away.  Check 'transferDone()' before touching
+// the buffers (or starting another one).  Returns false if there's no DMA, a transfer is
+// already running, or 'count' is 0 or more than 65535.  This is how you run several SPI buses
+// at once.
+
+bool USARTSPI::startTransfer(const void *txBuf, void *rxBuf, size_t count)
+{
+#if defined(DMA_CH0_CTRLA)
+DMA_CH_t *pTX, *pRX;
+uint8_t bTrig, oldSREG;
+
+
+  if(!_port || _dmaTX < 0 || !count || count > 0xffffUL || !transferDone())
+  {
+    return false;
+  }
+
+  pTX = usartspi_dma_ch(_dmaTX);
+  pRX = usartspi_dma_ch(_dmaRX);
+  bTrig = usartspi_dma_trigger(_usart);
+
+  while(_usart->STATUS & _BV(USART_RXCIF_bp)) // anything left over from before
+  {
+    (void)_usart->DATA;
+  }
+
+  oldSREG = SREG;
+  cli(); // the serial DMA code also changes DMA_CTRL
+
+  DMA_CTRL |= DMA_ENABLE_bm; // enable the DMA controller (other bits as they were)
+
+  SREG = oldSREG;
+
+  // RX first, so it's ready before the first byte comes back.  source is always DATA
+  pRX->CTRLA = 0;
+  pRX->ADDRCTRL = DMA_CH_SRCRELOAD_NONE_gc | DMA_CH_SRCDIR_FIXED_gc
+                | DMA_CH_DESTRELOAD_NONE_gc | (rxBuf ? DMA_CH_DESTDIR_INC_gc : DMA_CH_DESTDIR_FIXED_gc);
+  usartspi_dma_addr(pRX, &(_usart->DATA), rxBuf ? rxBuf : &_dummyRX);
+  pRX->TRIGSRC = bTrig;
+  pRX->TRFCNT = (uint16_t)count;
+  pRX->REPCNT = 0;
+  pRX->CTRLB = DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm; // clear flags, no interrupts
+  pRX->CTRLA = DMA_CH_ENABLE_bm | DMA_CH_SINGLE_bm | DMA_CH_BURSTLEN_1BYTE_gc;
+
+  // TX, destination is always DATA.  DRE is already set, so this starts right away
+  pTX->CTRLA = 0;
+  pTX->ADDRCTRL = DMA_CH_SRCRELOAD_NONE_gc | (txBuf ? DMA_CH_SRCDIR_INC_gc : DMA_CH_SRCDIR_FIXED_gc)
+                | DMA_CH_DESTRELOAD_NONE_gc | DMA_CH_DESTDIR_FIXED_gc;
+  usartspi_dma_addr(pTX, txBuf ? txBuf : &_dummyTX, &(_usart->DATA));
+  pTX->TRIGSRC = bTrig + 1; // DRE
+  pTX->TRFCNT = (uint16_t)count;
+  pTX->REPCNT = 0;
+  pTX->CTRLB = DMA_CH_TRNIF_bm | DMA_CH_ERRIF_bm;
+  pTX->CTRLA = DMA_CH_ENABLE_bm | DMA_CH_SINGLE_bm | DMA_CH_BURSTLEN_1BYTE_gc;
+
+  return true;
+#else // DMA_CH0_CTRLA
+  return false;
+#endif // DMA_CH0_CTRLA
+}
+
+bool USARTSPI::transferDone(void)
+{
+#if defined(DMA_CH0_CTRLA)
+  if(_dmaRX >= 0)
+  {
+    // the RX channel finishes last, when the last byte has been received.  The channel turns
+    // its ENABLE bit off when the block is done (or on an error)
+    return !(usartspi_dma_ch(_dmaRX)->CTRLA & DMA_CH_ENABLE_bm);
+  }
+#endif // DMA_CH0_CTRLA
+
+  return true; // the polled transfers are done when they return
+}
@@ -0,0 +1,71 @@
+/*
+  USARTSPI.h - master SPI (MSPI) mode on the xmega USARTs
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+  Every xmega USART can run as an SPI master, with XCK as SCK, TXD as MOSI and RXD as MISO.
+  This uses the same pin assignments (and re-mapping) as the serial port on that USART, so
+  a USART can be a serial port OR an SPI bus, but not both at once.  Chip selects are up to
+  you (any pin, via 'digitalWrite()').
+
+  Example, using the USART for 'Serial3' as an SPI bus:
+
+    USARTSPI spi3((uint16_t)&(SERIAL_2_USART_NAME));
+
+    spi3.begin(8000000UL, USARTSPI_MODE0, MSBFIRST);
+    spi3.useDMA(0, 1);  // optional, DMA channel 0 for TX, 1 for RX
+    spi3.transfer(txbuf, rxbuf, 512);
+
+*/
+
+#ifndef USARTSPI_h
+#define USARTSPI_h
+
+#include <inttypes.h>
+
+#include "Arduino.h"
+
+// SPI modes - bit 1 is CPOL (clock idles HIGH), bit 0 is CPHA (sample on the trailing edge)
+#define USARTSPI_MODE0 0x00
+#define USARTSPI_MODE1 0x01
+#define USARTSPI_MODE2 0x02
+#define USARTSPI_MODE3 0x03
+
+class USARTSPI
+{
+  protected: // NEVER 'private'
+    volatile USART_t *_usart;
+    PORT_t *_port;        // the port with the XCK, RX and TX pins, NULL until 'begin()'
+    uint8_t _bitXCK;      // XCK pin index (RX - 1)
+    int8_t _dmaTX;        // DMA channel that feeds DATA, -1 if none
+    int8_t _dmaRX;        // DMA channel that empties DATA, -1 if none
+    uint8_t _dummyTX;     // what the DMA sends when there's no TX buffer (0xff)
+    uint8_t _dummyRX;     // where the DMA puts data when there's no RX buffer
+  public:
+    USARTSPI(uint16_t usart);
+    bool begin(unsigned long clock = 4000000UL, uint8_t mode = USARTSPI_MODE0, uint8_t bitOrder = MSBFIRST);
+    void end(void);
+    unsigned long actualClock(void); // the SCK frequency the USART is ACTUALLY running at
+
+    uint8_t transfer(uint8_t data);
+    void transfer(void *buf, size_t count); // in place, 'buf' is sent and then overwritten
+    void transfer(const void *txBuf, void *rxBuf, size_t count); // either can be NULL
+
+    bool useDMA(int txChannel, int rxChannel); // -1, -1 for none.  'A' series only
+    bool startTransfer(const void *txBuf, void *rxBuf, size_t count); // DMA, returns right away
+    bool transferDone(void); // true when the DMA transfer from 'startTransfer()' is done
+};
+
+#endif // USARTSPI_h
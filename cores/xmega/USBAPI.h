@@ -42,9 +42,12 @@ public:
 	virtual int available(void);
 	virtual int peek(void);
 	virtual int read(void);
+	virtual int read(uint8_t *buffer, size_t length); // block read, does not wait.  returns # of bytes read
 	virtual void flush(void);
 	virtual size_t write(uint8_t);
 	virtual size_t write(const uint8_t*, size_t);
+	uint8_t *reserveWrite(uint8_t *pSpace); // zero-copy write, see USB_SendReserve()
+	size_t commitWrite(uint8_t len, bool bSend = false); // 'bSend' sends the packet now
 	using Print::write; // pull in write(str) and write(buf, size) from Print
 	operator bool();
 };
@@ -193,6 +196,8 @@ int USB_RecvControl(void* d, int len);
 
 uint8_t	USB_Available(uint8_t ep);
 int USB_Send(uint8_t ep, const void* data, int len);	// blocking
+uint8_t *USB_SendReserve(uint8_t ep, uint8_t *pSpace);	// zero-copy send, ping-pong 'in' endpoints only
+int USB_SendCommit(uint8_t ep, uint8_t len);			// TRANSFER_RELEASE in 'ep' sends the packet now
 int USB_Recv(uint8_t ep, void* data, int len);		// non-blocking
 int USB_Recv(uint8_t ep);							// non-blocking
 void USB_Flush(uint8_t ep);
@@ -168,8 +168,12 @@ typedef struct
   uint8_t aBuf2[INTERNAL_BUFFER_LENGTH]; // normally send data (for 'in' or 'control') [also 'ping pong' 2nd buffer?]
   volatile uint8_t iBufIndex1, iBufIndex2; // index into buffer
   volatile uint8_t iBufLen1, iBufLen2;     // length of data in buffer
+  volatile uint8_t iBank;                  // ping-pong only:  the bank the CPU is using now (0 or 1)
+  volatile uint8_t bBanks;                 // ping-pong only:  bits 0,1 = bank owned by the hardware, see BANK_RESERVED
 } INTERNAL_BUFFER;
 
+#define BANK_RESERVED 0x80 /* 'bBanks' bit - the CPU has a pointer into the current bank, so the SOF handler leaves it alone */
+
 INTERNAL_BUFFER aEPBuff[INTERNAL_NUM_EP];
 
 
@@ -570,6 +574,217 @@ static inline void ReleaseTX() // function name is misleading, change it
   SREG = oldSREG;
 }
 
+// ----------------------------------------------------------------------------------------
+//                           PING-PONG (DOUBLE BANK) IN ENDPOINTS
+//
+// A bulk 'in' endpoint that's initialized with EP_DOUBLE_64 uses ping-pong mode (20.7 in the
+// AU manual).  The 'out' descriptor for the same endpoint number is disabled, and its data
+// pointer and byte count become bank 1.  So while the hardware sends one bank, the CPU fills
+// the other one.  'in' endpoints never use 'aBuf1' so it's bank 1, and 'aBuf2' is bank 0.
+// The TRNCOMPL and BUSNACK flags for BOTH banks are in the 'in' descriptor's status.
+//
+// 'iBank' is the bank the CPU fills next, and the hardware always sends them in order, so
+// the two stay in step.  A bank belongs to the hardware from the time it's sent until its
+// TRNCOMPL flag is set.  The bulk endpoints don't interrupt on completion, so the flags are
+// checked whenever the CPU needs a bank, plus in the SOF and TRNCOMPL ISRs.
+//
+// 'USB_SendReserve()' and 'USB_SendCommit()' let the caller write directly into the bank, so
+// there's no extra copy.  Anything left in a partly filled bank gets sent by the SOF handler
+// (once per millisecond) when nothing else is queued, so 'flush()' isn't required.
+//
+// Full-speed bulk tops out at 19 64-byte packets per 1ms frame (~1.2MB/sec) if the host
+// schedules them.  One 64-byte packet takes ~43us on the wire, so with 2 banks the CPU has
+// about that long to re-fill the other one.  A single bank had to sit idle for a whole
+// packet time (or until the next SOF) before it could be filled again.  (numbers from the
+// USB spec and the manual)
+// ----------------------------------------------------------------------------------------
+
+static inline bool IsPingPongIN(u8 idx)
+{
+  return idx > 0 && idx <= MAXEP
+         && (epData.endpoint[idx].in.ctrl & USB_EP_TYPE_gm)
+         && (epData.endpoint[idx].in.ctrl & USB_EP_PINGPONG_bm);
+}
+
+// the byte count for bank 'bank' of a ping-pong 'in' endpoint
+static inline volatile uint8_t *InBankLen(u8 idx, u8 bank)
+{
+  return bank ? &(aEPBuff[idx].iBufLen1) : &(aEPBuff[idx].iBufLen2);
+}
+
+static inline uint8_t *InBankBuf(u8 idx, u8 bank)
+{
+  return bank ? aEPBuff[idx].aBuf1 : aEPBuff[idx].aBuf2;
+}
+
+// mark banks that the hardware has finished sending as 'free'.  interrupts must be disabled
+static void PingPongINComplete(u8 idx)
+{
+register uint8_t status = epData.endpoint[idx].in.status;
+
+  if(status & USB_EP_TRNCOMPL0_bm)
+  {
+    aEPBuff[idx].iBufLen2 = 0;
+    aEPBuff[idx].bBanks &= ~_BV(0);
+    epData.endpoint[idx].in.status &= ~USB_EP_TRNCOMPL0_bm;
+  }
+
+  if(status & USB_EP_TRNCOMPL1_bm)
+  {
+    aEPBuff[idx].iBufLen1 = 0;
+    aEPBuff[idx].bBanks &= ~_BV(1);
+    epData.endpoint[idx].in.status &= ~USB_EP_TRNCOMPL1_bm;
+  }
+}
+
+// hand the current bank to the hardware and switch to the other one.  interrupts must be disabled
+static void PingPongINSend(u8 idx)
+{
+register uint8_t bank = aEPBuff[idx].iBank;
+
+  if(bank)
+  {
+    epData.endpoint[idx].out.cnt = aEPBuff[idx].iBufLen1 | ZLP_BIT;
+  }
+  else
+  {
+    epData.endpoint[idx].in.cnt = aEPBuff[idx].iBufLen2 | ZLP_BIT;
+  }
+
+  aEPBuff[idx].bBanks = (aEPBuff[idx].bBanks | _BV(bank)) & ~BANK_RESERVED;
+  aEPBuff[idx].iBank = bank ^ 1;
+
+  epData.endpoint[idx].in.status &= ~(bank ? USB_EP_BUSNACK1_bm : USB_EP_BUSNACK0_bm); // this sends it
+}
+
+// free space in the current bank, 0 if it belongs to the hardware.  interrupts must be disabled
+static uint8_t PingPongINSpace(u8 idx)
+{
+register uint8_t bank;
+
+  PingPongINComplete(idx);
+
+  bank = aEPBuff[idx].iBank;
+
+  if(aEPBuff[idx].bBanks & _BV(bank))
+  {
+    return 0;
+  }
+
+  return INTERNAL_BUFFER_LENGTH - *InBankLen(idx, bank);
+}
+
+// called by the SOF handler - send a partly filled bank if nothing else is queued and nobody is writing to it
+static void PingPongINFlush(u8 idx)
+{
+  PingPongINComplete(idx);
+
+  if(!aEPBuff[idx].bBanks && // no banks being sent, and not reserved
+     *InBankLen(idx, aEPBuff[idx].iBank))
+  {
+    PingPongINSend(idx);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+//                           PING-PONG (DOUBLE BANK) OUT ENDPOINTS
+//
+// Same idea for a bulk 'out' endpoint initialized with EP_DOUBLE_64.  Bank 0 is the 'out'
+// descriptor with 'aBuf1', and bank 1 is the (disabled) 'in' descriptor with 'aBuf2'.  Both
+// banks' flags are in the 'out' status.  While the sketch drains one bank, the host can send
+// the next packet into the other one instead of getting NAKed.
+//
+// Here a bank belongs to the hardware while it's waiting for a packet.  When TRNCOMPL is set
+// the byte count is saved and the bank belongs to the CPU until it's been read.  Then it goes
+// back to the hardware (byte count zeroed and BUSNACK cleared).  The hardware fills them in
+// order, so 'iBank' (the next bank to read) stays in step.  The ISRs only touch a bank that
+// belongs to the hardware, so a bank that belongs to the CPU can be copied out with interrupts
+// enabled.
+// ----------------------------------------------------------------------------------------
+
+static inline bool IsPingPongOUT(u8 idx)
+{
+  return idx > 0 && idx <= MAXEP
+         && (epData.endpoint[idx].out.ctrl & USB_EP_TYPE_gm)
+         && (epData.endpoint[idx].out.ctrl & USB_EP_PINGPONG_bm);
+}
+
+// mark banks that the hardware has received a packet into as belonging to the CPU.  interrupts must be disabled
+static void PingPongOUTComplete(u8 idx)
+{
+register uint8_t status = epData.endpoint[idx].out.status;
+
+  if(status & USB_EP_TRNCOMPL0_bm)
+  {
+    aEPBuff[idx].iBufIndex1 = 0;
+    aEPBuff[idx].iBufLen1 = 0x3ff & epData.endpoint[idx].out.cnt; // byte count of received data
+    aEPBuff[idx].bBanks &= ~_BV(0);
+    epData.endpoint[idx].out.status &= ~USB_EP_TRNCOMPL0_bm;
+  }
+
+  if(status & USB_EP_TRNCOMPL1_bm)
+  {
+    aEPBuff[idx].iBufIndex2 = 0;
+    aEPBuff[idx].iBufLen2 = 0x3ff & epData.endpoint[idx].in.cnt; // bank 1 uses the 'in' descriptor
+    aEPBuff[idx].bBanks &= ~_BV(1);
+    epData.endpoint[idx].out.status &= ~USB_EP_TRNCOMPL1_bm;
+  }
+}
+
+// give the current bank back to the hardware and move on to the other one.  interrupts must be disabled
+static void PingPongOUTRelease(u8 idx)
+{
+register uint8_t bank = aEPBuff[idx].iBank;
+
+  if(bank)
+  {
+    aEPBuff[idx].iBufIndex2 = aEPBuff[idx].iBufLen2 = 0;
+    epData.endpoint[idx].in.cnt = 0;
+  }
+  else
+  {
+    aEPBuff[idx].iBufIndex1 = aEPBuff[idx].iBufLen1 = 0;
+    epData.endpoint[idx].out.cnt = 0;
+  }
+
+  aEPBuff[idx].bBanks |= _BV(bank);
+  aEPBuff[idx].iBank = bank ^ 1;
+
+  epData.endpoint[idx].out.status &= ~(bank ? USB_EP_BUSNACK1_bm : USB_EP_BUSNACK0_bm); // ready to receive again
+}
+
+// unread bytes in bank 'bank', 0 if it belongs to the hardware
+static inline uint8_t PingPongOUTCount(u8 idx, u8 bank)
+{
+  if(aEPBuff[idx].bBanks & _BV(bank))
+  {
+    return 0;
+  }
+
+  return bank ? aEPBuff[idx].iBufLen2 - aEPBuff[idx].iBufIndex2
+              : aEPBuff[idx].iBufLen1 - aEPBuff[idx].iBufIndex1;
+}
+
+// check for new packets, and give back a current bank that's been completely read (or was a
+// zero-length packet).  returns the number of unread bytes in both banks.  interrupts must be disabled
+static uint8_t PingPongOUTUpdate(u8 idx)
+{
+  PingPongOUTComplete(idx);
+
+  for(u8 i1=0; i1 < 2; i1++)
+  {
+    if((aEPBuff[idx].bBanks & _BV(aEPBuff[idx].iBank)) || // current bank waiting for data
+       PingPongOUTCount(idx, aEPBuff[idx].iBank))         // or it has some
+    {
+      break;
+    }
+
+    PingPongOUTRelease(idx); // it's empty
+  }
+
+  return PingPongOUTCount(idx, 0) + PingPongOUTCount(idx, 1);
+}
+
 // an API for debugging help
 uint16_t GetFrameNumber(void)
 {
@@ -612,6 +827,11 @@ public:
 u8 USB_Available(u8 ep)
 {
   LockEP lock(ep);
+  if (IsPingPongOUT(ep & 7))
+  {
+    cli(); // 'lock' restores SREG
+    return PingPongOUTUpdate(ep & 7);
+  }
 //  return FifoByteCount();
   return ReadByteCount();
 }
@@ -623,6 +843,57 @@ int USB_Recv(u8 ep, void* d, int len)
   if (!_usbConfiguration || len < 0)
     return -1;
   
+  if (IsPingPongOUT(ep & 7))
+  {
+    // copy whole spans out of the banks (up to 2 packets) rather than 1 byte at a time
+    u8 idx = ep & 7;
+    u8* dst = (u8*)d;
+    int total = 0;
+    uint8_t oldSREG = SREG;
+
+    while (len > 0)
+    {
+      cli();
+      u8 n = PingPongOUTUpdate(idx) ? PingPongOUTCount(idx, aEPBuff[idx].iBank) : 0;
+      SREG = oldSREG;
+
+      if (!n)
+        break;
+      if (n > len)
+        n = len;
+
+      // the bank belongs to the CPU, so interrupts can stay on for the copy
+      if (aEPBuff[idx].iBank)
+      {
+        memcpy(dst, aEPBuff[idx].aBuf2 + aEPBuff[idx].iBufIndex2, n);
+        aEPBuff[idx].iBufIndex2 += n;
+      }
+      else
+      {
+        memcpy(dst, aEPBuff[idx].aBuf1 + aEPBuff[idx].iBufIndex1, n);
+        aEPBuff[idx].iBufIndex1 += n;
+      }
+
+      dst += n;
+      len -= n;
+      total += n;
+    }
+
+    cli();
+    PingPongOUTUpdate(idx); // give the bank back right away if I emptied it
+    SREG = oldSREG;
+
+#ifdef TX_RX_LED_INIT
+    if (total)
+    {
+      RXLED1;          // light the RX LED
+      RxLEDPulse = TX_RX_LED_PULSE_MS;
+    }
+#endif // TX_RX_LED_INIT
+
+    return total;
+  }
+
   LockEP lock(ep);
   u8 n = ReadByteCount();//FifoByteCount();
   len = min(n,len);
@@ -649,11 +920,97 @@ int USB_Recv(u8 ep)
 u8 USB_SendSpace(u8 ep)
 {
   LockEP lock(ep);
+  if (IsPingPongIN(ep & 7))
+  {
+    cli(); // 'lock' restores SREG
+    return PingPongINSpace(ep & 7);
+  }
   if (!ReadWriteAllowed())
     return 0;
   return INTERNAL_BUFFER_LENGTH - WriteByteCount(); //FifoByteCount();
 }
 
+// zero-copy send for ping-pong endpoints (see above).  Returns a pointer to the free space in the
+// current bank and assigns '*pSpace' to its size, or returns NULL if both banks are being sent
+// (or it's the wrong kind of endpoint).  Does not wait.  Write up to '*pSpace' bytes there, then
+// call 'USB_SendCommit()' with the number actually written.  Don't call anything else that sends
+// to the same endpoint in between.
+uint8_t *USB_SendReserve(uint8_t ep, uint8_t *pSpace)
+{
+uint8_t *pRval = NULL;
+uint8_t nSpace = 0;
+u8 idx = ep & 7;
+
+  if (_usbConfiguration && IsPingPongIN(idx))
+  {
+    uint8_t oldSREG = SREG;
+    cli(); // the ISRs use these too
+
+    nSpace = PingPongINSpace(idx);
+
+    if (nSpace)
+    {
+      pRval = InBankBuf(idx, aEPBuff[idx].iBank) + (INTERNAL_BUFFER_LENGTH - nSpace);
+      aEPBuff[idx].bBanks |= BANK_RESERVED; // so the SOF handler won't send it out from under me
+    }
+
+    SREG = oldSREG;
+  }
+
+  if (pSpace)
+  {
+    *pSpace = nSpace;
+  }
+
+  return pRval;
+}
+
+// add 'len' bytes, written at the pointer from 'USB_SendReserve()', to the current bank.  The bank
+// is sent when it's full, or when 'ep' includes TRANSFER_RELEASE.  Returns the number of bytes
+// added, or -1 if it's the wrong kind of endpoint.
+int USB_SendCommit(uint8_t ep, uint8_t len)
+{
+u8 idx = ep & 7;
+uint8_t oldSREG, bank;
+volatile uint8_t *pLen;
+
+  if (!IsPingPongIN(idx))
+    return -1;
+
+  oldSREG = SREG;
+  cli(); // the ISRs use these too
+
+  bank = aEPBuff[idx].iBank;
+  pLen = InBankLen(idx, bank);
+
+  if (aEPBuff[idx].bBanks & _BV(bank)) // not reserved, it belongs to the hardware
+  {
+    len = 0;
+  }
+  else if (len > INTERNAL_BUFFER_LENGTH - *pLen)
+  {
+    len = INTERNAL_BUFFER_LENGTH - *pLen;
+  }
+
+  *pLen += len;
+  aEPBuff[idx].bBanks &= ~BANK_RESERVED;
+
+  if (!(aEPBuff[idx].bBanks & _BV(bank)) &&
+      (*pLen >= INTERNAL_BUFFER_LENGTH || (ep & TRANSFER_RELEASE)))
+  {
+    PingPongINSend(idx);
+  }
+
+  SREG = oldSREG;
+
+#ifdef TX_RX_LED_INIT
+  TXLED1;          // light the TX LED
+  TxLEDPulse = TX_RX_LED_PULSE_MS;
+#endif // TX_RX_LED_INIT
+
+  return len;
+}
+
 //  Blocking Send of data to an endpoint
 int USB_Send(u8 ep, const void* d, int len)
 {
@@ -664,6 +1021,42 @@ int USB_Send(u8 ep, const void* d, int len)
   const u8* data = (const u8*)d;
   u8 zero = ep & TRANSFER_ZERO;
   u8 timeout = 250;    // 250ms timeout on send? TODO
+
+  if (IsPingPongIN(ep & 7))
+  {
+    // copy straight into the banks.  No 'delay()' while waiting for a free bank,
+    // since one frees up every ~43us while data is moving.  The timeout is 250ms
+    // without progress.
+    unsigned long tStart = millis();
+    while (len)
+    {
+      u8 n;
+      u8* p = USB_SendReserve(ep, &n);
+      if (!p)
+      {
+        if ((millis() - tStart) >= timeout)
+          return -1;
+        continue;
+      }
+
+      if (n > len)
+        n = len;
+      if (zero)
+        memset(p, 0, n);
+      else if (ep & TRANSFER_PGM)
+        memcpy_P(p, data, n);
+      else
+        memcpy(p, data, n);
+
+      data += n;
+      len -= n;
+      USB_SendCommit(len ? (ep & ~TRANSFER_RELEASE) : ep, n); // release (if asked) with the last of it
+      tStart = millis();
+    }
+
+    return r;
+  }
+
   while (len)
   {
     u8 n = USB_SendSpace(ep);
@@ -837,6 +1230,26 @@ int i1;
 //    DEBUG_OUT((uint16_t)type);
 //    DEBUG_OUT(F("\r\n"));
 //  }
+  else if(type == EP_TYPE_BULK_IN && size == EP_DOUBLE_64) /* ping-pong, see PingPongINSend etc. */
+  {
+    // bank 0 is the 'in' descriptor with aBuf2, bank 1 is the (disabled) 'out' descriptor with aBuf1
+
+    epData.endpoint[index].in.dataptr = (uint16_t)&(aEPBuff[index].aBuf2[0]);
+    epData.endpoint[index].in.auxdata = 0;
+    epData.endpoint[index].in.cnt = ZLP_BIT;
+
+    epData.endpoint[index].out.dataptr = (uint16_t)&(aEPBuff[index].aBuf1[0]);
+    epData.endpoint[index].out.auxdata = 0;
+    epData.endpoint[index].out.cnt = ZLP_BIT;
+
+    // both banks 'NACK' until there's something to send
+    epData.endpoint[index].in.status = USB_EP_BUSNACK0_bm | USB_EP_BUSNACK1_bm;
+
+    epData.endpoint[index].in.ctrl = USB_EP_TYPE_BULK_gc
+                                   | USB_EP_INTDSBL_bm      /* disable interrupt */
+                                   | USB_EP_PINGPONG_bm     /* double bank */
+                                   | USB_EP_SIZE_64_gc;     /* data size */
+  }
   else if(type == EP_TYPE_INTERRUPT_IN || type == EP_TYPE_BULK_IN
           || type == EP_TYPE_ISOCHRONOUS_IN) /* these types have *ME* write data and send to 'in' for host */
   {
@@ -850,6 +1263,29 @@ int i1;
                                    | (size == EP_DOUBLE_64 ? USB_EP_SIZE_64_gc :             // TODO:  set 'double buffer' flag?
                                       size == EP_SINGLE_64 ? USB_EP_SIZE_64_gc : 0);         /* data size */
   }
+  else if(type == EP_TYPE_BULK_OUT && size == EP_DOUBLE_64) /* ping-pong, see PingPongOUTUpdate etc. */
+  {
+    // bank 0 is the 'out' descriptor with aBuf1, bank 1 is the (disabled) 'in' descriptor with aBuf2
+
+    epData.endpoint[index].out.dataptr = (uint16_t)&(aEPBuff[index].aBuf1[0]);
+    epData.endpoint[index].out.auxdata = 0;
+    epData.endpoint[index].out.cnt = 0;
+
+    epData.endpoint[index].in.dataptr = (uint16_t)&(aEPBuff[index].aBuf2[0]);
+    epData.endpoint[index].in.auxdata = 0;
+    epData.endpoint[index].in.cnt = 0;
+
+    aEPBuff[index].bBanks = _BV(0) | _BV(1); // both banks are waiting for data
+
+    // both banks ready to receive (BUSNACK0 and BUSNACK1 clear)
+    epData.endpoint[index].out.status = 0;
+    epData.endpoint[index].in.status = 0;
+
+    epData.endpoint[index].out.ctrl = USB_EP_TYPE_BULK_gc
+                                    | USB_EP_INTDSBL_bm      /* disable interrupt */
+                                    | USB_EP_PINGPONG_bm     /* double bank */
+                                    | USB_EP_SIZE_64_gc;     /* data size */
+  }
   else if(type == EP_TYPE_INTERRUPT_OUT || type == EP_TYPE_BULK_OUT /* these send *ME* data */
           || type == EP_TYPE_ISOCHRONOUS_OUT)
   {
@@ -1084,6 +1520,18 @@ register int i1;
 
   for(i1=0; i1 <= MAXEP; i1++)
   {
+    if(IsPingPongIN(i1)) // both banks' flags are in the 'in' status, and the 'out' is bank 1
+    {
+      PingPongINComplete(i1);
+      continue;
+    }
+
+    if(IsPingPongOUT(i1)) // both banks' flags are in the 'out' status, and the 'in' is bank 1
+    {
+      PingPongOUTComplete(i1);
+      continue;
+    }
+
     if((epData.endpoint[i1].in.ctrl & USB_EP_TYPE_gm) && // 'in' enabled
 //       !(epData.endpoint[i1].in.ctrl & USB_EP_INTDSBL_bm) && // ints enabled
        (epData.endpoint[i1].in.status & USB_EP_TRNCOMPL0_bm)) // data sent
@@ -1267,6 +1715,21 @@ uint8_t udint;
 
 void USB_Flush(u8 ep)
 {
+  if (IsPingPongIN(ep & 7))
+  {
+    uint8_t oldSREG = SREG;
+    cli();
+
+    PingPongINComplete(ep & 7);
+
+    if (!(aEPBuff[ep & 7].bBanks & _BV(aEPBuff[ep & 7].iBank)) &&
+        *InBankLen(ep & 7, aEPBuff[ep & 7].iBank))
+      PingPongINSend(ep & 7);
+
+    SREG = oldSREG;
+    return;
+  }
+
   SetEP(ep);
   if (WriteByteCount())//FifoByteCount())
     ReleaseTX();
@@ -1381,6 +1844,15 @@ ISR(USB_BUSEVENT_vect) // USB_GEN_vect)
 //    }
 
     DoTransactionComplete(); // maybe *THIS* will help?
+
+    // send whatever is sitting in a partly filled ping-pong bank (see PingPongINFlush)
+    for(u8 i1=1; i1 <= MAXEP; i1++)
+    {
+      if(IsPingPongIN(i1))
+      {
+        PingPongINFlush(i1);
+      }
+    }
   }
 
 //  if(udint & ~(USB_RSTIF_bm | USB_SOFIF_bm)) // anything else
@@ -496,76 +496,21 @@ PORT_t *port;
   {
 #endif // INT0MASK and INT1MASK supported
     // if this matches a CTS port, I do _NOT_ want to disable interrupts
-#if defined(SERIAL_0_CTS_ENABLED) && defined(SERIAL_1_CTS_ENABLED)
-    if(SERIAL_0_CTS_PORT == port)
+#ifdef SERIAL_CTS_ENABLED
+    if(SERIAL_CTS_PINS(port))
     {
 #ifndef PORTC_INT0MASK /* meaning there's only one int vector and not two */
-      if(SERIAL_1_CTS_PORT == port)
-      {
-        port->INTMASK = SERIAL_0_CTS_PIN | SERIAL_1_CTS_PIN;   // disable interrupts but leave BOTH enabled
-      }
-      else
-      {
-        port->INTMASK = SERIAL_0_CTS_PIN;    // disable interrupts but leave THIS one enabled
-      }
+      port->INTMASK = SERIAL_CTS_PINS(port);  // disable interrupts but leave the CTS pins enabled
 
       port->INTCTRL |= PORT_INTLVL_gm; // max priority when I do this
 #else // INT0MASK and INT1MASK supported
-      if(SERIAL_1_CTS_PORT == port)
-      {
-        port->INT1MASK = SERIAL_0_CTS_PIN | SERIAL_1_CTS_PIN;   // disable interrupts but leave BOTH enabled
-      }
-      else
-      {
-        port->INT1MASK = SERIAL_0_CTS_PIN;    // disable interrupts but leave THIS one enabled
-      }
+      port->INT1MASK = SERIAL_CTS_PINS(port); // disable interrupts but leave the CTS pins enabled
 
       port->INTCTRL |= PORT_INT1LVL_gm; // max priority when I do this
 #endif // INT0MASK and INT1MASK supported
     }
-    else if(SERIAL_1_CTS_PORT == port)
-    {
-#ifndef PORTC_INT0MASK /* meaning there's only one int vector and not two */
-      port->INTMASK = SERIAL_1_CTS_PIN;    // disable interrupts but leave THIS one enabled
-
-      port->INTCTRL |= PORT_INTLVL_gm; // max priority when I do this
-#else // INT0MASK and INT1MASK supported
-      port->INT1MASK = SERIAL_1_CTS_PIN;    // disable interrupts but leave THIS one enabled
-
-      port->INTCTRL |= PORT_INT1LVL_gm; // max priority when I do this
-#endif // INT0MASK and INT1MASK supported
-    }
-#elif defined(SERIAL_0_CTS_ENABLED)
-    if(SERIAL_0_CTS_PORT == port)
-    {
-#ifndef PORTC_INT0MASK /* meaning there's only one int vector and not two */
-      port->INTMASK = SERIAL_0_CTS_PIN;    // disable interrupts but leave THIS one enabled
-
-      port->INTCTRL |= PORT_INTLVL_gm; // max priority when I do this
-#else // INT0MASK and INT1MASK supported
-      port->INT1MASK = SERIAL_0_CTS_PIN;    // disable interrupts but leave THIS one enabled
-
-      port->INTCTRL |= PORT_INT1LVL_gm; // max priority when I do this
-#endif // INT0MASK and INT1MASK supported
-    }
-#elif defined(SERIAL_1_CTS_ENABLED)
-    if(SERIAL_1_CTS_PORT == port)
-    {
-#ifndef PORTC_INT0MASK /* meaning there's only one int vector and not two */
-      port->INTMASK = SERIAL_1_CTS_PIN;    // disable interrupts but leave THIS one enabled
-
-      port->INTCTRL |= PORT_INTLVL_gm; // max priority when I do this
-#else // INT0MASK and INT1MASK supported
-      port->INT1MASK = SERIAL_1_CTS_PIN;    // disable interrupts but leave THIS one enabled
-
-      port->INTCTRL |= PORT_INT1LVL_gm; // max priority when I do this
-#endif // INT0MASK and INT1MASK supported
-    }
-#endif // SERIAL_0/1_CTS_ENABLED
-
-#if defined(SERIAL_0_CTS_ENABLED) || defined(SERIAL_1_CTS_ENABLED)
     else
-#endif // SERIAL_0/1_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
 
     {
 #ifndef PORTC_INT0MASK /* meaning there's only one int vector and not two */
@@ -619,19 +564,12 @@ ISR(PORTA_INT1_vect)
     intFunc[PORTA_INT1]();
 #endif // INT0MASK and INT1MASK supported
 
-#if defined(SERIAL_0_CTS_ENABLED)
-  if(SERIAL_0_CTS_PORT == &(PORTA)) // this should compile as a constant expression
-  {
-    serial_0_cts_callback();
-  }
-#endif // SERIAL_0_CTS_ENABLED
-
-#ifdef SERIAL_1_CTS_ENABLED
-  if(SERIAL_1_CTS_PORT == &(PORTA))
+#ifdef SERIAL_CTS_ENABLED
+  if(SERIAL_CTS_PINS(&(PORTA))) // this should compile as a constant expression
   {
-    serial_1_cts_callback();
+    serial_cts_interrupt(&(PORTA));
   }
-#endif // SERIAL_1_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
 }
 
 #if NUM_ANALOG_PINS > 8 /* which means we have PORT B */
@@ -646,19 +584,12 @@ ISR(PORTB_INT1_vect)
   if(intFunc[PORTB_INT1])
     intFunc[PORTB_INT1]();
 
-#if defined(SERIAL_0_CTS_ENABLED)
-  if(SERIAL_0_CTS_PORT == &(PORTB)) // this should compile as a constant expression
-  {
-    serial_0_cts_callback();
-  }
-#endif // SERIAL_0_CTS_ENABLED
-
-#ifdef SERIAL_1_CTS_ENABLED
-  if(SERIAL_1_CTS_PORT == &(PORTB))
+#ifdef SERIAL_CTS_ENABLED
+  if(SERIAL_CTS_PINS(&(PORTB))) // this should compile as a constant expression
   {
-    serial_1_cts_callback();
+    serial_cts_interrupt(&(PORTB));
   }
-#endif // SERIAL_1_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
 }
 #endif // NUM_ANALOG_PINS > 8
 
@@ -679,19 +610,12 @@ ISR(PORTC_INT1_vect)
     intFunc[PORTC_INT1]();
 #endif // INT0MASK and INT1MASK supported
 
-#if defined(SERIAL_0_CTS_ENABLED)
-  if(SERIAL_0_CTS_PORT == &(PORTC)) // this should compile as a constant expression
+#ifdef SERIAL_CTS_ENABLED
+  if(SERIAL_CTS_PINS(&(PORTC))) // this should compile as a constant expression
   {
-    serial_0_cts_callback();
+    serial_cts_interrupt(&(PORTC));
   }
-#endif // SERIAL_0_CTS_ENABLED
-
-#ifdef SERIAL_1_CTS_ENABLED
-  if(SERIAL_1_CTS_PORT == &(PORTC))
-  {
-    serial_1_cts_callback();
-  }
-#endif // SERIAL_1_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
 }
 
 #ifndef PORTC_INT0MASK /* meaning there's only one int vector and not two */
@@ -711,19 +635,12 @@ ISR(PORTD_INT1_vect)
     intFunc[PORTD_INT1]();
 #endif // INT0MASK and INT1MASK supported
 
-#if defined(SERIAL_0_CTS_ENABLED)
-  if(SERIAL_0_CTS_PORT == &(PORTD)) // this should compile as a constant expression
+#ifdef SERIAL_CTS_ENABLED
+  if(SERIAL_CTS_PINS(&(PORTD))) // this should compile as a constant expression
   {
-    serial_0_cts_callback();
+    serial_cts_interrupt(&(PORTD));
   }
-#endif // SERIAL_0_CTS_ENABLED
-
-#ifdef SERIAL_1_CTS_ENABLED
-  if(SERIAL_1_CTS_PORT == &(PORTD))
-  {
-    serial_1_cts_callback();
-  }
-#endif // SERIAL_1_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
 }
 
 
@@ -739,23 +656,72 @@ ISR(PORTE_INT1_vect)
   if(intFunc[PORTE_INT1])
     intFunc[PORTE_INT1]();
 
-#if defined(SERIAL_0_CTS_ENABLED)
-  if(SERIAL_0_CTS_PORT == &(PORTE)) // this should compile as a constant expression
+#ifdef SERIAL_CTS_ENABLED
+  if(SERIAL_CTS_PINS(&(PORTE))) // this should compile as a constant expression
   {
-    serial_0_cts_callback();
+    serial_cts_interrupt(&(PORTE));
   }
-#endif // SERIAL_0_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
+}
+#endif // NUM_DIGITAL_PINS > 18
 
-#ifdef SERIAL_1_CTS_ENABLED
-  if(SERIAL_1_CTS_PORT == &(PORTE))
+// TODO:  'attachInterrupt()' for PORTF, PORTH, PORTJ, PORTK, PORTQ
+//
+// For now these only handle serial CTS pins (see HardwareSerial.cpp).  Without them a CTS pin
+// on one of these ports would never re-start the DRE interrupt, and TX would stall for good.
+// PORTn_INT1 (the index) is only defined by 'pins_arduino.h' when the port exists.
+
+#ifdef SERIAL_CTS_ENABLED
+#ifdef PORTF_INT1
+ISR(PORTF_INT1_vect)
+{
+  if(SERIAL_CTS_PINS(&(PORTF))) // this should compile as a constant expression
   {
-    serial_1_cts_callback();
+    serial_cts_interrupt(&(PORTF));
   }
-#endif // SERIAL_1_CTS_ENABLED
 }
-#endif // NUM_DIGITAL_PINS > 18
+#endif // PORTF_INT1
+
+#ifdef PORTH_INT1
+ISR(PORTH_INT1_vect)
+{
+  if(SERIAL_CTS_PINS(&(PORTH))) // this should compile as a constant expression
+  {
+    serial_cts_interrupt(&(PORTH));
+  }
+}
+#endif // PORTH_INT1
 
-// TODO:  ISRs for PORTF, PORTH, PORTJ, PORTK, PORTQ
+#ifdef PORTJ_INT1
+ISR(PORTJ_INT1_vect)
+{
+  if(SERIAL_CTS_PINS(&(PORTJ))) // this should compile as a constant expression
+  {
+    serial_cts_interrupt(&(PORTJ));
+  }
+}
+#endif // PORTJ_INT1
+
+#ifdef PORTK_INT1
+ISR(PORTK_INT1_vect)
+{
+  if(SERIAL_CTS_PINS(&(PORTK))) // this should compile as a constant expression
+  {
+    serial_cts_interrupt(&(PORTK));
+  }
+}
+#endif // PORTK_INT1
+
+#ifdef PORTQ_INT1
+ISR(PORTQ_INT1_vect)
+{
+  if(SERIAL_CTS_PINS(&(PORTQ))) // this should compile as a constant expression
+  {
+    serial_cts_interrupt(&(PORTQ));
+  }
+}
+#endif // PORTQ_INT1
+#endif // SERIAL_CTS_ENABLED
 
 #ifndef PORTC_INT0MASK /* meaning there's only one int vector and not two */
 ISR(PORTR_INT_vect)
@@ -774,19 +740,12 @@ ISR(PORTR_INT1_vect)
     intFunc[PORTR_INT1]();
 #endif // INT0MASK and INT1MASK supported
 
-#if defined(SERIAL_0_CTS_ENABLED)
-  if(SERIAL_0_CTS_PORT == &(PORTR)) // this should compile as a constant expression
-  {
-    serial_0_cts_callback();
-  }
-#endif // SERIAL_0_CTS_ENABLED
-
-#ifdef SERIAL_1_CTS_ENABLED
-  if(SERIAL_1_CTS_PORT == &(PORTR))
+#ifdef SERIAL_CTS_ENABLED
+  if(SERIAL_CTS_PINS(&(PORTR))) // this should compile as a constant expression
   {
-    serial_1_cts_callback();
+    serial_cts_interrupt(&(PORTR));
   }
-#endif // SERIAL_1_CTS_ENABLED
+#endif // SERIAL_CTS_ENABLED
 }
 
 
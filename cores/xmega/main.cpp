@@ -55,12 +55,24 @@ int main(void)
 //#if defined(USBCON)
 //  USBDevice.attach();
 //#endif
+
+#ifdef FAST_BOOT
+	boot_time_end(); // see 'boot_time_us()'
+#endif // FAST_BOOT
 	
 	setup();
 
+#ifdef FAST_BOOT
+	init_late(); // the things 'init()' put off until after 'setup()'
+#endif // FAST_BOOT
+
 	for (;;) {
 		loop();
 		if (serialEventRun) serialEventRun();
+		if (soft_timer_run) soft_timer_run(); // weak, so it's only there when software timers are used
+#ifdef LOW_POWER_TICKLESS
+		idle_sleep(); // see 'set_idle_deadline()'
+#endif // LOW_POWER_TICKLESS
 	}
         
 	return 0;
@@ -64,6 +64,927 @@
 volatile unsigned long timer0_overflow_count = 0;
 volatile unsigned long timer0_millis = 0;
 static unsigned char timer0_fract = 0;
+#ifdef TIMER0_TICK_HOOK
+volatile voidFuncPtr timer0_tick_hook = NULL; // see wiring_private.h
+#endif // TIMER0_TICK_HOOK
+#ifdef CLOCK_SWITCHING
+static uint8_t clock_shift = 0; // the CPU clock is F_CPU >> clock_shift (see 'clock_switch()')
+#endif // CLOCK_SWITCHING
+
+
+// ---------------------------------------------------------------------------------------
+//                    CASCADED 'MILLIS' TIMERS (NO PERIODIC INTERRUPT)
+//
+// When there are 2 spare 16-bit timers, 'millis()' and 'micros()' are read straight from the
+// hardware instead of being counted by an ISR every 256 ticks (~2000 per second at 32Mhz).
+// The 'low' timer counts CPU clocks with a period of 1 millisecond, and its overflow goes
+// through an event channel to clock the 'high' timer, which counts milliseconds.  Together
+// they're a 32-bit counter (milliseconds:clocks).  The high timer's overflow ISR, once every
+// 65.536 seconds, extends that to a 32-bit 'millis()' so it still wraps at ~49 days.
+//
+// 'micros()' gets 1 clock resolution instead of 64, and bit-timed code no longer gets
+// interrupted for the ~80 cycles that the tick ISR took.
+//
+// The 'millis' timer (TCD0/TCD2/TCD5) still runs, since PWM needs it, but its interrupt is
+// only on while 'timer0_tick_hook' is assigned (see 'timer0_set_tick_hook()') or inside
+// 'low_power_delay()', which needs something to wake it up.
+//
+// The default is TCD1 and TCE1 with event channel 7, for CPUs that have them (A1, A3).
+// Everything else uses the tick ISR, like before.  To pick other timers, or to turn it off,
+// define these in 'pins_arduino.h':
+//
+//   #define MILLIS_CASCADE_LOW TCF1                /* counts clocks, 1 msec period */
+//   #define MILLIS_CASCADE_HIGH TCE1               /* counts milliseconds */
+//   #define MILLIS_CASCADE_HIGH_vect TCE1_OVF_vect /* its overflow vector */
+//   #define MILLIS_CASCADE_EVENT_CHANNEL 6
+//
+//   #define MILLIS_NO_CASCADE /* tick ISR for everything */
+//
+// F_CPU has to be a whole number of Mhz (up to 65Mhz) so 1 msec is exactly 'PER + 1' clocks.
+// ---------------------------------------------------------------------------------------
+
+#ifndef MILLIS_NO_CASCADE
+
+#if !defined(MILLIS_CASCADE_LOW) && defined(TCD1) && defined(TCE1)
+#define MILLIS_CASCADE_LOW TCD1
+#define MILLIS_CASCADE_HIGH TCE1
+#define MILLIS_CASCADE_HIGH_vect TCE1_OVF_vect
+#endif // MILLIS_CASCADE_LOW, TCD1, TCE1
+
+#ifndef MILLIS_CASCADE_EVENT_CHANNEL
+#define MILLIS_CASCADE_EVENT_CHANNEL 7
+#endif // MILLIS_CASCADE_EVENT_CHANNEL
+
+#if defined(MILLIS_CASCADE_LOW) && defined(MILLIS_CASCADE_HIGH) && (F_CPU % 1000000L) == 0 && (F_CPU / 1000L) <= 65536L
+#define MILLIS_CASCADE_ENABLED
+#endif // MILLIS_CASCADE_LOW, MILLIS_CASCADE_HIGH, F_CPU
+
+#endif // MILLIS_NO_CASCADE
+
+#ifdef TCC4 // the 'millis' timer's interrupt control, for turning the tick on and off
+#define TIMER0_TICK_INTCTRLA TCD5_INTCTRLA
+#elif !defined(TCD2)
+#define TIMER0_TICK_INTCTRLA TCD0_INTCTRLA
+#else // TCC4
+#define TIMER0_TICK_INTCTRLA TCD2_INTCTRLA
+#endif // TCC4
+
+#ifdef MILLIS_CASCADE_ENABLED
+
+static volatile uint16_t timer0_cascade_upper = 0; // upper 16 bits of 'millis()'
+
+ISR(MILLIS_CASCADE_HIGH_vect)
+{
+  timer0_cascade_upper++;
+}
+
+static void timer0_cascade_init(void)
+{
+TC1_t *pLow = (TC1_t *)&(MILLIS_CASCADE_LOW); // TC0_t starts with the same registers
+TC1_t *pHigh = (TC1_t *)&(MILLIS_CASCADE_HIGH);
+uint16_t wOffset = (uint16_t)pLow - (uint16_t)&TCC0;
+
+
+  pLow->CTRLA = TC_CLKSEL_OFF_gc;
+  pHigh->CTRLA = TC_CLKSEL_OFF_gc;
+
+  pLow->CTRLB = TC_WGMODE_NORMAL_gc; // no outputs, no capture
+  pHigh->CTRLB = TC_WGMODE_NORMAL_gc;
+  pLow->CTRLD = 0; // no event actions
+  pHigh->CTRLD = 0;
+  pLow->CTRLE = 0;
+  pHigh->CTRLE = 0;
+  pLow->INTCTRLA = 0;
+  pLow->INTCTRLB = 0;
+  pHigh->INTCTRLB = 0;
+
+  pLow->PER = F_CPU / 1000L - 1; // 1 msec
+  pHigh->PER = 0xffff;
+  pLow->CNT = 0;
+  pHigh->CNT = 0;
+
+  // the 'TCxn overflow' event sources are in the same order as the timers, 0x10 per port
+  // and 8 for the '1' timer (at +40H).  TCC0 is at 800H, TCD0 at 900H, and so on.
+
+  (&(EVSYS.CH0MUX))[MILLIS_CASCADE_EVENT_CHANNEL] = EVSYS_CHMUX_TCC0_OVF_gc
+                                                  + (uint8_t)((wOffset >> 8) << 4)
+                                                  + ((wOffset & 0x40) ? 8 : 0);
+  (&(EVSYS.CH0CTRL))[MILLIS_CASCADE_EVENT_CHANNEL] = 0;
+
+  pLow->INTFLAGS = 0xff;
+  pHigh->INTFLAGS = 0xff;
+  pHigh->INTCTRLA = TC_OVFINTLVL_HI_gc; // same priority as the tick ISR
+
+  pHigh->CTRLA = TC_CLKSEL_EVCH0_gc + MILLIS_CASCADE_EVENT_CHANNEL; // clocked by the low timer's overflow
+  pLow->CTRLA = TC_CLKSEL_DIV1_gc;
+}
+
+// milliseconds, and clocks since the last one, as a consistent pair.  Call with interrupts OFF.
+static unsigned long timer0_cascade_read(uint16_t *pClocks)
+{
+TC1_t *pLow = (TC1_t *)&(MILLIS_CASCADE_LOW);
+TC1_t *pHigh = (TC1_t *)&(MILLIS_CASCADE_HIGH);
+uint16_t wMS, wClocks;
+unsigned long lUpper;
+
+
+  // if the low timer wraps between the 2 reads of the high timer, read them again.  The event
+  // only takes a clock or 2 to get there, and the second read is several clocks after 'wClocks'
+
+  do
+  {
+    wMS = pHigh->CNT;
+    wClocks = pLow->CNT;
+  } while(pHigh->CNT != wMS);
+
+  lUpper = timer0_cascade_upper;
+
+  if((pHigh->INTFLAGS & TC1_OVFIF_bm) && wMS < 0x8000) // it wrapped but the ISR hasn't run yet
+  {
+    lUpper++;
+  }
+
+#ifdef CLOCK_SWITCHING
+  *pClocks = wClocks << clock_shift; // F_CPU clocks, as if it were still running at F_CPU
+#else // CLOCK_SWITCHING
+  *pClocks = wClocks;
+#endif // CLOCK_SWITCHING
+
+  return (lUpper << 16) | wMS;
+}
+
+#endif // MILLIS_CASCADE_ENABLED
+
+
+// ---------------------------------------------------------------------------------------
+//                         CYCLE COUNTER ('cycles()' AND 'ticks()')
+//
+// 'cycles()' is a 32-bit count of CPU clocks (it wraps every ~134 seconds at 32Mhz) and
+// 'ticks()' is the low 16 bits of it, for timing things down to a single clock.  Subtract 2
+// readings to get the time in between, like 'micros()'.  See Profile.h for timing blocks of code.
+//
+// With the cascaded 'millis' timers it's 'milliseconds * clocks per msec + clocks', which costs
+// nothing extra.  Otherwise define a spare 16-bit timer for it in 'pins_arduino.h':
+//
+//   #define CYCLES_TIMER TCC1                /* free-running, no prescaler */
+//   #define CYCLES_TIMER_vect TCC1_OVF_vect  /* its overflow vector, for the upper 16 bits */
+//
+// and it gets an overflow ISR every 65536 clocks (~20 cycles each).  The 'D' series variant
+// does this with TCC1.  'HardwareSerial::beginAutoBaud()' and 'boot_time_us()' share it
+// without stopping it.  Don't use it for anything else.
+//
+// With neither of those, 'cycles()' would only be 'micros() * clocks per usec', good to 64
+// clocks, so using 'cycles()', 'ticks()', 'clock_measure_hz()' or Profile.h is a link error
+// instead.  The 'E' series has no spare timer (TCC4, TCC5 and TCD5 are all PWM, and TCD5 is
+// also 'millis').  To accept the 64 clock resolution, define CYCLES_ALLOW_MICROS.
+// ---------------------------------------------------------------------------------------
+
+#if !defined(MILLIS_CASCADE_ENABLED) && defined(CYCLES_TIMER) && defined(CYCLES_TIMER_vect)
+#define CYCLES_TIMER_ENABLED
+
+static volatile uint16_t cycles_upper = 0; // upper 16 bits of 'cycles()'
+
+ISR(CYCLES_TIMER_vect)
+{
+  cycles_upper++;
+}
+
+static void cycles_init(void)
+{
+TC1_t *pT = (TC1_t *)&(CYCLES_TIMER); // TC0_t starts with the same registers
+
+
+  pT->CTRLA = TC_CLKSEL_OFF_gc;
+  pT->CTRLB = TC_WGMODE_NORMAL_gc;
+  pT->CTRLD = 0;
+  pT->CTRLE = 0;
+  pT->INTCTRLB = 0;
+  pT->PER = 0xffff;
+  pT->CNT = 0;
+  pT->INTFLAGS = 0xff;
+  pT->INTCTRLA = TC_OVFINTLVL_HI_gc;
+  pT->CTRLA = TC_CLKSEL_DIV1_gc;
+}
+#endif // CYCLES_TIMER_ENABLED
+
+
+// ---------------------------------------------------------------------------------------
+//                      TICKLESS LOW POWER (RTC WAKE-UP, POWER-SAVE)
+//
+// With LOW_POWER_TICKLESS defined (in 'pins_arduino.h'), 'delay()', 'low_power_delay()' and
+// 'main()' (between calls to 'loop()') sleep in POWER-SAVE mode, with the RTC compare set to
+// wake up at the deadline.  Instead of waking up at every 'millis' tick (or ~2000 times a
+// second) the CPU sleeps for as long as the delay, up to 60 seconds at a time.
+//
+// The RTC runs from the 1.024khz output of the internal 32.768khz oscillator (see
+// 'clock_setup()'), and keeps counting in power-save.  The 'millis' timers do NOT, so after
+// waking up the time spent asleep goes into 'timer0_slept_ms', which 'millis()' and 'micros()'
+// add in.  That keeps them consistent across the sleep (to within ~1 msec).
+//
+// Power-save stops the CPU clock and every peripheral except the RTC (and async things like
+// pin change interrupts and TWI address match), so:
+//
+//   a) serial output is flushed before going to sleep (so a character isn't cut in half)
+//   b) serial INPUT that arrives while asleep is lost.  A pin change on RX can wake it up,
+//      but the character that woke it is lost.
+//   c) PWM outputs, 'tone()' and the ADC freeze while asleep
+//
+// which is why it's not the default.  'set_idle_deadline(ms)' tells 'main()' to sleep for up
+// to 'ms' after 'loop()' returns.  It still sleeps until that deadline if something else
+// wakes it up and 'loop()' doesn't set a new one.  Sleeps shorter than ~3 msec (the RTC needs
+// 2 of its clocks to sync) are done the usual way.
+//
+// It does NOT power-save (so 'delay()' counts it out, and 'low_power_delay()' uses IDLE) while
+// USB is enabled, since the host would see the device drop off the bus, or while something is
+// using 'timer0_tick_hook' (soft timers, 'Serial.setIdleTime()'), since the hook would stop.
+// ---------------------------------------------------------------------------------------
+
+#ifdef LOW_POWER_TICKLESS
+
+#define TICKLESS_MIN_MS 3UL      /* anything shorter isn't worth the RTC overhead */
+#define TICKLESS_MAX_MS 60000UL  /* 61440 RTC ticks, it's only 16 bits */
+
+static volatile unsigned long timer0_slept_ms = 0; // added to 'millis()' and 'micros()'
+static uint16_t tickless_frac = 0;                  // left over from RTC ticks to msecs, in 1/1024 msec
+static unsigned long idle_deadline = 0;             // 'millis()' to wake up at, from 'set_idle_deadline()'
+static uint8_t idle_deadline_set = 0;
+
+ISR(RTC_COMP_vect)
+{
+  // nothing to do, it just wakes up the CPU
+}
+
+static void tickless_init(void)
+{
+  CLK_RTCCTRL = (CLK_RTCCTRL & CLK_RTCSRC_gm) | CLK_RTCEN_bm; // 1.024khz from 'clock_setup()', section 6.9.4
+
+  while(RTC.STATUS & RTC_SYNCBUSY_bm) { }
+
+  RTC.CTRL = 0; // stopped
+  RTC.INTCTRL = 0;
+
+  while(RTC.STATUS & RTC_SYNCBUSY_bm) { }
+
+  RTC.PER = 0xffff; // free-running
+  RTC.CNT = 0;
+  RTC.COMP = 0xffff;
+  RTC.INTFLAGS = RTC_COMPIF_bm | RTC_OVFIF_bm;
+
+  while(RTC.STATUS & RTC_SYNCBUSY_bm) { }
+
+  RTC.CTRL = RTC_PRESCALER_DIV1_gc;
+}
+
+unsigned long tickless_sleep(unsigned long ms)
+{
+uint16_t wStart, wTicks;
+unsigned long lTotal;
+
+
+  // interrupts have to be on to wake up, and the RTC has to be running.  If the 32.768khz
+  // oscillator didn't start, 'clock_setup()' never got as far as 'tickless_init()'
+
+  if(ms < TICKLESS_MIN_MS || !(SREG & CPU_I_bm) || !(RTC.CTRL & RTC_PRESCALER_gm))
+  {
+    return 0;
+  }
+
+  // the 'millis' tick stops in power-save, and so would the USB clock and anything on the hook
+
+#ifdef TIMER0_TICK_HOOK
+  if(timer0_tick_hook)
+  {
+    return 0;
+  }
+#endif // TIMER0_TICK_HOOK
+
+#ifdef USB_CTRLA
+  if(USB_CTRLA & USB_ENABLE_bm)
+  {
+    return 0;
+  }
+#endif // USB_CTRLA
+
+  if(ms > TICKLESS_MAX_MS)
+  {
+    ms = TICKLESS_MAX_MS;
+  }
+
+  if(serial_flush_all) // weak, NULL unless HardwareSerial is linked in
+  {
+    serial_flush_all();
+  }
+
+  wTicks = (uint16_t)ms + (uint16_t)((ms * 3) / 125); // 1.024 ticks per msec, rounded down
+
+  cli();
+
+  while(RTC.STATUS & RTC_SYNCBUSY_bm) { }
+
+  wStart = RTC.CNT;
+  RTC.COMP = wStart + wTicks; // at least 3 ticks away, so it can't be missed
+  RTC.INTFLAGS = RTC_COMPIF_bm;
+  RTC.INTCTRL = RTC_COMPINTLVL_LO_gc;
+
+  set_sleep_mode(SLEEP_MODE_PWR_SAVE);
+  sleep_enable();
+
+  sei(); // the instruction after 'sei' always runs, so nothing can sneak in before the 'sleep'
+
+  sleep_cpu();
+
+  sleep_disable();
+
+  cli();
+
+  RTC.INTCTRL = 0;
+
+  // when it's the RTC that woke me up it's exact.  otherwise read CNT.  It can be 1 tick stale
+  // right after waking up (see errata) but that's within the ~1 msec this is good for anyway
+
+  if(!(RTC.INTFLAGS & RTC_COMPIF_bm))
+  {
+    while(RTC.STATUS & RTC_SYNCBUSY_bm) { }
+
+    wTicks = RTC.CNT - wStart;
+  }
+
+  lTotal = (unsigned long)wTicks * 1000UL + tickless_frac;
+  tickless_frac = (uint16_t)(lTotal & 1023);
+  lTotal >>= 10;
+
+  timer0_slept_ms += lTotal;
+
+  sei(); // it was on before, or I wouldn't be here
+
+  return lTotal;
+}
+
+void set_idle_deadline(unsigned long ms)
+{
+uint8_t oldSREG = SREG;
+
+  cli();
+
+  idle_deadline = millis() + ms;
+  idle_deadline_set = ms ? 1 : 0;
+
+  SREG = oldSREG;
+}
+
+void idle_sleep(void)
+{
+long lLeft;
+
+
+  if(!idle_deadline_set)
+  {
+    return;
+  }
+
+  lLeft = (long)(idle_deadline - millis());
+
+  if(lLeft <= 0)
+  {
+    idle_deadline_set = 0; // it's here
+    return;
+  }
+
+  tickless_sleep((unsigned long)lLeft); // or until some other interrupt
+}
+
+#endif // LOW_POWER_TICKLESS
+
+
+// ---------------------------------------------------------------------------------------
+//                                      FAST BOOT
+//
+// Before 'setup()' runs, 'init()' normally waits for the 32.768Khz oscillator to start (the
+// DFLL and RTC need it), sets up all of the PWM timers, resets every port's DIR and PINnCTRL
+// registers, and calibrates the ADC and does a conversion with it.  Define FAST_BOOT in
+// 'pins_arduino.h' to put off everything that 'setup()' doesn't need right away:
+//
+//   - the 32.768Khz oscillator, DFLL and RTC are done by 'init_late()', which 'main()' calls
+//     after 'setup()' returns.  Until then the 32Mhz RC is on its factory calibration
+//   - the PWM timers (except the 'millis' timer) are set up by the first 'analogWrite()'
+//   - the ADC is set up by the first 'analogRead()' (or 'analogReference()', etc.)
+//   - the DIR and PINnCTRL registers on ports C through Q are left as they are.  After a
+//     reset that's the same thing, but if a bootloader changed them, they stay changed.
+//     Port R and the analog pins on ports A and B are still done.
+//
+// FAST_BOOT also measures the time from the first instruction (before '.data' is copied and
+// '.bss' is zeroed) to 'setup()', and 'boot_time_us()' returns it.  This uses a spare 16-bit
+// timer during startup, the same one as CYCLES_TIMER if there is one, or else TCC1, unless
+// BOOT_TIME_TIMER says otherwise (NOT one of MILLIS_CASCADE_LOW/HIGH).  It counts 2 usec at a
+// time, up to ~260 msec.  When it's CYCLES_TIMER, 'init()' stops the count just before it
+// starts 'cycles()', and 'cycles()' times the rest.  Otherwise the timer is left the way reset
+// did before 'setup()'.
+// The oscillator start-up delay from the fuses, before the first instruction, is NOT
+// included.  Without a timer, or if F_CPU isn't 32Mhz, 'boot_time_us()' returns 0.
+//
+// On a 'D' series at 32Mhz, with no bootloader, this should be ~1 msec shorter at least, and
+// a lot more than that when the 32.768Khz oscillator is slow to start.  Use 'boot_time_us()'
+// to find out for sure.
+// ---------------------------------------------------------------------------------------
+
+#ifdef FAST_BOOT
+
+#if !defined(BOOT_TIME_TIMER) && defined(CYCLES_TIMER_ENABLED)
+#define BOOT_TIME_TIMER CYCLES_TIMER
+#define BOOT_TIME_SHARED /* 'init()' hands it over to 'cycles()' */
+#elif !defined(BOOT_TIME_TIMER) && defined(TCC1) && !defined(CYCLES_TIMER)
+#define BOOT_TIME_TIMER TCC1
+#endif // BOOT_TIME_TIMER, CYCLES_TIMER_ENABLED, TCC1, CYCLES_TIMER
+
+#if defined(BOOT_TIME_TIMER) && F_CPU == 32000000L
+#define BOOT_TIME_ENABLED
+#define BOOT_TIME_TC ((TC1_t *)&(BOOT_TIME_TIMER)) /* TC0_t starts with the same registers */
+
+static unsigned long boot_time = 0;
+
+// this runs before the startup code copies '.data' and zeros '.bss', so it can't use RAM.
+// The CPU starts on the 2Mhz RC, and 'clock_setup()' switches the timer to 'divide by 64'
+// when it switches to 32Mhz.  A bootloader may have switched already.
+
+static void __attribute__((section(".init3"),naked,used,no_instrument_function)) boot_time_start(void);
+
+void boot_time_start(void)
+{
+  BOOT_TIME_TC->CTRLA = (CLK_CTRL & CLK_SCLKSEL_gm) == CLK_SCLKSEL_RC2M_gc
+                      ? TC_CLKSEL_DIV4_gc    // 2 usec per count at 2Mhz
+                      : TC_CLKSEL_DIV64_gc;  // 2 usec per count at 32Mhz
+}
+
+static void boot_time_stop(void)
+{
+unsigned long lCount;
+
+
+  lCount = BOOT_TIME_TC->CNT;
+
+  if(BOOT_TIME_TC->INTFLAGS & TC1_OVFIF_bm) // it can only tell if it wrapped once
+  {
+    lCount += 0x10000UL;
+  }
+
+  BOOT_TIME_TC->CTRLA = TC_CLKSEL_OFF_gc; // the way it was after reset
+  BOOT_TIME_TC->CNT = 0;
+  BOOT_TIME_TC->INTFLAGS = 0xff;
+
+  boot_time = lCount * 2;
+}
+#endif // BOOT_TIME_TIMER, F_CPU
+
+// 'main()' calls this just before 'setup()'
+void boot_time_end(void)
+{
+#if defined(BOOT_TIME_SHARED) && defined(BOOT_TIME_ENABLED)
+  boot_time += cycles() / (F_CPU / 1000000UL); // 'init()' already stopped it, and 'cycles()' started at 0
+#elif defined(BOOT_TIME_ENABLED)
+  boot_time_stop();
+#endif // BOOT_TIME_SHARED, BOOT_TIME_ENABLED
+}
+
+#endif // FAST_BOOT
+
+unsigned long boot_time_us(void)
+{
+#ifdef BOOT_TIME_ENABLED
+  return boot_time;
+#else // BOOT_TIME_ENABLED
+  return 0;
+#endif // BOOT_TIME_ENABLED
+}
+
+
+// ---------------------------------------------------------------------------------------
+//                             RUN-TIME CLOCK SWITCHING
+//
+// With CLOCK_SWITCHING defined in 'pins_arduino.h', 'clock_switch()' changes the CPU clock
+// source while the sketch is running.  A typical use is dropping to the 2Mhz RC oscillator
+// during long idle stretches (the 32Mhz one draws a LOT more current) and going back to
+// 32Mhz when there's work to do:
+//
+//   clock_switch(CLOCK_RC2M);  // idle, waiting for something
+//   ...
+//   clock_switch(CLOCK_RC32M); // burst
+//
+// The sources are:
+//
+//   CLOCK_RC32M - the 32Mhz internal RC (what 'clock_setup()' uses), only when F_CPU is 32Mhz
+//   CLOCK_RC2M  - the 2Mhz internal RC, F_CPU / 16 (or F_CPU / 8 when F_CPU is 16Mhz)
+//   CLOCK_PLL   - the PLL from the 2Mhz RC, multiplied up to F_CPU.  This leaves the 32Mhz RC
+//                 free, but only when USB isn't already using the PLL
+//   CLOCK_XOSC  - an external crystal through the PLL, multiplied up to F_CPU.  Define
+//                 CLOCK_XOSC_HZ in 'pins_arduino.h' as the crystal frequency, which has to
+//                 divide evenly into F_CPU (with a multiplier of 31 or less)
+//
+// So the CPU clock is always F_CPU divided by a power of 2, and 'clock_hz()' tells you which.
+// That keeps the re-timing simple.  The timers the core set up (the 'millis' timer and the
+// PWM timers) are still on their 'divide by 64' pre-scaler when I switch, so I change the
+// pre-scaler to match (divide by 4 at 2Mhz).  'millis()', 'micros()' and PWM don't change at
+// all.  The cascaded 'millis' timers get a shorter period instead.  Everything else that
+// depends on the clock registers with 'clock_set_change_hook()' (in wiring_private.h), and
+// the hooks run right after the switch with interrupts still off:  the serial ports re-do
+// BSEL/BSCALE for the baud rate they're running at, and a tone that's playing re-calculates
+// its divisor and period.  The serial ports are flushed first, so nothing goes out at the
+// wrong speed.  A character being received DURING the switch can still be garbled.
+//
+// NOT re-timed:  timers that you re-configured (the pre-scaler no longer matches), the
+// CYCLES_TIMER (it counts actual CPU clocks), TWI and SPI clock rates (call 'begin()' again),
+// and the ADC clock (slower, but still in range).  'cycles()' with the cascaded timers counts
+// F_CPU clocks, not actual ones.  'delayMicroseconds()' adjusts, but at 2Mhz it's only good
+// to a few microseconds.  You can't go from CLOCK_PLL to CLOCK_XOSC (or back) directly, since
+// the PLL can't be changed while it's the CPU clock.  Switch to CLOCK_RC32M first.
+//
+// Switching takes about 1-2 msec at most (the oscillators' start-up time, the 2Mhz and 32Mhz
+// RC are much faster than a crystal) plus the time to flush the serial ports.  Oscillators
+// that aren't being used any more are turned off, unless USB is running (it needs the PLL and
+// the 32Mhz RC).
+// ---------------------------------------------------------------------------------------
+
+#ifdef CLOCK_SWITCHING
+
+#if F_CPU == 32000000L
+#define CLOCK_RC2M_SHIFT 4 /* 2Mhz is F_CPU / 16 */
+#elif F_CPU == 16000000L
+#define CLOCK_RC2M_SHIFT 3 /* 2Mhz is F_CPU / 8 */
+#else // F_CPU
+#error CLOCK_SWITCHING needs F_CPU to be 16Mhz or 32Mhz
+#endif // F_CPU
+
+#if defined(CLOCK_XOSC_HZ) && defined(CLOCK_DFLL_XTAL32K)
+#error CLOCK_XOSC_HZ and CLOCK_DFLL_XTAL32K both need the crystal oscillator, pick one
+#endif // CLOCK_XOSC_HZ, CLOCK_DFLL_XTAL32K
+
+#ifdef CLOCK_XOSC_HZ
+#if (F_CPU % CLOCK_XOSC_HZ) != 0 || (F_CPU / CLOCK_XOSC_HZ) > 31 || CLOCK_XOSC_HZ < 400000L
+#error CLOCK_XOSC_HZ must be at least 400khz and divide evenly into F_CPU, with a multiplier up to 31
+#elif CLOCK_XOSC_HZ < 2000000L
+#define CLOCK_XOSC_RANGE OSC_FRQRANGE_04TO2_gc
+#elif CLOCK_XOSC_HZ < 9000000L
+#define CLOCK_XOSC_RANGE OSC_FRQRANGE_2TO9_gc
+#elif CLOCK_XOSC_HZ < 12000000L
+#define CLOCK_XOSC_RANGE OSC_FRQRANGE_9TO12_gc
+#else // CLOCK_XOSC_HZ
+#define CLOCK_XOSC_RANGE OSC_FRQRANGE_12TO16_gc
+#endif // CLOCK_XOSC_HZ
+#endif // CLOCK_XOSC_HZ
+
+static volatile voidFuncPtr clock_change_hook = NULL;
+
+// the CLKSEL for the core's 'divide by 64' pre-scaler when the CPU clock is F_CPU >> bShift.
+// bShift is only ever 0 or CLOCK_RC2M_SHIFT (3 or 4).  'clock_pwm_clksel()' uses this too
+static uint8_t clock_div64_clksel(uint8_t bShift)
+{
+  switch(bShift)
+  {
+    case 3:
+      return TC_CLKSEL_DIV8_gc;  // 16Mhz F_CPU on the 2Mhz RC
+    case 4:
+      return TC_CLKSEL_DIV4_gc;  // 32Mhz F_CPU on the 2Mhz RC
+  }
+
+  return TC_CLKSEL_DIV64_gc;
+}
+
+static void clock_retime_timer(volatile uint8_t *pCTRLA, uint8_t bOld, uint8_t bNew)
+{
+  if((*pCTRLA & 0x0f) == bOld) // CLKSEL is still what 'init()' assigned (for the old clock)
+  {
+    *pCTRLA = (*pCTRLA & 0xf0) | bNew;
+  }
+}
+
+// re-time the core's timers for a CPU clock of F_CPU >> bNewShift.  Call with interrupts OFF
+static void clock_retime(uint8_t bOldShift, uint8_t bNewShift)
+{
+uint8_t bOld = clock_div64_clksel(bOldShift);
+uint8_t bNew = clock_div64_clksel(bNewShift);
+#ifdef MILLIS_CASCADE_ENABLED
+TC1_t *pLow = (TC1_t *)&(MILLIS_CASCADE_LOW);
+uint16_t wCount;
+#endif // MILLIS_CASCADE_ENABLED
+
+
+#ifdef TCC4 /* 'E' series */
+  clock_retime_timer(&TCC4_CTRLA, bOld, bNew);
+#ifdef TCC5
+  clock_retime_timer(&TCC5_CTRLA, bOld, bNew);
+#endif // TCC5
+  clock_retime_timer(&TCD5_CTRLA, bOld, bNew); // the 'millis' timer
+#else // TCC4
+  clock_retime_timer(&TCC0_CTRLA, bOld, bNew); // TCC2 is the same register
+  clock_retime_timer(&TCD0_CTRLA, bOld, bNew); // the 'millis' timer (TCD2 is the same register)
+#if NUM_DIGITAL_PINS > 18 /* meaning there is a PORT E available */
+  clock_retime_timer(&TCE0_CTRLA, bOld, bNew);
+#endif // NUM_DIGITAL_PINS > 18
+#if NUM_DIGITAL_PINS > 30 && defined(TCF0) /* meaning PORTF exists */
+  clock_retime_timer(&TCF0_CTRLA, bOld, bNew);
+#endif // NUM_DIGITAL_PINS > 30, TCF0
+#endif // TCC4
+
+#ifdef MILLIS_CASCADE_ENABLED
+  // the low timer counts CPU clocks at DIV1, so its period changes instead.  Scale the count
+  // the same way, so the millisecond it's in the middle of comes out (nearly) right
+
+  wCount = pLow->CNT;
+  pLow->PER = (uint16_t)((F_CPU / 1000L) >> bNewShift) - 1;
+  pLow->CNT = bNewShift > bOldShift ? (wCount >> (bNewShift - bOldShift))
+                                    : (wCount << (bOldShift - bNewShift));
+#endif // MILLIS_CASCADE_ENABLED
+}
+
+uint8_t clock_switch(uint8_t source)
+{
+uint8_t bShift, bSel, bOsc, bWasOn, bOff, oldSREG;
+uint8_t bPLL = 0;
+unsigned short sCtr;
+
+
+  switch(source)
+  {
+#if F_CPU == 32000000L
+    case CLOCK_RC32M:
+      bShift = 0;
+      bSel = CLK_SCLKSEL_RC32M_gc;
+      bOsc = OSC_RC32MEN_bm;
+      break;
+#endif // F_CPU
+    case CLOCK_RC2M:
+      bShift = CLOCK_RC2M_SHIFT;
+      bSel = CLK_SCLKSEL_RC2M_gc;
+      bOsc = OSC_RC2MEN_bm;
+      break;
+    case CLOCK_PLL:
+      bShift = 0;
+      bSel = CLK_SCLKSEL_PLL_gc;
+      bOsc = OSC_RC2MEN_bm;
+      bPLL = OSC_PLLSRC_RC2M_gc | (uint8_t)(F_CPU / 2000000L);
+      break;
+#ifdef CLOCK_XOSC_HZ
+    case CLOCK_XOSC:
+      bShift = 0;
+      bSel = CLK_SCLKSEL_PLL_gc;
+      bOsc = OSC_XOSCEN_bm;
+      bPLL = OSC_PLLSRC_XOSC_gc | (uint8_t)(F_CPU / CLOCK_XOSC_HZ);
+      break;
+#endif // CLOCK_XOSC_HZ
+    default:
+      return 0; // not supported
+  }
+
+  if(CLK_LOCK & CLK_LOCK_bm) // clock lock bit set, can't change it
+  {
+    return 0;
+  }
+
+  if((CLK_CTRL & CLK_SCLKSEL_gm) == bSel && (!bPLL || OSC_PLLCTRL == bPLL))
+  {
+    return 1; // already there
+  }
+
+  if(bPLL && (CLK_CTRL & CLK_SCLKSEL_gm) == CLK_SCLKSEL_PLL_gc)
+  {
+    return 0; // can't re-configure the PLL while it's the CPU clock
+  }
+
+#ifdef CLK_USBCTRL
+  if(bPLL && (CLK_USBCTRL & CLK_USBEN_bm)) // USB owns the PLL
+  {
+    return 0;
+  }
+#endif // CLK_USBCTRL
+
+  // start the oscillator (and the PLL) first, and wait for 'ready'.  As with 'clock_setup()'
+  // I time out rather than hang, and leave everything the way it was
+
+  bWasOn = OSC_CTRL & bOsc;
+
+#ifdef CLOCK_XOSC_HZ
+  if(bOsc == OSC_XOSCEN_bm && !bWasOn)
+  {
+    OSC_XOSCCTRL = CLOCK_XOSC_RANGE | OSC_XOSCSEL_XTAL_16KCLK_gc;
+  }
+#endif // CLOCK_XOSC_HZ
+
+  OSC_CTRL |= bOsc;
+
+  for(sCtr=32767; sCtr > 0 && !(OSC_STATUS & bOsc); sCtr--) { } // the 'ready' bits match the 'enable' bits
+
+  if(bPLL && (OSC_STATUS & bOsc))
+  {
+    OSC_CTRL &= ~OSC_PLLEN_bm; // it's not in use (checked above), so it can be re-configured
+    OSC_PLLCTRL = bPLL;
+    OSC_CTRL |= OSC_PLLEN_bm;
+
+    for(sCtr=32767; sCtr > 0 && !(OSC_STATUS & OSC_PLLRDY_bm); sCtr--) { }
+
+    bOsc |= OSC_PLLEN_bm; // so it's checked as well
+  }
+
+  if((OSC_STATUS & bOsc) != bOsc) // not ready
+  {
+    if(!bWasOn)
+    {
+      OSC_CTRL &= ~bOsc; // includes the PLL
+    }
+
+    return 0;
+  }
+
+  // don't change the baud rate in the middle of a character
+
+  if(serial_flush_all)
+  {
+    serial_flush_all();
+  }
+
+  oldSREG = SREG;
+  cli(); // the switch, re-timing, and hooks all at once, so no ISR sees a half-done job
+
+  CCP = CCP_IOREG_gc; // 0xd8 - see D manual, sect 3.14.1 (protected I/O)
+  CLK_CTRL = bSel;    // section 6.9.1
+
+  clock_retime(clock_shift, bShift);
+  clock_shift = bShift;
+
+  if(clock_change_hook)
+  {
+    clock_change_hook();
+  }
+
+  SREG = oldSREG;
+
+  // turn off what's not being used any more.  The 32.768Khz RC stays on (RTC, DFLL)
+
+  bOff = (OSC_RC32MEN_bm | OSC_RC2MEN_bm | OSC_XOSCEN_bm | OSC_PLLEN_bm) & ~bOsc;
+
+#ifdef CLOCK_DFLL_XTAL32K
+  bOff &= ~OSC_XOSCEN_bm; // it's the 32.768Khz crystal, for the DFLL and RTC
+#endif // CLOCK_DFLL_XTAL32K
+
+#ifdef CLK_USBCTRL
+  if(CLK_USBCTRL & CLK_USBEN_bm) // USB could be using any of them
+  {
+    bOff = 0;
+  }
+#endif // CLK_USBCTRL
+
+  OSC_CTRL &= ~bOff;
+
+  return 1;
+}
+
+voidFuncPtr clock_set_change_hook(voidFuncPtr pHook)
+{
+voidFuncPtr pOld;
+uint8_t oldSREG = SREG;
+
+  cli();
+
+  pOld = clock_change_hook;
+  clock_change_hook = pHook;
+
+  SREG = oldSREG;
+
+  return pOld;
+}
+
+#endif // CLOCK_SWITCHING
+
+unsigned long clock_hz(void)
+{
+#ifdef CLOCK_SWITCHING
+  return F_CPU >> clock_shift;
+#else // CLOCK_SWITCHING
+  return F_CPU;
+#endif // CLOCK_SWITCHING
+}
+
+
+// ---------------------------------------------------------------------------------------
+//                       DFLL CALIBRATION, AND MEASURING THE CPU CLOCK
+//
+// 'clock_setup()' always turns on the DFLL for the 32Mhz RC, which keeps it locked to the
+// 32.768Khz internal RC.  That RC drifts with temperature, and the 32Mhz one follows it, by
+// enough that the highest baud rates (921600 has to be within ~2%, with BSEL error included)
+// stop working at the ends of the temperature range.  Define ONE of these in
+// 'pins_arduino.h' for a better reference:
+//
+//   #define CLOCK_DFLL_XTAL32K /* a 32.768Khz crystal on TOSC1/TOSC2, also used for the RTC */
+//   #define CLOCK_DFLL_USBSOF  /* USB start-of-frame ('U' parts), only while USB is connected */
+//
+// The crystal gets CLOCK_XTAL32K_TIMEOUT msec (default 1500) to start, during 'init()', or
+// with FAST_BOOT in 'init_late()', which holds up the first 'loop()' by that much.  If it
+// doesn't start, the internal RC stays the reference and 'clock_xtal32k_ready()' returns 0.
+//
+// 'clock_measure_hz()' measures the CPU clock against the RTC (or USB frames with
+// CLOCK_DFLL_USBSOF, while they're coming in) for 125 msec, and returns it in Hz, or 0 if the
+// reference isn't running.  It uses 'cycles()', so it's good to ~10ppm with the cascaded
+// 'millis' timers or CYCLES_TIMER, and ~500ppm with CYCLES_ALLOW_MICROS.  An interrupt that
+// lands right on the first or last edge adds its length to the error.  The result is only as
+// good as the reference, so against the internal RC it mostly tells you that the DFLL is
+// locked.  Call it while running at F_CPU (see 'clock_switch()').
+// ---------------------------------------------------------------------------------------
+
+#define CLOCK_MEASURE_PERIODS 125 /* 1/8 second of USB frames, or 128 RTC ticks */
+
+unsigned long clock_measure_hz(void)
+{
+uint16_t wStart, wMask, wPeriods;
+unsigned long lStart, lTimeout;
+unsigned long lHz = 0; // 0 if it times out
+uint8_t bStarted = 0;
+volatile uint16_t *pCount;
+
+
+  pCount = &(RTC.CNT);
+  wMask = 0xffff;
+  wPeriods = CLOCK_MEASURE_PERIODS * 1024L / 1000L; // 128
+
+#if defined(CLOCK_DFLL_USBSOF) && defined(USB_CTRLA)
+  if((USB_CTRLA & USB_ENABLE_bm) && (OSC_DFLLCTRL & OSC_RC32MCREF_gm) == OSC_RC32MCREF_USBSOF_gc)
+  {
+    pCount = &(USB_FRAMENUM); // 1 per msec, 11 bits
+    wMask = 0x7ff;
+    wPeriods = CLOCK_MEASURE_PERIODS;
+  }
+  else
+#endif // CLOCK_DFLL_USBSOF, USB_CTRLA
+  if(!(CLK_RTCCTRL & CLK_RTCEN_bm) || !RTC.CTRL) // the RTC isn't running, so run it just for this
+  {
+    CLK_RTCCTRL |= CLK_RTCEN_bm;
+
+    while(RTC.STATUS & RTC_SYNCBUSY_bm) { }
+
+    RTC.PER = 0xffff; // free-running
+    RTC.CNT = 0;
+
+    while(RTC.STATUS & RTC_SYNCBUSY_bm) { }
+
+    RTC.CTRL = RTC_PRESCALER_DIV1_gc;
+    bStarted = 1;
+  }
+
+  lTimeout = millis(); // only in case the reference stops, so CPU clock accuracy doesn't matter
+
+  // start on an edge, and end on one, so the time it takes to notice them cancels out
+
+  wStart = *pCount & wMask;
+
+  while((*pCount & wMask) == wStart)
+  {
+    if(millis() - lTimeout > 250)
+    {
+      goto stop_rtc;
+    }
+  }
+
+  lStart = cycles();
+  wStart = *pCount & wMask;
+
+  while(((*pCount - wStart) & wMask) < wPeriods)
+  {
+    if(millis() - lTimeout > 500)
+    {
+      goto stop_rtc;
+    }
+  }
+
+  lHz = (cycles() - lStart) * 8; // 1/8 of a second either way
+
+stop_rtc:
+
+  if(bStarted)
+  {
+    RTC.CTRL = 0;
+    CLK_RTCCTRL &= ~CLK_RTCEN_bm;
+  }
+
+  return lHz;
+}
+
+#ifdef TIMER0_TICK_HOOK
+voidFuncPtr timer0_set_tick_hook(voidFuncPtr pHook)
+{
+voidFuncPtr pOld;
+uint8_t oldSREG = SREG;
+
+  cli();
+
+  pOld = timer0_tick_hook;
+  timer0_tick_hook = pHook;
+
+#ifdef MILLIS_CASCADE_ENABLED
+  TIMER0_TICK_INTCTRLA = pHook ? 0x3 : 0; // the tick interrupt is only needed for the hook
+#endif // MILLIS_CASCADE_ENABLED
+
+  SREG = oldSREG;
+
+  return pOld;
+}
+#endif // TIMER0_TICK_HOOK
 
 // timer zero overflow - affects pins 5 and 6 for PWM on Arduino and compatibles
 // what I want to do is simulate what the Arduino already does, using TCD2
@@ -99,6 +1020,7 @@ ISR(TCD2_LUNF_vect)
   TCD5_INTFLAGS = 1; // clears the flag so I don't 'spin' (this behavior changed from previous timers)
 #endif // 'E' series
 
+#ifndef MILLIS_CASCADE_ENABLED // otherwise the hardware keeps time, and this is only for the hook
   // copy these to local variables so they can be stored in registers
   // (volatile variables must be read from memory on every access)
   unsigned long m = timer0_millis;
@@ -117,17 +1039,40 @@ ISR(TCD2_LUNF_vect)
   timer0_fract = f;
   timer0_millis = m;
   timer0_overflow_count++;
+#endif // MILLIS_CASCADE_ENABLED
+
+#ifdef TIMER0_TICK_HOOK
+  // other things that want a periodic tick without a timer of their own (like the serial
+  // idle line detector) hook in here.  NOTE:  calling a function means the ISR has to save
+  // the call-used registers, so it's a bit longer than before (~30 cycles) even when NULL.
+  // That's why it's only here with TIMER0_TICK_HOOK defined in 'pins_arduino.h'.
+
+  if(timer0_tick_hook)
+  {
+    timer0_tick_hook();
+  }
+#endif // TIMER0_TICK_HOOK
 }
 
 unsigned long millis()
 {
   unsigned long m;
   uint8_t oldSREG = SREG;
+#ifdef MILLIS_CASCADE_ENABLED
+  uint16_t wClocks;
+#endif // MILLIS_CASCADE_ENABLED
 
   // disable interrupts while we read timer0_millis or we might get an
   // inconsistent value (e.g. in the middle of a write to timer0_millis)
   cli();
+#ifdef MILLIS_CASCADE_ENABLED
+  m = timer0_cascade_read(&wClocks);
+#else // MILLIS_CASCADE_ENABLED
   m = timer0_millis;
+#endif // MILLIS_CASCADE_ENABLED
+#ifdef LOW_POWER_TICKLESS
+  m += timer0_slept_ms; // the 'millis' timers don't count while in power-save
+#endif // LOW_POWER_TICKLESS
   SREG = oldSREG;
 
   return m;
@@ -135,8 +1080,26 @@ unsigned long millis()
 
 unsigned long micros()
 {
+#ifdef MILLIS_CASCADE_ENABLED
+  unsigned long m;
+  uint16_t wClocks;
+  uint8_t oldSREG = SREG;
+
+  cli();
+  m = timer0_cascade_read(&wClocks);
+#ifdef LOW_POWER_TICKLESS
+  m += timer0_slept_ms;
+#endif // LOW_POWER_TICKLESS
+  SREG = oldSREG;
+
+  // this wraps at 2^32 microseconds, same as before
+  return m * 1000UL + wClocks / (uint16_t)(F_CPU / 1000000L);
+#else // MILLIS_CASCADE_ENABLED
   unsigned long m;
   uint8_t t, oldSREG;
+#ifdef LOW_POWER_TICKLESS
+  unsigned long s;
+#endif // LOW_POWER_TICKLESS
 
   oldSREG = SREG;
   cli(); // for consistency, don't let this part get interrupted
@@ -164,14 +1127,92 @@ unsigned long micros()
     m++; // increment ISR count for more accurate microseconds
   }
 
+#ifdef LOW_POWER_TICKLESS
+  s = timer0_slept_ms;
+#endif // LOW_POWER_TICKLESS
+
+  SREG = oldSREG;
+
+#ifdef LOW_POWER_TICKLESS
+  return ((m << 8) + t) * (64 / clockCyclesPerMicrosecond()) + s * 1000UL;
+#else // LOW_POWER_TICKLESS
+  return ((m << 8) + t) * (64 / clockCyclesPerMicrosecond()); // TODO:  make the '64' a #define ?
+#endif // LOW_POWER_TICKLESS
+#endif // MILLIS_CASCADE_ENABLED
+}
+
+unsigned long cycles(void)
+{
+#if defined(MILLIS_CASCADE_ENABLED)
+  unsigned long m;
+  uint16_t wClocks;
+  uint8_t oldSREG = SREG;
+
+  cli();
+  m = timer0_cascade_read(&wClocks); // NOT counting power-save sleep, these are CPU clocks
+  SREG = oldSREG;
+
+  return m * (F_CPU / 1000UL) + wClocks; // wraps correctly, since it's all modulo 2^32
+#elif defined(CYCLES_TIMER_ENABLED)
+  TC1_t *pT = (TC1_t *)&(CYCLES_TIMER);
+  uint16_t wCount, wUpper;
+  uint8_t oldSREG = SREG;
+
+  cli();
+  wCount = pT->CNT;
+  wUpper = cycles_upper;
+
+  if((pT->INTFLAGS & TC1_OVFIF_bm) && wCount < 0x8000) // it wrapped but the ISR hasn't run yet
+  {
+    wUpper++;
+  }
+
   SREG = oldSREG;
 
-  return ((m << 8) + t) * (64 / clockCyclesPerMicrosecond()); // TODO:  make the '64' a #define ?
+  return ((unsigned long)wUpper << 16) | wCount;
+#elif defined(CYCLES_ALLOW_MICROS)
+  return micros() * (F_CPU / 1000000UL);
+#else // neither
+  extern void cycles_needs_CYCLES_TIMER_or_CYCLES_ALLOW_MICROS(void); // never defined, see above
+  cycles_needs_CYCLES_TIMER_or_CYCLES_ALLOW_MICROS();
+
+  return 0;
+#endif // MILLIS_CASCADE_ENABLED, CYCLES_TIMER_ENABLED, CYCLES_ALLOW_MICROS
+}
+
+uint16_t ticks(void)
+{
+#ifdef CYCLES_TIMER_ENABLED
+  uint16_t wCount;
+  uint8_t oldSREG = SREG;
+
+  cli(); // 16-bit read through TEMP, so an ISR must not read this timer in the middle of it
+  wCount = ((TC1_t *)&(CYCLES_TIMER))->CNT;
+  SREG = oldSREG;
+
+  return wCount;
+#else // CYCLES_TIMER_ENABLED
+  return (uint16_t)cycles();
+#endif // CYCLES_TIMER_ENABLED
 }
 
 void delay(unsigned long ms)
 {
-  uint16_t start = (uint16_t)micros();
+  uint16_t start;
+#ifdef LOW_POWER_TICKLESS
+  unsigned long slept;
+
+  // sleep for most of it, and count out the last msec or so the usual way (the RTC is only
+  // good to ~1 msec).  'tickless_sleep()' returns 0 when it can't sleep, i.e. interrupts off,
+  // USB enabled, or a tick hook installed
+
+  while(ms > TICKLESS_MIN_MS && (slept = tickless_sleep(ms - 1)) != 0)
+  {
+    ms = slept < ms ? ms - slept : 0; // it might wake up early, so keep going
+  }
+#endif // LOW_POWER_TICKLESS
+
+  start = (uint16_t)micros();
 
   while (ms > 0) /* BF - fixed K&R style to Allman for readability/consistency */
   {
@@ -201,18 +1242,41 @@ void wait_for_interrupt(void)
 
 void low_power_delay(unsigned long ms)
 {
-  uint16_t start = (uint16_t)micros();
+  uint16_t start;
+#ifdef MILLIS_CASCADE_ENABLED
+  uint8_t oldTick;
+#endif // MILLIS_CASCADE_ENABLED
+#ifdef LOW_POWER_TICKLESS
+  unsigned long slept;
+
+  while(ms >= TICKLESS_MIN_MS && (slept = tickless_sleep(ms)) != 0) // power-save, see above
+  {
+    ms = slept < ms ? ms - slept : 0;
+  }
+#endif // LOW_POWER_TICKLESS
+
+  start = (uint16_t)micros();
+
+#ifdef MILLIS_CASCADE_ENABLED
+  oldTick = TIMER0_TICK_INTCTRLA;
+
+  TIMER0_TICK_INTCTRLA = 0x3; // no periodic interrupt otherwise, so turn on the tick to wake up
+#endif // MILLIS_CASCADE_ENABLED
 
   while (ms > 0)
   {
     wait_for_interrupt(); // up to 1msec perhaps?
 
-    while (((uint16_t)micros() - start) >= 1000)
+    while (ms > 0 && ((uint16_t)micros() - start) >= 1000)
     {
       ms--;
       start += 1000;
     }
   }
+
+#ifdef MILLIS_CASCADE_ENABLED
+  TIMER0_TICK_INTCTRLA = oldTick;
+#endif // MILLIS_CASCADE_ENABLED
 }
 
 
@@ -308,6 +1372,15 @@ void delayMicroseconds(unsigned int us)
   us--;
 #endif
 
+#ifdef CLOCK_SWITCHING
+  us >>= clock_shift; // fewer loops per microsecond at a slower clock (see 'clock_switch()')
+
+  if(!us)
+  {
+    return; // the overhead is longer than that
+  }
+#endif // CLOCK_SWITCHING
+
   // busy wait
   __asm__ __volatile__ (
     "1: sbiw %0,1" "\n\t" // 2 cycles
@@ -330,10 +1403,11 @@ void delayMicroseconds(unsigned int us)
 // this function is separate since it provides a specific functionality
 // and aids in readability by separating it from the main 'init()' code
 // regardless of the extra bytes needed to make the function call
+static void clock_setup_rc32k(void);
+
 void clock_setup(void)
 {
 unsigned short sCtr;
-register unsigned char c1;
 
   // TODO:  get rid of magic bit numbers, and use bit value constants from iox64d4.h etc. (ongoing)
 
@@ -376,6 +1450,10 @@ register unsigned char c1;
 
       CCP = CCP_IOREG_gc; // 0xd8 - see D manual, sect 3.14.1 (protected I/O)
       CLK_CTRL = CLK_SCLKSEL_RC32M_gc; // set the clock to 32Mhz (6.9.1)
+
+#ifdef BOOT_TIME_ENABLED
+      BOOT_TIME_TC->CTRLA = TC_CLKSEL_DIV64_gc; // 16 times the clock, so still 2 usec per count
+#endif // BOOT_TIME_ENABLED
     }
 
     if(CLK_PSCTRL != 0)
@@ -393,7 +1471,42 @@ register unsigned char c1;
         | OSC_RC8MEN_bm    /* disable the 8M oscillator (when present) */
 #endif // OSC_RC8MCAL
         );
+  }
+
+#ifndef FAST_BOOT
+  clock_setup_rc32k();
+#endif // FAST_BOOT
+}
+
+#ifdef CLOCK_DFLL_XTAL32K
+#ifndef CLOCK_XTAL32K_TIMEOUT
+#define CLOCK_XTAL32K_TIMEOUT 1500 /* msec to wait for the crystal to start */
+#endif // CLOCK_XTAL32K_TIMEOUT
+
+static uint8_t clock_xtal32k_ok = 0; // set once the crystal is the DFLL and RTC reference
+#endif // CLOCK_DFLL_XTAL32K
 
+// returns non-zero once the 32.768Khz crystal is running and is the DFLL and RTC reference.
+// 0 means it didn't start in time, or it hasn't been tried yet (FAST_BOOT, before
+// 'init_late()'), or CLOCK_DFLL_XTAL32K isn't defined
+uint8_t clock_xtal32k_ready(void)
+{
+#ifdef CLOCK_DFLL_XTAL32K
+  return clock_xtal32k_ok;
+#else // CLOCK_DFLL_XTAL32K
+  return 0;
+#endif // CLOCK_DFLL_XTAL32K
+}
+
+// the 32.768KHz oscillator, the DFLL, and the RTC.  This is separate because the 32.768KHz
+// oscillator can take a while to start, and FAST_BOOT puts it off until after 'setup()'
+static void clock_setup_rc32k(void)
+{
+unsigned short sCtr;
+register unsigned char c1;
+
+  if(!(CLK_LOCK & CLK_LOCK_bm)) // clock lock bit NOT set (see 'clock_setup()')
+  {
     // wait until 32.768KHz clock is 'stable'.  this one goes for a while
     // in case it doesn't stabilize in a reasonable time.  I figure about
     // 64*255 clock cycles should be enough, ya think?  Timeout if it's not
@@ -414,6 +1527,48 @@ register unsigned char c1;
     // (it uses the reasonably precise 32.768KHz clock to do it)
 
     OSC_DFLLCTRL = 0; // sect 6.10.7 - select 32.768KHz osc for everything, basically
+
+#if defined(CLOCK_DFLL_XTAL32K)
+    // a 32.768KHz crystal on TOSC1/TOSC2 is a LOT better than the internal RC, over temperature
+    // especially.  It can take a second or so to start up, so it gets CLOCK_XTAL32K_TIMEOUT
+    // msec, counted with 'delayMicroseconds()' since interrupts may not be on yet.  If it never
+    // gets there (i.e. no crystal), the internal RC is still the reference, and
+    // 'clock_xtal32k_ready()' returns 0.
+
+    OSC_XOSCCTRL = OSC_XOSCSEL_32KHz_gc; // section 6.10.3
+    OSC_CTRL |= OSC_XOSCEN_bm;
+
+    for(sCtr=CLOCK_XTAL32K_TIMEOUT; sCtr > 0; sCtr--)
+    {
+      if(OSC_STATUS & OSC_XOSCRDY_bm) // crystal oscillator is 'ready' (6.10.2)
+      {
+        break;
+      }
+
+      delayMicroseconds(1000);
+    }
+
+    if(OSC_STATUS & OSC_XOSCRDY_bm)
+    {
+      OSC_DFLLCTRL = OSC_RC32MCREF_XOSC32K_gc; // the crystal is the DFLL reference
+      CLK_RTCCTRL = CLK_RTCSRC_TOSC_gc;        // and the RTC's (see below), still 1.024khz
+
+      clock_xtal32k_ok = 1;
+    }
+    else
+    {
+      OSC_CTRL &= ~OSC_XOSCEN_bm;
+    }
+#elif defined(CLOCK_DFLL_USBSOF) && defined(USB_CTRLA)
+    // USB start-of-frame is exactly 1khz (the host's crystal), so the DFLL compares against
+    // 32000 clocks per frame instead of 31250 per 1.024khz tick.  It only corrects while
+    // the frames are coming in, i.e. USB is connected.  Until then, factory calibration.
+
+    DFLLRC32M_COMP1 = (uint8_t)(F_CPU / 1000L);        // 7D00H at 32Mhz (section 6.11.6)
+    DFLLRC32M_COMP2 = (uint8_t)((F_CPU / 1000L) >> 8);
+    OSC_DFLLCTRL = OSC_RC32MCREF_USBSOF_gc;
+#endif // CLOCK_DFLL_XTAL32K, CLOCK_DFLL_USBSOF
+
     DFLLRC32M_CTRL = 1; // set the bit to enable DFLL calibration - section 6.11.1
   }
 
@@ -434,129 +1589,292 @@ register unsigned char c1;
     }
   }
 
-  if(!(OSC_STATUS & OSC_RC32KRDY_bm/*CLK_SCLKSEL_RC32K_gc*/)) // is my oscillator 'ready' ?
-  {
-    return; // exit - don't change anything else.  Better to fail than to hang
-  }
+  if(!(OSC_STATUS & OSC_RC32KRDY_bm/*CLK_SCLKSEL_RC32K_gc*/)) // is my oscillator 'ready' ?
+  {
+    return; // exit - don't change anything else.  Better to fail than to hang
+  }
+
+
+  // RUN-TIME clock - use internal 1.024 khz source.  cal'd 32khz needed for this (but it's running)
+  // The RTC can be used to wake up the CPU.  It uses VERY little current.
+
+#ifdef CLOCK_DFLL_XTAL32K
+  if((CLK_RTCCTRL & CLK_RTCSRC_gm) != CLK_RTCSRC_TOSC_gc) // the crystal isn't running
+#endif // CLOCK_DFLL_XTAL32K
+  {
+    CLK_RTCCTRL = CLK_RTCSRC_RCOSC_gc; // section 6.9.4
+  }
+
+#ifdef LOW_POWER_TICKLESS
+  tickless_init(); // and start the RTC, for waking up from power-save
+#endif // LOW_POWER_TICKLESS
+}
+
+
+// this was derived from a message board post.  The function is public to make it easy to
+// use the 'Production Signature Row'.  There is a unique identifier for the CPU as well as
+// calibration data for the ADC available, and also USB settings (for USB-capable devices)
+// See sect. 4.14 "Production Signature Row" in 'D' manual.  
+uint8_t readCalibrationData(uint16_t iIndex)
+{
+  uint8_t rVal;
+
+  /* Load the NVM Command register to read the calibration row. */
+  NVM_CMD = NVM_CMD_READ_CALIB_ROW_gc; // see the section on NVM operations and lpm instruction
+
+//  rVal = pgm_read_byte_near(iIndex); // effectively the same thing as the inline assembler
+  __asm__ ("lpm %0, Z\n" : "=r" (rVal) : "z" (iIndex)); // do it THIS way instead
+
+  /* Clean up NVM Command register. */
+  NVM_CMD = NVM_CMD_NO_OPERATION_gc;
+
+  return(rVal);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//                                                                                                           //
+//   _____  _                          ___         _  _    _         _  _             _    _                 //
+//  |_   _|(_) _ __ ___    ___  _ __  |_ _| _ __  (_)| |_ (_)  __ _ | |(_) ____ __ _ | |_ (_)  ___   _ __    //
+//    | |  | || '_ ` _ \  / _ \| '__|  | | | '_ \ | || __|| | / _` || || ||_  // _` || __|| | / _ \ | '_ \   //
+//    | |  | || | | | | ||  __/| |     | | | | | || || |_ | || (_| || || | / /| (_| || |_ | || (_) || | | |  //
+//    |_|  |_||_| |_| |_| \___||_|    |___||_| |_||_| \__||_| \__,_||_||_|/___|\__,_| \__||_| \___/ |_| |_|  //
+//                                                                                                           //
+//                                                                                                           //
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// the PWM timers' CLKSEL, 'divide by 64' at F_CPU.  With FAST_BOOT, 'pwm_setup()' can run after a
+// 'clock_switch()', so use the same pre-scaler that 'clock_retime()' would have switched it to.
+// Tone.cpp uses it too (see wiring_private.h)
+uint8_t clock_pwm_clksel(void)
+{
+#ifdef CLOCK_SWITCHING
+  return clock_div64_clksel(clock_shift);
+#else // CLOCK_SWITCHING
+  return TC_CLKSEL_DIV64_gc; // b0101 - divide by 64
+#endif // CLOCK_SWITCHING
+}
+
+#ifdef TCC2
+static void Timer2Init(TC2_t *port)
+{
+  port->CTRLA = clock_pwm_clksel(); // b0101 - divide by 64 at F_CPU - D manual 13.9.1
+  port->CTRLB = 0; // compare outputs disabled on all 8 bits (13.9.2)
+//  port->CTRLC = 0; // when timer not running, sets compare (13.9.3)
+  port->CTRLE = 0x2; // b10 - 'split' mode - D manual 13.9.4
+  port->CTRLF = 0;   // not resetting or anything (13.9.7)
+
+  port->LPER = 255; // count 255 to 0 (total period = 256)
+  port->HPER = 255;
+
+  // pre-assign comparison registers to 'zero' (for PWM out) which is actually 255
+  // 'timer 2' counts DOWN.  This, however, would generate a '1' output.
+
+  port->LCMPA = 255;
+  port->LCMPB = 255;
+  port->LCMPC = 255;
+  port->LCMPD = 255;
+
+  port->HCMPA = 255;
+  port->HCMPB = 255;
+  port->HCMPC = 255;
+  port->HCMPD = 255;
+
+  // disable underflow and comparison interrupts
+  port->INTCTRLA = 0;   // no underflow interrupts
+  port->INTCTRLB = 0;   // no comparison interrupts
+}
+#elif defined(TCC0) // use TC0_t
+static void Timer2Init(TC0_t *port)
+{
+  // TCC2
+  // first the clock selection
+  port->CTRLA = clock_pwm_clksel(); // b0101 - divide by 64 at F_CPU - D manual 13.9.1
+  port->CTRLB = 0; // compare outputs disabled on all 8 bits (13.9.2)
+//  TCC2_CTRLC = 0; // when timer not running, sets compare (13.9.3)
+  port->CTRLE = 0x2; // b10 - 'split' mode - D manual 13.9.4
+#ifdef TCC0_CTRLFCLR // NOTE:  is this correct?
+  port->CTRLFCLR = 0xff; // this does NOT map to anything for TC_t, but I want zeros in CTRLF so 'just in case'
+  port->CTRLFSET = 0; // this maps to 'CTRLF' for TC2_t, and this assignment should work on its own
+#else // TCC0_CTRLFCLR
+  // NOTE: this code will probably NOT be compiled due to the way TC0_t maps to TC2_t
+  port->CTRLF = 0;   // not resetting or anything (13.9.7)
+#endif // TCC0_CTRLFCLR
+
+  port->PER = 255;
+//  TCC2_LPER = 255; // count 255 to 0 (total period = 256)
+//  TCC2_HPER = 255; // should this be zero?
+
+  // pre-assign comparison registers to 'zero' (for PWM out) which is actually 255
+  // 'timer 2' counts DOWN.  This, however, would generate a '1' output.
+
+//  ((uint8_t *)&(port->CCA))[0] = 255; // low bytes
+//  ((uint8_t *)&(port->CCB))[0] = 255;
+//  ((uint8_t *)&(port->CCC))[0] = 255;
+//  ((uint8_t *)&(port->CCD))[0] = 255;
+
+//  ((uint8_t *)&(port->CCA))[1] = 255; // high bytes
+//  ((uint8_t *)&(port->CCB))[1] = 255;
+//  ((uint8_t *)&(port->CCC))[1] = 255;
+//  ((uint8_t *)&(port->CCD))[1] = 255;
+
+  // NOTE:  according to the docs, 16-bit registers MUST be accessed
+  //        low byte first, then high byte, before the actual value
+  //        is transferred to the register.  THIS code will.
+  //        see A1U manual sect. 3.11 (and others as well)
+
+  port->CCA = 0xffff;
+  port->CCB = 0xffff;
+  port->CCC = 0xffff;
+  port->CCD = 0xffff;
+
+  // disable underflow and comparison interrupts
+  port->INTCTRLA = 0;   // no underflow interrupts
+  port->INTCTRLB = 0;   // no comparison interrupts
+}
+#endif // TCC2
+
+// the PWM timers, other than the 'millis' timer (which also does PWM on port D).  'init()'
+// calls this, or with FAST_BOOT the first 'analogWrite()' does (see wiring_analog.c)
+void pwm_setup(void)
+{
+#ifdef TCC4 /* this is my trigger for 'E' series */
+
+// if 'HIRES' enabled, shut it off
+#ifdef HIRESC_ENABLE
+  HIRESC_ENABLE = HIRES_HREN_NONE_gc;
+#endif // HIRESC_ENABLE
+
+  PORTC_REMAP &= PORT_USART0_bm; // all other pins are zero except maybe USART0 remap
+
+  // TCC4
+  // first the clock selection
+  TCC4_CTRLA = clock_pwm_clksel(); // b0101 - divide by 64 at F_CPU - E manual 13.13.1
+  TCC4_CTRLB = TC45_BYTEM_BYTEMODE_gc | TC45_WGMODE_SINGLESLOPE_gc; // byte mode, single slope
+//  TCC4_CTRLB = TC45_BYTEM_BYTEMODE_gc | TC45_WGMODE_DSBOTH_gc; // byte mode, dual slope, ovf on bottom AND top
+////  TCC4_CTRLC = 0; // when timer not running, sets compare (13.9.3)
+  TCC4_CTRLD = 0; // events off
+  TCC4_CTRLE = 0; // no output on L pins
+  TCC4_CTRLF = 0; // no output on H pins
+
+  TCC4_PER = 255; // 255 for period limit
+
+  // pre-assign comparison registers to 'zero' (for PWM out) which is actually 255
+  // 'timer 2' counts DOWN.
+
+  TCC4_CCA = 65535;
+  TCC4_CCB = 65535;
+  TCC4_CCC = 65535;
+  TCC4_CCD = 65535;
+
+  TCC4_CTRLGCLR = 0xfe;
+  TCC4_CTRLGSET = 1; // count DOWN
+
+  // disable underflow and comparison interrupts
+  TCC4_INTCTRLA = 0;   // no underflow interrupts
+  TCC4_INTCTRLB = 0;   // no comparison interrupts
+
+
+  // also set up TCC5
+
+#ifdef TCC5
+
+  TCC5_INTCTRLA = 0;   // no underflow interrupts
+  TCC5_INTCTRLB = 0;   // no comparison interrupts
+
+  TCC5_CTRLA = clock_pwm_clksel(); // b0101 - divide by 64 at F_CPU - E manual 13.13.1
+  TCC5_CTRLB = TC45_WGMODE_NORMAL_gc; // 'normal' mode, 16-bit mode
+////  TCC5_CTRLC = 0; // when timer not running, sets compare (13.9.3)
+  TCC5_CTRLD = 0; // events off
+  TCC5_CTRLE = 0; // no output on L pins
+  TCC5_CTRLF = 0; // no output on H pins
+
+  TCC5_PER = 255; // 255 for period limit
+
+  TCC5_CCA = 0;
+  TCC5_CCB = 0;
+
+  TCC5_CTRLGCLR = 0xff;
+  TCC5_CTRLGSET = 0; // count UP
+
+  // disable underflow and comparison interrupts
+  TCC5_INTCTRLA = 0;   // no underflow interrupts
+  TCC5_INTCTRLB = 0;   // no comparison interrupts
+
+#endif // TCC5
+
+#elif !defined(TCC2) /* A1 series doesn't define this properly, so use TCC0 and TCD0, etc. */
+
+  Timer2Init(&TCC0);
+
+#else // TCC2
+
+  Timer2Init(&TCC2);
+
+#endif // TCC4, TCC2
+
 
+#if NUM_DIGITAL_PINS > 22 /* meaning PORTE is available and has 8 pins */
 
-  // RUN-TIME clock - use internal 1.024 khz source.  cal'd 32khz needed for this (but it's running)
-  // The RTC can be used to wake up the CPU.  It uses VERY little current.
+#if !defined(TCE2) && defined(TCE0)
 
-  CLK_RTCCTRL = CLK_RTCSRC_RCOSC_gc; // section 6.9.4
-}
+  Timer2Init(&TCE0);
 
+#elif defined(TCE2) // TCE2 defined, use that
 
-// this was derived from a message board post.  The function is public to make it easy to
-// use the 'Production Signature Row'.  There is a unique identifier for the CPU as well as
-// calibration data for the ADC available, and also USB settings (for USB-capable devices)
-// See sect. 4.14 "Production Signature Row" in 'D' manual.  
-uint8_t readCalibrationData(uint16_t iIndex)
-{
-  uint8_t rVal;
+  Timer2Init(&TCE2);
 
-  /* Load the NVM Command register to read the calibration row. */
-  NVM_CMD = NVM_CMD_READ_CALIB_ROW_gc; // see the section on NVM operations and lpm instruction
+#endif // TCE2, TCE0
 
-//  rVal = pgm_read_byte_near(iIndex); // effectively the same thing as the inline assembler
-  __asm__ ("lpm %0, Z\n" : "=r" (rVal) : "z" (iIndex)); // do it THIS way instead
 
-  /* Clean up NVM Command register. */
-  NVM_CMD = NVM_CMD_NO_OPERATION_gc;
+#if NUM_DIGITAL_PINS > 30 /* meaning PORTF exists */
 
-  return(rVal);
-}
+#if !defined(TCF2) && defined(TCF0)
 
+  Timer2Init(&TCF0);
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////
-//                                                                                                           //
-//   _____  _                          ___         _  _    _         _  _             _    _                 //
-//  |_   _|(_) _ __ ___    ___  _ __  |_ _| _ __  (_)| |_ (_)  __ _ | |(_) ____ __ _ | |_ (_)  ___   _ __    //
-//    | |  | || '_ ` _ \  / _ \| '__|  | | | '_ \ | || __|| | / _` || || ||_  // _` || __|| | / _ \ | '_ \   //
-//    | |  | || | | | | ||  __/| |     | | | | | || || |_ | || (_| || || | / /| (_| || |_ | || (_) || | | |  //
-//    |_|  |_||_| |_| |_| \___||_|    |___||_| |_||_| \__||_| \__,_||_||_|/___|\__,_| \__||_| \___/ |_| |_|  //
-//                                                                                                           //
-//                                                                                                           //
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#elif defined(TCF2) // TCF2 defined, use that
 
-#ifdef TCC2
-static void Timer2Init(TC2_t *port)
-{
-  port->CTRLA = 5; // b0101 - divide by 64 - D manual 13.9.1
-  port->CTRLB = 0; // compare outputs disabled on all 8 bits (13.9.2)
-//  port->CTRLC = 0; // when timer not running, sets compare (13.9.3)
-  port->CTRLE = 0x2; // b10 - 'split' mode - D manual 13.9.4
-  port->CTRLF = 0;   // not resetting or anything (13.9.7)
+  Timer2Init(&TCF2);
 
-  port->LPER = 255; // count 255 to 0 (total period = 256)
-  port->HPER = 255;
+#endif // TCF2, TCF0
 
-  // pre-assign comparison registers to 'zero' (for PWM out) which is actually 255
-  // 'timer 2' counts DOWN.  This, however, would generate a '1' output.
 
-  port->LCMPA = 255;
-  port->LCMPB = 255;
-  port->LCMPC = 255;
-  port->LCMPD = 255;
+// TODO:  other timers on other ports when more than 38 pins available?
 
-  port->HCMPA = 255;
-  port->HCMPB = 255;
-  port->HCMPC = 255;
-  port->HCMPD = 255;
 
-  // disable underflow and comparison interrupts
-  port->INTCTRLA = 0;   // no underflow interrupts
-  port->INTCTRLB = 0;   // no comparison interrupts
-}
-#elif defined(TCC0) // use TC0_t
-static void Timer2Init(TC0_t *port)
-{
-  // TCC2
-  // first the clock selection
-  port->CTRLA = 5; // b0101 - divide by 64 - D manual 13.9.1
-  port->CTRLB = 0; // compare outputs disabled on all 8 bits (13.9.2)
-//  TCC2_CTRLC = 0; // when timer not running, sets compare (13.9.3)
-  port->CTRLE = 0x2; // b10 - 'split' mode - D manual 13.9.4
-#ifdef TCC0_CTRLFCLR // NOTE:  is this correct?
-  port->CTRLFCLR = 0xff; // this does NOT map to anything for TC_t, but I want zeros in CTRLF so 'just in case'
-  port->CTRLFSET = 0; // this maps to 'CTRLF' for TC2_t, and this assignment should work on its own
-#else // TCC0_CTRLFCLR
-  // NOTE: this code will probably NOT be compiled due to the way TC0_t maps to TC2_t
-  port->CTRLF = 0;   // not resetting or anything (13.9.7)
-#endif // TCC0_CTRLFCLR
+#endif // NUM_DIGITAL_PINS > 30
 
-  port->PER = 255;
-//  TCC2_LPER = 255; // count 255 to 0 (total period = 256)
-//  TCC2_HPER = 255; // should this be zero?
 
-  // pre-assign comparison registers to 'zero' (for PWM out) which is actually 255
-  // 'timer 2' counts DOWN.  This, however, would generate a '1' output.
+#elif NUM_DIGITAL_PINS > 18 /* meaning there is a PORT E available with only 4 pins */
 
-//  ((uint8_t *)&(port->CCA))[0] = 255; // low bytes
-//  ((uint8_t *)&(port->CCB))[0] = 255;
-//  ((uint8_t *)&(port->CCC))[0] = 255;
-//  ((uint8_t *)&(port->CCD))[0] = 255;
+  // now set up TCE0 as an 8-bit timer so it's compatible with Arduino's PWM
+  // first the clock selection
+  TCE0_CTRLA = clock_pwm_clksel(); // b0101 - divide by 64 at F_CPU - D manual 12.11.1
+  TCE0_CTRLB = TC_WGMODE_SS_gc; // single-slope PWM.  NOTE:  this counts UP, whereas the other timers count DOWN
+               // other bits (high nybble) are OFF - they enable output on the 4 port E pins
+//  TCE0_CTRLC = 0; // when timer not running, sets compare (12.11.3)
+  TCE0_CTRLD = 0; // not an event timer, 16-bit mode (12.11.4)
+  TCE0_CTRLE = 1; // normal 8-bit timer (set to 0 for 16-bit mode) (12.11.5)
 
-//  ((uint8_t *)&(port->CCA))[1] = 255; // high bytes
-//  ((uint8_t *)&(port->CCB))[1] = 255;
-//  ((uint8_t *)&(port->CCC))[1] = 255;
-//  ((uint8_t *)&(port->CCD))[1] = 255;
+  // disable under/overflow and comparison interrupts
+  TCE0_INTCTRLA = 0;   // no underflow interrupts
+  TCE0_INTCTRLB = 0;   // no comparison interrupts
 
-  // NOTE:  according to the docs, 16-bit registers MUST be accessed
-  //        low byte first, then high byte, before the actual value
-  //        is transferred to the register.  THIS code will.
-  //        see A1U manual sect. 3.11 (and others as well)
+  // make sure the timer E 'period' register is correctly set at 255 (i.e. 0-255 or 256 clock cycles).
+  TCE0_PER = 255;
 
-  port->CCA = 0xffff;
-  port->CCB = 0xffff;
-  port->CCC = 0xffff;
-  port->CCD = 0xffff;
+  // pre-assign comparison registers to 'zero' (for PWM out) which is actually 255
+  // timer 0 can be configured to count UP or DOWN, but for single-slope PWM it is
+  // always 'UP'.  A value of '255' should generate a '1' output for each PWM.
 
-  // disable underflow and comparison interrupts
-  port->INTCTRLA = 0;   // no underflow interrupts
-  port->INTCTRLB = 0;   // no comparison interrupts
+  TCE0_CCA = 255;
+  TCE0_CCB = 255;
+  TCE0_CCC = 255;
+  TCE0_CCD = 255;
+
+#endif // NUM_DIGITAL_PINS > 18, 22
 }
-#endif // TCC2
 
 
 //////////////////////////////////////////////////////////////////////////////
@@ -666,70 +1984,6 @@ void init()
 #endif // PORTD_REMAP
 
 
-// if 'HIRES' enabled, shut it off
-#ifdef HIRESC_ENABLE
-  HIRESC_ENABLE = HIRES_HREN_NONE_gc;
-#endif // HIRESC_ENABLE
-
-  PORTC_REMAP &= PORT_USART0_bm; // all other pins are zero except maybe USART0 remap
-
-  // TCC4
-  // first the clock selection
-  TCC4_CTRLA = 5; // b0101 - divide by 64 - E manual 13.13.1
-  TCC4_CTRLB = TC45_BYTEM_BYTEMODE_gc | TC45_WGMODE_SINGLESLOPE_gc; // byte mode, single slope
-//  TCC4_CTRLB = TC45_BYTEM_BYTEMODE_gc | TC45_WGMODE_DSBOTH_gc; // byte mode, dual slope, ovf on bottom AND top
-////  TCC4_CTRLC = 0; // when timer not running, sets compare (13.9.3)
-  TCC4_CTRLD = 0; // events off
-  TCC4_CTRLE = 0; // no output on L pins
-  TCC4_CTRLF = 0; // no output on H pins
-
-  TCC4_PER = 255; // 255 for period limit
-
-  // pre-assign comparison registers to 'zero' (for PWM out) which is actually 255
-  // 'timer 2' counts DOWN.
-
-  TCC4_CCA = 65535;
-  TCC4_CCB = 65535;
-  TCC4_CCC = 65535;
-  TCC4_CCD = 65535;
-
-  TCC4_CTRLGCLR = 0xfe;
-  TCC4_CTRLGSET = 1; // count DOWN
-
-  // disable underflow and comparison interrupts
-  TCC4_INTCTRLA = 0;   // no underflow interrupts
-  TCC4_INTCTRLB = 0;   // no comparison interrupts
-
-
-  // also set up TCC5
-
-#ifdef TCC5
-
-  TCC5_INTCTRLA = 0;   // no underflow interrupts
-  TCC5_INTCTRLB = 0;   // no comparison interrupts
-
-  TCC5_CTRLA = 5; // b0101 - divide by 64 - E manual 13.13.1
-  TCC5_CTRLB = TC45_WGMODE_NORMAL_gc; // 'normal' mode, 16-bit mode
-////  TCC5_CTRLC = 0; // when timer not running, sets compare (13.9.3)
-  TCC5_CTRLD = 0; // events off
-  TCC5_CTRLE = 0; // no output on L pins
-  TCC5_CTRLF = 0; // no output on H pins
-
-  TCC5_PER = 255; // 255 for period limit
-
-  TCC5_CCA = 0;
-  TCC5_CCB = 0;
-
-  TCC5_CTRLGCLR = 0xff;
-  TCC5_CTRLGSET = 0; // count UP
-
-  // disable underflow and comparison interrupts
-  TCC5_INTCTRLA = 0;   // no underflow interrupts
-  TCC5_INTCTRLB = 0;   // no comparison interrupts
-
-#endif // TCC5
-
-
 #else // everything else uses TCD2 for system timer
 
 #ifndef TCC2 /* A1 series doesn't define this properly, so use TCC0 and TCD0, etc. */
@@ -767,8 +2021,6 @@ void init()
   TCD0_INTCTRLA = 0x3; // enable LOW underflow interrupt, pri level 3 (see 13.9.5 in D manual)
   TCD0_INTCTRLB = 0;   // no comparison or underflow interrupts on anything else
 
-  Timer2Init(&TCC0);
-
 #else // TCC2
 
   // TCD2
@@ -799,73 +2051,27 @@ void init()
   TCD2_INTCTRLA = 0x3; // enable LOW underflow interrupt, pri level 3 (see 13.9.5 in D manual)
   TCD2_INTCTRLB = 0;   // no comparison or underflow interrupts on anything else
 
-  Timer2Init(&TCC2);
-
 #endif // TCC2
 
 #endif // TCD5 or TCD2
 
+#ifdef CYCLES_TIMER_ENABLED
+#if defined(BOOT_TIME_SHARED) && defined(BOOT_TIME_ENABLED)
+  boot_time_stop(); // same timer - 'boot_time_end()' adds 'cycles()' from here on
+#endif // BOOT_TIME_SHARED, BOOT_TIME_ENABLED
+  cycles_init();
+#endif // CYCLES_TIMER_ENABLED
 
-#if NUM_DIGITAL_PINS > 22 /* meaning PORTE is available and has 8 pins */
-
-#if !defined(TCE2) && defined(TCE0)
-
-  Timer2Init(&TCE0);
-
-#elif defined(TCE2) // TCE2 defined, use that
-
-  Timer2Init(&TCE2);
-
-#endif // TCE2, TCE0
-
-
-#if NUM_DIGITAL_PINS > 30 /* meaning PORTF exists */
-
-#if !defined(TCF2) && defined(TCF0)
-
-  Timer2Init(&TCF0);
-
-#elif defined(TCF2) // TCF2 defined, use that
-
-  Timer2Init(&TCF2);
-
-#endif // TCF2, TCF0
-
-
-// TODO:  other timers on other ports when more than 38 pins available?
-
-
-#endif // NUM_DIGITAL_PINS > 30
-
-
-#elif NUM_DIGITAL_PINS > 18 /* meaning there is a PORT E available with only 4 pins */
-
-  // now set up TCE0 as an 8-bit timer so it's compatible with Arduino's PWM
-  // first the clock selection
-  TCE0_CTRLA = 5; // b0101 - divide by 64 - D manual 12.11.1
-  TCE0_CTRLB = TC_WGMODE_SS_gc; // single-slope PWM.  NOTE:  this counts UP, whereas the other timers count DOWN
-               // other bits (high nybble) are OFF - they enable output on the 4 port E pins
-//  TCE0_CTRLC = 0; // when timer not running, sets compare (12.11.3)
-  TCE0_CTRLD = 0; // not an event timer, 16-bit mode (12.11.4)
-  TCE0_CTRLE = 1; // normal 8-bit timer (set to 0 for 16-bit mode) (12.11.5)
-
-  // disable under/overflow and comparison interrupts
-  TCE0_INTCTRLA = 0;   // no underflow interrupts
-  TCE0_INTCTRLB = 0;   // no comparison interrupts
-
-  // make sure the timer E 'period' register is correctly set at 255 (i.e. 0-255 or 256 clock cycles).
-  TCE0_PER = 255;
+#ifdef MILLIS_CASCADE_ENABLED
+  timer0_cascade_init();
 
-  // pre-assign comparison registers to 'zero' (for PWM out) which is actually 255
-  // timer 0 can be configured to count UP or DOWN, but for single-slope PWM it is
-  // always 'UP'.  A value of '255' should generate a '1' output for each PWM.
+  TIMER0_TICK_INTCTRLA = 0; // no periodic interrupt, unless 'timer0_set_tick_hook()' needs it
+#endif // MILLIS_CASCADE_ENABLED
 
-  TCE0_CCA = 255;
-  TCE0_CCB = 255;
-  TCE0_CCC = 255;
-  TCE0_CCD = 255;
 
-#endif // NUM_DIGITAL_PINS > 18, 22
+#ifndef FAST_BOOT
+  pwm_setup(); // with FAST_BOOT, the first 'analogWrite()' does this
+#endif // FAST_BOOT
 
 
 
@@ -936,6 +2142,7 @@ void init()
   // all pins on all ports are inputs except for the LEDs on PR0,1
   //--------------------------------------------------------------
 
+#ifndef FAST_BOOT /* with FAST_BOOT they stay the way reset (or the bootloader) left them */
   PORTC_DIR = 0; // all 'port C' pins are now inputs
   PORTD_DIR = 0; // all 'port D' pins are now inputs
 #ifdef PORTE_DIR
@@ -971,6 +2178,7 @@ void init()
 #ifdef PORTQ_DIR
   PORTQ_DIR = 0;
 #endif // PORTF_DIR
+#endif // FAST_BOOT
 
 // port R - outputs on pin 1 if LED_BUILTIN defined as 'PR1'
 
@@ -985,6 +2193,7 @@ void init()
   PORTR_DIR = 0;
 #endif // LED_BUILTIN not defined
 
+#ifndef FAST_BOOT
   // Added code to pre-set input pins also - note PIN0CTRL through PIN7CTRL are like an array
   // also, 'PORT_ISC_BOTHEDGES_gc | PORT_OPC_TOTEM_gc' evaluates to '0' and is the normal default
   memset((void *)&(PORTC.PIN0CTRL), PORT_ISC_BOTHEDGES_gc | PORT_OPC_TOTEM_gc, 8);
@@ -1023,6 +2232,7 @@ void init()
 #ifdef PORTQ_DIR /* PORTQ only has 4 pins */
   memset((void *)&(PORTQ.PIN0CTRL), PORT_ISC_BOTHEDGES_gc | PORT_OPC_TOTEM_gc, 4); // always 4?
 #endif // PORTQ_DIR
+#endif // FAST_BOOT
 
   // PORT R (which is typically an output on both pins)
   PORTR.PIN0CTRL = PORT_ISC_BOTHEDGES_gc | PORT_OPC_TOTEM_gc;
@@ -1066,7 +2276,9 @@ void init()
   *((volatile uint8_t *)&(PMIC_CTRL)) = PMIC_RREN_bm | PMIC_HILVLEN_bm | PMIC_MEDLVLEN_bm | PMIC_LOLVLEN_bm;
 
 
+#ifndef FAST_BOOT
   adc_setup(); // set up the ADC (function exported from wiring_analog.c)
+#endif // FAST_BOOT
 
   // this needs to be called before setup() or some functions won't work there
   // but it's safe to enable interrupts so I shall simply do it!
@@ -1074,4 +2286,13 @@ void init()
   sei();
 }
 
+#ifdef FAST_BOOT
+// 'main()' calls this after 'setup()' returns, for whatever 'init()' put off that doesn't
+// wait for first use (see FAST BOOT, above)
+void init_late(void)
+{
+  clock_setup_rc32k();
+}
+#endif // FAST_BOOT
+
 
@@ -44,6 +44,20 @@ extern void DebugOutP(const void * PROGMEM pStr);
 
 uint8_t analog_reference, muxctrl_muxneg; // = ADC_REFSEL2_bp;// the default analog reference is Vcc / 2 (now assigned in adc_setup)
 
+#ifdef FAST_BOOT
+// with FAST_BOOT, 'init()' doesn't set up the ADC or the PWM timers.  The first function
+// that needs one of them does it instead (see wiring.c)
+static uint8_t adc_ready = 0, pwm_ready = 0;
+
+static void adc_first_use(void)
+{
+  if(!adc_ready)
+  {
+    adc_setup(); // this sets 'adc_ready' before it calls anything that comes back here
+  }
+}
+#endif // FAST_BOOT
+
 
 // NOTE:  On the A-series processors with more than a handful of inputs,
 //        it is NOT possible to use 'diff input with gain' on MORE than
@@ -56,6 +70,10 @@ uint8_t analog_reference, muxctrl_muxneg; // = ADC_REFSEL2_bp;// the default ana
 // adc_setup() - call this from init() and whenever you wake up from sleep mode
 void adc_setup(void)
 {
+#ifdef FAST_BOOT
+  adc_ready = 1;
+#endif // FAST_BOOT
+
   // calibration is a 16-bit register - CAL0 + (CAL1 << 8)
   ADCA_CAL = (uint16_t)readCalibrationData((uint8_t)(uint16_t)&PRODSIGNATURES_ADCACAL0)
            | (((uint16_t)readCalibrationData((uint8_t)(uint16_t)&PRODSIGNATURES_ADCACAL1)) << 8);
@@ -152,6 +170,10 @@ static uint8_t normal_adca_ch0_ctrl_bits(void) // also assigns 'muxctrl_muxneg'
 
 void analogReference(uint8_t bMode)
 {
+#ifdef FAST_BOOT
+  adc_first_use();
+#endif // FAST_BOOT
+
   if((bMode & ADC_REFSEL_gm) != bMode)
   {
     bMode &= ADC_REFSEL_gm;
@@ -207,6 +229,10 @@ int analogRead(uint8_t pin)
 {
   short iRval;
 
+#ifdef FAST_BOOT
+  adc_first_use();
+#endif // FAST_BOOT
+
   // this is pure XMEGA code
 
   if(pin >= A0)
@@ -287,6 +313,10 @@ int analogReadDeltaWithGain(uint8_t pin, uint8_t negpin, uint8_t gain)
 short iRval;
 uint8_t mode;
 
+#ifdef FAST_BOOT
+  adc_first_use();
+#endif // FAST_BOOT
+
   // this is pure XMEGA code
   // NOTE:  On the A-series processors with more than a handful of inputs,
   //        it is NOT possible to use 'diff input with gain' on MORE than
@@ -511,6 +541,14 @@ void analogWrite(uint8_t pin, int val)
 #endif // TCC4
   uint8_t bit = digitalPinToBitMask(pin);
 
+#ifdef FAST_BOOT
+  if(!pwm_ready)
+  {
+    pwm_setup(); // the first time only (see wiring.c)
+    pwm_ready = 1;
+  }
+#endif // FAST_BOOT
+
   pinMode(pin, OUTPUT); // forces 'totem pole' - TODO allow for something different?
 
   // note 'val' is a SIGNED INTEGER.  deal with 'out of range' values accordingly
@@ -116,6 +116,31 @@ extern "C"{
 
 typedef void (*voidFuncPtr)(void);
 
+// called from the 'millis' timer ISR on every tick (64 * 256 clocks) when not NULL - see wiring.c.
+// Only there with TIMER0_TICK_HOOK defined in 'pins_arduino.h', since calling it makes the ISR
+// longer for everyone.  Soft timers and 'Serial.setIdleTime()' need it.  Without it you get an
+// 'undefined reference to timer0_set_tick_hook' from the linker when you use them.
+#ifdef TIMER0_TICK_HOOK
+extern volatile voidFuncPtr timer0_tick_hook;
+#endif // TIMER0_TICK_HOOK
+
+// assigns 'timer0_tick_hook' and returns the old one, so a new hook can call it (chaining).  Use
+// this rather than assigning it, since the tick interrupt may be off when there's no hook (see
+// 'MILLIS_CASCADE_LOW' in wiring.c)
+voidFuncPtr timer0_set_tick_hook(voidFuncPtr pHook);
+
+// called with interrupts OFF right after 'clock_switch()' changes the CPU clock, so that anything
+// derived from it can be re-calculated using 'clock_hz()'.  Chained like 'timer0_set_tick_hook()'
+voidFuncPtr clock_set_change_hook(voidFuncPtr pHook);
+
+// the CLKSEL (TC_CLKSEL_DIVn_gc) for the PWM timers' 'divide by 64' at F_CPU, adjusted for the
+// CPU clock that 'clock_switch()' selected.  For timers that run at the same rate as PWM
+uint8_t clock_pwm_clksel(void);
+
+// flushes the output of every serial port (HardwareSerial.cpp).  Weak, so it's NULL when
+// HardwareSerial isn't linked in.  Power-save sleep calls it first (see wiring.c)
+void serial_flush_all(void) __attribute__((weak));
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
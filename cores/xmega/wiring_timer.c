@@ -0,0 +1,288 @@
+/*
+  wiring_timer.c - software timers (one-shot and periodic callbacks) on the 'millis' tick
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+
+  Instead of comparing 'millis()' values in 'loop()' for every timeout, start a 'soft_timer'
+  and get a callback.  Example:
+
+    static struct soft_timer blinker; // static or global, so it starts out zeroed
+
+    void blink(void *pArg) { digitalWrite(LED_BUILTIN, !digitalRead(LED_BUILTIN)); }
+
+    soft_timer_start(&blinker, 500, 500, blink, NULL, SOFT_TIMER_DEFERRED); // every 500 msec, from 'loop()'
+
+  The timers live in a 'hashed timer wheel', an array of SOFT_TIMER_SLOTS lists indexed by
+  the tick they expire on (modulo the array size).  Start and cancel are O(1), since they only
+  link or unlink the timer in one list.  Each 'millis' tick looks at one list, so it's only as
+  long as the number of timers that hash to it (with 32 slots and 40 timers, 1 or 2).
+
+  The tick is the 'millis' timer ISR (64 * 256 CPU clocks, 512us at 32Mhz) via 'timer0_tick_hook',
+  chained to whatever hook was there before.  That hook is only there with TIMER0_TICK_HOOK
+  defined in 'pins_arduino.h' (otherwise 'soft_timer_start()' is a link error).  Times are rounded UP to whole ticks, and a
+  one-shot gets 1 extra tick since the first one can come right after it starts.  Periodic
+  timers re-arm from when they were due, not when they ran, so they don't drift.
+
+  Callbacks run one of 2 ways:
+
+  a) in the timer ISR (the default).  Interrupts are off, at the same (high) priority as the
+     serial ports.  Keep it SHORT.  Starting and cancelling timers from here is fine.
+  b) SOFT_TIMER_DEFERRED - from 'loop()', via 'soft_timer_run()' (main() calls it after every
+     'loop()', like 'serialEventRun()').  If 'loop()' takes longer than the period, the extra
+     expirations are merged into one call.
+
+  NOTE:  with LOW_POWER_TICKLESS the 'millis' timer stops during power-save sleep, so while
+         any timer has been started (the tick hook is installed) 'tickless_sleep()' doesn't
+         power-save at all.  'delay()' counts it out instead, and 'main()' keeps calling 'loop()'
+         ('set_idle_deadline()' is NOT enough to keep these running).
+
+  The longest time is about 25 days at 32Mhz, where the tick count wraps (2^32 ticks).
+*/
+
+#include "wiring_private.h"
+
+#ifndef SOFT_TIMER_SLOTS
+#define SOFT_TIMER_SLOTS 32 /* must be a power of 2 */
+#endif // SOFT_TIMER_SLOTS
+
+#if (SOFT_TIMER_SLOTS & (SOFT_TIMER_SLOTS - 1)) != 0 || SOFT_TIMER_SLOTS > 256
+#error SOFT_TIMER_SLOTS must be a power of 2, up to 256
+#endif // SOFT_TIMER_SLOTS
+
+// internal flags, along with SOFT_TIMER_DEFERRED
+#define SOFT_TIMER_ACTIVE  0x10 /* linked into the wheel */
+#define SOFT_TIMER_QUEUED  0x20 /* linked into the 'run' queue (maybe cancelled since) */
+#define SOFT_TIMER_PENDING 0x40 /* expired, waiting for 'soft_timer_run()' */
+
+static struct soft_timer *soft_timer_wheel[SOFT_TIMER_SLOTS];
+static struct soft_timer *soft_timer_run_head = NULL; // deferred callbacks, in the order they expired
+static struct soft_timer *soft_timer_run_tail = NULL;
+static volatile unsigned long soft_timer_now = 0;     // tick count
+static voidFuncPtr soft_timer_next = NULL;            // the tick hook that was there before, if any
+static uint8_t soft_timer_hooked = 0;
+
+
+// msecs to 'millis' ticks, rounded up.  A tick is 16384 clocks, so it's ms * (F_CPU / 1000) / 16384,
+// done in 2 parts so that it doesn't overflow.  (F_CPU / 1000 is 32000 at 32Mhz)
+static unsigned long soft_timer_ticks(unsigned long ms)
+{
+  return (ms >> 14) * (F_CPU / 1000UL)
+         + (((ms & 16383UL) * (F_CPU / 1000UL) + 16383UL) >> 14);
+}
+
+// these 2 need interrupts OFF
+
+static void soft_timer_link(struct soft_timer *pT)
+{
+struct soft_timer **ppSlot = &(soft_timer_wheel[(uint8_t)pT->expires & (SOFT_TIMER_SLOTS - 1)]);
+
+  pT->pPrev = NULL;
+  pT->pNext = *ppSlot;
+
+  if(*ppSlot)
+  {
+    (*ppSlot)->pPrev = pT;
+  }
+
+  *ppSlot = pT;
+  pT->flags |= SOFT_TIMER_ACTIVE;
+}
+
+static void soft_timer_unlink(struct soft_timer *pT)
+{
+  if(pT->pPrev)
+  {
+    pT->pPrev->pNext = pT->pNext;
+  }
+  else
+  {
+    soft_timer_wheel[(uint8_t)pT->expires & (SOFT_TIMER_SLOTS - 1)] = pT->pNext;
+  }
+
+  if(pT->pNext)
+  {
+    pT->pNext->pPrev = pT->pPrev;
+  }
+
+  pT->pNext = pT->pPrev = NULL;
+  pT->flags &= ~SOFT_TIMER_ACTIVE;
+}
+
+// the timer ISR (via 'timer0_tick_hook')
+static void soft_timer_tick(void)
+{
+struct soft_timer **ppSlot, *pT;
+unsigned long lNow = soft_timer_now + 1;
+
+
+  soft_timer_now = lNow;
+
+  ppSlot = &(soft_timer_wheel[(uint8_t)lNow & (SOFT_TIMER_SLOTS - 1)]);
+
+  pT = *ppSlot;
+
+  while(pT)
+  {
+    if(pT->expires != lNow) // a later 'lap' around the wheel
+    {
+      pT = pT->pNext;
+      continue;
+    }
+
+    soft_timer_unlink(pT);
+
+    if(pT->period) // re-arm first, so the callback can still cancel it
+    {
+      pT->expires += pT->period;
+      soft_timer_link(pT);
+    }
+
+    if(pT->flags & SOFT_TIMER_DEFERRED)
+    {
+      pT->flags |= SOFT_TIMER_PENDING;
+
+      if(!(pT->flags & SOFT_TIMER_QUEUED)) // already there if 'loop()' hasn't gotten to it yet
+      {
+        pT->pNextRun = NULL;
+
+        if(soft_timer_run_tail)
+        {
+          soft_timer_run_tail->pNextRun = pT;
+        }
+        else
+        {
+          soft_timer_run_head = pT;
+        }
+
+        soft_timer_run_tail = pT;
+        pT->flags |= SOFT_TIMER_QUEUED;
+      }
+    }
+    else
+    {
+      pT->pCallback(pT->pArg);
+    }
+
+    pT = *ppSlot; // the callback may have started or cancelled timers in this slot, so start over
+  }
+
+  if(soft_timer_next)
+  {
+    soft_timer_next(); // chained
+  }
+}
+
+void soft_timer_start(struct soft_timer *pT, unsigned long ms, unsigned long periodMS,
+                      void (*pCallback)(void *pArg), void *pArg, uint8_t flags)
+{
+uint8_t oldSREG = SREG;
+
+
+  cli();
+
+  if(pT->flags & SOFT_TIMER_ACTIVE)
+  {
+    soft_timer_unlink(pT);
+  }
+
+  // it stays in the 'run' queue if it's there, but won't run unless it expires again
+  pT->flags = (pT->flags & SOFT_TIMER_QUEUED) | (flags & SOFT_TIMER_DEFERRED);
+
+  pT->pCallback = pCallback;
+  pT->pArg = pArg;
+  pT->period = periodMS ? soft_timer_ticks(periodMS) : 0;
+  pT->expires = soft_timer_now + soft_timer_ticks(ms) + 1; // +1 for the phase of the first tick
+
+  if(periodMS && !pT->period)
+  {
+    pT->period = 1; // never 0, that's a one-shot
+  }
+
+  soft_timer_link(pT);
+
+  if(!soft_timer_hooked) // only once, since other hooks may have chained onto mine
+  {
+    soft_timer_next = timer0_set_tick_hook(soft_timer_tick);
+    soft_timer_hooked = 1;
+  }
+
+  SREG = oldSREG;
+}
+
+void soft_timer_cancel(struct soft_timer *pT)
+{
+uint8_t oldSREG = SREG;
+
+
+  cli();
+
+  if(pT->flags & SOFT_TIMER_ACTIVE)
+  {
+    soft_timer_unlink(pT);
+  }
+
+  pT->flags &= ~SOFT_TIMER_PENDING; // 'soft_timer_run()' drops it from the queue
+
+  SREG = oldSREG;
+}
+
+uint8_t soft_timer_active(struct soft_timer *pT)
+{
+  return (pT->flags & (SOFT_TIMER_ACTIVE | SOFT_TIMER_PENDING)) ? 1 : 0;
+}
+
+void soft_timer_run(void)
+{
+struct soft_timer *pT;
+void (*pCallback)(void *pArg);
+void *pArg;
+uint8_t oldSREG, bRun;
+
+
+  for(;;)
+  {
+    oldSREG = SREG;
+    cli();
+
+    pT = soft_timer_run_head;
+
+    if(!pT)
+    {
+      SREG = oldSREG;
+      return;
+    }
+
+    soft_timer_run_head = pT->pNextRun;
+
+    if(!soft_timer_run_head)
+    {
+      soft_timer_run_tail = NULL;
+    }
+
+    bRun = pT->flags & SOFT_TIMER_PENDING;
+    pT->flags &= ~(SOFT_TIMER_QUEUED | SOFT_TIMER_PENDING);
+
+    pCallback = pT->pCallback; // in case it's re-started before I call it
+    pArg = pT->pArg;
+
+    SREG = oldSREG;
+
+    if(bRun)
+    {
+      pCallback(pArg); // the callback can re-start or cancel it
+    }
+  }
+}
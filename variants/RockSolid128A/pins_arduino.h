@@ -164,6 +164,7 @@
 #define SERIAL_0_USART_DATA USARTC0_DATA
 #define SERIAL_0_RXC_ISR ISR(USARTC0_RXC_vect)
 #define SERIAL_0_DRE_ISR ISR(USARTC0_DRE_vect)
+#define SERIAL_0_TXC_ISR ISR(USARTC0_TXC_vect)
 #define SERIAL_0_RX_PIN_INDEX 2 /* the pin number on the port, not the mapped digital pin number */
 #define SERIAL_0_TX_PIN_INDEX 3 /* the pin number on the port, not the mapped digital pin number */
 #define USARTC0_VECTOR_EXISTS
@@ -174,6 +175,7 @@
 #define SERIAL_1_USART_DATA USARTD0_DATA
 #define SERIAL_1_RXC_ISR ISR(USARTD0_RXC_vect)
 #define SERIAL_1_DRE_ISR ISR(USARTD0_DRE_vect)
+#define SERIAL_1_TXC_ISR ISR(USARTD0_TXC_vect)
 #define SERIAL_1_RX_PIN_INDEX 2 /* the pin number on the port, not the mapped digital pin number */
 #define SERIAL_1_TX_PIN_INDEX 3 /* the pin number on the port, not the mapped digital pin number */
 #define USARTD0_VECTOR_EXISTS
@@ -184,6 +186,7 @@
 #define SERIAL_2_USART_DATA USARTE1_DATA
 #define SERIAL_2_RXC_ISR ISR(USARTE1_RXC_vect)
 #define SERIAL_2_DRE_ISR ISR(USARTE1_DRE_vect)
+#define SERIAL_2_TXC_ISR ISR(USARTE1_TXC_vect)
 #define SERIAL_2_RX_PIN_INDEX 6 /* the pin number on the port, not the mapped digital pin number */
 #define SERIAL_2_TX_PIN_INDEX 7 /* the pin number on the port, not the mapped digital pin number */
 #define USARTE1_VECTOR_EXISTS
@@ -194,6 +197,7 @@
 #define SERIAL_3_USART_DATA USARTF0_DATA
 #define SERIAL_3_RXC_ISR ISR(USARTF0_RXC_vect)
 #define SERIAL_3_DRE_ISR ISR(USARTF0_DRE_vect)
+#define SERIAL_3_TXC_ISR ISR(USARTF0_TXC_vect)
 #define SERIAL_3_RX_PIN_INDEX 2 /* the pin number on the port, not the mapped digital pin number */
 #define SERIAL_3_TX_PIN_INDEX 3 /* the pin number on the port, not the mapped digital pin number */
 #define USARTF0_VECTOR_EXISTS
@@ -312,6 +316,22 @@ static const uint8_t A14 = 76;
 static const uint8_t A15 = 77;
 
 
+// digital pin number to PORT and bit index (0-7), for 'digitalWriteFast()' etc. (see Arduino.h).
+// These MUST match the tables below.  With a constant pin number they fold down to constants.
+// 'digitalPinToPortStruct()' is zero for 'not a pin'.
+
+#define digitalPinToPortStruct(P) ( (P) < 2 ? &PORTC : (P) < 8 ? &PORTE : (P) < 10 ? &PORTD : (P) < 14 ? &PORTC : \
+                                    (P) < 16 ? &PORTF : (P) < 18 ? &PORTE : (P) < 22 ? &PORTD : (P) < 30 ? &PORTJ : \
+                                    (P) < 38 ? &PORTK : (P) < 46 ? &PORTH : (P) < 48 ? &PORTD : (P) < 50 ? &PORTC : \
+                                    (P) < 56 ? &PORTF : (P) < 60 ? &PORTQ : (P) < 62 ? &PORTR : (P) < 70 ? &PORTA : \
+                                    (P) < 78 ? &PORTB : (PORT_t *)0 )
+#define digitalPinToBitIndex(P)   ( (P) < 2 ? (P) + 2 : (P) < 8 ? 7 - (P) : (P) < 10 ? 13 - (P) : (P) < 14 ? (P) - 6 : \
+                                    (P) < 16 ? 17 - (P) : (P) < 18 ? 23 - (P) : (P) < 20 ? 21 - (P) : (P) < 22 ? (P) - 20 : \
+                                    (P) < 30 ? (P) - 22 : (P) < 38 ? 37 - (P) : (P) < 42 ? 41 - (P) : (P) < 46 ? 49 - (P) : \
+                                    (P) < 48 ? 53 - (P) : (P) < 50 ? 49 - (P) : (P) < 52 ? 56 - (P) : (P) < 53 ? 7 : \
+                                    (P) < 54 ? 4 : (P) < 56 ? 55 - (P) : (P) < 60 ? (P) - 56 : (P) < 62 ? (P) - 60 : \
+                                    (P) < 70 ? (P) - 62 : (P) - 70 )
+
 // on the xmega, all 'pin 2' inputs on any port are asynchronous ints.  Others are 'synchronous' which means
 // that they must be held in their 'interrupt state' long enough for the system to detect them.  In any case
 // all digital input pins can be use as interrupts, synchronous or otherwise.
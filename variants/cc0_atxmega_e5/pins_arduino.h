@@ -96,6 +96,8 @@
 // NOTE:  'E' series can have analog inputs on PORTD.
 //#define USE_AREF 0x2 /* see 24.14.3 in 'E' manual - this is the REFCTRL bits for the reference select, AREF on PORTA (PA0) */
 
+//#define CYCLES_ALLOW_MICROS /* define THIS to let 'cycles()' fall back to 'micros()' (64 clocks), there's no spare timer for it (see wiring.c) */
+
 #define NUM_DIGITAL_PINS            18
 #define NUM_ANALOG_INPUTS           8
 #define analogInputToDigitalPin(p)  ((p < NUM_ANALOG_INPUTS) ? (p) + NUM_DIGITAL_PINS : -1)
@@ -184,6 +186,7 @@
 #define SERIAL_0_USART_DATA USARTD0_DATA
 #define SERIAL_0_RXC_ISR ISR(USARTD0_RXC_vect)
 #define SERIAL_0_DRE_ISR ISR(USARTD0_DRE_vect)
+#define SERIAL_0_TXC_ISR ISR(USARTD0_TXC_vect)
 #define SERIAL_0_REMAP PORTD_REMAP         /* define THIS to re-map the pins from 0-3 to 4-7 on serial port 0 */
 #define SERIAL_0_REMAP_BIT PORT_USART0_bm  /* the bitmask needed to remap the port if SERIAL_0_REMAP is defined */
 #define SERIAL_0_RX_PIN_INDEX 6 /* the pin number on the port, not the mapped digital pin number */
@@ -196,6 +199,7 @@
 #define SERIAL_1_USART_DATA USARTC0_DATA
 #define SERIAL_1_RXC_ISR ISR(USARTC0_RXC_vect)
 #define SERIAL_1_DRE_ISR ISR(USARTC0_DRE_vect)
+#define SERIAL_1_TXC_ISR ISR(USARTC0_TXC_vect)
 //#define SERIAL_1_REMAP PORTC_REMAP        /* define THIS to re-map the pins from 0-3 to 4-7 on serial port 1 */
 //#define SERIAL_1_REMAP_BIT PORT_USART0_bm /* the bit needed to remap the port if SERIAL_1_REMAP is defined */
 #define SERIAL_1_RX_PIN_INDEX 2 /* the pin number on the port, not the mapped digital pin number */
@@ -330,6 +334,21 @@ static const uint8_t A5 = 23;
 static const uint8_t A6 = 24;
 static const uint8_t A7 = 25;
 
+// digital pin number to PORT and bit index (0-7), for 'digitalWriteFast()' etc. (see Arduino.h).
+// These MUST match the tables below.  With a constant pin number they fold down to constants.
+// 'digitalPinToPortStruct()' is zero for 'not a pin'.
+
+#ifndef DIGITAL_IO_PIN_SHIFT
+#define digitalPinToPortStruct(P) ( (P) < 8 ? &PORTD : (P) < 16 ? &PORTC : (P) < 18 ? &PORTR : \
+                                    (P) < 26 ? &PORTA : (PORT_t *)0 )
+#define digitalPinToBitIndex(P)   ( (P) < 8 ? (P) : (P) < 16 ? (P) - 8 : (P) < 18 ? (P) - 16 : (P) - 18 )
+#else // DIGITAL_IO_PIN_SHIFT - PD6,7,4,5,2,3,0,1 are 0-7 (so it's 'pin XOR 6'), PC0,1 are 16,17
+#define digitalPinToPortStruct(P) ( (P) < 8 ? &PORTD : (P) < 14 ? &PORTC : (P) < 16 ? &PORTR : (P) < 18 ? &PORTC : \
+                                    (P) < 26 ? &PORTA : (PORT_t *)0 )
+#define digitalPinToBitIndex(P)   ( (P) < 8 ? (P) ^ 6 : (P) < 14 ? (P) - 6 : (P) < 16 ? (P) - 14 : \
+                                    (P) < 18 ? (P) - 16 : (P) - 18 )
+#endif // DIGITAL_IO_PIN_SHIFT
+
 // on the xmega 'E' series, PA2, PC2, and PD2 are asynchronous ints.  Others are 'synchronous' which means
 // that they must be held in their 'interrupt state' long enough for the system to detect them.  In any case
 // all digital input pins can be use as interrupts, synchronous or otherwise.
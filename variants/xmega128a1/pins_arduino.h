@@ -76,7 +76,13 @@
   #define SERIAL_0_CTS_PORT_NAME PORTD
   #define SERIAL_0_CTS_PIN_INDEX 1
 
-  use similar definitions for serial 1, aka 'SERIAL_1_CTS_PORT'
+  use similar definitions for the other serial ports, SERIAL_1_xxx through SERIAL_7_xxx
+
+  RTS goes high when the RX buffer reaches a 'high' watermark, and low again when it's down to a
+  'low' watermark (by default, SERIAL_RTS_HEADROOM bytes short of full, and half full).  Use
+  'Serial.setFlowControl(high, low)' to change them, i.e. more headroom for 1-2Mbit links.
+
+  #define SERIAL_RTS_HEADROOM 16 (optional, default is 4)
 
   NOTE:  you can even use PORTA or PORTB pins for this, if you don't need to measure analog volts on those pins
 
@@ -98,6 +104,16 @@
 
 //#define USE_AREF 0x2 /* see 28.16.3 in 'AU' manual - this is the REFCTRL bits for the reference select, AREF on PORTA (PA0) */
 
+//#define MILLIS_NO_CASCADE /* define THIS to count 'millis()' with the tick ISR instead of TCD1 and TCE1 (see wiring.c) */
+//#define LOW_POWER_TICKLESS /* define THIS to sleep in POWER-SAVE (RTC wake-up) in 'delay()', 'low_power_delay()' and between 'loop()' calls (see wiring.c) */
+//#define CLOCK_SWITCHING /* define THIS for 'clock_switch()', e.g. 2Mhz while idle and 32Mhz when busy (see wiring.c) */
+//#define CLOCK_XOSC_HZ 16000000L /* define THIS for CLOCK_XOSC, the crystal frequency (must divide evenly into F_CPU) */
+//#define CLOCK_DFLL_XTAL32K /* define THIS to lock the 32Mhz RC to a 32.768Khz crystal on TOSC1/TOSC2 (see wiring.c) */
+//#define CLOCK_DFLL_USBSOF /* OR define THIS to lock it to USB start-of-frame, on 'U' parts */
+//#define FAST_BOOT /* define THIS to put off ADC, PWM and 32.768Khz oscillator setup until needed, and for 'boot_time_us()' (see wiring.c) */
+//#define TIMER0_TICK_HOOK /* define THIS for 'timer0_tick_hook', needed by soft timers and 'Serial.setIdleTime()' (see wiring.c) */
+//#define PROFILE_SCOPES 16 /* define THIS to change the number of 'Profile.h' scopes (default 8) */
+
 #define NUM_DIGITAL_PINS            62
 
 #ifdef USE_AREF
@@ -234,11 +250,22 @@
 #define SERIAL_0_USART_DATA USARTD0_DATA
 #define SERIAL_0_RXC_ISR ISR(USARTD0_RXC_vect)
 #define SERIAL_0_DRE_ISR ISR(USARTD0_DRE_vect)
+#define SERIAL_0_TXC_ISR ISR(USARTD0_TXC_vect)
 //#define SERIAL_0_REMAP PORTD_REMAP /* define THIS to re-map the pins from 0-3 to 4-7 on serial port 0 */
 #define SERIAL_0_REMAP_BIT 4    /* the bit needed to remap the port if SERIAL_0_REMAP is defined */
 #define SERIAL_0_RX_PIN_INDEX 2 /* the pin number on the port, not the mapped digital pin number */
 #define SERIAL_0_TX_PIN_INDEX 3 /* the pin number on the port, not the mapped digital pin number */
 #define USARTD0_VECTOR_EXISTS
+//#define SERIAL_0_TX_DMA_CHANNEL 0 /* define THIS to transmit via DMA channel 0 instead of the DRE interrupt */
+//#define SERIAL_0_RX_BUFFER_SIZE 64 /* define THIS to change the RX buffer size for serial port 0 (must be a power of 2) */
+//#define SERIAL_0_TX_BUFFER_SIZE 64 /* define THIS to change the TX buffer size for serial port 0 (must be a power of 2) */
+//#define SERIAL_0_RX_TIMESTAMP /* define THIS to time-stamp received bytes (see 'readWithTimestamp()') */
+//#define SERIAL_0_RX_9BIT /* define THIS to keep the 9th bit of received frames (see 'read9()' and 'setNodeAddress()') */
+//#define SERIAL_RS485 /* define THIS for the RS-485 driver enable pin, 'Serial.setDriverEnable()' (adds TXC interrupts, all ports) */
+//#define SERIAL_SHARED_ISR 1 /* define THIS for one copy of the serial RXC/DRE handler code, smaller but slower per byte (see HardwareSerial.cpp) */
+//#define SERIAL_NO_STATS /* define THIS to leave out the statistics and error counters, see 'HardwareSerial::getStats()' (all ports) */
+//#define SERIAL_AUTOBAUD_TIMER TCF1 /* define THIS to use a different timer for 'HardwareSerial::beginAutoBaud()' (default is CYCLES_TIMER if defined, else TCC1) */
+//#define SERIAL_AUTOBAUD_EVENT_CHANNEL 2 /* and THIS for a different event channel (default is 3) */
 
 // serial port 1
 #define SERIAL_1_PORT_NAME PORTC
@@ -246,6 +273,7 @@
 #define SERIAL_1_USART_DATA USARTC0_DATA
 #define SERIAL_1_RXC_ISR ISR(USARTC0_RXC_vect)
 #define SERIAL_1_DRE_ISR ISR(USARTC0_DRE_vect)
+#define SERIAL_1_TXC_ISR ISR(USARTC0_TXC_vect)
 //#define SERIAL_1_REMAP PORTC_REMAP /* define THIS to re-map the pins from 0-3 to 4-7 on serial port 1 */
 #define SERIAL_1_REMAP_BIT 4    /* the bit needed to remap the port if SERIAL_1_REMAP is defined */
 #define SERIAL_1_RX_PIN_INDEX 2 /* the pin number on the port, not the mapped digital pin number */
@@ -258,6 +286,7 @@
 #define SERIAL_2_USART_DATA USARTE0_DATA
 #define SERIAL_2_RXC_ISR ISR(USARTE0_RXC_vect)
 #define SERIAL_2_DRE_ISR ISR(USARTE0_DRE_vect)
+#define SERIAL_2_TXC_ISR ISR(USARTE0_TXC_vect)
 //#define SERIAL_2_REMAP PORTE_REMAP /* define THIS to re-map the pins from 0-3 to 4-7 on serial port 2 */
 #define SERIAL_2_REMAP_BIT 4    /* the bit needed to remap the port if SERIAL_1_REMAP is defined */
 #define SERIAL_2_RX_PIN_INDEX 2 /* the pin number on the port, not the mapped digital pin number */
@@ -270,6 +299,7 @@
 #define SERIAL_3_USART_DATA USARTF0_DATA
 #define SERIAL_3_RXC_ISR ISR(USARTF0_RXC_vect)
 #define SERIAL_3_DRE_ISR ISR(USARTF0_DRE_vect)
+#define SERIAL_3_TXC_ISR ISR(USARTF0_TXC_vect)
 //#define SERIAL_3_REMAP PORTF_REMAP /* define THIS to re-map the pins from 0-3 to 4-7 on serial port 3 */
 #define SERIAL_3_REMAP_BIT 4    /* the bit needed to remap the port if SERIAL_1_REMAP is defined */
 #define SERIAL_3_RX_PIN_INDEX 2 /* the pin number on the port, not the mapped digital pin number */
@@ -420,6 +450,23 @@ static const uint8_t A13 = 75;
 static const uint8_t A14 = 76;
 static const uint8_t A15 = 77;
 
+// digital pin number to PORT and bit index (0-7), for 'digitalWriteFast()' etc. (see Arduino.h).
+// These MUST match the tables below.  With a constant pin number they fold down to constants.
+// 'digitalPinToPortStruct()' is zero for 'not a pin'.
+
+#ifndef DIGITAL_IO_PIN_SHIFT
+#define digitalPinToPortStruct(P) ( (P) < 8 ? &PORTD : (P) < 16 ? &PORTC : (P) < 24 ? &PORTE : (P) < 32 ? &PORTF : \
+                                    (P) < 40 ? &PORTH : (P) < 48 ? &PORTJ : (P) < 56 ? &PORTK : (P) < 60 ? &PORTQ : \
+                                    (P) < 62 ? &PORTR : (P) < 70 ? &PORTA : (P) < 78 ? &PORTB : (PORT_t *)0 )
+#define digitalPinToBitIndex(P)   ( (P) < 60 ? (P) & 7 : (P) < 62 ? (P) - 60 : (P) < 70 ? (P) - 62 : (P) - 70 )
+#else // DIGITAL_IO_PIN_SHIFT, PD0,1 are 60,61
+#define digitalPinToPortStruct(P) ( (P) < 6 ? &PORTD : (P) < 14 ? &PORTC : (P) < 22 ? &PORTE : (P) < 30 ? &PORTF : \
+                                    (P) < 38 ? &PORTH : (P) < 46 ? &PORTJ : (P) < 54 ? &PORTK : (P) < 58 ? &PORTQ : \
+                                    (P) < 60 ? &PORTR : (P) < 62 ? &PORTD : (P) < 70 ? &PORTA : (P) < 78 ? &PORTB : (PORT_t *)0 )
+#define digitalPinToBitIndex(P)   ( (P) < 58 ? ((P) + 2) & 7 : (P) < 60 ? (P) - 58 : (P) < 62 ? (P) - 60 : \
+                                    (P) < 70 ? (P) - 62 : (P) - 70 )
+#endif // DIGITAL_IO_PIN_SHIFT
+
 // on the xmega, PA2, PB2, PC2, PD2, and PE2 are asynchronous ints.  Others are 'synchronous' which means
 // that they must be held in their 'interrupt state' long enough for the system to detect them.  In any case
 // all digital input pins can be use as interrupts, synchronous or otherwise.
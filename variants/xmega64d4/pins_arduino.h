@@ -71,7 +71,13 @@
   #define SERIAL_0_CTS_PORT_NAME PORTD
   #define SERIAL_0_CTS_PIN_INDEX 1
 
-  use similar definitions for serial 1, aka 'SERIAL_1_CTS_PORT'
+  use similar definitions for the other serial ports, SERIAL_1_xxx through SERIAL_7_xxx
+
+  RTS goes high when the RX buffer reaches a 'high' watermark, and low again when it's down to a
+  'low' watermark (by default, SERIAL_RTS_HEADROOM bytes short of full, and half full).  Use
+  'Serial.setFlowControl(high, low)' to change them, i.e. more headroom for 1-2Mbit links.
+
+  #define SERIAL_RTS_HEADROOM 16 (optional, default is 4)
 
   NOTE:  you can even use PORTA or PORTB pins for this, if you don't need to measure analog volts on those pins
 
@@ -95,6 +101,15 @@
 // TWIE may not work properly.  To make use of TWIC for 2-wire, it needs to be re-mapped
 #define USE_TWIC /* define this to re-map TWIC to digital pins 20 and 21, similar to an Arduino Mega2560.  requires DIGITAL_IO_PIN_SHIFT */
 
+//#define LOW_POWER_TICKLESS /* define THIS to sleep in POWER-SAVE (RTC wake-up) in 'delay()', 'low_power_delay()' and between 'loop()' calls (see wiring.c) */
+#define CYCLES_TIMER TCC1 /* TCC1 is the only spare timer, so it's a 1-clock 'cycles()' (see wiring.c).  'beginAutoBaud()' and 'boot_time_us()' share it */
+#define CYCLES_TIMER_vect TCC1_OVF_vect
+//#define CLOCK_SWITCHING /* define THIS for 'clock_switch()', e.g. 2Mhz while idle and 32Mhz when busy (see wiring.c) */
+//#define CLOCK_DFLL_XTAL32K /* define THIS to lock the 32Mhz RC to a 32.768Khz crystal on TOSC1/TOSC2 (see wiring.c) */
+//#define FAST_BOOT /* define THIS to put off ADC, PWM and 32.768Khz oscillator setup until needed, and for 'boot_time_us()' (see wiring.c) */
+//#define TIMER0_TICK_HOOK /* define THIS for 'timer0_tick_hook', needed by soft timers and 'Serial.setIdleTime()' (see wiring.c) */
+//#define PROFILE_SCOPES 16 /* define THIS to change the number of 'Profile.h' scopes (default 8) */
+
 
 
 #define NUM_DIGITAL_PINS            22
@@ -199,11 +214,19 @@
 #define SERIAL_0_USART_DATA USARTD0_DATA
 #define SERIAL_0_RXC_ISR ISR(USARTD0_RXC_vect)
 #define SERIAL_0_DRE_ISR ISR(USARTD0_DRE_vect)
+#define SERIAL_0_TXC_ISR ISR(USARTD0_TXC_vect)
 //#define SERIAL_0_REMAP PORTD_REMAP /* define THIS to re-map the pins from 0-3 to 4-7 on serial port 0 */
 #define SERIAL_0_REMAP_BIT 4    /* the bit needed to remap the port if SERIAL_0_REMAP is defined */
 #define SERIAL_0_RX_PIN_INDEX 2 /* the pin number on the port, not the mapped digital pin number */
 #define SERIAL_0_TX_PIN_INDEX 3 /* the pin number on the port, not the mapped digital pin number */
 #define USARTD0_VECTOR_EXISTS
+//#define SERIAL_0_RX_BUFFER_SIZE 64 /* define THIS to change the RX buffer size for serial port 0 (must be a power of 2) */
+//#define SERIAL_0_TX_BUFFER_SIZE 64 /* define THIS to change the TX buffer size for serial port 0 (must be a power of 2) */
+//#define SERIAL_0_RX_TIMESTAMP /* define THIS to time-stamp received bytes (see 'readWithTimestamp()') */
+//#define SERIAL_0_RX_9BIT /* define THIS to keep the 9th bit of received frames (see 'read9()' and 'setNodeAddress()') */
+//#define SERIAL_RS485 /* define THIS for the RS-485 driver enable pin, 'Serial.setDriverEnable()' (adds TXC interrupts, all ports) */
+//#define SERIAL_NO_STATS /* define THIS to leave out the statistics and error counters, see 'HardwareSerial::getStats()' (all ports) */
+//#define SERIAL_AUTOBAUD_EVENT_CHANNEL 2 /* define THIS to use a different event channel (0-3) for 'HardwareSerial::beginAutoBaud()' (default is 3, timer is CYCLES_TIMER) */
 
 // serial port 1
 #define SERIAL_1_PORT_NAME PORTC
@@ -211,6 +234,7 @@
 #define SERIAL_1_USART_DATA USARTC0_DATA
 #define SERIAL_1_RXC_ISR ISR(USARTC0_RXC_vect)
 #define SERIAL_1_DRE_ISR ISR(USARTC0_DRE_vect)
+#define SERIAL_1_TXC_ISR ISR(USARTC0_TXC_vect)
 //#define SERIAL_1_REMAP PORTC_REMAP /* define THIS to re-map the pins from 0-3 to 4-7 on serial port 1 */
 #define SERIAL_1_REMAP_BIT 4    /* the bit needed to remap the port if SERIAL_1_REMAP is defined */
 #define SERIAL_1_RX_PIN_INDEX 2 /* the pin number on the port, not the mapped digital pin number */
@@ -344,6 +368,27 @@ static const uint8_t A9 = 31;
 static const uint8_t A10 = 32;
 static const uint8_t A11 = 33;
 
+// digital pin number to PORT and bit index (0-7), for 'digitalWriteFast()' etc. (see Arduino.h).
+// These MUST match the tables below.  With a constant pin number they fold down to constants.
+// 'digitalPinToPortStruct()' is zero for 'not a pin'.
+
+#ifndef DIGITAL_IO_PIN_SHIFT
+#define digitalPinToPortStruct(P) ( (P) < 8 ? &PORTD : (P) < 16 ? &PORTC : (P) < 20 ? &PORTE : \
+                                    (P) < 22 ? &PORTR : (P) < 30 ? &PORTA : (P) < 34 ? &PORTB : (PORT_t *)0 )
+#define digitalPinToBitIndex(P)   ( (P) < 8 ? (P) : (P) < 16 ? (P) - 8 : (P) < 20 ? (P) - 16 : \
+                                    (P) < 22 ? (P) - 20 : (P) < 30 ? (P) - 22 : (P) - 30 )
+#elif defined(USE_TWIC) /* PD0,1 are 6,7 and PC0,1 are 20,21 */
+#define digitalPinToPortStruct(P) ( (P) < 8 ? &PORTD : (P) < 14 ? &PORTC : (P) < 18 ? &PORTE : (P) < 20 ? &PORTR : \
+                                    (P) < 22 ? &PORTC : (P) < 30 ? &PORTA : (P) < 34 ? &PORTB : (PORT_t *)0 )
+#define digitalPinToBitIndex(P)   ( (P) < 6 ? (P) + 2 : (P) < 14 ? (P) - 6 : (P) < 18 ? (P) - 14 : (P) < 20 ? (P) - 18 : \
+                                    (P) < 22 ? (P) - 20 : (P) < 30 ? (P) - 22 : (P) - 30 )
+#else // DIGITAL_IO_PIN_SHIFT without USE_TWIC, PD0,1 are 20,21
+#define digitalPinToPortStruct(P) ( (P) < 6 ? &PORTD : (P) < 14 ? &PORTC : (P) < 18 ? &PORTE : (P) < 20 ? &PORTR : \
+                                    (P) < 22 ? &PORTD : (P) < 30 ? &PORTA : (P) < 34 ? &PORTB : (PORT_t *)0 )
+#define digitalPinToBitIndex(P)   ( (P) < 6 ? (P) + 2 : (P) < 14 ? (P) - 6 : (P) < 18 ? (P) - 14 : (P) < 20 ? (P) - 18 : \
+                                    (P) < 22 ? (P) - 20 : (P) < 30 ? (P) - 22 : (P) - 30 )
+#endif // DIGITAL_IO_PIN_SHIFT, USE_TWIC
+
 // on the xmega64d4, PA2, PB2, PC2, PD2, and PE2 are asynchronous ints.  Others are 'synchronous' which means
 // that they must be held in their 'interrupt state' long enough for the system to detect them.  In any case
 // all digital input pins can be use as interrupts, synchronous or otherwise.